@@ -0,0 +1,80 @@
+#ifndef HEADER_GUARD_ANALYSIS_HPP_INCLUDED
+#define HEADER_GUARD_ANALYSIS_HPP_INCLUDED
+
+#include <climits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "cpu.hpp"
+
+// Static analysis of loaded byte code: control flow, stack depth and opcode statistics.
+// Nothing is executed, only Program::code is read
+namespace analysis_ns {
+	// Stack effect of VLOAD and VSTORE, it depends on values on the stack
+	const int UNKNOWN_EFFECT = INT_MIN;
+
+	// Stack depth of an instruction
+	const int NO_DEPTH      = INT_MIN;     // the instruction is not reachable
+	const int UNKNOWN_DEPTH = INT_MIN + 1; // depends on values on the stack
+	const int MIXED_DEPTH   = INT_MIN + 2; // paths to the instruction come with different depths
+
+	// Command id-s of the control flow
+	const int RET_ID  = 18;
+	const int END_ID  = 19;
+	const int CALL_ID = 20;
+	const int JMP_ID  = 21;
+
+	// Net change of the stack size made by the command, CALL itself does not change it
+	int stack_effect(int id);
+
+	bool is_branch(int id);         // JMP or a conditional jump
+	bool is_conditional(int id);    // JEQ ... JBE
+	int inverse_condition(int id);  // conditional jump taken when the one of id is not
+	bool has_target(int id);        // argument is an instruction: jumps, CALL and SPAWN
+	bool ends_block(int id);        // next instruction is not executed right after this one
+
+	// Instructions [begin, end) entered only at begin
+	struct BasicBlock {
+		int begin;
+		int end;
+		std::vector<int> successors; // blocks executed next, a CALL is followed by its return block
+	};
+
+	struct Analysis {
+		std::vector<BasicBlock> blocks;
+		std::vector<int> block_of; // block of every instruction
+
+		// Entry of the routine (begin, CALL or SPAWN target) every instruction is reached from,
+		// -1 if it is not reachable
+		std::vector<int> routine;
+
+		// Stack size before every instruction, relative to the entry of its routine
+		std::vector<int> depth;
+
+		// Net stack effect of routines by their entries, e.g. -1 for one argument and no result.
+		// Routines without a reachable RET are missing
+		std::map<int, int> returns;
+
+		std::map<int, unsigned> opcodes;                     // number of instructions by command id
+		std::map<std::pair<int, int>, unsigned> opcode_pairs; // adjacent instructions of one block
+	};
+
+	Analysis analyze(const Program& program);
+
+	// Routine whose results depend only on its arguments and registers
+	struct PureRoutine {
+		int arguments = 0;        // values taken from the stack of the caller
+		int results = 0;          // values left instead of them
+		std::vector<int> inputs;  // registers read before written or not written on every path
+		std::vector<int> outputs; // registers written, their values after RET are a part of the result
+	};
+
+	// CALL targets using only the stack, arithmetic, registers, jumps, calls of pure routines
+	// and RET: no memory, input, output, channels or threads. The stack depth must be
+	// the same on all paths, so the number of arguments and results is known.
+	// Registers are not local, so the written ones are results of the routine
+	std::map<int, PureRoutine> find_pure_routines(const Program& program);
+}
+
+#endif //HEADER_GUARD_ANALYSIS_HPP_INCLUDED
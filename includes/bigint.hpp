@@ -0,0 +1,115 @@
+#ifndef HEADER_GUARD_BIGINT_HPP_INCLUDED
+#define HEADER_GUARD_BIGINT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class CPU;
+
+// Integers of arbitrary precision for the commands of family 8 (BIG, BADD, ...).
+//
+// The stack keeps 32-bit handles, values live in the arena of the context. A value is
+// a sign and a magnitude of 32-bit limbs, the least significant first, stored in one
+// limb buffer of the arena: commands do not allocate memory for every result.
+// Values are immutable, every result is a new value.
+//
+// Handles are not traced: when the buffer has grown, the arena frees values whose
+// handles are not found in the stack, registers and data memory of the context
+// (any integer equal to a handle keeps the value) and compacts the buffer.
+// Handles of one context are not valid in another one, commands fail on them.
+// Channels do not keep values alive, so SEND fails on handles of the context
+namespace bigint_ns {
+	typedef uint32_t Limb;
+
+	// Handles are HANDLE_BASE + (tag << INDEX_BITS) + index of the value: small integers
+	// are not taken for them, and the tag of the arena tells handles of other contexts
+	const int HANDLE_BASE = 1 << 30;
+	const int INDEX_BITS = 20;
+
+	// Values of one arena, arenas alive at the same time
+	const size_t MAX_VALUES = size_t(1) << INDEX_BITS;
+	const unsigned MAX_ARENAS = 1u << (30 - INDEX_BITS);
+
+	// Multiplication of magnitudes of at least this many limbs uses Karatsuba
+	const size_t KARATSUBA_THRESHOLD = 32;
+
+	// The buffer is not collected while it has fewer limbs
+	const size_t MIN_COLLECT_LIMBS = 1 << 16;
+
+	struct ArenaStats {
+		size_t values = 0;      // live and not yet collected
+		size_t limbs = 0;       // used in the buffer
+		unsigned long long collections = 0;
+		unsigned long long freed = 0;
+	};
+
+	class BigArena {
+	private:
+		struct Value {
+			size_t offset;  // of the first limb in the buffer
+			size_t size;    // limbs without leading zeros, 0 for zero
+			bool negative;
+			bool free;
+		};
+
+		std::vector<Limb> limbs_;
+		std::vector<Value> values_;
+		std::vector<int> free_;     // indices of freed values
+		std::vector<Limb> scratch_; // temporaries of Karatsuba
+		size_t next_collection_;
+		ArenaStats stats_;
+		unsigned tag_;
+		std::shared_ptr<void> tag_owner_; // releases the tag after the last copy
+
+		int handle(size_t index) const;
+		size_t index(int handle) const;
+		const Value& value(int handle) const;
+
+		// New value with room for size limbs, the limbs are zero
+		int allocate(size_t size, bool negative);
+
+		// Drop leading zero limbs of the new value, freeing the end of the buffer
+		void normalize(int handle);
+
+		// |a| + |b| or |a| - |b| (|a| >= |b|) with the sign
+		int add_magnitudes(int a, int b, bool negative);
+		int subtract_magnitudes(int a, int b, bool negative);
+		int compare_magnitudes(const Value& a, const Value& b) const;
+	public:
+		// Copies share the tag, so handles of the arena are valid in its copies
+		// (checkpoints of the replayer keep them)
+		BigArena();
+
+		// Check if the integer is the handle of a live value of this arena
+		bool contains(int handle) const;
+
+		int make(long long value);
+
+		int add(int a, int b);
+		int subtract(int a, int b);
+		int multiply(int a, int b);
+
+		// -1, 0 or 1 as a is less than, equal to or greater than b
+		int compare(int a, int b) const;
+
+		// Decimal digits with '-' for negative values
+		void write(std::ostream& out, int handle) const;
+		std::string to_string(int handle) const;
+
+		// Free values unreachable from the context if the buffer has grown enough
+		// since the last collection
+		void collect_if_needed(const CPU& cpu);
+		void collect(const CPU& cpu);
+
+		ArenaStats stats() const;
+	};
+
+	// Arena of the context, made on the first use
+	BigArena& arena(CPU& cpu);
+}
+
+#endif //HEADER_GUARD_BIGINT_HPP_INCLUDED
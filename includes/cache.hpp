@@ -0,0 +1,53 @@
+#ifndef HEADER_GUARD_CACHE_HPP_INCLUDED
+#define HEADER_GUARD_CACHE_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#include "inliner.hpp"
+#include "preprocessor.hpp"
+
+namespace cache_ns {
+	// Changed whenever the parser emits different byte code for the same source,
+	// so entries of older compilers are not used
+	const char* const COMPILER_VERSION = "lng-1";
+
+	// Used when LNG_CACHE_DIR is not set. It is outside of build and programs,
+	// so make clean does not wipe it
+	const char* const DEFAULT_CACHE_DIRECTORY = ".bcode_cache";
+
+	// Everything besides the source the byte code depends on
+	struct CompileOptions {
+		bool debug_section = true;
+		int inline_budget = inliner_ns::DEFAULT_INLINE_BUDGET; // 0 keeps every CALL
+
+		std::string flags() const;
+	};
+
+	// LNG_CACHE_DIR or DEFAULT_CACHE_DIRECTORY
+	std::string cache_directory();
+
+	// Byte code of compiled sources stored in files named by the hash of preprocessed
+	// source (so included files are covered too), its path (it is written to the debug section),
+	// compiler version and flags. Warm starts only preprocess the source, parsing is skipped.
+	// Entries are written to a temporary file and renamed, so concurrent compilers
+	// and readers never see a partial entry
+	class BytecodeCache {
+	private:
+		std::string directory_;
+	public:
+		explicit BytecodeCache(const std::string& directory = cache_directory());
+
+		uint64_t key(const std::string& source, const preprocessor_ns::ExpandedSource& expanded,
+		             const CompileOptions& options) const;
+
+		// Path of the entry for the key, it may not exist
+		std::string entry(uint64_t key) const;
+
+		// Path of byte code of the source, it is parsed only if there is no entry yet.
+		// hit is set to true if the entry was found
+		std::string compile(const std::string& source, const CompileOptions& options = {}, bool* hit = nullptr);
+	};
+}
+
+#endif //HEADER_GUARD_CACHE_HPP_INCLUDED
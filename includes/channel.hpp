@@ -0,0 +1,97 @@
+#ifndef HEADER_GUARD_CHANNEL_HPP_INCLUDED
+#define HEADER_GUARD_CHANNEL_HPP_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// Size of cache line, used to keep producer and consumer indices apart
+constexpr std::size_t CACHE_LINE = 64;
+
+// Capacity of the channel if not specified
+constexpr unsigned DEFAULT_CHANNEL_CAPACITY = 1024;
+
+/////////////
+// CHANNEL //
+/////////////
+
+// Bounded queue of integers between CPU instances running on different threads.
+// Operations never block: a full or empty channel makes them return false,
+// and the command interrupts its slice to try again later
+class Channel {
+private:
+	std::atomic<bool> closed_;
+	std::atomic<bool> abandoned_;
+public:
+	Channel();
+	virtual ~Channel() = default;
+
+	Channel(const Channel& other) = delete;
+	Channel& operator= (const Channel& other) = delete;
+
+	virtual bool try_send(int value) = 0;
+	virtual bool try_receive(int& value) = 0;
+
+	// After the channel is closed receivers drain it and stop
+	void close();
+	bool closed() const;
+
+	// After the channel is abandoned by its receivers senders stop, nobody will read their values
+	void abandon();
+	bool abandoned() const;
+
+	// Check if the context (CPU) may send or receive. Any context may for a channel
+	// of many senders and receivers, a single-sided channel takes the first one
+	virtual bool bind_sender(const void* context);
+	virtual bool bind_receiver(const void* context);
+};
+
+// Ring buffer for exactly one sender thread and one receiver thread.
+// The first context sending (receiving) becomes the only sender (receiver),
+// e.g. a context and its spawned child cannot both send into it
+class SPSCChannel : public Channel {
+private:
+	const unsigned mask_;
+	std::unique_ptr<int[]> buffer_;
+
+	std::atomic<const void*> sender_;
+	std::atomic<const void*> receiver_;
+
+	// next position to read, written only by the receiver
+	alignas(CACHE_LINE) std::atomic<unsigned> head_;
+	// next position to write, written only by the sender
+	alignas(CACHE_LINE) std::atomic<unsigned> tail_;
+public:
+	// capacity is rounded up to a power of two
+	SPSCChannel(unsigned capacity = DEFAULT_CHANNEL_CAPACITY);
+
+	virtual bool try_send(int value) override;
+	virtual bool try_receive(int& value) override;
+
+	virtual bool bind_sender(const void* context) override;
+	virtual bool bind_receiver(const void* context) override;
+};
+
+// Ring buffer for any number of senders and receivers.
+// Every cell has a sequence number telling whose turn it is (D. Vyukov's bounded queue)
+class MPMCChannel : public Channel {
+private:
+	struct Cell {
+		std::atomic<unsigned> sequence;
+		int value;
+	};
+
+	const unsigned mask_;
+	std::unique_ptr<Cell[]> buffer_;
+
+	alignas(CACHE_LINE) std::atomic<unsigned> head_;
+	alignas(CACHE_LINE) std::atomic<unsigned> tail_;
+public:
+	// capacity is rounded up to a power of two
+	MPMCChannel(unsigned capacity = DEFAULT_CHANNEL_CAPACITY);
+
+	virtual bool try_send(int value) override;
+	virtual bool try_receive(int& value) override;
+};
+
+#endif //HEADER_GUARD_CHANNEL_HPP_INCLUDED
@@ -8,6 +8,29 @@
 
 #include "cpu.hpp"
 
+// The first digit of the command id is its family. It defines the type of argument:
+// 	1, 5, 7, 8 - no argument
+// 	2          - label
+// 	3          - integer
+// 	4          - register
+// 	6          - memory operand
+inline int command_family(int id) {
+	return id / 10;
+}
+
+inline bool command_has_no_argument(int id) {
+	int family = command_family(id);
+	return (family == 1) || (family == 5) || (family == 7) || (family == 8);
+}
+
+// Memory commands (LOAD/STORE) have three variants with consecutive id-s,
+// the addressing mode is added to the id of the command
+enum AddressingMode {
+	ADDRESS_ABSOLUTE = 0, // [123]: address is the argument
+	ADDRESS_REGISTER = 1, // [BX]:  address is stored in the register
+	ADDRESS_STACK    = 2  // no argument: address is popped from the stack
+};
+
 ///////////////////
 // COMMAND CLASS //
 ///////////////////
@@ -20,10 +43,19 @@ protected:
 public:
 	Command();
 	Command(int arg);
-	~Command() = default;
+	virtual ~Command() = default;
 	virtual void execute(CPU& cpu) = 0;
 	static Command* get_command(int id, int argument);
+
+	// Superinstruction of the catalog for the commands of code starting at pc
+	static Command* get_superinstruction(int index, const std::vector<Instruction>& code, int pc);
 };
 
+// Sequences of command id-s the VM can run as one superinstruction, by index.
+// A superinstruction replaces the first command of the sequence, the others stay
+// in place, so jumps into the middle of the sequence run them one by one.
+// Only the last command of a sequence may jump
+std::vector<std::vector<int>> superinstruction_catalog();
+
 
 #endif //HEADER_GUARD_COMMAND_HPP_INCLUDED
@@ -0,0 +1,50 @@
+#ifndef HEADER_GUARD_COMPILER_HPP_INCLUDED
+#define HEADER_GUARD_COMPILER_HPP_INCLUDED
+
+#include <iostream>
+#include <string>
+
+#include "preprocessor.hpp"
+
+// Structured language (.lnx) compiled to .lng assembly, which is then parsed as usual:
+//
+//     var total = 0;                 global variable, a memory cell from the end of memory
+//
+//     func fact(n) {                 at most MAX_LOCALS parameters and local variables,
+//         if (n <= 1) {              they live in registers
+//             return 1;
+//         }
+//         return n * fact(n - 1);
+//     }
+//
+//     func main() {                  entry point, compiled between BEGIN and END
+//         var i = in();
+//         while (i > 0 && total < 1000) {
+//             total = total + fact(i);
+//             mem[i] = total;        data memory, LOAD and STORE
+//             i = i - 1;
+//         }
+//         out(total);
+//     }
+//
+// Operators by precedence: || ; && ; == != < <= > >= ; + - ; * / ; unary - and !.
+// Comments start with //
+//
+// Expressions are evaluated in Sethi-Ullman order: of two operands of a commutative
+// operator or a comparison the one that needs more stack goes first, an operand with a call goes last,
+// so registers read by the other operand are not saved around the call.
+// Registers are saved around a call only if they are live after it and the callee writes them.
+// Constants are folded, conditions compile to jumps, loops test the condition at the bottom,
+// and a call in return position is a jump
+namespace compiler_ns {
+	const char* const SOURCE_EXTENSION = ".lnx";
+
+	// Registers AX ... EX hold variables, FX is scratch
+	const int MAX_LOCALS = 5;
+
+	// Assembly with the line of .lnx every line comes from
+	preprocessor_ns::ExpandedSource compile(const std::string& filename);
+	preprocessor_ns::ExpandedSource compile(std::istream& source);
+}
+
+#endif //HEADER_GUARD_COMPILER_HPP_INCLUDED
@@ -5,41 +5,271 @@
 #include <map>
 #include <string>
 #include <fstream>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
 
 #include "stack.hpp"
+#include "guarded_stack.hpp"
 
 class Command;
 class Parser;
+class Scheduler;
+class Channel;
+
+namespace trace_ns {
+	class TraceBuffer;
+}
+
+namespace replay_ns {
+	class InputJournal;
+}
+
+namespace pgo_ns {
+	class ProfileCounters;
+}
+
+namespace hot_trace_ns {
+	struct Trace;
+	class TraceCache;
+}
+
+namespace memo_ns {
+	class MemoCache;
+	struct PendingCall;
+}
+
+namespace bigint_ns {
+	class BigArena;
+}
 
 #define MAX_LINE 100
 
+// First line of the optional debug section of byte code
+#define DEBUG_SECTION_MARKER "#debug"
+
+// First line of the optional section of superinstructions, before the debug section.
+// Every line is "<pc> <index in superinstruction_catalog()>"
+#define FUSED_SECTION_MARKER "#fused"
+
 const int REGS = 6;
 
+// Operand and call stacks of contexts. Builds with VM_GUARD_STACK (make VM_GUARD_STACK=1)
+// use stacks between guard pages: no checks on push and top, overflow and reading
+// an empty stack are caught by the SIGSEGV handler
+#ifdef VM_GUARD_STACK
+typedef stack_ns::GuardedStack<int> VMStack;
+#else
+typedef stack_ns::Stack<int> VMStack;
+#endif
+
+// Size of linear data memory in integer cells
+const int MEMORY_SIZE = 1 << 16;
+
+// How often (in instructions) the wall-clock deadline is checked
+const unsigned long long DEADLINE_CHECK_PERIOD = 4096;
+
+const unsigned long long UNLIMITED = std::numeric_limits<unsigned long long>::max();
+
+// State of execution returned after a slice
+enum CPUStatus {
+	CPU_RUNNING   = 0, // the slice is over, program can be resumed
+	CPU_HALTED    = 1, // END is reached
+	CPU_BUDGET    = 2, // total instruction budget is exhausted
+	CPU_DEADLINE  = 3, // wall-clock deadline has passed
+	CPU_YIELDED   = 4  // a command interrupted the slice, program can be resumed
+};
+
+// Execution engines, all of them must give the same results
+enum Engine {
+	ENGINE_VIRTUAL = 0, // virtual call of Command::execute for every instruction
+	ENGINE_SWITCH  = 1, // switch over command id, rare commands fall back to Command::execute
+	ENGINE_PROFILE = 2, // virtual calls, executions and jumps of every instruction are counted
+	ENGINE_TRACE   = 3  // virtual calls, iterations of hot loops run from recorded traces
+};
+
+// Command id and argument as they are written in byte code
+struct Instruction {
+	int id;
+	int argument;
+};
+
+// Position of an instruction in source, from 1
+struct SourceLocation {
+	int line;
+	int column;
+};
+
+// Contents of the debug section of byte code
+struct DebugInfo {
+	std::string source; // path of .lng file, may be empty
+	std::vector<SourceLocation> locations;
+	std::map<std::string, int> labels;
+};
+
+// Decoded byte code. It is shared by all contexts running the same program
+struct Program {
+	std::vector<Command*> commands;
+	std::vector<Instruction> code;
+	unsigned begin;
+	unsigned end;
+
+	// superinstructions from the fused section: catalog index by pc.
+	// commands[pc] runs the whole sequence in the virtual engines,
+	// the switch engine dispatches on code and ignores them
+	std::map<int, int> superinstructions;
+
+	// results of pure routines, nullptr unless memo_ns::enable_memoization was called
+	std::shared_ptr<memo_ns::MemoCache> memo;
+
+	// Where the debug section is: in the file at the offset or in the text.
+	// It is not parsed until debug_info() is called
+	std::string debug_file;
+	std::streamoff debug_offset;
+	std::string debug_text;
+
+	Program();
+	~Program();
+
+	Program(const Program& other) = delete;
+	Program& operator= (const Program& other) = delete;
+
+	// Parse the debug section on the first call, nullptr if byte code has none
+	const DebugInfo* debug_info() const;
+
+	// "file.lng:12:5" if the location of the instruction is known, "instruction 12" otherwise
+	std::string describe(int pc) const;
+private:
+	mutable std::once_flag debug_once_;
+	mutable std::unique_ptr<DebugInfo> debug_info_;
+};
+
 class CPU {
 private:
 	// State while reading byte code
 	const char* pos_;
 	const char* next_;
 	char line_[MAX_LINE];
-	unsigned int begin;
-	unsigned int end;
+
+	// Limits of execution
+	unsigned long long budget_;
+	bool has_deadline_;
+	std::chrono::steady_clock::time_point deadline_;
+
+	// storage of data memory shared with spawned contexts
+	std::shared_ptr<int[]> memory_storage_;
+
+	// filename is used to read the debug section later, empty if the stream is temporary
+	void load(std::istream& bytecode, const std::string& filename);
+	bool deadline_passed() const;
+
+	// Execute at most n instructions, stop at the end of program or on interrupt.
+	// Return the number of executed instructions
+	unsigned long long execute_virtual(unsigned long long n);
+	unsigned long long execute_switch(unsigned long long n);
+	unsigned long long execute_profile(unsigned long long n);
+	unsigned long long execute_trace(unsigned long long n);
+
+	// Run iterations of the hot loop while they fit into n instructions,
+	// stop at the head or at the exit of a failed guard
+	unsigned long long run_trace(const hot_trace_ns::Trace& loop, unsigned long long n);
 public:
 	// file with byte-code
 	std::ifstream file_;
 
-	stack_ns::Stack<int> stack;
-	stack_ns::Stack<int> call_stack;
+	VMStack stack;
+	VMStack call_stack;
 	
-	std::vector<Command*> commands;
+	std::shared_ptr<Program> program;
 
 	int* registers;
 	int pc_register;
+
+	// linear data memory of MEMORY_SIZE cells, zero-initialized
+	int* memory;
+
+	// number of instructions executed so far
+	unsigned long long executed;
+
+	// set by a command to end the current slice after it
+	bool interrupt;
+
+	// instructions the current slice may run after the dispatched one.
+	// A superinstruction counts its commands here and runs only as many as fit
+	unsigned long long slice_left;
+
+	// engine used by run_for(), contexts spawned by this CPU use the same engine
+	Engine engine;
+
+	// scheduler running this context, nullptr if CPU runs alone
+	Scheduler* scheduler;
+
+	// channels used by SEND and RECV, indexed by channel id.
+	// Spawned contexts share them with the parent, an SPSC channel still
+	// takes only the first context sending and the first one receiving
+	std::vector<std::shared_ptr<Channel>> channels;
+
+	// streams of IN and OUT commands
+	std::istream* input;
+	std::ostream* output;
+
+	// ring of executed instructions, filled only in builds with VM_TRACE.
+	// Spawned contexts are not traced
+	std::shared_ptr<trace_ns::TraceBuffer> trace;
+
+	// records or replays values of IN, nullptr to read input directly.
+	// Spawned contexts read input directly
+	std::shared_ptr<replay_ns::InputJournal> journal;
+
+	// counters of ENGINE_PROFILE, made on the first run and shared with spawned contexts
+	std::shared_ptr<pgo_ns::ProfileCounters> profile;
+
+	// hot loops of ENGINE_TRACE, made on the first run. Spawned contexts record their own
+	std::shared_ptr<hot_trace_ns::TraceCache> traces;
+
+	// memoized calls running in this context, the innermost last
+	std::vector<memo_ns::PendingCall> memo_calls;
+
+	// values of big integer commands, made on the first use. Spawned contexts have their own
+	std::shared_ptr<bigint_ns::BigArena> bigints;
 	
 	CPU(const std::string& filename);
 
+	// Load byte code from the stream (e.g. produced by Parser in memory)
+	CPU(std::istream& bytecode);
+
+	// Run the already decoded program from BEGIN with fresh registers and memory,
+	// e.g. a program kept loaded between requests
+	CPU(std::shared_ptr<Program> decoded);
+
+	// Make a new context running the program of parent from the entry point.
+	// Program and data memory are shared, registers and limits are copied
+	CPU(const CPU& parent, int entry);
+
 	~CPU();
 
+	// Make the channel available to SEND and RECV with the id
+	void attach_channel(int id, std::shared_ptr<Channel> channel);
+
+	// Limit the total number of executed instructions
+	void set_budget(unsigned long long instructions);
+
+	// Limit the wall-clock time of execution, counted from now
+	void set_deadline(std::chrono::milliseconds timeout);
+
+	// Execute at most n instructions. The state is preserved between calls,
+	// so execution can be resumed with the next call
+	CPUStatus run_for(unsigned long long n);
+
+	// Run until END, terminate if the budget or the deadline is exceeded
 	void run();
+
+	// Value for IN: from input or from the journal
+	int read_input();
+
+	// Context executed by the calling thread, nullptr outside of run_for()
+	static const CPU* running();
 };
 
 #endif //HEADER_GUARD_CPU_HPP_INCLUDED
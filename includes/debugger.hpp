@@ -0,0 +1,105 @@
+#ifndef HEADER_GUARD_DEBUGGER_HPP_INCLUDED
+#define HEADER_GUARD_DEBUGGER_HPP_INCLUDED
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+
+class Command;
+
+namespace debug_ns {
+	// Id written into Program::code for patched instructions. It is not a valid command,
+	// so the switch engine falls back to Command::execute of the patch
+	const int PATCHED_COMMAND_ID = 90;
+
+	const int NO_PC = -1;
+
+	// Instructions of the program mapped to the source
+	struct SourceMap {
+		std::vector<int> lines;            // source line of every instruction, from 1
+		std::map<std::string, int> labels; // label to instruction
+		std::vector<std::string> text;     // source lines
+
+		// First instruction of the line or of the first line with code after it, NO_PC if there is none
+		int line_to_pc(int line) const;
+	};
+
+	// Parse the source again to map its instructions
+	SourceMap load_source_map(const std::string& source);
+
+	// Take the map from the debug section of byte code, only the text is read from the source
+	SourceMap load_source_map(const DebugInfo& info, const std::string& source);
+
+	enum StopReason {
+		STOP_NONE       = 0,
+		STOP_STEP       = 1, // one instruction is executed
+		STOP_BREAKPOINT = 2, // next instruction has a breakpoint
+		STOP_WATCH      = 3, // watched register has changed
+		STOP_HALTED     = 4, // END is reached
+		STOP_LIMIT      = 5  // budget or deadline is exceeded
+	};
+
+	// Original instruction replaced by a patch
+	struct Patch {
+		Command* original;
+		int id;
+		Command* patch;
+	};
+
+	// Breakpoints and watches are made by replacing instructions of the program
+	// with patches, so the engines run at full speed between stops.
+	// The program is restored when the debugger is destroyed, except superinstructions
+	// covering patched instructions: they are replaced by plain commands for good
+	class Debugger {
+	private:
+		CPU& cpu_;
+		std::map<int, Patch> patches_;
+		std::set<int> breakpoints_;
+		std::set<int> watched_;
+		int temporary_; // breakpoint of step over, NO_PC if not set
+
+		bool needs_patch(int pc) const;
+		void update_patch(int pc);
+		void install(int pc);
+		void uninstall(int pc);
+		void unfuse(int pc);
+
+		StopReason run();
+	public:
+		// Set by patches when they stop the execution
+		StopReason stop;
+		int watch_register;
+		int old_value;
+		int new_value;
+
+		explicit Debugger(CPU& cpu);
+		~Debugger();
+
+		Debugger(const Debugger& other) = delete;
+		Debugger& operator= (const Debugger& other) = delete;
+
+		void set_breakpoint(int pc);
+		void remove_breakpoint(int pc);
+		const std::set<int>& breakpoints() const;
+
+		// Command id of the instruction as it is in byte code, even if it is patched
+		int original_id(int pc) const;
+
+		void watch(int register_id);
+		void unwatch(int register_id);
+
+		// Execute one instruction, the one under a breakpoint too
+		StopReason step();
+
+		// Like step, but CALL is executed until it returns
+		StopReason step_over();
+
+		// Run until a breakpoint, a change of watched register or the end
+		StopReason resume();
+	};
+}
+
+#endif //HEADER_GUARD_DEBUGGER_HPP_INCLUDED
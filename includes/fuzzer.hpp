@@ -0,0 +1,64 @@
+#ifndef HEADER_GUARD_FUZZER_HPP_INCLUDED
+#define HEADER_GUARD_FUZZER_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+
+namespace fuzzer_ns {
+	// Part of generated program. Every statement leaves the stack as it was,
+	// except for pushes at the top level of main, which stay on the stack until END.
+	// Statements are removed as a whole while minimizing, so programs stay valid
+	struct Statement {
+		std::vector<std::string> head; // lines before the body
+		std::vector<Statement> body;   // nested statements of loop or condition
+		std::vector<std::string> tail; // lines after the body
+	};
+
+	struct GeneratedProgram {
+		std::vector<Statement> main;
+		// function i may only call functions with greater index, so there is no recursion
+		std::vector<std::vector<Statement>> functions;
+
+		std::string source() const;
+	};
+
+	// Way of running the program, every configuration must give the same outcome
+	struct EngineConfig {
+		const char* name;
+		Engine engine;
+		unsigned long long slice; // instructions per run_for() call
+	};
+
+	// Everything observable after the program halts
+	struct Outcome {
+		CPUStatus status;
+		std::string output;
+		std::vector<int> stack;
+		std::vector<int> registers;
+		std::vector<int> memory;
+		unsigned long long executed;
+
+		bool operator== (const Outcome& other) const = default;
+	};
+
+	const std::vector<EngineConfig>& engine_configs();
+
+	GeneratedProgram generate(unsigned seed);
+
+	Outcome execute(const std::string& source, const EngineConfig& config);
+
+	// Run the program with every engine, return the description of the first
+	// difference or an empty string if all engines agree
+	std::string compare_engines(const GeneratedProgram& program);
+
+	// Remove statements while the engines still disagree
+	GeneratedProgram minimize(GeneratedProgram program);
+
+	// Generate and check programs with seeds seed, seed + 1, ...
+	// Prints the minimized program for every difference, returns the number of failed programs
+	unsigned fuzz(unsigned iterations, unsigned seed);
+}
+
+#endif //HEADER_GUARD_FUZZER_HPP_INCLUDED
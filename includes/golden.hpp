@@ -0,0 +1,30 @@
+#ifndef HEADER_GUARD_GOLDEN_HPP_INCLUDED
+#define HEADER_GUARD_GOLDEN_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+namespace golden_ns {
+	// Subdirectory of programs with golden files:
+	// 	name.out - expected output of the program (required)
+	// 	name.in  - input of the program (optional)
+	// Name is the program name, optionally followed by '.' and the case name,
+	// e.g. fact.out and fact.big.out are both cases of fact.lng
+	const char* const GOLDEN_DIRECTORY = "golden";
+
+	struct GoldenCase {
+		std::string name;
+		std::string program;  // path to .lng file, or .lnx if there is no .lng
+		std::string input;    // path to input file, empty if there is none
+		std::string expected; // path to golden output
+	};
+
+	// Find all cases in the directory of programs, sorted by name
+	std::vector<GoldenCase> find_cases(const std::string& programs);
+
+	// Parse, load and run the program in this process and compare its output with the golden file.
+	// Prints the number of executed instructions and the time of every stage
+	bool run_case(const GoldenCase& test);
+}
+
+#endif //HEADER_GUARD_GOLDEN_HPP_INCLUDED
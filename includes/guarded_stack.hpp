@@ -0,0 +1,88 @@
+#ifndef HEADER_GUARD_GUARDED_STACK_HPP_INCLUDED
+#define HEADER_GUARD_GUARDED_STACK_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace stack_ns {
+	// Bytes reserved for the values of one guarded stack. Pages are mapped
+	// by the kernel when they are touched first, so unused room costs no memory
+	const size_t GUARDED_STACK_BYTES = 16 << 20;
+
+	// Reserve GUARDED_STACK_BYTES between two inaccessible guard pages and register
+	// them, return the start of the usable room. An access to a guard page ends
+	// the process with the error of an empty or a full stack
+	void* reserve_guarded_region();
+	void release_guarded_region(void* room);
+
+	// Stack of trivially copyable values without checks: push, pop and top are a single
+	// load or store. Pushing past GUARDED_STACK_BYTES hits the guard page above the room,
+	// reading the top of an empty stack hits the guard page below it, both are reported
+	// by the SIGSEGV handler like VERIFY_CONTRACT with the running instruction.
+	// Unlike Stack, pop of an empty stack is not ignored: pop reads the removed value,
+	// so it fails at once in the guard page instead of moving below it.
+	// The interface is the part of Stack used by CPU (see VMStack in cpu.hpp)
+	template <typename T>
+	class GuardedStack {
+		static_assert(std::is_trivially_copyable_v<T>, "guarded stack copies values as bytes");
+		static_assert(4096 % sizeof(T) == 0, "values must not cross the guard page");
+
+		T* base_;
+		T* top_;
+	public:
+		GuardedStack() : base_(static_cast<T*>(reserve_guarded_region())), top_(base_) {}
+
+		GuardedStack(const GuardedStack& s) : GuardedStack() {
+			*this = s;
+		}
+
+		GuardedStack(GuardedStack&& s) : base_(s.base_), top_(s.top_) {
+			s.base_ = nullptr;
+			s.top_ = nullptr;
+		}
+
+		GuardedStack& operator= (const GuardedStack& s) {
+			if (this == &s) return *this;
+			// a moved-from stack has no room of its own
+			if (base_ == nullptr) base_ = static_cast<T*>(reserve_guarded_region());
+			size_t length = s.top_ - s.base_;
+			if (length > 0) std::memcpy(base_, s.base_, length * sizeof(T));
+			top_ = base_ + length;
+			return *this;
+		}
+
+		GuardedStack& operator= (GuardedStack&& s) {
+			if (this == &s) return *this;
+			if (base_ != nullptr) release_guarded_region(base_);
+			base_ = s.base_;
+			top_ = s.top_;
+			s.base_ = nullptr;
+			s.top_ = nullptr;
+			return *this;
+		}
+
+		~GuardedStack() {
+			if (base_ != nullptr) release_guarded_region(base_);
+		}
+
+		unsigned size() { return static_cast<unsigned>(top_ - base_); }
+		unsigned capacity() { return static_cast<unsigned>(GUARDED_STACK_BYTES / sizeof(T)); }
+
+		const T* data() const { return base_; }
+		unsigned unchecked_size() const { return static_cast<unsigned>(top_ - base_); }
+
+		template <typename... Args>
+		void emplace(Args&&... args) { *top_++ = T(std::forward<Args>(args)...); }
+
+		void push(const T& value) { *top_++ = value; }
+		void pop() {
+			static_cast<void>(*static_cast<volatile T*>(top_ - 1));
+			--top_;
+		}
+		T& top() { return top_[-1]; }
+	};
+}
+
+#endif //HEADER_GUARD_GUARDED_STACK_HPP_INCLUDED
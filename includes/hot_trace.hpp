@@ -0,0 +1,83 @@
+#ifndef HEADER_GUARD_HOT_TRACE_HPP_INCLUDED
+#define HEADER_GUARD_HOT_TRACE_HPP_INCLUDED
+
+#include <vector>
+
+#include "cpu.hpp"
+
+// Traces of hot loops run by ENGINE_TRACE.
+//
+// A jump backward taken HOT_LOOP_THRESHOLD times makes its target the head of a loop,
+// the next iteration from the head back to it is recorded. Executed instructions become
+// a linear list of operations with decoded and checked operands: JMP does nothing,
+// a conditional jump becomes a guard leaving the trace where the recorded iteration
+// did not go. Following iterations run from the trace without dispatch on command
+// objects until a guard fails (side exit), then the interpreter goes on from the exit.
+//
+// Iterations with commands other than stack, arithmetic, register, memory and OUT
+// (e.g. CALL, IN, channels) or longer than MAX_TRACE_LENGTH are not recorded,
+// the head is tried again after RETRY_BACKOFF more jumps to it
+namespace hot_trace_ns {
+	const int HOT_LOOP_THRESHOLD = 64;
+	const unsigned MAX_TRACE_LENGTH = 256;
+	const int RETRY_BACKOFF = 1024;
+
+	struct TraceOp {
+		int id;            // command id, for a guard the jump taken when the trace is left
+		int operand;
+		int pc;            // instruction of the operation, for error messages
+		int exit;          // pc after the failed guard
+		unsigned executed; // instructions of the iteration up to this operation
+	};
+
+	struct Trace {
+		int head;
+		std::vector<TraceOp> ops;
+		unsigned instructions = 0; // executed by one iteration, as counted by the virtual engine
+	};
+
+	struct TraceStats {
+		unsigned long long recorded = 0;
+		unsigned long long aborted = 0;    // recordings of iterations that cannot be traced
+		unsigned long long entered = 0;
+		unsigned long long side_exits = 0;
+	};
+
+	// Hot loops of one context: spawned contexts have their own
+	class TraceCache {
+	private:
+		std::vector<int> hotness_;   // jumps to every instruction
+		std::vector<int> trace_of_;  // index of the trace by its head, -1 if there is none
+		std::vector<Trace> traces_;
+
+		bool recording_;
+		Trace recorded_;
+
+		void abort();
+	public:
+		TraceStats stats;
+
+		explicit TraceCache(const Program& program);
+
+		const Trace* at(int pc) const {
+			int index = trace_of_[pc];
+			return (index < 0) ? nullptr : &traces_[index];
+		}
+
+		bool recording() const {
+			return recording_;
+		}
+
+		// A command jumped back to the target, the recording starts there if it is hot
+		void jumped_back(int target);
+
+		// The command at pc ran its first length instructions (more than one for a superinstruction)
+		// and went to next: add them to the recorded iteration, the trace is ready when next is the head
+		void record(const Program& program, int pc, int length, int next);
+
+		// The command interrupted the slice, the iteration is not recorded
+		void interrupted();
+	};
+}
+
+#endif //HEADER_GUARD_HOT_TRACE_HPP_INCLUDED
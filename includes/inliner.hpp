@@ -0,0 +1,24 @@
+#ifndef HEADER_GUARD_INLINER_HPP_INCLUDED
+#define HEADER_GUARD_INLINER_HPP_INCLUDED
+
+#include "preprocessor.hpp"
+
+// Replaces "CALL name" with the body of the subroutine when it is small enough:
+//
+//     name:                    the body is the code from the label to the first RET,
+//         ...                  jumps of the body stay inside it, and the body does not call
+//         RET                  itself directly or through other subroutines
+//
+// The body runs on the data stack just like after CALL, so only RET is dropped and
+// the inlined code falls through to the instruction after the call.
+// Labels of the body get a unique suffix in every copy. Subroutines are left in place,
+// they may still be called from elsewhere. Inlined lines keep the source lines of the body
+namespace inliner_ns {
+	// Maximum number of instructions of an inlined body, after inlining its own calls
+	const int DEFAULT_INLINE_BUDGET = 16;
+
+	// Budget 0 leaves the source unchanged
+	preprocessor_ns::ExpandedSource inline_calls(preprocessor_ns::ExpandedSource source, int budget = DEFAULT_INLINE_BUDGET);
+}
+
+#endif //HEADER_GUARD_INLINER_HPP_INCLUDED
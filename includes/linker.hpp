@@ -0,0 +1,73 @@
+#ifndef HEADER_GUARD_LINKER_HPP_INCLUDED
+#define HEADER_GUARD_LINKER_HPP_INCLUDED
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+
+// Separate compilation: every source is parsed into a relocatable object file,
+// the linker merges objects into one byte code file.
+//
+// Labels starting with '_' are local to their file, other labels are exported.
+// A label used in a file resolves to its own declaration first, otherwise to
+// the only object exporting it. Exactly one object must contain BEGIN.
+//
+// Object file format (text, like byte code):
+//      #object
+//      source <path of the source file>    (only if parsed from file)
+//      code <number of instructions>
+//      <id> <argument>                     for every instruction, 0 for labels
+//      relocations <number>
+//      <instruction> <label>               for every label argument
+//      labels <number>
+//      <label> <instruction>               for every declared label
+//      lines <number of instructions>
+//      <line> <column>                     for every instruction
+namespace linker_ns {
+	const char* const OBJECT_EXTENSION = ".lobj";
+	const char* const OBJECT_MARKER = "#object";
+
+	// Label argument of the instruction
+	struct Relocation {
+		int instruction;
+		std::string label;
+	};
+
+	struct ObjectFile {
+		std::string source; // may be empty
+		std::vector<Instruction> code;
+		std::vector<Relocation> relocations;
+		std::map<std::string, int> labels;
+		std::vector<SourceLocation> locations;
+	};
+
+	void write_object(const ObjectFile& object, std::ostream& out);
+	void write_object(const ObjectFile& object, const std::string& filename);
+	ObjectFile read_object(std::istream& in);
+	ObjectFile read_object(const std::string& filename);
+
+	struct LinkOptions {
+		bool strip_dead = true;         // leave out routines never reached from BEGIN
+		bool debug_section = true;
+		std::vector<std::string> hot;   // routines placed right after the entry, in this order
+	};
+
+	struct LinkStats {
+		int instructions = 0;
+		int stripped_instructions = 0;
+		int stripped_routines = 0;
+	};
+
+	// Write byte code of the objects linked together.
+	//
+	// Code is split into routines after every RET, JMP and END, so code that may fall through
+	// stays together. Routines not reachable from the one with BEGIN by jumps, calls and
+	// spawns are stripped. The entry goes first, then the hot routines, then the rest
+	// in the order they are first referenced, so callees lie close to their callers
+	LinkStats link(const std::vector<ObjectFile>& objects, std::ostream& out, const LinkOptions& options = {});
+}
+
+#endif //HEADER_GUARD_LINKER_HPP_INCLUDED
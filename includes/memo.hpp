@@ -0,0 +1,79 @@
+#ifndef HEADER_GUARD_MEMO_HPP_INCLUDED
+#define HEADER_GUARD_MEMO_HPP_INCLUDED
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "analysis.hpp"
+#include "cpu.hpp"
+
+// Memoization of pure routines (see analysis_ns::find_pure_routines).
+//
+// CALL of a pure routine looks up its arguments and input registers in the cache
+// of the program. On a hit the arguments are replaced by the results and the output
+// registers are set without running the routine, the call counts as one instruction.
+// On a miss the routine runs and its RET stores the results.
+//
+// The cache belongs to the program, so it is shared by its contexts and kept between
+// runs of a loaded program (e.g. by the daemon). Memoization replaces commands of the
+// program, so the switch engine, which dispatches on command id-s, does not use it
+namespace memo_ns {
+	// Results kept for every routine, an arbitrary one is dropped for a new one
+	const size_t DEFAULT_MEMO_CAPACITY = 1 << 12;
+
+	struct MemoStats {
+		unsigned long long hits = 0;
+		unsigned long long misses = 0;
+		unsigned long long evictions = 0;
+	};
+
+	// Arguments from the bottom, then input registers
+	using MemoKey = std::vector<int>;
+
+	struct MemoKeyHash {
+		size_t operator() (const MemoKey& key) const;
+	};
+
+	// Results from the bottom, then output registers
+	using MemoResult = std::vector<int>;
+
+	// Call of a routine waiting for its RET, made on a miss
+	struct PendingCall {
+		int routine;
+		unsigned depth; // size of the call stack before CALL
+		MemoKey key;
+	};
+
+	class MemoCache {
+	private:
+		struct Table {
+			analysis_ns::PureRoutine routine;
+			std::unordered_map<MemoKey, MemoResult, MemoKeyHash> results;
+		};
+
+		size_t capacity_;
+		std::map<int, Table> tables_;
+		MemoStats stats_;
+		mutable std::mutex mutex_;
+	public:
+		MemoCache(const std::map<int, analysis_ns::PureRoutine>& routines, size_t capacity);
+
+		const analysis_ns::PureRoutine& routine(int entry) const;
+
+		// Results of the routine for the key, false on a miss
+		bool lookup(int entry, const MemoKey& key, MemoResult& result);
+		void store(int entry, const MemoKey& key, MemoResult result);
+
+		MemoStats stats() const;
+	};
+
+	// Make CALL of pure routines and every RET of the program memoizing.
+	// ENGINE_SWITCH runs CALL and RET without the commands, so it does not memoize.
+	// Return the number of pure routines
+	size_t enable_memoization(Program& program, size_t capacity = DEFAULT_MEMO_CAPACITY);
+}
+
+#endif //HEADER_GUARD_MEMO_HPP_INCLUDED
@@ -7,12 +7,17 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <sstream>
+
+#include "linker.hpp"
+#include "preprocessor.hpp"
 
 #define MAX_LINE_SIZE 100
 
 class Parser {
 private:
-	std::ifstream file_;
+	std::istringstream expanded_; // source after preprocessing
+	std::istream* input_;
 
 	const char* pos_;
 	const char* end_;
@@ -20,6 +25,24 @@ private:
 
 	int command_line_number;
 
+	// number of the line in expanded source (from 1), origins_ map it to the source file
+	int source_line_;
+	std::vector<preprocessor_ns::LineOrigin> origins_;
+
+	// source line and column (from 1) for every parsed command
+	std::vector<int> command_lines_;
+	std::vector<int> command_columns_;
+
+	std::string source_name_; // empty if source is a stream
+	bool debug_section_;
+
+	// every parsed command and the label arguments, kept for object files
+	std::vector<Instruction> code_;
+	std::vector<linker_ns::Relocation> relocations_;
+	bool resolve_labels_;
+
+	void write_debug_section(std::ostream& out) const;
+
 	void read_line_from_file();
 	bool parse_pattern(std::regex regexp);
 	bool parse_pattern(std::regex regexp, std::string& ret);
@@ -32,12 +55,19 @@ private:
 	int parse_command();
 	int parse_register();
 	int parse_int_number();
+	int parse_memory_operand(int& argument);
 	std::string parse_label();
 
 	std::map<std::string, int> declared_labels;
 	std::map<long int, std::string> used_labels;
 public:
 	Parser(const std::string& filename);
+
+	// Parse source text from the stream, e.g. generated in memory
+	Parser(std::istream& source);
+
+	// Parse source that is already preprocessed, source_name is written to the debug section
+	Parser(preprocessor_ns::ExpandedSource source, const std::string& source_name);
 	~Parser();
 
 	Parser() = delete;
@@ -47,6 +77,32 @@ public:
 	Parser& operator= (Parser&& other) = delete;
 
 	void parse(const std::string& outfile);
+
+	// Write byte code to the stream, it must support seekp() to resolve labels
+	void parse(std::ostream& out);
+
+	// Parse into a relocatable object: labels are left unresolved, so they may be declared in other files
+	linker_ns::ObjectFile parse_object();
+
+	// Write the map of instructions to source lines after the code (on by default)
+	void set_debug_section(bool enabled);
+
+	// Source line and column of every command in the byte code, valid after parse()
+	const std::vector<int>& command_lines() const;
+	const std::vector<int>& command_columns() const;
+
+	// Instruction of every declared label, valid after parse()
+	const std::map<std::string, int>& labels() const;
 };
 
+// Mnemonic of the command id as written in source, e.g. "LOAD" for 61
+std::string get_command_name(int id);
+
+// Debug section of byte code, see Parser::write_debug_section
+void write_debug_section(std::ostream& out, const std::string& source, const std::vector<int>& lines,
+                         const std::vector<int>& columns, const std::map<std::string, int>& labels);
+
+// Source ready for parsing: .lnx files are compiled to assembly, others are preprocessed
+preprocessor_ns::ExpandedSource read_source(const std::string& filename);
+
 #endif
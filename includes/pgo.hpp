@@ -0,0 +1,84 @@
+#ifndef HEADER_GUARD_PGO_HPP_INCLUDED
+#define HEADER_GUARD_PGO_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+
+// Profile-guided optimization of byte code.
+//
+// ENGINE_PROFILE counts how many times every instruction was executed and how many
+// times the next executed instruction was not the following one (a jump was taken).
+// Frequencies of opcode pairs follow from them: the pair at pc runs
+// counts[pc] - jumps[pc] times.
+//
+// Profile file format (text):
+//      #profile
+//      program <hash of the byte code>
+//      instructions <number of instructions>
+//      <pc> <count> <jumps>                for every executed instruction
+namespace pgo_ns {
+	const char* const PROFILE_MARKER = "#profile";
+
+	// Kinds of superinstructions chosen for one program, the most profitable ones
+	const unsigned MAX_SUPERINSTRUCTION_KINDS = 8;
+
+	struct ExecutionProfile {
+		uint64_t program_hash = 0; // see replay_ns::program_hash
+		std::vector<uint64_t> counts;
+		std::vector<uint64_t> jumps;
+
+		void save(std::ostream& out) const;
+		void save(const std::string& filename) const;
+	};
+
+	ExecutionProfile load(std::istream& in);
+	ExecutionProfile load(const std::string& filename);
+
+	// Counters of ENGINE_PROFILE, shared by all contexts of the program
+	class ProfileCounters {
+	private:
+		uint64_t program_hash_;
+		size_t size_;
+		std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+		std::unique_ptr<std::atomic<uint64_t>[]> jumps_;
+	public:
+		explicit ProfileCounters(const Program& program);
+
+		// The instruction at pc was executed, next is pc_register after it
+		void count(int pc, int next) {
+			counts_[pc].fetch_add(1, std::memory_order_relaxed);
+			if (next != pc + 1) jumps_[pc].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		ExecutionProfile snapshot() const;
+	};
+
+	struct OptimizationStats {
+		int blocks = 0;
+		int moved_blocks = 0;   // blocks placed out of their original order
+		int inverted_jumps = 0;
+		int added_jumps = 0;    // JMP to a fallthrough block placed elsewhere
+		int removed_jumps = 0;  // JMP to the block placed right after it
+		uint64_t executed = 0;  // instructions the new code runs on the profiled input
+		std::map<int, unsigned> superinstructions; // occurrences by catalog index
+	};
+
+	// Write byte code of the program optimized for the profile:
+	//  - basic blocks are chained along the most frequent edges, so hot paths fall through.
+	//    The chain of BEGIN goes first, then chains by their hottest block, never executed ones last;
+	//  - a conditional jump is inverted when its frequent target is placed right after it;
+	//  - superinstructions of at most MAX_SUPERINSTRUCTION_KINDS kinds saving the most
+	//    dispatches are placed over executed sequences of the new code.
+	// The profile must be recorded on the same byte code
+	OptimizationStats optimize(const Program& program, const ExecutionProfile& profile, std::ostream& out,
+	                           bool debug_section = true);
+}
+
+#endif //HEADER_GUARD_PGO_HPP_INCLUDED
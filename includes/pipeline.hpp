@@ -0,0 +1,19 @@
+#ifndef HEADER_GUARD_PIPELINE_HPP_INCLUDED
+#define HEADER_GUARD_PIPELINE_HPP_INCLUDED
+
+#include <memory>
+#include <vector>
+
+#include "cpu.hpp"
+
+// Stage i receives from channel 0 and sends to channel 1.
+// Channel 1 of stage i is channel 0 of stage i + 1
+const int INPUT_CHANNEL  = 0;
+const int OUTPUT_CHANNEL = 1;
+
+// Link neighbouring stages with SPSC channels and run every stage on its own thread.
+// A finished stage closes its output, so the next stage drains it and halts,
+// and abandons its input, so the previous stage halts on its next SEND
+void run_pipeline(std::vector<std::unique_ptr<CPU>>& stages);
+
+#endif //HEADER_GUARD_PIPELINE_HPP_INCLUDED
@@ -0,0 +1,42 @@
+#ifndef HEADER_GUARD_PREPROCESSOR_HPP_INCLUDED
+#define HEADER_GUARD_PREPROCESSOR_HPP_INCLUDED
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Directives of .lng sources, expanded before parsing:
+//
+//     #define NAME VALUE       NAME is replaced by VALUE in the following lines
+//     #macro NAME PARAM...     lines up to #endmacro are the body of the macro,
+//     ...                      a line "NAME ARG..." is replaced by the body with
+//     #endmacro                parameters replaced by arguments
+//     #include "FILE"          lines of FILE, relative to the including file.
+//                              A file is included only once
+//
+// Labels declared in a macro body get a unique suffix in every expansion
+namespace preprocessor_ns {
+	// Maximum depth of nested includes and macro expansions
+	const int MAX_EXPANSION_DEPTH = 64;
+
+	// Line and column of the main source an expanded line comes from
+	struct LineOrigin {
+		int line;
+		int column; // 0 if columns of the line are the same as in source
+	};
+
+	// Source after preprocessing. Directives and empty lines are removed,
+	// lines are separated by '\n' with no newline after the last one
+	struct ExpandedSource {
+		std::string text;
+		std::vector<LineOrigin> origins;  // origin of every line of text
+		std::vector<std::string> files;   // files read, the main one first (none for a stream)
+	};
+
+	ExpandedSource preprocess(const std::string& filename);
+
+	// Includes are relative to the current directory
+	ExpandedSource preprocess(std::istream& source);
+}
+
+#endif //HEADER_GUARD_PREPROCESSOR_HPP_INCLUDED
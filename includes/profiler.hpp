@@ -0,0 +1,87 @@
+#ifndef HEADER_GUARD_PROFILER_HPP_INCLUDED
+#define HEADER_GUARD_PROFILER_HPP_INCLUDED
+
+#include <iostream>
+#include <string>
+
+#include "cpu.hpp"
+
+// Where the interpreter spends its time on the host:
+//  - hardware counters of perf_event_open around the run (cycles, instructions,
+//    branch misses, L1 instruction cache misses);
+//  - sampling profiler taking pc_register and the CALL chain of the running
+//    context on SIGPROF and writing folded stacks for flame graphs:
+//        BEGIN;fact;multiply 120
+//    Frames are subroutines named by the labels of CALL and SPAWN targets
+namespace profiler_ns {
+	enum Counter {
+		COUNTER_CYCLES        = 0,
+		COUNTER_INSTRUCTIONS  = 1,
+		COUNTER_BRANCH_MISSES = 2,
+		COUNTER_L1I_MISSES    = 3,
+		COUNTERS              = 4
+	};
+
+	const char* const COUNTER_NAMES[COUNTERS] = {"cycles", "instructions", "branch misses", "L1i misses"};
+
+	// Value of a counter the kernel refused to open, e.g. without PMU in a VM
+	// or with kernel.perf_event_paranoid forbidding it
+	const long long UNAVAILABLE = -1;
+
+	// Counters of the calling thread and threads it creates while they are enabled
+	class HardwareCounters {
+	private:
+		int fds_[COUNTERS];
+	public:
+		HardwareCounters();
+		~HardwareCounters();
+
+		HardwareCounters(const HardwareCounters& other) = delete;
+		HardwareCounters& operator= (const HardwareCounters& other) = delete;
+
+		// Reset and enable counters
+		void start();
+		void stop();
+
+		long long value(Counter counter) const;
+
+		// Counters with host instructions and cycles per executed instruction of the VM
+		void print(std::ostream& out, unsigned long long executed) const;
+	};
+
+	// Microseconds of CPU time between samples
+	const unsigned DEFAULT_SAMPLE_PERIOD = 1000;
+
+	// Deeper CALL chains keep the innermost frames
+	const unsigned MAX_SAMPLE_DEPTH = 64;
+
+	// Samples are stored in a buffer allocated before the start,
+	// the handler does not allocate. Later samples are dropped
+	const unsigned MAX_SAMPLES = 1 << 16;
+
+	// Samples whichever context the interrupted thread runs. One profiler runs at a time
+	class SamplingProfiler {
+	private:
+		unsigned period_;
+		bool running_;
+	public:
+		explicit SamplingProfiler(unsigned period = DEFAULT_SAMPLE_PERIOD);
+		~SamplingProfiler();
+
+		SamplingProfiler(const SamplingProfiler& other) = delete;
+		SamplingProfiler& operator= (const SamplingProfiler& other) = delete;
+
+		void start();
+		void stop();
+
+		// Samples taken since the start, dropped ones included
+		unsigned long long samples() const;
+
+		// One line per distinct stack with the number of its samples. Samples
+		// taken outside of the interpreter loop (scheduler, input) are "[vm]"
+		void write_folded(const Program& program, std::ostream& out) const;
+		void write_folded(const Program& program, const std::string& filename) const;
+	};
+}
+
+#endif //HEADER_GUARD_PROFILER_HPP_INCLUDED
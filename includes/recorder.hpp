@@ -0,0 +1,116 @@
+#ifndef HEADER_GUARD_RECORDER_HPP_INCLUDED
+#define HEADER_GUARD_RECORDER_HPP_INCLUDED
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu.hpp"
+#include "stack.hpp"
+
+namespace replay_ns {
+	// Instructions between checkpoints taken while replaying
+	const unsigned long long DEFAULT_CHECKPOINT_PERIOD = 1 << 20;
+
+	// Value read by IN and the number of the IN instruction (counted from 0)
+	struct InputEvent {
+		uint64_t instruction;
+		int32_t value;
+	};
+
+	// Everything a program read from input. Stored as deltas of instruction numbers
+	// and values in variable-length encoding, so a file takes a few bytes per IN
+	struct Recording {
+		uint64_t program_hash; // recording can only be replayed by the same byte code
+		std::vector<InputEvent> events;
+
+		void save(std::ostream& out) const;
+		void save(const std::string& filename) const;
+	};
+
+	Recording load(std::istream& in);
+	Recording load(const std::string& filename);
+
+	// Hash of commands, arguments and superinstructions of the program
+	uint64_t program_hash(const Program& program);
+
+	// Source of IN values for one context. In record mode values are read
+	// from the input stream and logged, in replay mode they come from the recording
+	// and the input stream is not touched
+	class InputJournal {
+	private:
+		Recording recording_;
+		bool replaying_;
+		size_t next_;   // number of events read so far
+		bool pending_;  // the last read is not settled yet
+	public:
+		// Record mode
+		explicit InputJournal(const Program& program);
+
+		// Replay mode, terminates if the recording was made by another program
+		InputJournal(const Program& program, Recording recording);
+
+		// Called by IN
+		int read(std::istream& input);
+
+		// Called by CPU::run_for() when the slice with IN is over, the instruction is the number of IN.
+		// Replay terminates if IN comes at other instruction than in the recording
+		void settle(uint64_t instruction);
+
+		bool replaying() const;
+		const Recording& recording() const;
+
+		// Number of events read, used by checkpoints
+		size_t position() const;
+		void seek(size_t position);
+	};
+
+	// Save the recording of the journal when the process exits, including exit(1) on a runtime error
+	void save_at_exit(std::shared_ptr<InputJournal> journal, const std::string& filename);
+
+	// State of the context at some instruction
+	struct Checkpoint {
+		unsigned long long executed;
+		int pc;
+		VMStack stack;
+		VMStack call_stack;
+		std::vector<int> registers;
+		std::vector<int> memory;
+		size_t input_position;
+		std::shared_ptr<bigint_ns::BigArena> bigints; // values of the handles in the state
+	};
+
+	Checkpoint capture(CPU& cpu);
+	void restore(CPU& cpu, const Checkpoint& checkpoint);
+
+	// Replays the recording on the context and moves it to any instruction. Going back
+	// restores the nearest checkpoint before the instruction and executes the rest again.
+	// Checkpoints are taken every period instructions while executing forward
+	class Replayer {
+	private:
+		CPU& cpu_;
+		std::shared_ptr<InputJournal> journal_;
+		unsigned long long period_;
+		std::vector<Checkpoint> checkpoints_; // sorted by executed, the first one is the start
+
+		void take_checkpoint();
+	public:
+		Replayer(CPU& cpu, Recording recording, unsigned long long period = DEFAULT_CHECKPOINT_PERIOD);
+
+		Replayer(const Replayer& other) = delete;
+		Replayer& operator= (const Replayer& other) = delete;
+
+		// Stop right before the instruction with the number (cpu.executed == instruction)
+		// or earlier if the program ends
+		CPUStatus seek(unsigned long long instruction);
+
+		// Replay to the end of program
+		CPUStatus run();
+
+		size_t checkpoints() const;
+	};
+}
+
+#endif //HEADER_GUARD_RECORDER_HPP_INCLUDED
@@ -0,0 +1,69 @@
+#ifndef HEADER_GUARD_SCHEDULER_HPP_INCLUDED
+#define HEADER_GUARD_SCHEDULER_HPP_INCLUDED
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "cpu.hpp"
+
+// Number of instructions a context executes before the switch
+const unsigned long long DEFAULT_SLICE = 1000;
+
+///////////////
+// SCHEDULER //
+///////////////
+
+// Runs green threads (contexts) of one program in round-robin order.
+// A context is switched after the slice is over or when a command
+// interrupts it (YIELD, JOIN on unfinished context).
+// With one worker everything runs on the calling thread,
+// with N workers contexts are distributed over N OS threads (M:N mode)
+class Scheduler {
+private:
+	struct Task {
+		CPU* cpu;
+		std::unique_ptr<CPU> owned; // nullptr for contexts added with add()
+		bool finished;
+	};
+
+	// id of the context is its index in tasks_
+	std::deque<Task> tasks_;
+	std::deque<int> ready_;
+
+	// number of contexts executed by workers right now
+	unsigned running_;
+
+	unsigned long long slice_;
+	unsigned workers_;
+
+	std::mutex mutex_;
+	std::condition_variable wakeup_;
+
+	int push_task(CPU* cpu, std::unique_ptr<CPU> owned);
+	void work();
+public:
+	Scheduler(unsigned long long slice = DEFAULT_SLICE, unsigned workers = 1);
+	~Scheduler() = default;
+
+	Scheduler(const Scheduler& other) = delete;
+	Scheduler& operator= (const Scheduler& other) = delete;
+
+	// Add an existing context, scheduler does not own it
+	int add(CPU& cpu);
+
+	// Create a context running the program of parent from entry with argument on its stack
+	int spawn(CPU& parent, int entry, int argument);
+
+	// Check if the context reached END
+	bool finished(int id);
+
+	// Run until every context reaches END
+	void run();
+
+	// Total number of instructions executed by all contexts
+	unsigned long long executed();
+};
+
+#endif //HEADER_GUARD_SCHEDULER_HPP_INCLUDED
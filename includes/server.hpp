@@ -0,0 +1,88 @@
+#ifndef HEADER_GUARD_SERVER_HPP_INCLUDED
+#define HEADER_GUARD_SERVER_HPP_INCLUDED
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <sys/types.h>
+
+#include "cpu.hpp"
+
+// Daemon keeping decoded programs in memory and running them on request,
+// so a request does not pay for process start, opening and decoding byte code.
+//
+// Requests come over a Unix domain socket, one request per connection:
+//      run <budget> <deadline> <path>       budget in instructions, deadline in milliseconds, 0 for no limit
+//      <input of the program>               read by IN, the client closes its side after it
+// The server streams the output of OUT back, after END it sends
+//      #done <number of executed instructions>
+// Without this line the program failed, the error message is the last output.
+//
+// Workers are processes forked from the server and accepting on the same socket:
+// errors of programs exit the process, the server starts a new worker instead
+namespace server_ns {
+	const unsigned DEFAULT_WORKERS = 4;
+
+	// Last line of the response of a finished program
+	const char* const DONE_MARKER = "#done";
+
+	struct Request {
+		std::string program;            // .bcode, .lng or .lnx, relative to the client
+		unsigned long long budget = 0;  // instructions, 0 for no limit
+		long long deadline = 0;         // milliseconds, 0 for no limit
+	};
+
+	class Server {
+	private:
+		struct LoadedProgram {
+			std::shared_ptr<Program> program;
+			std::filesystem::file_time_type modified;
+		};
+
+		std::string socket_path_;
+		unsigned workers_;
+		int listener_;
+		bool memoize_;
+
+		// decoded programs by path, reloaded when the file changes.
+		// Workers inherit programs loaded before they start
+		std::map<std::string, LoadedProgram> programs_;
+		std::vector<pid_t> pids_;
+
+		// Source is compiled through the byte code cache
+		std::shared_ptr<Program> load(const std::string& requested);
+
+		pid_t start_worker();
+		[[noreturn]] void work();
+		void handle(int client);
+	public:
+		// Listen on the socket, a stale socket file is replaced.
+		// Fails if another server accepts connections on it
+		Server(const std::string& socket_path, unsigned workers = DEFAULT_WORKERS);
+		~Server();
+
+		Server(const Server& other) = delete;
+		Server& operator= (const Server& other) = delete;
+
+		// Memoize pure routines of programs loaded from now on, every worker keeps
+		// its own results between requests
+		void enable_memoization();
+
+		// Decode the program before workers start, so every worker has it warm
+		void preload(const std::string& path);
+
+		// Run workers until SIGINT or SIGTERM, then stop them and remove the socket
+		void serve();
+	};
+
+	// Send the request with the input and write the output of the program,
+	// the input is sent on another thread while the output comes.
+	// Return true if the program reached END, executed is set to the number of its instructions
+	bool submit(const std::string& socket_path, const Request& request, std::istream& input, std::ostream& output,
+	            unsigned long long* executed = nullptr);
+}
+
+#endif //HEADER_GUARD_SERVER_HPP_INCLUDED
@@ -0,0 +1,34 @@
+#ifndef HEADER_GUARD_SIMD_HPP_INCLUDED
+#define HEADER_GUARD_SIMD_HPP_INCLUDED
+
+namespace simd_ns {
+	// Element-wise kernel: dst[i] = a[i] op b[i], i in [0, n)
+	// dst may be equal to a or b, but must not partially overlap them
+	typedef void (*BinaryKernel)(int* dst, const int* a, const int* b, unsigned n);
+
+	// Horizontal kernel: returns a[0] + ... + a[n - 1]
+	typedef int (*ReduceKernel)(const int* a, unsigned n);
+
+	// Set of kernels implemented for one instruction set.
+	// Arithmetic wraps around like two's complement 32-bit integers,
+	// compare kernels write -1 (all bits set) for true and 0 for false
+	struct Kernels {
+		const char* name;
+
+		BinaryKernel add;
+		BinaryKernel sub;
+		BinaryKernel mul;
+		BinaryKernel cmpeq;
+		BinaryKernel cmpgt;
+		ReduceKernel sum;
+	};
+
+	// Kernels for the best instruction set of this machine (AVX2, SSE4.1 or scalar),
+	// chosen once by CPUID on the first call
+	const Kernels& kernels();
+
+	// Portable implementation, always available
+	const Kernels& scalar_kernels();
+}
+
+#endif //HEADER_GUARD_SIMD_HPP_INCLUDED
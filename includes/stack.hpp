@@ -2,6 +2,7 @@
 #define HEADER_GUARD_STACK_HPP_INCLUDED
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <cstdlib>
 #include <utils.hpp>
@@ -17,6 +18,7 @@ namespace stack_ns {
 		bool ok() const;
 		void augment();
 		void diminish();
+		void replace_array(T* buffer);
 
 	public:
 		//////////////////////
@@ -40,6 +42,13 @@ namespace stack_ns {
 		unsigned size();
 		unsigned capacity();
 
+		// Elements from the bottom without the checks of size(),
+		// for readers that interrupt the owner (e.g. a signal handler sampling the stack).
+		// The array stays valid during reallocation, but the size may be read
+		// before or after the interrupted push or pop, so the top element may be stale
+		const T* data() const { return array; }
+		unsigned unchecked_size() const { return Length; }
+
 		/////////////
 		// Methods //
 		/////////////
@@ -56,6 +65,17 @@ namespace stack_ns {
 	///////////////////////
 	// Memory management //
 	///////////////////////
+	// The filled buffer is published before the old one is freed, so a signal handler
+	// interrupting the owner (see data()) reads either of them, never freed memory
+	template <typename T>
+	void Stack<T>::replace_array(T* buffer) {
+		T* old = array;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		array = buffer;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		delete[] old;
+	}
+
 	template <typename T>
 	void Stack<T>::augment() {
 		VERIFY_CONTRACT(this->ok(), "ERROR: cannot allocate memory for invalid stack");
@@ -72,9 +92,7 @@ namespace stack_ns {
 		for (unsigned i = 0; i < Length; i++) {
 			buffer[i] = std::move(array[i]);
 		}
-		delete[] array;
-		array = buffer;
-		buffer = nullptr;
+		replace_array(buffer);
 	}
 
 	template <typename T>
@@ -93,9 +111,7 @@ namespace stack_ns {
 		for (unsigned i = 0; i < Length; i++) {
 			buffer[i] = std::move(array[i]);
 		}
-		delete[] array;
-		array = buffer;
-		buffer = nullptr;
+		replace_array(buffer);
 	}
 
 	//////////////////////
@@ -165,7 +181,7 @@ namespace stack_ns {
 		VERIFY_CONTRACT(s.ok(), "ERROR: right operand of copy assignment is invalid");
 
 		// Handle self-assignment
-		if (*this == s) return *this;
+		if (this == &s) return *this;
 
 		// Delete previous data
 		delete[] array;
@@ -189,13 +205,13 @@ namespace stack_ns {
 		VERIFY_CONTRACT(s.ok(), "ERROR: right operand of move assignment is invalid");
 
 		// Handle self-assignment
-		if (*this == s) return *this;
+		if (this == &s) return *this;
 
 		// Delete previous data
 		delete[] array;
 
 		// Move
-		array = s,array;
+		array = s.array;
 		Length = s.Length;
 		Capacity = s.Capacity;
 
@@ -2,9 +2,13 @@
 #define HEADER_GUARD_TEST_SYSTEM_HPP_INCLUDED
 
 #include <iostream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <chrono>
 
 namespace TestSystem {
-	typedef bool (*TestScenario)();
+	typedef std::function<bool()> TestScenario;
 
     enum TestResult
     {
@@ -15,6 +19,47 @@ namespace TestSystem {
         TIMEOUT   = 4
     };
 
+    // Test time limit if not specified. It has room for a loaded machine
+    // and for tests running in parallel, heavier tests set their own limit
+    constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{1000};
+
+    struct TestReport {
+        std::string name;
+        TestResult result;
+        std::chrono::microseconds duration;
+        std::string output; // everything the test printed to stdout
+    };
+
+    // Runs every test in a forked child process, at most 'jobs' children at once.
+    // Children are awaited with poll() on their pidfd-s, so the scheduler sleeps
+    // until some test finishes or the nearest timeout expires.
+    // Standard output of the child is captured and shown in the summary
+    class TestScheduler {
+    private:
+        struct Test {
+            std::string name;
+            TestScenario scenario;
+            std::chrono::milliseconds timeout;
+        };
+
+        std::vector<Test> tests_;
+        std::vector<TestReport> reports_;
+        std::chrono::microseconds elapsed_;
+    public:
+        TestScheduler();
+
+        void add(const std::string& name, TestScenario test, std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+
+        // Run all registered tests, returns the number of tests that did not pass
+        unsigned run(unsigned jobs);
+
+        // Reports in the order of registration, available after run()
+        const std::vector<TestReport>& reports() const;
+
+        // Print the table of results and durations
+        void print_summary() const;
+    };
+
     TestResult run_test(const char* name, TestScenario test);
 }
 
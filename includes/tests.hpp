@@ -25,5 +25,30 @@ bool test_move_push();
 bool test_emplace();
 bool test_pop();
 bool test_top();
+bool test_simd_kernels();
+bool test_vector_commands();
+bool test_mpmc_channel();
+bool test_spsc_channel();
+bool test_trace_buffer();
+bool test_record_replay();
+bool test_debugger();
+bool test_source_map();
+bool test_analysis();
+bool test_bytecode_cache();
+bool test_preprocessor();
+bool test_compiler();
+bool test_inliner();
+bool test_linker();
+bool test_server();
+bool test_profiler();
+bool test_pgo();
+bool test_hot_traces();
+bool test_memoization();
+bool test_big_integers();
+bool test_guarded_stack();
+bool test_run_for();
+bool test_memory_commands();
+bool test_scheduler();
+bool test_pipeline();
 
 #endif //HEADER_GUARD_TESTS_HPP_INCLUDED
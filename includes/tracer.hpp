@@ -0,0 +1,121 @@
+#ifndef HEADER_GUARD_TRACER_HPP_INCLUDED
+#define HEADER_GUARD_TRACER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "stack.hpp"
+#include "cpu.hpp"
+
+// Tracing is compiled only with -DVM_TRACE (make VM_TRACE=1),
+// otherwise TRACE_INSTRUCTION expands to nothing and engines run without any checks
+#ifdef VM_TRACE
+#define TRACE_INSTRUCTION(pc, opcode) \
+	if (trace) trace->record((pc), (opcode), stack, registers);
+#else
+#define TRACE_INSTRUCTION(pc, opcode)
+#endif
+
+// Record the last of count instructions run by the command at pc. A superinstruction
+// records the instructions before its last one itself, so every instruction has a record
+#define TRACE_DISPATCH(pc, count) \
+	TRACE_INSTRUCTION((pc) + (int)(count) - 1, program->code[(pc) + (int)(count) - 1].id)
+
+namespace trace_ns {
+	// Number of records kept by default (1 MiB of records)
+	const unsigned DEFAULT_TRACE_CAPACITY = 1 << 16;
+
+	const uint8_t NO_REGISTER = 0xFF;
+
+	const uint8_t RECORD_HAS_TOP = 1;        // stack was not empty after the instruction
+	const uint8_t RECORD_MORE_REGISTERS = 2; // registers other than register_id changed too
+
+	// State after one executed instruction
+	struct TraceRecord {
+		int32_t pc;              // index of the instruction
+		int32_t top;             // top of the stack if RECORD_HAS_TOP is set
+		int32_t register_value;  // new value of the changed register
+		uint8_t opcode;
+		uint8_t register_id;     // register changed by the instruction or NO_REGISTER
+		uint8_t flags;
+		uint8_t reserved;
+	};
+	static_assert(sizeof(TraceRecord) == 16, "trace records are written to files as is");
+
+	// Ring of the last records of one context. The context writes without locks,
+	// other threads may take a snapshot at any time
+	class TraceBuffer {
+	private:
+		std::unique_ptr<TraceRecord[]> records_;
+		uint64_t mask_;
+		std::atomic<uint64_t> written_; // total number of records ever written
+
+		int registers_[REGS]; // registers after the previous record
+	public:
+		// Capacity is rounded up to a power of two
+		explicit TraceBuffer(unsigned capacity = DEFAULT_TRACE_CAPACITY);
+
+		TraceBuffer(const TraceBuffer& other) = delete;
+		TraceBuffer& operator= (const TraceBuffer& other) = delete;
+
+		uint64_t capacity() const;
+		uint64_t written() const;
+
+		// Called by the engine after every instruction. Only one thread may record
+		void record(int pc, int opcode, VMStack& stack, const int* registers) {
+			uint64_t index = written_.load(std::memory_order_relaxed);
+			TraceRecord& entry = records_[index & mask_];
+
+			entry.pc = pc;
+			entry.opcode = static_cast<uint8_t>(opcode);
+			entry.flags = 0;
+			entry.top = 0;
+			if (stack.size() > 0) {
+				entry.flags |= RECORD_HAS_TOP;
+				entry.top = stack.top();
+			}
+
+			// POPR changes one register, a memoized CALL may set several of them:
+			// the record keeps the last one and flags the others
+			entry.register_id = NO_REGISTER;
+			entry.register_value = 0;
+			for (int i = 0; i < REGS; ++i) {
+				if (registers[i] != registers_[i]) {
+					registers_[i] = registers[i];
+					if (entry.register_id != NO_REGISTER) entry.flags |= RECORD_MORE_REGISTERS;
+					entry.register_id = static_cast<uint8_t>(i);
+					entry.register_value = registers[i];
+				}
+			}
+
+			written_.store(index + 1, std::memory_order_release);
+		}
+
+		// Copy the records that are still in the ring, the oldest first.
+		// Records overwritten while copying are dropped. The snapshot is exact
+		// when the context is stopped, e.g. after run() or at exit
+		std::vector<TraceRecord> snapshot() const;
+
+		// Write the snapshot in binary format
+		void save(std::ostream& out) const;
+		void save(const std::string& filename) const;
+	};
+
+	// Records read from a trace file
+	struct TraceFile {
+		uint64_t written; // records written in total, the file has only the last of them
+		std::vector<TraceRecord> records;
+	};
+
+	TraceFile load(std::istream& in);
+	TraceFile load(const std::string& filename);
+
+	// Save the buffer to the file when the process exits, including exit(1) on a runtime error
+	void save_at_exit(std::shared_ptr<TraceBuffer> buffer, const std::string& filename);
+}
+
+#endif //HEADER_GUARD_TRACER_HPP_INCLUDED
@@ -3,17 +3,32 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <string>
+#include <cerrno>
+#include <limits>
+
+// Set on the thread while it runs a program to print where an error happened,
+// e.g. the source line of the running instruction
+inline thread_local void (*error_context_hook)() = nullptr;
 
 #define VERIFY_CONTRACT(contract, message) \
 if (!(contract)) { \
 	std::cout << SET_COLOR_RED << message << RESET_COLOR << '\n'; \
+	if (error_context_hook) error_context_hook(); \
 	exit(1); \
 }
 
 #define TERMINATE(message) \
 	std::cout << SET_COLOR_RED << message << RESET_COLOR << '\n'; \
+	if (error_context_hook) error_context_hook(); \
 	exit(1);
 
+// Check if the file name is longer than the extension and ends with it, e.g. ".bcode"
+inline bool has_extension(const std::string& filename, const std::string& extension) {
+	return filename.size() > extension.size()
+		&& filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
 #define SET_COLOR_RED 		"\033[1;31m"
 #define SET_COLOR_GREEN 	"\033[1;32m"
 #define SET_COLOR_YELLOW 	"\033[1;33m"
@@ -21,4 +36,16 @@ if (!(contract)) { \
 #define SET_COLOR_CYAN 		"\033[1;36m"
 #define RESET_COLOR 		"\033[0m"
 
+// Value of a command-line option: the whole text must be a decimal integer in [min, max]
+inline long long parse_number(const std::string& text, const std::string& option,
+                              long long min = 0, long long max = std::numeric_limits<long long>::max()) {
+	char* end = nullptr;
+	errno = 0;
+	long long value = std::strtoll(text.c_str(), &end, 10);
+	bool digits = !text.empty() && text.find_first_not_of("-0123456789") == std::string::npos;
+	VERIFY_CONTRACT(digits && *end == '\0' && errno == 0 && value >= min && value <= max,
+		"ERROR: invalid value " << text << " of " << option << ", expected an integer from " << min << " to " << max);
+	return value;
+}
+
 #endif //HEADER_GUARD_UTILS_HPP_INCLUDED
@@ -0,0 +1,456 @@
+#include "analysis.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <set>
+
+using namespace analysis_ns;
+
+const int SPAWN_ID  = 28;
+const int PUSH_ID   = 30;
+const int VLOAD_ID  = 50;
+const int VSTORE_ID = 51;
+
+////////////////////
+// COMMAND EFFECT //
+////////////////////
+
+int analysis_ns::stack_effect(int id) {
+	switch (id) {
+		// BEGIN, RET, END, CALL, JMP, SPAWN (pops a value, pushes an id), LOAD from stack, YIELD, BIG
+		case 10: case 18: case 19: case 20: case 21: case 28: case 62: case 70: case 80:
+			return 0;
+
+		// IN, PUSH, RECV, PUSHR, LOAD absolute and by register
+		case 17: case 30: case 32: case 41: case 60: case 61:
+			return 1;
+
+		// POP, ADD, SUB, MUL, DIV, OUT, SEND, POPR, VSUM, STORE absolute and by register, JOIN
+		case 11: case 12: case 13: case 14: case 15: case 16: case 31: case 40: case 57: case 63: case 64: case 71:
+			return -1;
+
+		// BADD, BSUB, BMUL, BCMP, BOUT
+		case 81: case 82: case 83: case 84: case 85:
+			return -1;
+
+		// conditional jumps, STORE to address from stack
+		case 22: case 23: case 24: case 25: case 26: case 27: case 65:
+			return -2;
+
+		// VADD, VSUB, VMUL, VCMPEQ, VCMPGT
+		case 52: case 53: case 54: case 55: case 56:
+			return -4;
+
+		// VLOAD and VSTORE move n values, unknown commands
+		default:
+			return UNKNOWN_EFFECT;
+	}
+}
+
+bool analysis_ns::is_branch(int id) {
+	return id == JMP_ID || is_conditional(id);
+}
+
+bool analysis_ns::is_conditional(int id) {
+	return id >= 22 && id <= 27;
+}
+
+int analysis_ns::inverse_condition(int id) {
+	switch (id) {
+		case 22: return 23; // JEQ <-> JNE
+		case 23: return 22;
+		case 24: return 27; // JA <-> JBE
+		case 27: return 24;
+		case 25: return 26; // JAE <-> JB
+		case 26: return 25;
+	}
+	TERMINATE("ERROR: command " << id << " is not a conditional jump");
+}
+
+bool analysis_ns::has_target(int id) {
+	return id / 10 == 2;
+}
+
+bool analysis_ns::ends_block(int id) {
+	return is_branch(id) || id == CALL_ID || id == RET_ID || id == END_ID;
+}
+
+//////////////////
+// BASIC BLOCKS //
+//////////////////
+
+static void find_blocks(const Program& program, Analysis& analysis) {
+	const std::vector<Instruction>& code = program.code;
+	int size = static_cast<int>(code.size());
+
+	std::set<int> leaders{static_cast<int>(program.begin)};
+	for (int pc = 0; pc < size; ++pc) {
+		int id = code[pc].id;
+		if (has_target(id) && code[pc].argument >= 0 && code[pc].argument < size) leaders.insert(code[pc].argument);
+		if (ends_block(id) && pc + 1 < size) leaders.insert(pc + 1);
+	}
+	leaders.insert(0);
+
+	analysis.block_of.assign(size, 0);
+	for (auto leader = leaders.begin(); leader != leaders.end() && *leader < size; ++leader) {
+		auto next = std::next(leader);
+		int end = (next != leaders.end() && *next < size) ? *next : size;
+
+		for (int pc = *leader; pc < end; ++pc) {
+			analysis.block_of[pc] = static_cast<int>(analysis.blocks.size());
+		}
+		analysis.blocks.push_back(BasicBlock{*leader, end, {}});
+	}
+
+	for (BasicBlock& block : analysis.blocks) {
+		const Instruction& last = code[block.end - 1];
+		bool has_next = block.end < size;
+
+		if (is_branch(last.id) && last.argument >= 0 && last.argument < size) {
+			block.successors.push_back(analysis.block_of[last.argument]);
+		}
+		if (has_next && (!ends_block(last.id) || is_conditional(last.id) || last.id == CALL_ID)) {
+			block.successors.push_back(analysis.block_of[block.end]);
+		}
+
+		for (int pc = block.begin; pc + 1 < block.end; ++pc) {
+			++analysis.opcode_pairs[{code[pc].id, code[pc + 1].id}];
+		}
+	}
+}
+
+/////////////////
+// STACK DEPTH //
+/////////////////
+
+// Depth of the instruction reached by two paths
+static int merge_depth(int old_depth, int new_depth) {
+	if (old_depth == NO_DEPTH || old_depth == new_depth) return new_depth;
+	if (new_depth == NO_DEPTH) return old_depth;
+	if (old_depth == MIXED_DEPTH || new_depth == MIXED_DEPTH) return MIXED_DEPTH;
+	if (old_depth == UNKNOWN_DEPTH || new_depth == UNKNOWN_DEPTH) return UNKNOWN_DEPTH;
+	return MIXED_DEPTH;
+}
+
+static bool is_known(int depth) {
+	return depth > MIXED_DEPTH;
+}
+
+static int apply_effect(int depth, int effect) {
+	if (!is_known(depth)) return depth;
+	return (effect == UNKNOWN_EFFECT) ? UNKNOWN_DEPTH : depth + effect;
+}
+
+// Length of VLOAD and VSTORE is known when it is pushed right before them
+static int instruction_effect(const Program& program, const Analysis& analysis, int pc) {
+	const std::vector<Instruction>& code = program.code;
+	int id = code[pc].id;
+	bool pushed_length = pc > 0 && code[pc - 1].id == PUSH_ID && analysis.block_of[pc - 1] == analysis.block_of[pc];
+
+	if (id == VLOAD_ID && pushed_length)  return code[pc - 1].argument - 2;
+	if (id == VSTORE_ID && pushed_length) return -code[pc - 1].argument - 2;
+	return stack_effect(id);
+}
+
+// Depths are propagated along the control flow from the entries of routines.
+// CALL continues after the callee has a known effect, so recursive routines
+// are finished by the path that does not recurse
+static void find_depths(const Program& program, Analysis& analysis) {
+	const std::vector<Instruction>& code = program.code;
+	int size = static_cast<int>(code.size());
+
+	analysis.depth.assign(size, NO_DEPTH);
+	analysis.routine.assign(size, -1);
+
+	std::map<int, int> entry_depth{{static_cast<int>(program.begin), 0}};
+	std::multimap<int, int> calls; // callee to CALL instructions
+	for (int pc = 0; pc < size; ++pc) {
+		int target = code[pc].argument;
+		if (target < 0 || target >= size) continue;
+
+		if (code[pc].id == CALL_ID) {
+			entry_depth.emplace(target, 0);
+			calls.emplace(target, pc);
+		}
+		// spawned context starts with the value on its stack
+		else if (code[pc].id == SPAWN_ID) {
+			entry_depth.emplace(target, 1);
+		}
+	}
+
+	std::vector<int> work;
+	auto reach = [&](int pc, int depth, int routine) {
+		if (pc >= size) return;
+		int merged = merge_depth(analysis.depth[pc], depth);
+		if (analysis.routine[pc] < 0) analysis.routine[pc] = routine;
+		if (merged == analysis.depth[pc]) return;
+		analysis.depth[pc] = merged;
+		work.push_back(pc);
+	};
+	auto resume_after_call = [&](int call) {
+		auto effect = analysis.returns.find(code[call].argument);
+		if (analysis.depth[call] == NO_DEPTH || effect == analysis.returns.end()) return;
+
+		int depth = analysis.depth[call];
+		int after = (is_known(depth) && !is_known(effect->second)) ? effect->second : apply_effect(depth, effect->second);
+		reach(call + 1, after, analysis.routine[call]);
+	};
+
+	for (const auto& [entry, depth] : entry_depth) {
+		reach(entry, depth, entry);
+	}
+
+	while (!work.empty()) {
+		int pc = work.back();
+		work.pop_back();
+
+		const Instruction& instruction = code[pc];
+		int routine = analysis.routine[pc];
+		int after = apply_effect(analysis.depth[pc], instruction_effect(program, analysis, pc));
+
+		if (instruction.id == END_ID) continue;
+		if (instruction.id == RET_ID) {
+			int effect = apply_effect(after, -entry_depth[routine]);
+			auto known = analysis.returns.find(routine);
+			int merged = merge_depth((known != analysis.returns.end()) ? known->second : NO_DEPTH, effect);
+			if (known != analysis.returns.end() && known->second == merged) continue;
+
+			analysis.returns[routine] = merged;
+			auto [first, last] = calls.equal_range(routine);
+			for (auto call = first; call != last; ++call) {
+				resume_after_call(call->second);
+			}
+			continue;
+		}
+		if (instruction.id == CALL_ID) {
+			resume_after_call(pc);
+			continue;
+		}
+
+		if (is_branch(instruction.id) && instruction.argument >= 0 && instruction.argument < size) {
+			reach(instruction.argument, after, routine);
+		}
+		if (instruction.id != JMP_ID) {
+			reach(pc + 1, after, routine);
+		}
+	}
+}
+
+//////////////
+// ANALYSIS //
+//////////////
+
+Analysis analysis_ns::analyze(const Program& program) {
+	Analysis analysis;
+	for (const Instruction& instruction : program.code) {
+		++analysis.opcodes[instruction.id];
+	}
+	if (program.code.empty()) return analysis;
+
+	find_blocks(program, analysis);
+	find_depths(program, analysis);
+	return analysis;
+}
+
+////////////
+// PURITY //
+////////////
+
+// Commands of pure routines besides jumps, CALL and RET
+static bool is_pure_command(int id) {
+	switch (id) {
+		case 11: case 12: case 13: case 14: case 15: // POP, ADD, SUB, MUL, DIV
+		case 30: case 40: case 41:                   // PUSH, POPR, PUSHR
+			return true;
+	}
+	return false;
+}
+
+// Number of values the command reads from the top of the stack
+static int popped_values(int id) {
+	if (is_conditional(id)) return 2;
+	switch (id) {
+		case 11: case 40:                   return 1; // POP, POPR
+		case 12: case 13: case 14: case 15: return 2; // ADD, SUB, MUL, DIV
+	}
+	return 0;
+}
+
+// Registers are bit masks of their id-s
+struct RoutineSummary {
+	int lowest = 0;              // the lowest stack value read, relative to the entry
+	int returned = NO_DEPTH;     // depth at RET
+	unsigned inputs = 0;
+	unsigned written = 0;
+	unsigned always_written = 0; // on every path to RET
+
+	bool operator== (const RoutineSummary& other) const = default;
+};
+
+// Walk the routine from its entry with the summaries of the callees known so far.
+// Paths through calls of routines without a summary are cut, false if the routine is not pure
+static bool summarize(const Program& program, int entry, const std::map<int, RoutineSummary>& known,
+                      RoutineSummary& summary, std::set<int>& callees, bool& cut) {
+	const std::vector<Instruction>& code = program.code;
+	int size = static_cast<int>(code.size());
+
+	std::vector<int> depth(size, NO_DEPTH);
+	std::vector<unsigned> defined(size, 0);
+	std::vector<int> work;
+	bool pure = true;
+	unsigned returned_defined = ~0U;
+
+	summary = RoutineSummary();
+	callees.clear();
+	cut = false;
+
+	auto reach = [&](int pc, int new_depth, unsigned new_defined) {
+		if (pc < 0 || pc >= size) {
+			pure = false;
+			return;
+		}
+		if (depth[pc] == NO_DEPTH) {
+			depth[pc] = new_depth;
+			defined[pc] = new_defined;
+			work.push_back(pc);
+		}
+		else if (depth[pc] != new_depth) {
+			pure = false;
+		}
+		else if ((defined[pc] & new_defined) != defined[pc]) {
+			defined[pc] &= new_defined;
+			work.push_back(pc);
+		}
+	};
+
+	reach(entry, 0, 0);
+	while (pure && !work.empty()) {
+		int pc = work.back();
+		work.pop_back();
+
+		const Instruction& instruction = code[pc];
+		int id = instruction.id;
+		int current = depth[pc];
+		unsigned registers = defined[pc];
+		summary.lowest = std::min(summary.lowest, current - popped_values(id));
+
+		if (id == RET_ID) {
+			if (summary.returned != NO_DEPTH && summary.returned != current) pure = false;
+			summary.returned = current;
+			returned_defined &= registers;
+		}
+		else if (id == CALL_ID) {
+			callees.insert(instruction.argument);
+			auto callee = known.find(instruction.argument);
+			if (callee == known.end()) {
+				cut = true;
+				continue;
+			}
+			const RoutineSummary& called = callee->second;
+			summary.lowest = std::min(summary.lowest, current + called.lowest);
+			summary.inputs |= called.inputs & ~registers;
+			summary.written |= called.written;
+			reach(pc + 1, current + called.returned, registers | called.always_written);
+		}
+		else if (id == JMP_ID) {
+			reach(instruction.argument, current, registers);
+		}
+		else if (is_conditional(id)) {
+			reach(instruction.argument, current - 2, registers);
+			reach(pc + 1, current - 2, registers);
+		}
+		else if (id == 41) { // PUSHR
+			unsigned bit = 1U << instruction.argument;
+			if ((registers & bit) == 0) summary.inputs |= bit;
+			reach(pc + 1, current + 1, registers);
+		}
+		else if (id == 40) { // POPR
+			unsigned bit = 1U << instruction.argument;
+			summary.written |= bit;
+			reach(pc + 1, current - 1, registers | bit);
+		}
+		else if (is_pure_command(id)) {
+			reach(pc + 1, current + stack_effect(id), registers);
+		}
+		else {
+			pure = false;
+		}
+	}
+
+	// registers not written on some path keep the values of the caller
+	summary.always_written = (summary.returned == NO_DEPTH) ? 0 : returned_defined & summary.written;
+	summary.inputs |= summary.written & ~summary.always_written;
+	return pure && summary.returned - summary.lowest >= 0;
+}
+
+static std::vector<int> register_list(unsigned mask) {
+	std::vector<int> registers;
+	for (int reg = 0; reg < REGS; ++reg) {
+		if (mask & (1U << reg)) registers.push_back(reg);
+	}
+	return registers;
+}
+
+// Summaries are refined in rounds until they do not change: recursive routines
+// are first summarized by the paths that do not recurse
+std::map<int, PureRoutine> analysis_ns::find_pure_routines(const Program& program) {
+	int size = static_cast<int>(program.code.size());
+	std::set<int> entries;
+	for (const Instruction& instruction : program.code) {
+		if (instruction.id == CALL_ID && instruction.argument >= 0 && instruction.argument < size) {
+			entries.insert(instruction.argument);
+		}
+	}
+
+	std::map<int, RoutineSummary> known;
+	std::map<int, std::set<int>> callees;
+	std::map<int, bool> complete;
+	bool changed = true;
+	for (size_t round = 0; changed && round < 2 * entries.size() + 4; ++round) {
+		changed = false;
+		for (int entry : entries) {
+			RoutineSummary summary;
+			bool cut = false;
+			bool pure = summarize(program, entry, known, summary, callees[entry], cut);
+			complete[entry] = !cut;
+
+			auto previous = known.find(entry);
+			if (!pure || summary.returned == NO_DEPTH) {
+				if (previous != known.end()) {
+					known.erase(previous);
+					changed = true;
+				}
+				continue;
+			}
+			if (previous == known.end() || !(previous->second == summary)) {
+				known[entry] = summary;
+				changed = true;
+			}
+		}
+	}
+
+	std::map<int, PureRoutine> pure;
+	if (changed) return pure;
+
+	// a summary made with the summary of an impure callee is not valid
+	for (bool removed = true; removed;) {
+		removed = false;
+		for (auto routine = known.begin(); routine != known.end();) {
+			bool valid = complete[routine->first];
+			for (int callee : callees[routine->first]) valid = valid && known.contains(callee);
+			if (valid) {
+				++routine;
+				continue;
+			}
+			routine = known.erase(routine);
+			removed = true;
+		}
+	}
+
+	for (const auto& [entry, summary] : known) {
+		int arguments = -summary.lowest;
+		pure[entry] = PureRoutine{arguments, arguments + summary.returned,
+			register_list(summary.inputs), register_list(summary.written)};
+	}
+	return pure;
+}
@@ -0,0 +1,403 @@
+#include "bigint.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <sstream>
+
+using namespace bigint_ns;
+
+typedef uint64_t DoubleLimb;
+
+//////////////////////////
+// KERNELS OF MAGNITUDE //
+//////////////////////////
+
+// out[0, na) = a + b, na >= nb. Return the carry
+static Limb add_limbs(Limb* out, const Limb* a, size_t na, const Limb* b, size_t nb) {
+	DoubleLimb carry = 0;
+	for (size_t i = 0; i < na; ++i) {
+		carry += static_cast<DoubleLimb>(a[i]) + (i < nb ? b[i] : 0);
+		out[i] = static_cast<Limb>(carry);
+		carry >>= 32;
+	}
+	return static_cast<Limb>(carry);
+}
+
+// out[0, na) = a - b, a >= b
+static void subtract_limbs(Limb* out, const Limb* a, size_t na, const Limb* b, size_t nb) {
+	Limb borrow = 0;
+	for (size_t i = 0; i < na; ++i) {
+		DoubleLimb subtrahend = static_cast<DoubleLimb>(i < nb ? b[i] : 0) + borrow;
+		borrow = static_cast<DoubleLimb>(a[i]) < subtrahend;
+		out[i] = static_cast<Limb>(a[i] - subtrahend);
+	}
+}
+
+// out[0, n) += b, the sum fits into n limbs
+static void add_in_place(Limb* out, size_t n, const Limb* b, size_t nb) {
+	DoubleLimb carry = 0;
+	for (size_t i = 0; i < n && (i < nb || carry != 0); ++i) {
+		carry += static_cast<DoubleLimb>(out[i]) + (i < nb ? b[i] : 0);
+		out[i] = static_cast<Limb>(carry);
+		carry >>= 32;
+	}
+}
+
+// out[0, n) -= b, out >= b
+static void subtract_in_place(Limb* out, size_t n, const Limb* b, size_t nb) {
+	Limb borrow = 0;
+	for (size_t i = 0; i < n && (i < nb || borrow != 0); ++i) {
+		DoubleLimb subtrahend = static_cast<DoubleLimb>(i < nb ? b[i] : 0) + borrow;
+		borrow = static_cast<DoubleLimb>(out[i]) < subtrahend;
+		out[i] = static_cast<Limb>(out[i] - subtrahend);
+	}
+}
+
+// out[0, na + nb) = a * b, out is zero
+static void schoolbook(Limb* out, const Limb* a, size_t na, const Limb* b, size_t nb) {
+	for (size_t i = 0; i < na; ++i) {
+		DoubleLimb carry = 0;
+		for (size_t j = 0; j < nb; ++j) {
+			carry += static_cast<DoubleLimb>(a[i]) * b[j] + out[i + j];
+			out[i + j] = static_cast<Limb>(carry);
+			carry >>= 32;
+		}
+		out[i + nb] = static_cast<Limb>(carry);
+	}
+}
+
+// Limbs of scratch enough for multiply_limbs of the sizes
+static size_t scratch_size(size_t na, size_t nb) {
+	return 4 * (na + nb) + 1024;
+}
+
+// out[0, na + nb) = a * b. Temporaries are taken from scratch in stack order,
+// a level uses about na + nb limbs and passes the rest to the next one
+static void multiply_limbs(Limb* out, const Limb* a, size_t na, const Limb* b, size_t nb, Limb* scratch) {
+	if (na < nb) {
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+
+	if (nb < KARATSUBA_THRESHOLD) {
+		std::fill_n(out, na + nb, 0);
+		schoolbook(out, a, na, b, nb);
+		return;
+	}
+
+	// unbalanced: a is multiplied by pieces of the size of b
+	if (2 * nb <= na) {
+		std::fill_n(out, na + nb, 0);
+		Limb* piece = scratch;
+		for (size_t i = 0; i < na; i += nb) {
+			size_t length = std::min(nb, na - i);
+			multiply_limbs(piece, a + i, length, b, nb, scratch + 2 * nb);
+			add_in_place(out + i, na + nb - i, piece, length + nb);
+		}
+		return;
+	}
+
+	// a = a1 * B^h + a0, b = b1 * B^h + b0, then
+	// a * b = z2 * B^2h + (z1 - z2 - z0) * B^h + z0, z1 = (a1 + a0) * (b1 + b0)
+	size_t h = na / 2;
+	size_t na1 = na - h; // >= h
+	size_t nb1 = nb - h; // > 0, as nb > na / 2
+	multiply_limbs(out, a, h, b, h, scratch);                   // z0
+	multiply_limbs(out + 2 * h, a + h, na1, b + h, nb1, scratch); // z2
+
+	Limb* sa = scratch;
+	size_t nsa = na1 + 1;
+	sa[na1] = add_limbs(sa, a + h, na1, a, h);
+
+	Limb* sb = sa + nsa;
+	size_t nsb = std::max(nb1, h) + 1;
+	sb[nsb - 1] = (nb1 >= h) ? add_limbs(sb, b + h, nb1, b, h) : add_limbs(sb, b, h, b + h, nb1);
+
+	Limb* z1 = sb + nsb;
+	size_t nz1 = nsa + nsb;
+	multiply_limbs(z1, sa, nsa, sb, nsb, z1 + nz1);
+	subtract_in_place(z1, nz1, out, 2 * h);
+	subtract_in_place(z1, nz1, out + 2 * h, na + nb - 2 * h);
+
+	while (nz1 > 0 && z1[nz1 - 1] == 0) --nz1;
+	add_in_place(out + h, na + nb - h, z1, nz1);
+}
+
+///////////////
+// BIG ARENA //
+///////////////
+
+// Tags of live arenas. A tag is taken again as late as possible,
+// so handles of a finished context are not taken for handles of a new one
+static std::mutex tags_mutex;
+static std::bitset<MAX_ARENAS> tags_taken;
+static unsigned next_tag = 0;
+
+static unsigned take_tag() {
+	std::lock_guard<std::mutex> lock(tags_mutex);
+	for (unsigned i = 0; i < MAX_ARENAS; ++i) {
+		unsigned tag = (next_tag + i) % MAX_ARENAS;
+		if (tags_taken[tag]) continue;
+		tags_taken[tag] = true;
+		next_tag = tag + 1;
+		return tag;
+	}
+	TERMINATE("ERROR: too many contexts with big integers, the limit is " << MAX_ARENAS);
+}
+
+static void release_tag(unsigned tag) {
+	std::lock_guard<std::mutex> lock(tags_mutex);
+	tags_taken[tag] = false;
+}
+
+BigArena::BigArena() :
+	limbs_(), values_(), free_(), scratch_(), next_collection_(MIN_COLLECT_LIMBS), stats_(), tag_(take_tag()),
+	tag_owner_(nullptr, [tag = tag_](void*) { release_tag(tag); })
+{}
+
+int BigArena::handle(size_t index) const {
+	return static_cast<int>(HANDLE_BASE + (static_cast<long long>(tag_) << INDEX_BITS) + static_cast<long long>(index));
+}
+
+size_t BigArena::index(int handle) const {
+	long long offset = static_cast<long long>(handle) - HANDLE_BASE;
+	VERIFY_CONTRACT(offset < 0 || (offset >> INDEX_BITS) == tag_, "ERROR: big integer " << handle << " belongs to another context");
+
+	size_t index = static_cast<size_t>(offset) & (MAX_VALUES - 1);
+	VERIFY_CONTRACT(offset >= 0 && index < values_.size() && !values_[index].free,
+		"ERROR: " << handle << " is not a big integer of this context");
+	return index;
+}
+
+bool BigArena::contains(int handle) const {
+	long long offset = static_cast<long long>(handle) - HANDLE_BASE;
+	size_t index = static_cast<size_t>(offset) & (MAX_VALUES - 1);
+	return offset >= 0 && (offset >> INDEX_BITS) == tag_ && index < values_.size() && !values_[index].free;
+}
+
+const BigArena::Value& BigArena::value(int handle) const {
+	return values_[index(handle)];
+}
+
+int BigArena::allocate(size_t size, bool negative) {
+	int index;
+	if (free_.empty()) {
+		VERIFY_CONTRACT(values_.size() < MAX_VALUES, "ERROR: too many big integers, the limit is " << MAX_VALUES);
+		index = static_cast<int>(values_.size());
+		values_.push_back(Value{});
+	}
+	else {
+		index = free_.back();
+		free_.pop_back();
+	}
+
+	values_[index] = Value{limbs_.size(), size, negative, false};
+	limbs_.resize(limbs_.size() + size, 0);
+	++stats_.values;
+	return handle(index);
+}
+
+void BigArena::normalize(int handle) {
+	Value& result = values_[index(handle)];
+	while (result.size > 0 && limbs_[result.offset + result.size - 1] == 0) --result.size;
+	if (result.size == 0) result.negative = false;
+
+	// the new value is the last one in the buffer
+	limbs_.resize(result.offset + result.size);
+}
+
+int BigArena::compare_magnitudes(const Value& a, const Value& b) const {
+	if (a.size != b.size) return (a.size < b.size) ? -1 : 1;
+	for (size_t i = a.size; i-- > 0;) {
+		Limb x = limbs_[a.offset + i];
+		Limb y = limbs_[b.offset + i];
+		if (x != y) return (x < y) ? -1 : 1;
+	}
+	return 0;
+}
+
+int BigArena::add_magnitudes(int a, int b, bool negative) {
+	if (value(a).size < value(b).size) std::swap(a, b);
+	size_t na = value(a).size;
+	size_t nb = value(b).size;
+
+	int result = allocate(na + 1, negative);
+	Limb* out = limbs_.data() + values_[index(result)].offset;
+	out[na] = add_limbs(out, limbs_.data() + value(a).offset, na, limbs_.data() + value(b).offset, nb);
+	normalize(result);
+	return result;
+}
+
+int BigArena::subtract_magnitudes(int a, int b, bool negative) {
+	size_t na = value(a).size;
+	size_t nb = value(b).size;
+
+	int result = allocate(na, negative);
+	Limb* out = limbs_.data() + values_[index(result)].offset;
+	subtract_limbs(out, limbs_.data() + value(a).offset, na, limbs_.data() + value(b).offset, nb);
+	normalize(result);
+	return result;
+}
+
+int BigArena::make(long long number) {
+	unsigned long long magnitude = (number < 0) ? 0ULL - static_cast<unsigned long long>(number) : number;
+	int result = allocate(2, number < 0);
+	Limb* out = limbs_.data() + values_[index(result)].offset;
+	out[0] = static_cast<Limb>(magnitude);
+	out[1] = static_cast<Limb>(magnitude >> 32);
+	normalize(result);
+	return result;
+}
+
+int BigArena::add(int a, int b) {
+	bool negative = value(a).negative;
+	if (negative == value(b).negative) return add_magnitudes(a, b, negative);
+
+	// signs differ: the larger magnitude gives the sign
+	if (compare_magnitudes(value(a), value(b)) >= 0) return subtract_magnitudes(a, b, negative);
+	return subtract_magnitudes(b, a, !negative);
+}
+
+int BigArena::subtract(int a, int b) {
+	bool negative = value(a).negative;
+	if (negative != value(b).negative) return add_magnitudes(a, b, negative);
+
+	if (compare_magnitudes(value(a), value(b)) >= 0) return subtract_magnitudes(a, b, negative);
+	return subtract_magnitudes(b, a, !negative);
+}
+
+int BigArena::multiply(int a, int b) {
+	size_t na = value(a).size;
+	size_t nb = value(b).size;
+	bool negative = value(a).negative != value(b).negative;
+
+	int result = allocate(na + nb, negative);
+	if (na == 0 || nb == 0) {
+		normalize(result);
+		return result;
+	}
+
+	if (scratch_.size() < scratch_size(na, nb)) scratch_.resize(scratch_size(na, nb));
+	const Limb* limbs = limbs_.data();
+	multiply_limbs(limbs_.data() + values_[index(result)].offset,
+	               limbs + value(a).offset, na, limbs + value(b).offset, nb, scratch_.data());
+	normalize(result);
+	return result;
+}
+
+int BigArena::compare(int a, int b) const {
+	const Value& x = value(a);
+	const Value& y = value(b);
+	if (x.negative != y.negative) return x.negative ? -1 : 1;
+	int magnitude = compare_magnitudes(x, y);
+	return x.negative ? -magnitude : magnitude;
+}
+
+void BigArena::write(std::ostream& out, int handle) const {
+	const Value& number = value(handle);
+	if (number.size == 0) {
+		out << '0';
+		return;
+	}
+
+	// chunks of nine digits, the least significant first: one division of
+	// the whole magnitude by 10^9 gives nine digits
+	const Limb CHUNK = 1000000000;
+	std::vector<Limb> magnitude(limbs_.begin() + number.offset, limbs_.begin() + number.offset + number.size);
+	std::vector<Limb> chunks;
+	chunks.reserve(magnitude.size() * 32 / 29 + 1);
+
+	size_t size = magnitude.size();
+	while (size > 0) {
+		DoubleLimb remainder = 0;
+		for (size_t i = size; i-- > 0;) {
+			DoubleLimb current = (remainder << 32) | magnitude[i];
+			magnitude[i] = static_cast<Limb>(current / CHUNK);
+			remainder = current % CHUNK;
+		}
+		chunks.push_back(static_cast<Limb>(remainder));
+		while (size > 0 && magnitude[size - 1] == 0) --size;
+	}
+
+	std::string digits;
+	digits.reserve(chunks.size() * 9 + 1);
+	if (number.negative) digits += '-';
+	digits += std::to_string(chunks.back());
+	for (size_t i = chunks.size() - 1; i-- > 0;) {
+		char chunk[10];
+		Limb rest = chunks[i];
+		for (int digit = 8; digit >= 0; --digit) {
+			chunk[digit] = static_cast<char>('0' + rest % 10);
+			rest /= 10;
+		}
+		digits.append(chunk, 9);
+	}
+	out << digits;
+}
+
+std::string BigArena::to_string(int handle) const {
+	std::ostringstream out;
+	write(out, handle);
+	return out.str();
+}
+
+void BigArena::collect_if_needed(const CPU& cpu) {
+	// zeros take no limbs, their values run out first
+	if (limbs_.size() >= next_collection_ || (free_.empty() && values_.size() == MAX_VALUES)) collect(cpu);
+}
+
+void BigArena::collect(const CPU& cpu) {
+	std::vector<bool> live(values_.size(), false);
+	auto mark = [&](int root) {
+		if (contains(root)) live[index(root)] = true;
+	};
+	const int* stack = cpu.stack.data();
+	for (unsigned i = 0; i < cpu.stack.unchecked_size(); ++i) mark(stack[i]);
+	for (int i = 0; i < REGS; ++i) mark(cpu.registers[i]);
+	for (int i = 0; i < MEMORY_SIZE; ++i) mark(cpu.memory[i]);
+
+	// live values slide to the start of the buffer in the order of their limbs
+	std::vector<int> order;
+	for (size_t index = 0; index < values_.size(); ++index) {
+		if (values_[index].free) continue;
+		if (live[index]) {
+			order.push_back(static_cast<int>(index));
+			continue;
+		}
+		values_[index].free = true;
+		free_.push_back(static_cast<int>(index));
+		--stats_.values;
+		++stats_.freed;
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) { return values_[a].offset < values_[b].offset; });
+
+	size_t used = 0;
+	for (int index : order) {
+		Value& live_value = values_[index];
+		if (live_value.offset != used) {
+			std::memmove(limbs_.data() + used, limbs_.data() + live_value.offset, live_value.size * sizeof(Limb));
+			live_value.offset = used;
+		}
+		used += live_value.size;
+	}
+	limbs_.resize(used);
+
+	++stats_.collections;
+	next_collection_ = std::max(MIN_COLLECT_LIMBS, 2 * used);
+}
+
+ArenaStats BigArena::stats() const {
+	ArenaStats current = stats_;
+	current.limbs = limbs_.size();
+	return current;
+}
+
+BigArena& bigint_ns::arena(CPU& cpu) {
+	if (!cpu.bigints) cpu.bigints = std::make_shared<BigArena>();
+	return *cpu.bigints;
+}
@@ -0,0 +1,91 @@
+#include "cache.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+using namespace cache_ns;
+
+namespace fs = std::filesystem;
+
+std::string CompileOptions::flags() const {
+	std::string flags = debug_section ? "debug" : "strip";
+	flags += " inline=";
+	flags += std::to_string(inline_budget);
+	return flags;
+}
+
+std::string cache_ns::cache_directory() {
+	const char* directory = std::getenv("LNG_CACHE_DIR");
+	return (directory != nullptr && directory[0] != '\0') ? directory : DEFAULT_CACHE_DIRECTORY;
+}
+
+BytecodeCache::BytecodeCache(const std::string& directory) : directory_(directory) {}
+
+// FNV-1a over the fields, every field ends with zero byte so they cannot run into each other
+uint64_t BytecodeCache::key(const std::string& source, const preprocessor_ns::ExpandedSource& expanded,
+                            const CompileOptions& options) const {
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](const std::string& field) {
+		for (size_t i = 0; i <= field.size(); ++i) {
+			hash ^= static_cast<unsigned char>(field.c_str()[i]);
+			hash *= 1099511628211ULL;
+		}
+	};
+	mix(COMPILER_VERSION);
+	mix(options.flags());
+	mix(source);
+	mix(expanded.text);
+
+	// lines of the debug section
+	std::string origins;
+	for (const preprocessor_ns::LineOrigin& origin : expanded.origins) {
+		origins += std::to_string(origin.line);
+		origins += ':';
+		origins += std::to_string(origin.column);
+		origins += ' ';
+	}
+	mix(origins);
+	return hash;
+}
+
+std::string BytecodeCache::entry(uint64_t key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bcode", static_cast<unsigned long long>(key));
+	return (fs::path(directory_) / name).string();
+}
+
+std::string BytecodeCache::compile(const std::string& source, const CompileOptions& options, bool* hit) {
+	preprocessor_ns::ExpandedSource expanded = read_source(source);
+	std::string path = entry(key(source, expanded, options));
+
+	bool found = fs::exists(path);
+	if (hit != nullptr) *hit = found;
+	if (found) return path;
+
+	std::error_code error;
+	fs::create_directories(directory_, error);
+	VERIFY_CONTRACT(!error, "ERROR: unable to create cache directory " << directory_ << ": " << error.message());
+
+	// parsed from the text that was hashed, even if the files change meanwhile
+	static std::atomic<unsigned> counter = 0;
+	std::string temporary = path;
+	temporary += ".tmp.";
+	temporary += std::to_string(getpid());
+	temporary += '.';
+	temporary += std::to_string(counter++);
+
+	Parser parser(inliner_ns::inline_calls(std::move(expanded), options.inline_budget), source);
+	parser.set_debug_section(options.debug_section);
+	parser.parse(temporary);
+
+	fs::rename(temporary, path, error);
+	if (error) fs::remove(temporary);
+	VERIFY_CONTRACT(!error, "ERROR: unable to write cache entry " << path << ": " << error.message());
+	return path;
+}
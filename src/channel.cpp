@@ -0,0 +1,152 @@
+#include "utils.hpp"
+#include "channel.hpp"
+
+#include <bit>
+
+static unsigned round_capacity(unsigned capacity) {
+	VERIFY_CONTRACT((capacity > 0) && (capacity <= (1U << 30)), "ERROR: invalid channel capacity " << capacity);
+	return std::bit_ceil(capacity);
+}
+
+/////////////
+// CHANNEL //
+/////////////
+
+Channel::Channel() : closed_(false), abandoned_(false) {}
+
+void Channel::close() {
+	closed_.store(true, std::memory_order_release);
+}
+
+bool Channel::closed() const {
+	return closed_.load(std::memory_order_acquire);
+}
+
+void Channel::abandon() {
+	abandoned_.store(true, std::memory_order_release);
+}
+
+bool Channel::abandoned() const {
+	return abandoned_.load(std::memory_order_acquire);
+}
+
+bool Channel::bind_sender(const void*) {
+	return true;
+}
+
+bool Channel::bind_receiver(const void*) {
+	return true;
+}
+
+//////////////////
+// SPSC CHANNEL //
+//////////////////
+
+SPSCChannel::SPSCChannel(unsigned capacity) :
+	mask_(round_capacity(capacity) - 1),
+	buffer_(std::make_unique<int[]>(mask_ + 1)),
+	sender_(nullptr), receiver_(nullptr), head_(0), tail_(0)
+{}
+
+// The side is taken by the first context, later ones are checked against it
+static bool bind(std::atomic<const void*>& side, const void* context) {
+	const void* bound = side.load(std::memory_order_relaxed);
+	if (bound == nullptr && side.compare_exchange_strong(bound, context)) return true;
+	return bound == context;
+}
+
+bool SPSCChannel::bind_sender(const void* context) {
+	return bind(sender_, context);
+}
+
+bool SPSCChannel::bind_receiver(const void* context) {
+	return bind(receiver_, context);
+}
+
+bool SPSCChannel::try_send(int value) {
+	unsigned tail = tail_.load(std::memory_order_relaxed);
+	if (tail - head_.load(std::memory_order_acquire) > mask_) {
+		return false; // full
+	}
+
+	buffer_[tail & mask_] = value;
+	tail_.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool SPSCChannel::try_receive(int& value) {
+	unsigned head = head_.load(std::memory_order_relaxed);
+	if (head == tail_.load(std::memory_order_acquire)) {
+		return false; // empty
+	}
+
+	value = buffer_[head & mask_];
+	head_.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+//////////////////
+// MPMC CHANNEL //
+//////////////////
+
+MPMCChannel::MPMCChannel(unsigned capacity) :
+	mask_(round_capacity(capacity) - 1),
+	buffer_(std::make_unique<Cell[]>(mask_ + 1)),
+	head_(0), tail_(0)
+{
+	// cell i is free for the sender with position i
+	for (unsigned i = 0; i <= mask_; ++i) {
+		buffer_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool MPMCChannel::try_send(int value) {
+	unsigned position = tail_.load(std::memory_order_relaxed);
+	while (true) {
+		Cell& cell = buffer_[position & mask_];
+		unsigned sequence = cell.sequence.load(std::memory_order_acquire);
+		int difference = static_cast<int>(sequence - position);
+
+		if (difference == 0) {
+			// the cell is free, try to take the position
+			if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				cell.value = value;
+				cell.sequence.store(position + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0) {
+			return false; // full
+		}
+		else {
+			// another sender took the position
+			position = tail_.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+bool MPMCChannel::try_receive(int& value) {
+	unsigned position = head_.load(std::memory_order_relaxed);
+	while (true) {
+		Cell& cell = buffer_[position & mask_];
+		unsigned sequence = cell.sequence.load(std::memory_order_acquire);
+		int difference = static_cast<int>(sequence - (position + 1));
+
+		if (difference == 0) {
+			// the cell is filled, try to take the position
+			if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				value = cell.value;
+				// free the cell for the sender of the next lap
+				cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (difference < 0) {
+			return false; // empty
+		}
+		else {
+			// another receiver took the position
+			position = head_.load(std::memory_order_relaxed);
+		}
+	}
+}
@@ -1,22 +1,109 @@
+#include "cache.hpp"
+#include "command.hpp"
+#include "compiler.hpp"
+#include "inliner.hpp"
+#include "linker.hpp"
 #include "parser.hpp"
+#include "pgo.hpp"
 #include "utils.hpp"
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <string>
-#include <regex>
+#include <vector>
 
+// Rule "target: files" and an empty rule for every included file,
+// so make does not fail after an included file is removed
+static void write_deps(const std::string& filename, const std::string& target, const std::vector<std::string>& files) {
+	std::ofstream out(filename);
+	VERIFY_CONTRACT(out.is_open(), "Unable to open file " << filename);
+
+	out << target << ':';
+	for (const std::string& file : files) out << ' ' << file;
+	out << '\n';
+	for (size_t i = 1; i < files.size(); ++i) out << '\n' << files[i] << ":\n";
+}
+
+// Usage: code FILE.lng | FILE.lnx [--strip] [--inline INSTRUCTIONS] [--object [--deps FILE]] [--profile FILE]
+// --strip leaves out the debug section with source lines of instructions.
+// --inline sets the largest subroutine inlined into its call sites, 0 keeps every CALL.
+// --object writes a relocatable FILE.lobj for the linker instead of byte code.
+// --deps writes a make rule with the files the object is built from, as g++ -MMD -MP does.
+// --profile optimizes byte code for the profile written by run --pgo: block layout,
+// jump directions and superinstructions. The result is not cached.
+// Byte code is taken from the cache if the source was compiled before
 int main(int argc, char** argv) {
-	VERIFY_CONTRACT(argc == 2, "Unexpected arguments passed to make code");
+	VERIFY_CONTRACT(argc >= 2, "Unexpected arguments passed to make code");
+
+	cache_ns::CompileOptions options;
+	bool object = false;
+	std::string profile;
+	std::string deps;
+	for (int i = 2; i < argc; ++i) {
+		std::string flag = argv[i];
+		if (flag == "--strip") {
+			options.debug_section = false;
+		}
+		else if (flag == "--object") {
+			object = true;
+		}
+		else if (flag == "--inline" && i + 1 < argc) {
+			options.inline_budget = parse_number(argv[++i], flag, 0, std::numeric_limits<int>::max());
+		}
+		else if (flag == "--profile" && i + 1 < argc) {
+			profile = argv[++i];
+		}
+		else if (flag == "--deps" && i + 1 < argc) {
+			deps = argv[++i];
+		}
+		else {
+			TERMINATE("Unexpected arguments passed to make code");
+		}
+	}
 
 	std::string filename(argv[1]);
-	std::regex extension = std::regex("[A-Za-z_\\/\\-]+\\.lng");
-	VERIFY_CONTRACT(std::regex_match(filename, extension), "Expected .lng file");
+	VERIFY_CONTRACT(has_extension(filename, ".lng") || has_extension(filename, compiler_ns::SOURCE_EXTENSION), "Expected .lng or .lnx file");
+	VERIFY_CONTRACT(deps.empty() || object, "ERROR: --deps is written only for --object");
 
 	std::cout << SET_COLOR_YELLOW << "Building byte code from " << SET_COLOR_CYAN << filename<< SET_COLOR_YELLOW << "...\n" << RESET_COLOR;
 
-	Parser parser = Parser(filename);
+	// objects are rebuilt only when their source changes, so they skip the cache
+	if (object) {
+		preprocessor_ns::ExpandedSource source = read_source(filename);
+		std::vector<std::string> files = source.files;
+		Parser parser(inliner_ns::inline_calls(std::move(source), options.inline_budget), filename);
+		std::string ofilename = filename.replace(filename.size() - 4, 4, linker_ns::OBJECT_EXTENSION);
+		linker_ns::write_object(parser.parse_object(), ofilename);
+		if (!deps.empty()) write_deps(deps, ofilename, files);
+		std::cout << SET_COLOR_YELLOW << "Building done: " << SET_COLOR_CYAN << ofilename << RESET_COLOR << '\n';
+		return 0;
+	}
+
+	bool hit = false;
+	std::string cached = cache_ns::BytecodeCache().compile(filename, options, &hit);
+
 	std::string ofilename = filename.replace(filename.size() - 3, 3, "bcode");
-	parser.parse(ofilename);
-	std::cout << SET_COLOR_YELLOW << "Building done: " << SET_COLOR_CYAN << ofilename << RESET_COLOR << '\n';
+	if (!profile.empty()) {
+		CPU compiled(cached);
+		std::ofstream out(ofilename);
+		VERIFY_CONTRACT(out.is_open(), "Unable to open file " << ofilename);
+		pgo_ns::OptimizationStats stats = pgo_ns::optimize(*compiled.program, pgo_ns::load(profile), out, options.debug_section);
+
+		std::cout << SET_COLOR_YELLOW << "Optimized for the profile: " << stats.moved_blocks << " of " << stats.blocks
+		          << " blocks moved, " << stats.inverted_jumps << " jumps inverted, " << stats.added_jumps << " added, "
+		          << stats.removed_jumps << " removed\n";
+		std::vector<std::vector<int>> catalog = superinstruction_catalog();
+		for (const auto& [kind, occurrences] : stats.superinstructions) {
+			std::cout << "    superinstruction";
+			for (int id : catalog[kind]) std::cout << ' ' << get_command_name(id);
+			std::cout << " x" << occurrences << '\n';
+		}
+		std::cout << "Building done: " << SET_COLOR_CYAN << ofilename << RESET_COLOR << '\n';
+		return 0;
+	}
+
+	std::filesystem::copy_file(cached, ofilename, std::filesystem::copy_options::overwrite_existing);
+	std::cout << SET_COLOR_YELLOW << (hit ? "Building done (cached): " : "Building done: ") << SET_COLOR_CYAN << ofilename << RESET_COLOR << '\n';
 	return 0;
 }
\ No newline at end of file
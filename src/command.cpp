@@ -1,10 +1,17 @@
 #include "cpu.hpp"
 #include "command.hpp"
+#include "simd.hpp"
+#include "scheduler.hpp"
+#include "channel.hpp"
+#include "bigint.hpp"
+#include "tracer.hpp"
 
 #include <iostream>
 #include <cstdio>
 #include <functional>
 #include <map>
+#include <tuple>
+#include <utility>
 
 // Constructors
 Command::Command() : argument(0) { }
@@ -28,7 +35,8 @@ public:
 	ENDCommand(int arg) : Command(arg) {}
 	static Command* get_command(int arg = 0) { return new ENDCommand(arg); }
 	virtual void execute(CPU& cpu) override {
-		cpu.pc_register = 0;
+		// every END halts the context, the run loop stops at the last one
+		cpu.pc_register = cpu.program->end;
 	}
 };
 
@@ -104,7 +112,7 @@ public:
 	OUTCommand(int arg) : Command(arg) {}
 	static Command* get_command(int arg = 0) { return new OUTCommand(arg); }
 	virtual void execute(CPU& cpu) override  {
-		std::cout << cpu.stack.top() << std::endl;
+		*cpu.output << cpu.stack.top() << std::endl;
 		cpu.stack.pop();
 		cpu.pc_register += 1;
 	}
@@ -115,10 +123,7 @@ public:
 	INCommand(int arg) : Command(arg) {}
 	static Command* get_command(int arg = 0) { return new INCommand(arg); }
 	virtual void execute(CPU& cpu) override {
-		int value;
-		int correct = scanf("%d", &value);
-		VERIFY_CONTRACT(correct == 1, "ERROR: invalid input in IN command");
-		cpu.stack.push(value);
+		cpu.stack.push(cpu.read_input());
 		cpu.pc_register += 1;
 	}
 };
@@ -148,6 +153,66 @@ public:
 	}
 };
 
+// SEND id - pop the value and put it into the channel,
+//           the context halts when the channel is abandoned by its receiver.
+//           Handles of big integers of the context cannot be sent
+// RECV id - take the value from the channel and push it,
+//           the context halts when the channel is closed and drained
+// Both commands interrupt the slice without moving on if the channel is full (empty).
+// A single-sided channel (SPSCChannel) fails on a second sending (receiving) context
+
+static Channel* get_channel(CPU& cpu, int id) {
+	VERIFY_CONTRACT((id >= 0) && (id < (int)cpu.channels.size()) && (cpu.channels[id] != nullptr),
+		"ERROR: channel " << id << " is not attached");
+	return cpu.channels[id].get();
+}
+
+class SENDCommand : public Command {
+public:
+	SENDCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg)  { return new SENDCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		Channel* channel = get_channel(cpu, argument);
+		VERIFY_CONTRACT(channel->bind_sender(&cpu), "ERROR: channel " << argument << " has another sender");
+		VERIFY_CONTRACT(!cpu.bigints || !cpu.bigints->contains(cpu.stack.top()),
+			"ERROR: big integer " << cpu.stack.top() << " cannot be sent, channels do not keep it alive");
+
+		if (channel->abandoned()) {
+			cpu.pc_register = cpu.program->end;
+		}
+		else if (channel->try_send(cpu.stack.top())) {
+			cpu.stack.pop();
+			cpu.pc_register += 1;
+		}
+		else {
+			cpu.interrupt = true;
+		}
+	}
+};
+
+class RECVCommand : public Command {
+public:
+	RECVCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg)  { return new RECVCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		Channel* channel = get_channel(cpu, argument);
+		VERIFY_CONTRACT(channel->bind_receiver(&cpu), "ERROR: channel " << argument << " has another receiver");
+
+		int value;
+		// the second attempt catches values sent right before closing
+		if (channel->try_receive(value) || (channel->closed() && channel->try_receive(value))) {
+			cpu.stack.push(value);
+			cpu.pc_register += 1;
+		}
+		else if (channel->closed()) {
+			cpu.pc_register = cpu.program->end;
+		}
+		else {
+			cpu.interrupt = true;
+		}
+	}
+};
+
 /////////////////////////////////
 // COMMAND TYPES: REGISTER ARG //
 /////////////////////////////////
@@ -157,7 +222,7 @@ public:
 	PUSHRCommand(int arg) : Command(arg) {}
 	static Command* get_command(int arg) { return new PUSHRCommand(arg); }
 	virtual void execute(CPU& cpu) override  {
-		VERIFY_CONTRACT( (argument >= 0) && (argument <= REGS), "ERROR: invalid register id after command");
+		VERIFY_CONTRACT( (argument >= 0) && (argument < REGS), "ERROR: invalid register id after command");
 		int value = cpu.registers[argument];
 		cpu.stack.push(value);
 		cpu.pc_register += 1;
@@ -169,7 +234,7 @@ public:
 	POPRCommand(int arg) : Command(arg) {}
 	static Command* get_command(int arg) { return new POPRCommand(arg); }
 	virtual void execute(CPU& cpu) override {
-		VERIFY_CONTRACT( (argument >= 0) && (argument <= REGS), "ERROR: invalid register id after command");
+		VERIFY_CONTRACT( (argument >= 0) && (argument < REGS), "ERROR: invalid register id after command");
 		cpu.registers[argument] = cpu.stack.top();
 		cpu.stack.pop();
 		cpu.pc_register += 1;
@@ -199,7 +264,6 @@ public:
 		auto lhs = cpu.stack.top();
 		cpu.stack.pop();
 		if (rhs == lhs) {
-			printf("JEQ: %d == %d\n", rhs, lhs);
 			cpu.pc_register = argument;
 		}
 		else {
@@ -308,6 +372,332 @@ public:
 	}
 };
 
+///////////////////////////////////////
+// COMMAND TYPES: VECTOR (STACK ARGS) //
+///////////////////////////////////////
+
+// Vector commands take their operands from the stack (the last one is on top):
+// 	VLOAD  addr n       - push memory[addr], ..., memory[addr + n - 1]
+// 	VSTORE addr n       - pop n values into memory[addr + n - 1], ..., memory[addr]
+// 	VADD   dst a b n    - memory[dst + i] = memory[a + i] + memory[b + i]
+// 	VSUB   dst a b n    - memory[dst + i] = memory[a + i] - memory[b + i]
+// 	VMUL   dst a b n    - memory[dst + i] = memory[a + i] * memory[b + i]
+// 	VCMPEQ dst a b n    - memory[dst + i] = (memory[a + i] == memory[b + i]) ? -1 : 0
+// 	VCMPGT dst a b n    - memory[dst + i] = (memory[a + i] >  memory[b + i]) ? -1 : 0
+// 	VSUM   addr n       - push memory[addr] + ... + memory[addr + n - 1]
+
+static int pop_value(CPU& cpu) {
+	int value = cpu.stack.top();
+	cpu.stack.pop();
+	return value;
+}
+
+// The whole range is checked once, so the kernels run without bound checks
+static int* memory_range(CPU& cpu, int address, int length) {
+	VERIFY_CONTRACT(
+		(address >= 0) && (length >= 0) && (static_cast<long long>(address) + length <= MEMORY_SIZE),
+		"ERROR: vector operand [" << address << ", " << address << " + " << length << ") is out of data memory");
+	return cpu.memory + address;
+}
+
+static bool overlap_partially(const int* lhs, const int* rhs, int length) {
+	return (lhs != rhs) && (lhs < rhs + length) && (rhs < lhs + length);
+}
+
+static void execute_vector_binary(CPU& cpu, simd_ns::BinaryKernel kernel) {
+	int length = pop_value(cpu);
+	int* b = memory_range(cpu, pop_value(cpu), length);
+	int* a = memory_range(cpu, pop_value(cpu), length);
+	int* dst = memory_range(cpu, pop_value(cpu), length);
+
+	// Kernels only allow dst to be exactly equal to a source,
+	// so partially overlapping sources are copied first
+	if (overlap_partially(dst, a, length) || overlap_partially(dst, b, length)) {
+		std::vector<int> a_copy(a, a + length);
+		std::vector<int> b_copy(b, b + length);
+		kernel(dst, a_copy.data(), b_copy.data(), length);
+	}
+	else {
+		kernel(dst, a, b, length);
+	}
+	cpu.pc_register += 1;
+}
+
+class VLOADCommand : public Command {
+public:
+	VLOADCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VLOADCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int length = pop_value(cpu);
+		int* src = memory_range(cpu, pop_value(cpu), length);
+		for (int i = 0; i < length; ++i) {
+			cpu.stack.push(src[i]);
+		}
+		cpu.pc_register += 1;
+	}
+};
+
+class VSTORECommand : public Command {
+public:
+	VSTORECommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VSTORECommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int length = pop_value(cpu);
+		int* dst = memory_range(cpu, pop_value(cpu), length);
+		for (int i = length - 1; i >= 0; --i) {
+			dst[i] = pop_value(cpu);
+		}
+		cpu.pc_register += 1;
+	}
+};
+
+class VADDCommand : public Command {
+public:
+	VADDCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VADDCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		execute_vector_binary(cpu, simd_ns::kernels().add);
+	}
+};
+
+class VSUBCommand : public Command {
+public:
+	VSUBCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VSUBCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		execute_vector_binary(cpu, simd_ns::kernels().sub);
+	}
+};
+
+class VMULCommand : public Command {
+public:
+	VMULCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VMULCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		execute_vector_binary(cpu, simd_ns::kernels().mul);
+	}
+};
+
+class VCMPEQCommand : public Command {
+public:
+	VCMPEQCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VCMPEQCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		execute_vector_binary(cpu, simd_ns::kernels().cmpeq);
+	}
+};
+
+class VCMPGTCommand : public Command {
+public:
+	VCMPGTCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VCMPGTCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		execute_vector_binary(cpu, simd_ns::kernels().cmpgt);
+	}
+};
+
+class VSUMCommand : public Command {
+public:
+	VSUMCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new VSUMCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int length = pop_value(cpu);
+		int* src = memory_range(cpu, pop_value(cpu), length);
+		cpu.stack.push(simd_ns::kernels().sum(src, length));
+		cpu.pc_register += 1;
+	}
+};
+
+//////////////////////////////////
+// COMMAND TYPES: MEMORY ACCESS //
+//////////////////////////////////
+
+// Absolute addresses are verified once when the command is created,
+// so only indirect addressing checks the bounds at runtime
+static int checked_address(int address) {
+	VERIFY_CONTRACT((address >= 0) && (address < MEMORY_SIZE),
+		"ERROR: address " << address << " is out of data memory");
+	return address;
+}
+
+class LOADCommand : public Command {
+public:
+	LOADCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg) { return new LOADCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		cpu.stack.push(cpu.memory[argument]);
+		cpu.pc_register += 1;
+	}
+};
+
+class LOADRCommand : public Command {
+public:
+	LOADRCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg) { return new LOADRCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		cpu.stack.push(cpu.memory[checked_address(cpu.registers[argument])]);
+		cpu.pc_register += 1;
+	}
+};
+
+class LOADSCommand : public Command {
+public:
+	LOADSCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new LOADSCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int& top = cpu.stack.top();
+		top = cpu.memory[checked_address(top)];
+		cpu.pc_register += 1;
+	}
+};
+
+class STORECommand : public Command {
+public:
+	STORECommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg) { return new STORECommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		cpu.memory[argument] = pop_value(cpu);
+		cpu.pc_register += 1;
+	}
+};
+
+class STORERCommand : public Command {
+public:
+	STORERCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg) { return new STORERCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		cpu.memory[checked_address(cpu.registers[argument])] = pop_value(cpu);
+		cpu.pc_register += 1;
+	}
+};
+
+class STORESCommand : public Command {
+public:
+	STORESCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new STORESCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int address = checked_address(pop_value(cpu));
+		cpu.memory[address] = pop_value(cpu);
+		cpu.pc_register += 1;
+	}
+};
+
+//////////////////////////////////
+// COMMAND TYPES: GREEN THREADS //
+//////////////////////////////////
+
+// SPAWN label - pop the argument, start a new context from the label with the argument
+//               on its stack and push the id of the new context
+// YIELD       - give the rest of the slice to other contexts
+// JOIN        - pop the context id and wait until that context reaches END
+
+class SPAWNCommand : public Command {
+public:
+	SPAWNCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg) { return new SPAWNCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		VERIFY_CONTRACT(cpu.scheduler != nullptr, "ERROR: SPAWN requires the program to be run by a scheduler");
+		int value = pop_value(cpu);
+		cpu.stack.push(cpu.scheduler->spawn(cpu, argument, value));
+		cpu.pc_register += 1;
+	}
+};
+
+class YIELDCommand : public Command {
+public:
+	YIELDCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new YIELDCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		cpu.interrupt = true;
+		cpu.pc_register += 1;
+	}
+};
+
+class JOINCommand : public Command {
+public:
+	JOINCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new JOINCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		VERIFY_CONTRACT(cpu.scheduler != nullptr, "ERROR: JOIN requires the program to be run by a scheduler");
+		if (cpu.scheduler->finished(cpu.stack.top())) {
+			cpu.stack.pop();
+			cpu.pc_register += 1;
+		}
+		else {
+			// try again when the context is scheduled next time
+			cpu.interrupt = true;
+		}
+	}
+};
+
+/////////////////////////////////
+// COMMAND TYPES: BIG INTEGERS //
+/////////////////////////////////
+
+// Values are kept by the arena of the context, the stack holds their handles (see bigint.hpp).
+// Operands are popped as by ADD: rhs is the top of the stack, lhs is the next one
+// BIG  - pop an integer, push the handle of a big integer with its value
+// BADD - push the handle of rhs + lhs
+// BSUB - push the handle of rhs - lhs
+// BMUL - push the handle of rhs * lhs
+// BCMP - push -1, 0 or 1 as rhs is less than, equal to or greater than lhs
+// BOUT - pop the handle and print the value in decimal
+
+// The arena is collected before the operands are popped, so they stay alive
+template <int (bigint_ns::BigArena::*Operation)(int, int)>
+class BigBinaryCommand : public Command {
+public:
+	BigBinaryCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new BigBinaryCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		bigint_ns::BigArena& arena = bigint_ns::arena(cpu);
+		arena.collect_if_needed(cpu);
+		int rhs = pop_value(cpu);
+		int lhs = pop_value(cpu);
+		cpu.stack.push((arena.*Operation)(rhs, lhs));
+		cpu.pc_register += 1;
+	}
+};
+
+typedef BigBinaryCommand<&bigint_ns::BigArena::add>      BADDCommand;
+typedef BigBinaryCommand<&bigint_ns::BigArena::subtract> BSUBCommand;
+typedef BigBinaryCommand<&bigint_ns::BigArena::multiply> BMULCommand;
+
+class BIGCommand : public Command {
+public:
+	BIGCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new BIGCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		bigint_ns::BigArena& arena = bigint_ns::arena(cpu);
+		arena.collect_if_needed(cpu);
+		cpu.stack.push(arena.make(pop_value(cpu)));
+		cpu.pc_register += 1;
+	}
+};
+
+class BCMPCommand : public Command {
+public:
+	BCMPCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new BCMPCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		int rhs = pop_value(cpu);
+		int lhs = pop_value(cpu);
+		cpu.stack.push(bigint_ns::arena(cpu).compare(rhs, lhs));
+		cpu.pc_register += 1;
+	}
+};
+
+class BOUTCommand : public Command {
+public:
+	BOUTCommand(int arg) : Command(arg) {}
+	static Command* get_command(int arg = 0) { return new BOUTCommand(arg); }
+	virtual void execute(CPU& cpu) override {
+		bigint_ns::arena(cpu).write(*cpu.output, pop_value(cpu));
+		*cpu.output << std::endl;
+		cpu.pc_register += 1;
+	}
+};
+
 // Next mapping is used when the parser needs to know what type of argument it needs to parse next
 // depending on Command.get_command_arg_type(std::string&)
 const std::map<int, std::function<Command*(int)>> command_id_to_function { 
@@ -330,20 +720,49 @@ const std::map<int, std::function<Command*(int)>> command_id_to_function {
 	{25, JAECommand::get_command },
 	{26, JBCommand::get_command },
 	{27, JBECommand::get_command },
+	{28, SPAWNCommand::get_command },
 	
 	{30, PUSHCommand::get_command },
+	{31, SENDCommand::get_command },
+	{32, RECVCommand::get_command },
 
 	{40, POPRCommand::get_command}, 
 	{41, PUSHRCommand::get_command},
+
+	{50, VLOADCommand::get_command},
+	{51, VSTORECommand::get_command},
+	{52, VADDCommand::get_command},
+	{53, VSUBCommand::get_command},
+	{54, VMULCommand::get_command},
+	{55, VCMPEQCommand::get_command},
+	{56, VCMPGTCommand::get_command},
+	{57, VSUMCommand::get_command},
+
+	{60 + ADDRESS_ABSOLUTE, LOADCommand::get_command},
+	{60 + ADDRESS_REGISTER, LOADRCommand::get_command},
+	{60 + ADDRESS_STACK,    LOADSCommand::get_command},
+	{63 + ADDRESS_ABSOLUTE, STORECommand::get_command},
+	{63 + ADDRESS_REGISTER, STORERCommand::get_command},
+	{63 + ADDRESS_STACK,    STORESCommand::get_command},
+
+	{70, YIELDCommand::get_command},
+	{71, JOINCommand::get_command},
+
+	{80, BIGCommand::get_command},
+	{81, BADDCommand::get_command},
+	{82, BSUBCommand::get_command},
+	{83, BMULCommand::get_command},
+	{84, BCMPCommand::get_command},
+	{85, BOUTCommand::get_command},
 };
 
 Command* Command::get_command(int id, int arg) {
 	VERIFY_CONTRACT(command_id_to_function.contains(id), "ERROR: invalid command id");
 
-	int command_arg_family = id / 10;
+	int command_arg_family = command_family(id);
 
 	// Check if non-argument commands always recieve zero
-	if (command_arg_family == 1) {
+	if (command_has_no_argument(id)) {
 		VERIFY_CONTRACT(arg == 0, "ERROR: non-zero argument after non-argument command");
 	}
 
@@ -354,8 +773,136 @@ Command* Command::get_command(int id, int arg) {
 
 	// Check if register id is correct
 	if (command_arg_family == 4) {
-		VERIFY_CONTRACT( (arg >= 0) && (arg <= REGS), "ERROR: invalid register id after command");
+		VERIFY_CONTRACT( (arg >= 0) && (arg < REGS), "ERROR: invalid register id after command");
+	}
+
+	// Check memory operand: this is the only bounds check for absolute addresses
+	if (command_arg_family == 6) {
+		switch ((id - 60) % 3) {
+			case ADDRESS_ABSOLUTE:
+				checked_address(arg);
+				break;
+			case ADDRESS_REGISTER:
+				VERIFY_CONTRACT( (arg >= 0) && (arg < REGS), "ERROR: invalid register id after command");
+				break;
+			case ADDRESS_STACK:
+				VERIFY_CONTRACT(arg == 0, "ERROR: non-zero argument after stack-indirect memory command");
+				break;
+		}
 	}
 
 	return command_id_to_function.at(id)(arg);
 }
+
+///////////////////////
+// SUPERINSTRUCTIONS //
+///////////////////////
+
+// Runs its components in one dispatch. The calls are qualified,
+// so they are not virtual and the compiler inlines them.
+// The dispatch loop counts the first component, every other one is counted
+// in CPU::slice_left. If the slice ends inside, pc is at the next component
+// and the rest runs unfused in the next slice
+template <typename... Components>
+class FusedCommand : public Command {
+private:
+	std::tuple<Components...> components_;
+
+	template <size_t... I>
+	FusedCommand(const Instruction* code, std::index_sequence<I...>) :
+		Command(code[0].argument), components_(Components(code[I].argument)...) {}
+
+	// Record the component before the next one, the dispatch loop records the last one
+	static void trace_previous([[maybe_unused]] CPU& cpu) {
+#ifdef VM_TRACE
+		int pc = cpu.pc_register - 1;
+		if (cpu.trace) cpu.trace->record(pc, cpu.program->code[pc].id, cpu.stack, cpu.registers);
+#endif
+	}
+
+	template <typename First, typename... Rest>
+	static void run(CPU& cpu, First& first, Rest&... rest) {
+		first.First::execute(cpu);
+		((cpu.slice_left > 0 && (trace_previous(cpu), --cpu.slice_left, rest.Rest::execute(cpu), true)) && ...);
+	}
+public:
+	explicit FusedCommand(const Instruction* code) : FusedCommand(code, std::index_sequence_for<Components...>{}) {}
+	static Command* get_command(const Instruction* code) { return new FusedCommand(code); }
+	virtual void execute(CPU& cpu) override {
+		std::apply([&cpu](Components&... component) { run(cpu, component...); }, components_);
+	}
+};
+
+struct Superinstruction {
+	std::vector<int> ids;
+	std::function<Command*(const Instruction*)> make;
+};
+
+// Every command moves to the next one, only the last one may jump.
+// None of them interrupts the slice, so the dispatch loop sees the same state
+static const std::vector<Superinstruction> superinstructions {
+	{{41, 30}, FusedCommand<PUSHRCommand, PUSHCommand>::get_command},
+	{{41, 41}, FusedCommand<PUSHRCommand, PUSHRCommand>::get_command},
+	{{30, 40}, FusedCommand<PUSHCommand, POPRCommand>::get_command},
+	{{40, 41}, FusedCommand<POPRCommand, PUSHRCommand>::get_command},
+	{{30, 30}, FusedCommand<PUSHCommand, PUSHCommand>::get_command},
+	{{30, 41}, FusedCommand<PUSHCommand, PUSHRCommand>::get_command},
+	{{40, 30}, FusedCommand<POPRCommand, PUSHCommand>::get_command},
+	{{40, 40}, FusedCommand<POPRCommand, POPRCommand>::get_command},
+	{{40, 21}, FusedCommand<POPRCommand, JMPCommand>::get_command},
+
+	{{12, 40}, FusedCommand<ADDCommand, POPRCommand>::get_command},
+	{{13, 40}, FusedCommand<SUBCommand, POPRCommand>::get_command},
+	{{14, 40}, FusedCommand<MULCommand, POPRCommand>::get_command},
+	{{30, 12}, FusedCommand<PUSHCommand, ADDCommand>::get_command},
+	{{30, 13}, FusedCommand<PUSHCommand, SUBCommand>::get_command},
+	{{30, 14}, FusedCommand<PUSHCommand, MULCommand>::get_command},
+	{{41, 12}, FusedCommand<PUSHRCommand, ADDCommand>::get_command},
+	{{41, 13}, FusedCommand<PUSHRCommand, SUBCommand>::get_command},
+	{{41, 14}, FusedCommand<PUSHRCommand, MULCommand>::get_command},
+
+	{{30, 41, 13}, FusedCommand<PUSHCommand, PUSHRCommand, SUBCommand>::get_command},
+	{{41, 30, 12}, FusedCommand<PUSHRCommand, PUSHCommand, ADDCommand>::get_command},
+	{{41, 30, 13}, FusedCommand<PUSHRCommand, PUSHCommand, SUBCommand>::get_command},
+	{{41, 41, 12}, FusedCommand<PUSHRCommand, PUSHRCommand, ADDCommand>::get_command},
+	{{41, 41, 13}, FusedCommand<PUSHRCommand, PUSHRCommand, SUBCommand>::get_command},
+	{{41, 41, 14}, FusedCommand<PUSHRCommand, PUSHRCommand, MULCommand>::get_command},
+
+	// compare and branch
+	{{30, 41, 22}, FusedCommand<PUSHCommand, PUSHRCommand, JEQCommand>::get_command},
+	{{30, 41, 23}, FusedCommand<PUSHCommand, PUSHRCommand, JNECommand>::get_command},
+	{{30, 41, 24}, FusedCommand<PUSHCommand, PUSHRCommand, JACommand>::get_command},
+	{{30, 41, 25}, FusedCommand<PUSHCommand, PUSHRCommand, JAECommand>::get_command},
+	{{30, 41, 26}, FusedCommand<PUSHCommand, PUSHRCommand, JBCommand>::get_command},
+	{{30, 41, 27}, FusedCommand<PUSHCommand, PUSHRCommand, JBECommand>::get_command},
+	{{41, 30, 22}, FusedCommand<PUSHRCommand, PUSHCommand, JEQCommand>::get_command},
+	{{41, 30, 23}, FusedCommand<PUSHRCommand, PUSHCommand, JNECommand>::get_command},
+	{{41, 30, 24}, FusedCommand<PUSHRCommand, PUSHCommand, JACommand>::get_command},
+	{{41, 30, 25}, FusedCommand<PUSHRCommand, PUSHCommand, JAECommand>::get_command},
+	{{41, 30, 26}, FusedCommand<PUSHRCommand, PUSHCommand, JBCommand>::get_command},
+	{{41, 30, 27}, FusedCommand<PUSHRCommand, PUSHCommand, JBECommand>::get_command},
+	{{41, 41, 22}, FusedCommand<PUSHRCommand, PUSHRCommand, JEQCommand>::get_command},
+	{{41, 41, 23}, FusedCommand<PUSHRCommand, PUSHRCommand, JNECommand>::get_command},
+	{{41, 41, 24}, FusedCommand<PUSHRCommand, PUSHRCommand, JACommand>::get_command},
+	{{41, 41, 25}, FusedCommand<PUSHRCommand, PUSHRCommand, JAECommand>::get_command},
+	{{41, 41, 26}, FusedCommand<PUSHRCommand, PUSHRCommand, JBCommand>::get_command},
+	{{41, 41, 27}, FusedCommand<PUSHRCommand, PUSHRCommand, JBECommand>::get_command},
+};
+
+std::vector<std::vector<int>> superinstruction_catalog() {
+	std::vector<std::vector<int>> catalog;
+	for (const Superinstruction& superinstruction : superinstructions) {
+		catalog.push_back(superinstruction.ids);
+	}
+	return catalog;
+}
+
+Command* Command::get_superinstruction(int index, const std::vector<Instruction>& code, int pc) {
+	VERIFY_CONTRACT((index >= 0) && (index < (int)superinstructions.size()), "ERROR: invalid superinstruction " << index);
+	const std::vector<int>& ids = superinstructions[index].ids;
+	VERIFY_CONTRACT((pc >= 0) && (pc + ids.size() <= code.size()), "ERROR: superinstruction out of code at " << pc);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		VERIFY_CONTRACT(code[pc + i].id == ids[i], "ERROR: superinstruction " << index << " does not match code at " << pc);
+	}
+	return superinstructions[index].make(code.data() + pc);
+}
@@ -0,0 +1,1174 @@
+#include "compiler.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+#include <cctype>
+#include <climits>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <vector>
+
+using namespace compiler_ns;
+using preprocessor_ns::ExpandedSource;
+using preprocessor_ns::LineOrigin;
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+const int SCRATCH_REGISTER = 5;
+
+const char* const KEYWORDS[] = {"func", "var", "if", "else", "while", "return", "out", "in", "mem"};
+
+///////////
+// LEXER //
+///////////
+
+enum TokenKind {
+	TOKEN_NAME   = 0,
+	TOKEN_NUMBER = 1,
+	TOKEN_SYMBOL = 2,
+	TOKEN_END    = 3
+};
+
+struct Token {
+	TokenKind kind;
+	std::string text;
+	int value; // of TOKEN_NUMBER
+	int line;
+	int column;
+};
+
+static std::vector<Token> tokenize(const std::string& text, const std::string& source) {
+	static const char* const TWO_CHAR_SYMBOLS[] = {"==", "!=", "<=", ">=", "&&", "||"};
+	static const std::string ONE_CHAR_SYMBOLS = "(){}[],;=<>+-*/!";
+
+	std::vector<Token> tokens;
+	int line = 1, column = 1;
+	size_t i = 0;
+	auto advance = [&](size_t count) {
+		for (size_t k = 0; k < count; ++k, ++i) {
+			if (text[i] == '\n') {
+				++line;
+				column = 1;
+			}
+			else {
+				++column;
+			}
+		}
+	};
+
+	while (i < text.size()) {
+		unsigned char c = static_cast<unsigned char>(text[i]);
+		if (std::isspace(c)) {
+			advance(1);
+			continue;
+		}
+		if (text.compare(i, 2, "//") == 0) {
+			while (i < text.size() && text[i] != '\n') advance(1);
+			continue;
+		}
+
+		Token token{TOKEN_SYMBOL, "", 0, line, column};
+		size_t length = 0;
+		if (std::isalpha(c) || c == '_') {
+			while (i + length < text.size() && (std::isalnum(static_cast<unsigned char>(text[i + length])) || text[i + length] == '_')) {
+				++length;
+			}
+			token.kind = TOKEN_NAME;
+		}
+		else if (std::isdigit(c)) {
+			while (i + length < text.size() && std::isdigit(static_cast<unsigned char>(text[i + length]))) ++length;
+			VERIFY_CONTRACT(length <= 10 && std::stoll(text.substr(i, length)) <= INT_MAX,
+				"ERROR: " << source << ":" << line << ":" << column << ": number is too big");
+			token.kind = TOKEN_NUMBER;
+			token.value = std::stoi(text.substr(i, length));
+		}
+		else {
+			for (const char* symbol : TWO_CHAR_SYMBOLS) {
+				if (text.compare(i, 2, symbol) == 0) length = 2;
+			}
+			if (length == 0 && ONE_CHAR_SYMBOLS.find(c) != std::string::npos) length = 1;
+			VERIFY_CONTRACT(length > 0, "ERROR: " << source << ":" << line << ":" << column << ": unexpected character " << c);
+		}
+
+		token.text = text.substr(i, length);
+		advance(length);
+		tokens.push_back(token);
+	}
+
+	tokens.push_back(Token{TOKEN_END, "end of file", 0, line, column});
+	return tokens;
+}
+
+/////////
+// AST //
+/////////
+
+enum ExpressionKind {
+	EXPR_NUMBER  = 0,
+	EXPR_LOCAL   = 1, // value is the register
+	EXPR_GLOBAL  = 2, // value is the address
+	EXPR_CALL    = 3, // name is the function, operands are arguments
+	EXPR_INPUT   = 4,
+	EXPR_MEMORY  = 5, // operand is the address
+	EXPR_NEGATE  = 6,
+	EXPR_NOT     = 7,
+	EXPR_BINARY  = 8, // name is + - * /
+	EXPR_COMPARE = 9, // name is == != < <= > >=
+	EXPR_AND     = 10,
+	EXPR_OR      = 11
+};
+
+struct Expression;
+using ExpressionPtr = std::unique_ptr<Expression>;
+
+struct Expression {
+	ExpressionKind kind;
+	std::string name;
+	int value;
+	int line;
+	int column;
+	std::vector<ExpressionPtr> operands;
+};
+
+enum StatementKind {
+	STMT_ASSIGN     = 0, // target is EXPR_LOCAL or EXPR_GLOBAL
+	STMT_STORE      = 1, // target is the address
+	STMT_OUT        = 2,
+	STMT_EXPRESSION = 3,
+	STMT_RETURN     = 4, // value may be null
+	STMT_IF         = 5, // value is the condition
+	STMT_WHILE      = 6  // value is the condition
+};
+
+struct Statement {
+	StatementKind kind;
+	int line;
+	int column;
+	ExpressionPtr target;
+	ExpressionPtr value;
+	std::vector<Statement> body;
+	std::vector<Statement> otherwise;
+
+	// Registers read later, found by liveness analysis
+	std::set<int> live_after;
+	std::set<int> live_condition; // after the condition of if and while
+};
+
+struct Function {
+	std::string name;
+	int line;
+	int column;
+	int parameters;
+	int locals; // parameters included, they are in registers from AX
+	std::vector<Statement> body;
+	std::set<std::string> callees;
+};
+
+struct Global {
+	std::string name;
+	int address;
+	int value;
+};
+
+struct Module {
+	std::vector<Function> functions;
+	std::vector<Global> globals;
+};
+
+/////////////////////
+// CONSTANT FOLDING //
+/////////////////////
+
+static ExpressionPtr make_expression(ExpressionKind kind, const std::string& name, int value, const Token& at) {
+	return ExpressionPtr(new Expression{kind, name, value, at.line, at.column, {}});
+}
+
+static ExpressionPtr make_number(int value, const Token& at) {
+	return make_expression(EXPR_NUMBER, "", value, at);
+}
+
+static bool is_number(const ExpressionPtr& expression, int value) {
+	return expression->kind == EXPR_NUMBER && expression->value == value;
+}
+
+static bool has_side_effects(const Expression& expression) {
+	if (expression.kind == EXPR_CALL || expression.kind == EXPR_INPUT) return true;
+	for (const ExpressionPtr& operand : expression.operands) {
+		if (has_side_effects(*operand)) return true;
+	}
+	return false;
+}
+
+static bool compare(const std::string& op, int lhs, int rhs) {
+	if (op == "==") return lhs == rhs;
+	if (op == "!=") return lhs != rhs;
+	if (op == "<")  return lhs < rhs;
+	if (op == "<=") return lhs <= rhs;
+	if (op == ">")  return lhs > rhs;
+	return lhs >= rhs;
+}
+
+static ExpressionPtr make_with_operands(ExpressionKind kind, const std::string& name, ExpressionPtr lhs, ExpressionPtr rhs, const Token& at) {
+	ExpressionPtr expression = make_expression(kind, name, 0, at);
+	expression->operands.push_back(std::move(lhs));
+	if (rhs) expression->operands.push_back(std::move(rhs));
+	return expression;
+}
+
+static ExpressionPtr make_binary(const std::string& op, ExpressionPtr lhs, ExpressionPtr rhs, const Token& at) {
+	if (lhs->kind == EXPR_NUMBER && rhs->kind == EXPR_NUMBER) {
+		long long a = lhs->value, b = rhs->value, result = 0;
+		bool folded = true;
+		if (op == "+") result = a + b;
+		else if (op == "-") result = a - b;
+		else if (op == "*") result = a * b;
+		else folded = (b != 0) && (result = a / b, true);
+
+		if (folded && result >= INT_MIN && result <= INT_MAX) return make_number(static_cast<int>(result), at);
+	}
+
+	if (op == "+" && is_number(lhs, 0)) return rhs;
+	if ((op == "+" || op == "-") && is_number(rhs, 0)) return lhs;
+	if ((op == "*" || op == "/") && is_number(rhs, 1)) return lhs;
+	if (op == "*" && is_number(lhs, 1)) return rhs;
+	if (op == "*" && (is_number(lhs, 0) || is_number(rhs, 0)) && !has_side_effects(*lhs) && !has_side_effects(*rhs)) {
+		return make_number(0, at);
+	}
+	return make_with_operands(EXPR_BINARY, op, std::move(lhs), std::move(rhs), at);
+}
+
+static ExpressionPtr make_compare(const std::string& op, ExpressionPtr lhs, ExpressionPtr rhs, const Token& at) {
+	if (lhs->kind == EXPR_NUMBER && rhs->kind == EXPR_NUMBER) {
+		return make_number(compare(op, lhs->value, rhs->value), at);
+	}
+	return make_with_operands(EXPR_COMPARE, op, std::move(lhs), std::move(rhs), at);
+}
+
+// Value of && and || is 0 or 1
+static ExpressionPtr make_logical(ExpressionKind kind, ExpressionPtr lhs, ExpressionPtr rhs, const Token& at) {
+	if (lhs->kind == EXPR_NUMBER) {
+		bool known = (kind == EXPR_AND) ? lhs->value == 0 : lhs->value != 0;
+		if (known) return make_number(kind == EXPR_OR, at);
+		return make_compare("!=", std::move(rhs), make_number(0, at), at);
+	}
+	return make_with_operands(kind, (kind == EXPR_AND) ? "&&" : "||", std::move(lhs), std::move(rhs), at);
+}
+
+static ExpressionPtr make_negate(ExpressionPtr operand, const Token& at) {
+	if (operand->kind == EXPR_NUMBER && operand->value != INT_MIN) return make_number(-operand->value, at);
+	if (operand->kind == EXPR_NEGATE) return std::move(operand->operands[0]);
+	return make_with_operands(EXPR_NEGATE, "-", std::move(operand), nullptr, at);
+}
+
+static ExpressionPtr make_not(ExpressionPtr operand, const Token& at) {
+	if (operand->kind == EXPR_NUMBER) return make_number(operand->value == 0, at);
+	return make_with_operands(EXPR_NOT, "!", std::move(operand), nullptr, at);
+}
+
+////////////
+// PARSER //
+////////////
+
+class SyntaxParser {
+private:
+	const std::vector<Token>& tokens_;
+	const std::string& source_;
+	size_t next_;
+
+	Module module_;
+	std::map<std::string, int> globals_;   // name to index in module_.globals
+	std::map<std::string, int> locals_;    // of the function being parsed, name to register
+	std::set<std::string> callees_;        // of the function being parsed
+	std::vector<std::pair<const Expression*, Token>> calls_; // checked when all functions are known
+
+	[[noreturn]] void error(const Token& at, const std::string& message) const {
+		TERMINATE("ERROR: " << source_ << ":" << at.line << ":" << at.column << ": " << message);
+	}
+
+	const Token& peek(size_t ahead = 0) const {
+		return tokens_[std::min(next_ + ahead, tokens_.size() - 1)];
+	}
+
+	bool check(const std::string& text) const {
+		return peek().kind != TOKEN_END && peek().kind != TOKEN_NUMBER && peek().text == text;
+	}
+
+	bool accept(const std::string& text) {
+		if (!check(text)) return false;
+		++next_;
+		return true;
+	}
+
+	const Token& expect(const std::string& text) {
+		if (!check(text)) error(peek(), "expected '" + text + "' before " + peek().text);
+		return tokens_[next_++];
+	}
+
+	const Token& expect_name() {
+		const Token& token = peek();
+		if (token.kind != TOKEN_NAME) error(token, "expected a name before " + token.text);
+		for (const char* keyword : KEYWORDS) {
+			if (token.text == keyword) error(token, "keyword " + token.text + " is not a name");
+		}
+		++next_;
+		return token;
+	}
+
+	ExpressionPtr variable(const Token& name) {
+		auto local = locals_.find(name.text);
+		if (local != locals_.end()) return make_expression(EXPR_LOCAL, name.text, local->second, name);
+
+		auto global = globals_.find(name.text);
+		if (global != globals_.end()) return make_expression(EXPR_GLOBAL, name.text, module_.globals[global->second].address, name);
+
+		error(name, "undeclared variable " + name.text);
+	}
+
+	void declare_local(const Token& name) {
+		if (locals_.contains(name.text)) error(name, "variable " + name.text + " is already declared");
+		if ((int)locals_.size() == MAX_LOCALS) {
+			error(name, "more than " + std::to_string(MAX_LOCALS) + " parameters and variables in a function");
+		}
+		int id = static_cast<int>(locals_.size());
+		locals_[name.text] = id;
+	}
+
+	/////////////////
+	// EXPRESSIONS //
+	/////////////////
+
+	ExpressionPtr parse_expression() {
+		ExpressionPtr lhs = parse_and();
+		while (check("||")) {
+			const Token& op = expect("||");
+			lhs = make_logical(EXPR_OR, std::move(lhs), parse_and(), op);
+		}
+		return lhs;
+	}
+
+	ExpressionPtr parse_and() {
+		ExpressionPtr lhs = parse_comparison();
+		while (check("&&")) {
+			const Token& op = expect("&&");
+			lhs = make_logical(EXPR_AND, std::move(lhs), parse_comparison(), op);
+		}
+		return lhs;
+	}
+
+	ExpressionPtr parse_comparison() {
+		ExpressionPtr lhs = parse_additive();
+		while (check("==") || check("!=") || check("<") || check("<=") || check(">") || check(">=")) {
+			const Token& op = tokens_[next_++];
+			lhs = make_compare(op.text, std::move(lhs), parse_additive(), op);
+		}
+		return lhs;
+	}
+
+	ExpressionPtr parse_additive() {
+		ExpressionPtr lhs = parse_multiplicative();
+		while (check("+") || check("-")) {
+			const Token& op = tokens_[next_++];
+			lhs = make_binary(op.text, std::move(lhs), parse_multiplicative(), op);
+		}
+		return lhs;
+	}
+
+	ExpressionPtr parse_multiplicative() {
+		ExpressionPtr lhs = parse_unary();
+		while (check("*") || check("/")) {
+			const Token& op = tokens_[next_++];
+			lhs = make_binary(op.text, std::move(lhs), parse_unary(), op);
+		}
+		return lhs;
+	}
+
+	ExpressionPtr parse_unary() {
+		if (check("-")) {
+			const Token& op = expect("-");
+			return make_negate(parse_unary(), op);
+		}
+		if (check("!")) {
+			const Token& op = expect("!");
+			return make_not(parse_unary(), op);
+		}
+		return parse_primary();
+	}
+
+	ExpressionPtr parse_primary() {
+		const Token& token = peek();
+		if (token.kind == TOKEN_NUMBER) {
+			++next_;
+			return make_number(token.value, token);
+		}
+		if (accept("(")) {
+			ExpressionPtr expression = parse_expression();
+			expect(")");
+			return expression;
+		}
+		if (accept("in")) {
+			expect("(");
+			expect(")");
+			return make_expression(EXPR_INPUT, "in", 0, token);
+		}
+		if (accept("mem")) {
+			expect("[");
+			ExpressionPtr address = parse_expression();
+			expect("]");
+			return make_with_operands(EXPR_MEMORY, "mem", std::move(address), nullptr, token);
+		}
+
+		const Token& name = expect_name();
+		if (!accept("(")) return variable(name);
+
+		ExpressionPtr call = make_expression(EXPR_CALL, name.text, 0, name);
+		if (!accept(")")) {
+			do {
+				call->operands.push_back(parse_expression());
+			} while (accept(","));
+			expect(")");
+		}
+		callees_.insert(name.text);
+		calls_.emplace_back(call.get(), name);
+		return call;
+	}
+
+	////////////////
+	// STATEMENTS //
+	////////////////
+
+	std::vector<Statement> parse_block() {
+		expect("{");
+		std::vector<Statement> statements;
+		while (!accept("}")) {
+			statements.push_back(parse_statement());
+		}
+		return statements;
+	}
+
+	Statement parse_statement() {
+		const Token& start = peek();
+		Statement statement{STMT_EXPRESSION, start.line, start.column, nullptr, nullptr, {}, {}, {}, {}};
+
+		if (accept("var")) {
+			const Token& name = expect_name();
+			expect("=");
+			statement.kind = STMT_ASSIGN;
+			statement.value = parse_expression();
+			expect(";");
+
+			// the variable is not visible in its own initializer
+			declare_local(name);
+			statement.target = variable(name);
+		}
+		else if (accept("if")) {
+			statement.kind = STMT_IF;
+			expect("(");
+			statement.value = parse_expression();
+			expect(")");
+			statement.body = parse_block();
+			if (accept("else")) {
+				if (check("if")) statement.otherwise.push_back(parse_statement());
+				else statement.otherwise = parse_block();
+			}
+		}
+		else if (accept("while")) {
+			statement.kind = STMT_WHILE;
+			expect("(");
+			statement.value = parse_expression();
+			expect(")");
+			statement.body = parse_block();
+		}
+		else if (accept("return")) {
+			statement.kind = STMT_RETURN;
+			if (!check(";")) statement.value = parse_expression();
+			expect(";");
+		}
+		else if (accept("out")) {
+			statement.kind = STMT_OUT;
+			expect("(");
+			statement.value = parse_expression();
+			expect(")");
+			expect(";");
+		}
+		else if (accept("mem")) {
+			statement.kind = STMT_STORE;
+			expect("[");
+			statement.target = parse_expression();
+			expect("]");
+			expect("=");
+			statement.value = parse_expression();
+			expect(";");
+		}
+		else if (start.kind == TOKEN_NAME && peek(1).text == "=") {
+			statement.kind = STMT_ASSIGN;
+			statement.target = variable(expect_name());
+			expect("=");
+			statement.value = parse_expression();
+			expect(";");
+		}
+		else {
+			statement.value = parse_expression();
+			expect(";");
+		}
+		return statement;
+	}
+
+	//////////////////
+	// DECLARATIONS //
+	//////////////////
+
+	void parse_global() {
+		const Token& name = expect_name();
+		if (globals_.contains(name.text)) error(name, "variable " + name.text + " is already declared");
+
+		int value = 0;
+		if (accept("=")) {
+			ExpressionPtr initializer = parse_expression();
+			if (initializer->kind != EXPR_NUMBER) error(name, "global variable " + name.text + " needs a constant value");
+			value = initializer->value;
+		}
+		expect(";");
+
+		globals_[name.text] = static_cast<int>(module_.globals.size());
+		module_.globals.push_back(Global{name.text, MEMORY_SIZE - 1 - static_cast<int>(module_.globals.size()), value});
+	}
+
+	void parse_function() {
+		const Token& name = expect_name();
+		if (name.text[0] == '_') error(name, "function names cannot start with _");
+		for (const Function& function : module_.functions) {
+			if (function.name == name.text) error(name, "function " + name.text + " is already defined");
+		}
+
+		locals_.clear();
+		callees_.clear();
+		expect("(");
+		if (!accept(")")) {
+			do {
+				declare_local(expect_name());
+			} while (accept(","));
+			expect(")");
+		}
+
+		Function function{name.text, name.line, name.column, static_cast<int>(locals_.size()), 0, {}, {}};
+		function.body = parse_block();
+		function.locals = static_cast<int>(locals_.size());
+		function.callees = callees_;
+		module_.functions.push_back(std::move(function));
+	}
+
+	void check_calls() const {
+		for (const auto& [call, at] : calls_) {
+			const Function* callee = nullptr;
+			for (const Function& function : module_.functions) {
+				if (function.name == call->name) callee = &function;
+			}
+			if (callee == nullptr) error(at, "undefined function " + call->name);
+			if (callee->name == "main") error(at, "main cannot be called");
+			if (callee->parameters != (int)call->operands.size()) {
+				error(at, "function " + call->name + " takes " + std::to_string(callee->parameters) + " arguments");
+			}
+		}
+	}
+public:
+	SyntaxParser(const std::vector<Token>& tokens, const std::string& source) :
+		tokens_(tokens), source_(source), next_(0), module_(), globals_(), locals_(), callees_(), calls_() {}
+
+	Module parse() {
+		while (peek().kind != TOKEN_END) {
+			if (accept("var")) parse_global();
+			else if (accept("func")) parse_function();
+			else error(peek(), "expected func or var before " + peek().text);
+		}
+		check_calls();
+
+		bool has_main = false;
+		for (const Function& function : module_.functions) {
+			if (function.name == "main" && function.parameters != 0) error(peek(), "main cannot have parameters");
+			has_main = has_main || function.name == "main";
+		}
+		if (!has_main) error(peek(), "function main is not defined");
+		return std::move(module_);
+	}
+};
+
+//////////////
+// LIVENESS //
+//////////////
+
+static void collect_reads(const Expression& expression, std::set<int>& reads) {
+	if (expression.kind == EXPR_LOCAL) reads.insert(expression.value);
+	for (const ExpressionPtr& operand : expression.operands) {
+		collect_reads(*operand, reads);
+	}
+}
+
+// Registers read by the expression, none for null
+static std::set<int> reads(const Expression* expression) {
+	std::set<int> registers;
+	if (expression != nullptr) collect_reads(*expression, registers);
+	return registers;
+}
+
+static std::set<int> unite(std::set<int> lhs, const std::set<int>& rhs) {
+	lhs.insert(rhs.begin(), rhs.end());
+	return lhs;
+}
+
+// Sets live registers of the statements, returns registers live before them
+static std::set<int> find_liveness(std::vector<Statement>& statements, std::set<int> live) {
+	for (auto statement = statements.rbegin(); statement != statements.rend(); ++statement) {
+		statement->live_after = live;
+		const Expression* value = statement->value.get();
+
+		switch (statement->kind) {
+			case STMT_ASSIGN:
+				if (statement->target->kind == EXPR_LOCAL) live.erase(statement->target->value);
+				live = unite(live, reads(value));
+				break;
+			case STMT_STORE:
+				live = unite(unite(live, reads(statement->target.get())), reads(value));
+				break;
+			case STMT_OUT:
+			case STMT_EXPRESSION:
+				live = unite(live, reads(value));
+				break;
+			case STMT_RETURN:
+				statement->live_after.clear();
+				live = reads(value);
+				break;
+			case STMT_IF:
+				statement->live_condition = unite(find_liveness(statement->body, live), find_liveness(statement->otherwise, live));
+				live = unite(statement->live_condition, reads(value));
+				break;
+			case STMT_WHILE: {
+				// the condition is checked before the first iteration and after every iteration
+				std::set<int> head = unite(live, reads(value));
+				std::set<int> body;
+				while (true) {
+					body = find_liveness(statement->body, head);
+					std::set<int> next = unite(head, body);
+					if (next == head) break;
+					head = next;
+				}
+				statement->live_condition = unite(live, body);
+				live = head;
+				break;
+			}
+		}
+	}
+	return live;
+}
+
+/////////////////////
+// CODE GENERATION //
+/////////////////////
+
+static bool contains_call(const Expression& expression) {
+	if (expression.kind == EXPR_CALL) return true;
+	for (const ExpressionPtr& operand : expression.operands) {
+		if (contains_call(*operand)) return true;
+	}
+	return false;
+}
+
+// Sethi-Ullman number: stack cells needed to evaluate the expression
+static int need(const Expression& expression) {
+	const std::vector<ExpressionPtr>& operands = expression.operands;
+	switch (expression.kind) {
+		case EXPR_MEMORY:
+			return std::max(1, need(*operands[0]));
+		case EXPR_NEGATE:
+			return std::max(2, need(*operands[0]));
+		case EXPR_NOT:
+			return std::max(2, need(*operands[0]));
+		case EXPR_AND:
+		case EXPR_OR:
+			return std::max(need(*operands[0]), need(*operands[1]));
+		case EXPR_BINARY:
+			// the right operand goes first for - and /
+			if (expression.name == "-" || expression.name == "/") return std::max(need(*operands[1]), need(*operands[0]) + 1);
+			[[fallthrough]];
+		case EXPR_COMPARE: {
+			int lhs = need(*operands[0]), rhs = need(*operands[1]);
+			return (lhs == rhs) ? lhs + 1 : std::max(lhs, rhs);
+		}
+		case EXPR_CALL: {
+			int cells = 1;
+			for (size_t i = 0; i < operands.size(); ++i) {
+				cells = std::max(cells, static_cast<int>(i) + need(*operands[i]));
+			}
+			return cells;
+		}
+		default:
+			return 1;
+	}
+}
+
+// Order of operands of a commutative operator or a comparison
+static bool left_first(const Expression& lhs, const Expression& rhs) {
+	bool left_call = contains_call(lhs), right_call = contains_call(rhs);
+	if (left_call != right_call) return right_call;
+	return need(lhs) >= need(rhs);
+}
+
+static std::string negate_comparison(const std::string& op) {
+	if (op == "==") return "!=";
+	if (op == "!=") return "==";
+	if (op == "<")  return ">=";
+	if (op == "<=") return ">";
+	if (op == ">")  return "<=";
+	return "<";
+}
+
+// Comparison with swapped operands
+static std::string mirror_comparison(const std::string& op) {
+	if (op == "<")  return ">";
+	if (op == "<=") return ">=";
+	if (op == ">")  return "<";
+	if (op == ">=") return "<=";
+	return op;
+}
+
+// Jump taken if top OP next
+static const char* jump_command(const std::string& op) {
+	if (op == "==") return "JEQ";
+	if (op == "!=") return "JNE";
+	if (op == "<")  return "JB";
+	if (op == "<=") return "JBE";
+	if (op == ">")  return "JA";
+	return "JAE";
+}
+
+static bool always_returns(const std::vector<Statement>& statements) {
+	if (statements.empty()) return false;
+	const Statement& last = statements.back();
+	if (last.kind == STMT_RETURN) return true;
+	return last.kind == STMT_IF && always_returns(last.body) && always_returns(last.otherwise);
+}
+
+class CodeGenerator {
+private:
+	Module& module_;
+	ExpandedSource output_;
+	std::map<std::string, std::set<int>> clobbers_; // registers written by the function and its callees
+	unsigned labels_;
+	bool in_main_;
+	bool main_returns_; // main has a return before its end
+
+	void append(const std::string& line, int source_line, int column) {
+		if (!output_.origins.empty()) output_.text += '\n';
+		output_.text += line;
+		output_.origins.push_back(LineOrigin{source_line, column});
+	}
+
+	template <typename Node>
+	void emit(const Node& at, const char* command, const std::string& argument = "") {
+		std::string line = "\t";
+		line += command;
+		if (!argument.empty()) {
+			line += ' ';
+			line += argument;
+		}
+		append(line, at.line, at.column);
+	}
+
+	template <typename Node>
+	void emit_label(const Node& at, const std::string& label) {
+		std::string line = label;
+		line += ':';
+		append(line, at.line, at.column);
+	}
+
+	std::string new_label(const char* kind) {
+		std::string label = "_";
+		label += kind;
+		label += std::to_string(++labels_);
+		return label;
+	}
+
+	static std::string address(int value) {
+		std::string operand = "[";
+		operand += std::to_string(value);
+		operand += ']';
+		return operand;
+	}
+
+	static std::string register_address(int id) {
+		std::string operand = "[";
+		operand += REGISTER_NAMES[id];
+		operand += ']';
+		return operand;
+	}
+
+	void find_clobbers() {
+		for (const Function& function : module_.functions) {
+			for (int id = 0; id < function.locals; ++id) clobbers_[function.name].insert(id);
+		}
+		for (bool changed = true; changed; ) {
+			changed = false;
+			for (const Function& function : module_.functions) {
+				std::set<int>& clobbers = clobbers_[function.name];
+				size_t before = clobbers.size();
+				for (const std::string& callee : function.callees) {
+					clobbers.insert(clobbers_[callee].begin(), clobbers_[callee].end());
+				}
+				changed = changed || clobbers.size() != before;
+			}
+		}
+	}
+
+	/////////////////
+	// EXPRESSIONS //
+	/////////////////
+
+	// live: registers read after the expression
+	void generate(const Expression& expression, const std::set<int>& live) {
+		const std::vector<ExpressionPtr>& operands = expression.operands;
+		switch (expression.kind) {
+			case EXPR_NUMBER: emit(expression, "PUSH", std::to_string(expression.value)); break;
+			case EXPR_LOCAL:  emit(expression, "PUSHR", REGISTER_NAMES[expression.value]); break;
+			case EXPR_GLOBAL: emit(expression, "LOAD", address(expression.value)); break;
+			case EXPR_INPUT:  emit(expression, "IN"); break;
+			case EXPR_CALL:   generate_call(expression, live); break;
+
+			case EXPR_MEMORY: {
+				const Expression& index = *operands[0];
+				if (index.kind == EXPR_NUMBER) emit(expression, "LOAD", address(index.value));
+				else if (index.kind == EXPR_LOCAL) emit(expression, "LOAD", register_address(index.value));
+				else {
+					generate(index, live);
+					emit(expression, "LOAD");
+				}
+				break;
+			}
+
+			// 0 - x, SUB subtracts the next value from the top one
+			case EXPR_NEGATE:
+				generate(*operands[0], live);
+				emit(expression, "PUSH", "0");
+				emit(expression, "SUB");
+				break;
+
+			case EXPR_BINARY: {
+				const char* command = (expression.name == "+") ? "ADD" : (expression.name == "-") ? "SUB"
+				                    : (expression.name == "*") ? "MUL" : "DIV";
+				const Expression& lhs = *operands[0];
+				const Expression& rhs = *operands[1];
+
+				// lhs must be on top for - and /
+				bool commutative = expression.name == "+" || expression.name == "*";
+				const Expression& first = (commutative && left_first(lhs, rhs)) ? lhs : rhs;
+				const Expression& second = (&first == &lhs) ? rhs : lhs;
+				generate(first, unite(live, reads(&second)));
+				generate(second, live);
+				emit(expression, command);
+				break;
+			}
+
+			// conditions as values are 0 or 1
+			default: {
+				std::string is_false = new_label("false");
+				std::string done = new_label("done");
+				generate_condition(expression, is_false, false, live);
+				emit(expression, "PUSH", "1");
+				emit(expression, "JMP", done);
+				emit_label(expression, is_false);
+				emit(expression, "PUSH", "0");
+				emit_label(expression, done);
+				break;
+			}
+		}
+	}
+
+	// Registers live after the call and written by the callee are saved on the stack
+	// under the arguments, the result is moved over them by the scratch register
+	void generate_call(const Expression& call, const std::set<int>& live) {
+		const std::set<int>& clobbers = clobbers_[call.name];
+		std::vector<int> saved;
+		for (int id : live) {
+			if (clobbers.contains(id)) saved.push_back(id);
+		}
+
+		for (int id : saved) emit(call, "PUSHR", REGISTER_NAMES[id]);
+
+		std::set<int> restored = live;
+		for (int id : saved) restored.erase(id);
+		generate_arguments(call, restored);
+		emit(call, "CALL", call.name);
+
+		if (saved.empty()) return;
+		emit(call, "POPR", REGISTER_NAMES[SCRATCH_REGISTER]);
+		for (auto id = saved.rbegin(); id != saved.rend(); ++id) emit(call, "POPR", REGISTER_NAMES[*id]);
+		emit(call, "PUSHR", REGISTER_NAMES[SCRATCH_REGISTER]);
+	}
+
+	void generate_arguments(const Expression& call, const std::set<int>& live) {
+		const std::vector<ExpressionPtr>& arguments = call.operands;
+		for (size_t i = 0; i < arguments.size(); ++i) {
+			std::set<int> later = live;
+			for (size_t j = i + 1; j < arguments.size(); ++j) later = unite(later, reads(arguments[j].get()));
+			generate(*arguments[i], later);
+		}
+	}
+
+	// Jump to the label if the condition is jump_if
+	void generate_condition(const Expression& condition, const std::string& label, bool jump_if, const std::set<int>& live) {
+		const std::vector<ExpressionPtr>& operands = condition.operands;
+		switch (condition.kind) {
+			case EXPR_NUMBER:
+				if ((condition.value != 0) == jump_if) emit(condition, "JMP", label);
+				break;
+
+			case EXPR_NOT:
+				generate_condition(*operands[0], label, !jump_if, live);
+				break;
+
+			case EXPR_AND:
+			case EXPR_OR: {
+				// the right operand decides if the left one does not
+				bool decides = (condition.kind == EXPR_OR) == jump_if;
+				std::set<int> left_live = unite(live, reads(operands[1].get()));
+				if (decides) {
+					generate_condition(*operands[0], label, jump_if, left_live);
+					generate_condition(*operands[1], label, jump_if, live);
+				}
+				else {
+					std::string skip = new_label("skip");
+					generate_condition(*operands[0], skip, !jump_if, left_live);
+					generate_condition(*operands[1], label, jump_if, live);
+					emit_label(condition, skip);
+				}
+				break;
+			}
+
+			case EXPR_COMPARE: {
+				std::string op = jump_if ? condition.name : negate_comparison(condition.name);
+				const Expression& lhs = *operands[0];
+				const Expression& rhs = *operands[1];
+
+				// the jump compares the top value with the next one
+				if (left_first(lhs, rhs)) {
+					generate(lhs, unite(live, reads(&rhs)));
+					generate(rhs, live);
+					op = mirror_comparison(op);
+				}
+				else {
+					generate(rhs, unite(live, reads(&lhs)));
+					generate(lhs, live);
+				}
+				emit(condition, jump_command(op), label);
+				break;
+			}
+
+			default:
+				generate(condition, live);
+				emit(condition, "PUSH", "0");
+				emit(condition, jump_if ? "JNE" : "JEQ", label);
+				break;
+		}
+	}
+
+	////////////////
+	// STATEMENTS //
+	////////////////
+
+	void generate(const std::vector<Statement>& statements, bool last = false) {
+		for (size_t i = 0; i < statements.size(); ++i) {
+			generate(statements[i], last && i + 1 == statements.size());
+		}
+	}
+
+	// last: nothing is executed after the statement in the function
+	void generate(const Statement& statement, bool last) {
+		const Expression* value = statement.value.get();
+		const std::set<int>& live = statement.live_after;
+
+		switch (statement.kind) {
+			case STMT_ASSIGN: {
+				const Expression& target = *statement.target;
+				if (target.kind == EXPR_GLOBAL) {
+					generate(*value, live);
+					emit(statement, "STORE", address(target.value));
+				}
+				// value that is never read is not computed
+				else if (live.contains(target.value) || has_side_effects(*value)) {
+					std::set<int> after = live;
+					after.erase(target.value);
+					generate(*value, after);
+					emit(statement, "POPR", REGISTER_NAMES[target.value]);
+				}
+				break;
+			}
+
+			case STMT_STORE: {
+				const Expression& index = *statement.target;
+				if (index.kind == EXPR_NUMBER) {
+					generate(*value, live);
+					emit(statement, "STORE", address(index.value));
+				}
+				else if (index.kind == EXPR_LOCAL) {
+					generate(*value, unite(live, {index.value}));
+					emit(statement, "STORE", register_address(index.value));
+				}
+				else {
+					generate(*value, unite(live, reads(&index)));
+					generate(index, live);
+					emit(statement, "STORE");
+				}
+				break;
+			}
+
+			case STMT_OUT:
+				generate(*value, live);
+				emit(statement, "OUT");
+				break;
+
+			case STMT_EXPRESSION:
+				if (!has_side_effects(*value)) break;
+				generate(*value, live);
+				emit(statement, "POP");
+				break;
+
+			case STMT_RETURN:
+				generate_return(statement, last);
+				break;
+
+			case STMT_IF: {
+				std::string otherwise = new_label("else");
+				generate_condition(*value, otherwise, false, statement.live_condition);
+				generate(statement.body, last);
+
+				if (statement.otherwise.empty()) {
+					emit_label(statement, otherwise);
+					break;
+				}
+				std::string done = new_label("endif");
+				if (!always_returns(statement.body)) emit(statement, "JMP", done);
+				emit_label(statement, otherwise);
+				generate(statement.otherwise, last);
+				emit_label(statement, done);
+				break;
+			}
+
+			// the condition is at the bottom, so an iteration takes one jump
+			case STMT_WHILE: {
+				if (value->kind == EXPR_NUMBER && value->value == 0) break;
+
+				std::string body = new_label("loop");
+				std::string condition = new_label("while");
+				bool forever = value->kind == EXPR_NUMBER;
+				if (!forever) emit(statement, "JMP", condition);
+				emit_label(statement, body);
+				generate(statement.body);
+				if (forever) {
+					emit(statement, "JMP", body);
+					break;
+				}
+				emit_label(statement, condition);
+				generate_condition(*value, body, true, statement.live_condition);
+				break;
+			}
+		}
+	}
+
+	void generate_return(const Statement& statement, bool last) {
+		const Expression* value = statement.value.get();
+		if (in_main_) {
+			if (value != nullptr && has_side_effects(*value)) {
+				generate(*value, {});
+				emit(statement, "POP");
+			}
+			if (!last) {
+				emit(statement, "JMP", "_main_end");
+				main_returns_ = true;
+			}
+			return;
+		}
+
+		if (value == nullptr) {
+			emit(statement, "PUSH", "0");
+		}
+		// nothing is read after the call, the callee returns right to our caller
+		else if (value->kind == EXPR_CALL) {
+			generate_arguments(*value, {});
+			emit(statement, "JMP", value->name);
+			return;
+		}
+		else {
+			generate(*value, {});
+		}
+		emit(statement, "RET");
+	}
+
+	void generate_function(Function& function) {
+		find_liveness(function.body, {});
+		in_main_ = (function.name == "main");
+
+		if (in_main_) {
+			emit(function, "BEGIN");
+			for (const Global& global : module_.globals) {
+				if (global.value == 0) continue;
+				emit(function, "PUSH", std::to_string(global.value));
+				emit(function, "STORE", address(global.address));
+			}
+			generate(function.body, true);
+			if (main_returns_) emit_label(function, "_main_end");
+			emit(function, "END");
+			return;
+		}
+
+		// arguments are on the stack, the last one on top
+		emit_label(function, function.name);
+		for (int id = function.parameters - 1; id >= 0; --id) {
+			emit(function, "POPR", REGISTER_NAMES[id]);
+		}
+		generate(function.body, true);
+		if (!always_returns(function.body)) {
+			emit(function, "PUSH", "0");
+			emit(function, "RET");
+		}
+	}
+public:
+	explicit CodeGenerator(Module& module) :
+		module_(module), output_(), clobbers_(), labels_(0), in_main_(false), main_returns_(false) {}
+
+	ExpandedSource generate() {
+		find_clobbers();
+
+		// main goes first, it starts with BEGIN
+		for (Function& function : module_.functions) {
+			if (function.name == "main") generate_function(function);
+		}
+		for (Function& function : module_.functions) {
+			if (function.name != "main") generate_function(function);
+		}
+		return std::move(output_);
+	}
+};
+
+static ExpandedSource compile_text(const std::string& text, const std::string& source) {
+	std::vector<Token> tokens = tokenize(text, source);
+	Module module = SyntaxParser(tokens, source).parse();
+
+	ExpandedSource assembly = CodeGenerator(module).generate();
+	if (source != "<stream>") assembly.files.push_back(source);
+	return assembly;
+}
+
+ExpandedSource compiler_ns::compile(const std::string& filename) {
+	std::ifstream in(filename);
+	VERIFY_CONTRACT(in.is_open(), "Unable to open file " << filename);
+
+	std::stringstream text;
+	text << in.rdbuf();
+	return compile_text(text.str(), filename);
+}
+
+ExpandedSource compiler_ns::compile(std::istream& source) {
+	std::stringstream text;
+	text << source.rdbuf();
+	return compile_text(text.str(), "<stream>");
+}
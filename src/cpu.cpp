@@ -2,22 +2,169 @@
 #include "cpu.hpp"
 #include "command.hpp"
 #include "stack.hpp"
+#include "channel.hpp"
+#include "tracer.hpp"
+#include "recorder.hpp"
+#include "memo.hpp"
 
-#include <regex>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <sstream>
+
+/////////////
+// PROGRAM //
+/////////////
+
+Program::Program() : begin(0), end(0), debug_file(), debug_offset(0), debug_text() {}
+
+Program::~Program() {
+	for (Command* command : commands) {
+		delete command;
+	}
+}
+
+// Malformed section is treated as absent, it may be read while reporting another error
+static std::unique_ptr<DebugInfo> parse_debug_section(std::istream& in) {
+	auto info = std::make_unique<DebugInfo>();
+	std::string word;
+	in >> word;
+	if (word == "source") {
+		in >> std::ws;
+		std::getline(in, info->source);
+		in >> word;
+	}
+
+	size_t count = 0;
+	if (word != "lines" || !(in >> count)) return nullptr;
+	int line = 0;
+	for (size_t i = 0; i < count; ++i) {
+		int delta = 0, column = 0;
+		in >> delta >> column;
+		line += delta;
+		info->locations.push_back(SourceLocation{line, column});
+	}
+
+	if (!(in >> word >> count) || word != "labels") return nullptr;
+	for (size_t i = 0; i < count; ++i) {
+		std::string label;
+		int instruction = 0;
+		in >> label >> instruction;
+		info->labels[label] = instruction;
+	}
+
+	if (!in) return nullptr;
+	return info;
+}
+
+const DebugInfo* Program::debug_info() const {
+	std::call_once(debug_once_, [this] {
+		if (!debug_file.empty()) {
+			std::ifstream file(debug_file);
+			file.seekg(debug_offset);
+			if (file.good()) debug_info_ = parse_debug_section(file);
+		}
+		else if (!debug_text.empty()) {
+			std::istringstream text(debug_text);
+			debug_info_ = parse_debug_section(text);
+		}
+	});
+	return debug_info_.get();
+}
+
+std::string Program::describe(int pc) const {
+	const DebugInfo* info = debug_info();
+	if (info == nullptr || pc < 0 || pc >= (int)info->locations.size()) {
+		return "instruction " + std::to_string(pc);
+	}
+
+	const SourceLocation& location = info->locations[pc];
+	std::string result = info->source.empty() ? "line " : info->source + ":";
+	result += std::to_string(location.line);
+	result += ':';
+	result += std::to_string(location.column);
+	return result;
+}
 
 /////////
 // CPU //
 /////////
 
-CPU::CPU(const std::string& filename) : pos_(), next_(), begin(0), end(0) {
+// Context running on this thread, tells where an error happened
+static thread_local const CPU* running_cpu = nullptr;
+
+static void print_running_instruction() {
+	const CPU* cpu = running_cpu;
+	running_cpu = nullptr;
+	error_context_hook = nullptr; // an error while describing must not come here again
+	std::cout << SET_COLOR_RED << "    at " << cpu->program->describe(cpu->pc_register) << RESET_COLOR << '\n';
+}
+
+// Marks the context as running on this thread until the end of scope
+class RunningScope {
+private:
+	const CPU* previous_;
+public:
+	RunningScope(const CPU* cpu) : previous_(running_cpu) {
+		running_cpu = cpu;
+		error_context_hook = print_running_instruction;
+	}
+	~RunningScope() {
+		running_cpu = previous_;
+		error_context_hook = previous_ ? print_running_instruction : nullptr;
+	}
+};
+
+CPU::CPU(const std::string& filename) :
+	pos_(), next_(), budget_(UNLIMITED), has_deadline_(false), deadline_(),
+	memory_storage_(std::make_shared<int[]>(MEMORY_SIZE)),
+	program(std::make_shared<Program>()), memory(memory_storage_.get()),
+	executed(0), interrupt(false), slice_left(0), engine(ENGINE_VIRTUAL), scheduler(nullptr), input(&std::cin), output(&std::cout)
+{
 	// Check if the extension is correct
-	std::regex extension {"[A-Za-z_\\/\\-]+\\.bcode"};
-	bool correct_file_extension = std::regex_match(filename, extension);
-	VERIFY_CONTRACT(correct_file_extension, "ERROR: incorrect file extension. Expected .bcode file");
+	VERIFY_CONTRACT(has_extension(filename, ".bcode"), "ERROR: incorrect file extension. Expected .bcode file");
 
 	file_ = std::ifstream(filename);
+	VERIFY_CONTRACT(file_.good(), "ERROR: unable to open file " << filename);
+	registers = new int[REGS]();
+
+	load(file_, filename);
+	pc_register = program->begin;
+}
+
+CPU::CPU(std::istream& bytecode) :
+	pos_(), next_(), budget_(UNLIMITED), has_deadline_(false), deadline_(),
+	memory_storage_(std::make_shared<int[]>(MEMORY_SIZE)),
+	program(std::make_shared<Program>()), memory(memory_storage_.get()),
+	executed(0), interrupt(false), slice_left(0), engine(ENGINE_VIRTUAL), scheduler(nullptr), input(&std::cin), output(&std::cout)
+{
+	registers = new int[REGS]();
+
+	load(bytecode, "");
+	pc_register = program->begin;
+}
+
+CPU::CPU(std::shared_ptr<Program> decoded) :
+	pos_(), next_(), budget_(UNLIMITED), has_deadline_(false), deadline_(),
+	memory_storage_(std::make_shared<int[]>(MEMORY_SIZE)),
+	program(std::move(decoded)), memory(memory_storage_.get()),
+	executed(0), interrupt(false), slice_left(0), engine(ENGINE_VIRTUAL), scheduler(nullptr), input(&std::cin), output(&std::cout)
+{
+	registers = new int[REGS]();
+	pc_register = program->begin;
+}
+
+CPU::CPU(const CPU& parent, int entry) :
+	pos_(), next_(), budget_(parent.budget_), has_deadline_(parent.has_deadline_), deadline_(parent.deadline_),
+	memory_storage_(parent.memory_storage_),
+	program(parent.program), memory(memory_storage_.get()),
+	executed(0), interrupt(false), slice_left(0), engine(parent.engine), scheduler(parent.scheduler), channels(parent.channels),
+	input(parent.input), output(parent.output), profile(parent.profile)
+{
 	registers = new int[REGS];
-	pc_register = 0;
+	std::copy_n(parent.registers, REGS, registers);
+	pc_register = entry;
 }
 
 CPU::~CPU() {
@@ -31,43 +178,172 @@ CPU::~CPU() {
 	}
 }
 
-// read the .bcode file and run the byte code
-void CPU::run() {
+// read the byte code and make list of commands
+void CPU::load(std::istream& bytecode, const std::string& filename) {
 	unsigned current_line = 0;
+	bool fused_section = false;
 
 	// read byte code and make list of commands
-	while(!file_.eof()) {
+	while(!bytecode.eof()) {
 		// read line of byte code
-		file_.getline(line_, MAX_LINE);
+		bytecode.getline(line_, MAX_LINE);
 
 		VERIFY_CONTRACT(
-		    file_.good() || file_.eof(),
-		    "ERROR: Unable to read line from .bcode file\n");
+		    bytecode.good() || bytecode.eof(),
+		    "ERROR: Unable to read line of byte code\n");
 
 		pos_ = line_;
 		next_ = line_ + std::strlen(line_);
 
+		// skip empty lines (the file ends with a newline)
+		if (pos_ == next_) continue;
+
+		// the rest is the debug section, it is parsed only when needed
+		if (std::strcmp(line_, DEBUG_SECTION_MARKER) == 0) {
+			if (!filename.empty()) {
+				program->debug_file = filename;
+				program->debug_offset = bytecode.tellg();
+			}
+			else {
+				std::stringstream section;
+				section << bytecode.rdbuf();
+				program->debug_text = section.str();
+			}
+			break;
+		}
+
+		if (std::strcmp(line_, FUSED_SECTION_MARKER) == 0) {
+			fused_section = true;
+			continue;
+		}
+
+		// code is complete, the superinstruction replaces the first command of its sequence
+		if (fused_section) {
+			int pc, index;
+			int correct = sscanf(line_, "%d %d", &pc, &index);
+			VERIFY_CONTRACT(correct == 2, "ERROR: invalid .bcode file format. Incorrect superinstruction");
+
+			Command* fused = Command::get_superinstruction(index, program->code, pc);
+			delete program->commands[pc];
+			program->commands[pc] = fused;
+			program->superinstructions[pc] = index;
+			continue;
+		}
+
 		// scan command from line
 		int command_id, argument;
 		int correct = sscanf(line_, "%d %d", &command_id, &argument);
 
-		VERIFY_CONTRACT(correct, "ERROR: invalid .bcode file format. Unexpected symbol or incorrect id");
-		commands.push_back(Command::get_command(command_id, argument));
+		VERIFY_CONTRACT(correct == 2, "ERROR: invalid .bcode file format. Unexpected symbol or incorrect id");
+		program->commands.push_back(Command::get_command(command_id, argument));
+		program->code.push_back(Instruction{command_id, argument});
 
 		// remember the begin and end
-		if (command_id == 10) begin = current_line;
-		if (command_id == 19) end = current_line;
+		if (command_id == 10) program->begin = current_line;
+		if (command_id == 19) program->end = current_line;
 
 		++current_line;
 	}
+}
+
+void CPU::attach_channel(int id, std::shared_ptr<Channel> channel) {
+	VERIFY_CONTRACT(id >= 0, "ERROR: invalid channel id " << id);
+	if (id >= (int)channels.size()) {
+		channels.resize(id + 1);
+	}
+	channels[id] = std::move(channel);
+}
+
+void CPU::set_budget(unsigned long long instructions) {
+	budget_ = instructions;
+}
+
+void CPU::set_deadline(std::chrono::milliseconds timeout) {
+	has_deadline_ = true;
+	deadline_ = std::chrono::steady_clock::now() + timeout;
+}
+
+bool CPU::deadline_passed() const {
+	return has_deadline_ && (std::chrono::steady_clock::now() >= deadline_);
+}
 
-	// execute
-	pc_register = begin;
-	while (pc_register != static_cast<int>(end)) {
-		int size = (int)commands.size();
-		
+unsigned long long CPU::execute_virtual(unsigned long long n) {
+	Command* const* commands = program->commands.data();
+	int size = (int)program->commands.size();
+	int stop = static_cast<int>(program->end);
+
+	slice_left = n;
+	while (slice_left > 0 && pc_register != stop) {
 		VERIFY_CONTRACT((pc_register < size) && (pc_register >= 0), 
 			"ERROR: jump or call to non-existing pointer");
-		commands[pc_register]->execute(*this);
+		[[maybe_unused]] const int pc = pc_register;
+		[[maybe_unused]] const unsigned long long before = slice_left--;
+		commands[pc]->execute(*this);
+		TRACE_DISPATCH(pc, before - slice_left)
+
+		if (interrupt) break;
 	}
+	return n - slice_left;
+}
+
+CPUStatus CPU::run_for(unsigned long long n) {
+	int stop = static_cast<int>(program->end);
+	RunningScope running(this);
+
+	while (n > 0) {
+		if (pc_register == stop) return CPU_HALTED;
+		if (executed >= budget_) return CPU_BUDGET;
+		if (deadline_passed())   return CPU_DEADLINE;
+
+		// the deadline is only checked between chunks to keep the clock off the hot loop
+		unsigned long long chunk = std::min({n, budget_ - executed, DEADLINE_CHECK_PERIOD});
+		unsigned long long done = 0;
+		switch (engine) {
+			case ENGINE_VIRTUAL: done = execute_virtual(chunk); break;
+			case ENGINE_SWITCH:  done = execute_switch(chunk);  break;
+			case ENGINE_PROFILE: done = execute_profile(chunk); break;
+			case ENGINE_TRACE:   done = execute_trace(chunk);   break;
+		}
+		executed += done;
+		n -= done;
+
+		if (interrupt) {
+			interrupt = false;
+			// IN was the last executed instruction if the journal waits for its number
+			if (journal) journal->settle(executed - 1);
+			return (pc_register == stop) ? CPU_HALTED : CPU_YIELDED;
+		}
+	}
+
+	return (pc_register == stop) ? CPU_HALTED : CPU_RUNNING;
+}
+
+void CPU::run() {
+	CPUStatus status = CPU_RUNNING;
+	while (status == CPU_RUNNING || status == CPU_YIELDED) {
+		status = run_for(UNLIMITED);
+
+		// let other threads run, e.g. fill the channel we are waiting for
+		if (status == CPU_YIELDED) std::this_thread::yield();
+	}
+
+	VERIFY_CONTRACT(status != CPU_BUDGET, "ERROR: instruction budget exhausted after " << executed << " instructions");
+	VERIFY_CONTRACT(status != CPU_DEADLINE, "ERROR: deadline exceeded after " << executed << " instructions");
+}
+
+const CPU* CPU::running() {
+	return running_cpu;
+}
+
+int CPU::read_input() {
+	if (journal) {
+		// end the slice, so that run_for() knows the number of this instruction
+		interrupt = true;
+		return journal->read(*input);
+	}
+
+	int value;
+	bool correct = static_cast<bool>(*input >> value);
+	VERIFY_CONTRACT(correct, "ERROR: invalid input in IN command");
+	return value;
 }
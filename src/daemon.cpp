@@ -0,0 +1,43 @@
+#include "server.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Usage: daemon SOCKET [--workers PROCESSES] [--memo] [PROGRAM...]
+// Serves run requests of submit until SIGINT or SIGTERM.
+// --memo keeps results of pure routines between requests.
+// Programs given here are decoded before workers start, others on their first request
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc >= 2, "Unexpected arguments passed to make daemon");
+
+	std::string socket_path = argv[1];
+	unsigned workers = server_ns::DEFAULT_WORKERS;
+	std::vector<std::string> programs;
+	bool memo = false;
+	for (int i = 2; i < argc; ++i) {
+		std::string argument = argv[i];
+		if (argument == "--workers" && i + 1 < argc) {
+			workers = parse_number(argv[++i], argument, 1, std::numeric_limits<unsigned>::max());
+		}
+		else if (argument == "--memo") {
+			memo = true;
+		}
+		else {
+			programs.push_back(argument);
+		}
+	}
+
+	server_ns::Server server(socket_path, workers);
+	if (memo) server.enable_memoization();
+	for (const std::string& program : programs) {
+		server.preload(program);
+	}
+
+	std::cout << SET_COLOR_YELLOW << "Serving " << programs.size() << " preloaded programs on " << SET_COLOR_CYAN << socket_path
+	          << SET_COLOR_YELLOW << " with " << workers << " workers..." << RESET_COLOR << '\n';
+	server.serve();
+	std::cout << SET_COLOR_YELLOW << "Server stopped" << RESET_COLOR << '\n';
+	return 0;
+}
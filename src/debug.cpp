@@ -0,0 +1,216 @@
+#include "debugger.hpp"
+#include "parser.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace debug_ns;
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+
+// Number of stack values printed by default
+const unsigned PRINTED_STACK = 16;
+
+const char* const HELP =
+	"break LINE | LABEL | *PC    set a breakpoint (b)\n"
+	"delete LINE | LABEL | *PC   remove a breakpoint (d)\n"
+	"breakpoints                 list breakpoints\n"
+	"watch REG, unwatch REG      stop when the register changes\n"
+	"step                        execute one instruction (s)\n"
+	"next                        execute one instruction, CALL runs until it returns (n)\n"
+	"continue                    run until a breakpoint, a watch or the end (c)\n"
+	"where                       show the next instruction (w)\n"
+	"regs                        show registers (r)\n"
+	"stack [COUNT]               show the stack from the top\n"
+	"calls                       show the call stack\n"
+	"mem ADDRESS [COUNT]         show data memory\n"
+	"quit                        exit (q)\n";
+
+// The whole text as a non-negative number, -1 if it is not one
+static int read_number(const std::string& text) {
+	int value = -1;
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return (error == std::errc() && end == text.data() + text.size() && value >= 0) ? value : -1;
+}
+
+static int register_id(const std::string& name) {
+	for (int i = 0; i < REGS; ++i) {
+		if (name == REGISTER_NAMES[i]) return i;
+	}
+	return -1;
+}
+
+class Session {
+private:
+	CPU& cpu_;
+	Debugger& debugger_;
+	const SourceMap& map_;
+
+	// Instruction of LINE, LABEL or *PC, NO_PC if there is none
+	int location_to_pc(const std::string& location) const {
+		if (location.empty()) return NO_PC;
+		if (location[0] == '*') {
+			int pc = read_number(location.substr(1));
+			return (pc < 0) ? NO_PC : pc;
+		}
+		if (std::isdigit(static_cast<unsigned char>(location[0]))) {
+			int line = read_number(location);
+			return (line < 0) ? NO_PC : map_.line_to_pc(line);
+		}
+
+		auto label = map_.labels.find(location);
+		return (label != map_.labels.end()) ? label->second : NO_PC;
+	}
+
+	void print_instruction(int pc) const {
+		if (pc == static_cast<int>(cpu_.program->end)) {
+			printf("pc %d: END\n", pc);
+			return;
+		}
+		int line = map_.lines[pc];
+		printf(SET_COLOR_CYAN "pc %d" RESET_COLOR ", line %d: %s\n", pc, line, map_.text[line - 1].c_str());
+	}
+
+	void print_stop(StopReason reason) const {
+		switch (reason) {
+			case STOP_BREAKPOINT: printf(SET_COLOR_YELLOW "Breakpoint\n" RESET_COLOR); break;
+			case STOP_WATCH:
+				printf(SET_COLOR_YELLOW "%s changed: %d -> %d\n" RESET_COLOR,
+					REGISTER_NAMES[debugger_.watch_register], debugger_.old_value, debugger_.new_value);
+				break;
+			case STOP_HALTED: printf(SET_COLOR_YELLOW "Program finished after %llu instructions\n" RESET_COLOR, cpu_.executed); return;
+			case STOP_LIMIT:  printf(SET_COLOR_RED "Budget or deadline exceeded\n" RESET_COLOR); return;
+			default: break;
+		}
+		print_instruction(cpu_.pc_register);
+	}
+
+	void print_stack(VMStack stack, unsigned count) const {
+		printf("%u values:", stack.size());
+		for (unsigned i = 0; i < count && stack.size() > 0; ++i) {
+			printf(" %d", stack.top());
+			stack.pop();
+		}
+		printf("%s\n", (stack.size() > 0) ? " ..." : "");
+	}
+public:
+	Session(CPU& cpu, Debugger& debugger, const SourceMap& map) : cpu_(cpu), debugger_(debugger), map_(map) {}
+
+	// Returns false on quit
+	bool execute(const std::string& line) {
+		std::istringstream words(line);
+		std::string command, argument;
+		words >> command >> argument;
+
+		if (command.empty()) return true;
+
+		if (command == "q" || command == "quit") return false;
+		else if (command == "h" || command == "help") printf("%s", HELP);
+		else if (command == "b" || command == "break" || command == "d" || command == "delete") {
+			int pc = location_to_pc(argument);
+			if (pc < 0 || pc >= (int)cpu_.program->code.size()) {
+				printf(SET_COLOR_RED "No code at %s\n" RESET_COLOR, argument.c_str());
+				return true;
+			}
+			if (command[0] == 'b') debugger_.set_breakpoint(pc);
+			else debugger_.remove_breakpoint(pc);
+			print_instruction(pc);
+		}
+		else if (command == "breakpoints") {
+			for (int pc : debugger_.breakpoints()) print_instruction(pc);
+		}
+		else if (command == "watch" || command == "unwatch") {
+			int id = register_id(argument);
+			if (id < 0) {
+				printf(SET_COLOR_RED "No register %s\n" RESET_COLOR, argument.c_str());
+				return true;
+			}
+			if (command == "watch") debugger_.watch(id);
+			else debugger_.unwatch(id);
+		}
+		else if (command == "s" || command == "step")     print_stop(debugger_.step());
+		else if (command == "n" || command == "next")     print_stop(debugger_.step_over());
+		else if (command == "c" || command == "continue") print_stop(debugger_.resume());
+		else if (command == "w" || command == "where")    print_instruction(cpu_.pc_register);
+		else if (command == "r" || command == "regs") {
+			for (int i = 0; i < REGS; ++i) printf("%s=%d ", REGISTER_NAMES[i], cpu_.registers[i]);
+			printf("\n");
+		}
+		else if (command == "stack") {
+			int count = argument.empty() ? PRINTED_STACK : read_number(argument);
+			if (count < 0) {
+				printf(SET_COLOR_RED "Invalid count %s\n" RESET_COLOR, argument.c_str());
+				return true;
+			}
+			print_stack(cpu_.stack, count);
+		}
+		else if (command == "calls") {
+			// return addresses are the CALL instructions
+			VMStack calls(cpu_.call_stack);
+			while (calls.size() > 0) {
+				print_instruction(calls.top());
+				calls.pop();
+			}
+		}
+		else if (command == "mem") {
+			std::string count_text;
+			words >> count_text;
+			int address = read_number(argument);
+			int count = count_text.empty() ? 1 : read_number(count_text);
+			if (address < 0 || count < 0) {
+				printf(SET_COLOR_RED "Invalid address or count %s %s\n" RESET_COLOR, argument.c_str(), count_text.c_str());
+				return true;
+			}
+			for (int i = address; i - address < count && i < MEMORY_SIZE; ++i) {
+				printf("[%d] = %d\n", i, cpu_.memory[i]);
+			}
+		}
+		else {
+			printf(SET_COLOR_RED "Unknown command %s, type help\n" RESET_COLOR, command.c_str());
+		}
+		return true;
+	}
+};
+
+// Usage: debug FILE.bcode [--input FILE]
+// Source map is taken from the debug section of byte code or made from FILE.lng next to it.
+// Commands are read from stdin, IN reads from the input file or from stdin too
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc == 2 || (argc == 4 && std::strcmp(argv[2], "--input") == 0),
+		"Unexpected arguments passed to make debug");
+
+	std::string filename(argv[1]);
+	CPU cpu(filename);
+
+	const DebugInfo* info = cpu.program->debug_info();
+	std::string source = (info && !info->source.empty()) ? info->source : filename.substr(0, filename.rfind('.')) + ".lng";
+	SourceMap map = info ? load_source_map(*info, source) : load_source_map(source);
+	VERIFY_CONTRACT(map.lines.size() == cpu.program->code.size(), "ERROR: " << source << " does not match the byte code");
+
+	std::ifstream input;
+	if (argc == 4) {
+		input.open(argv[3]);
+		VERIFY_CONTRACT(input.is_open(), "ERROR: unable to open file " << argv[3]);
+		cpu.input = &input;
+	}
+
+	Debugger debugger(cpu);
+	Session session(cpu, debugger, map);
+
+	std::cout << SET_COLOR_YELLOW << "Debugging " << SET_COLOR_CYAN << filename << SET_COLOR_YELLOW
+	          << ", type help for commands\n" << RESET_COLOR;
+	session.execute("where");
+
+	std::string line;
+	while (printf("(debug) "), fflush(stdout), std::getline(std::cin, line)) {
+		if (!session.execute(line)) break;
+	}
+	return 0;
+}
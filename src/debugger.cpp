@@ -0,0 +1,281 @@
+#include "debugger.hpp"
+#include "command.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <sstream>
+
+using namespace debug_ns;
+
+const int CALL_ID = 20;
+const int POPR_ID = 40;
+
+////////////////
+// SOURCE MAP //
+////////////////
+
+int SourceMap::line_to_pc(int line) const {
+	for (size_t pc = 0; pc < lines.size(); ++pc) {
+		if (lines[pc] >= line) return static_cast<int>(pc);
+	}
+	return NO_PC;
+}
+
+static std::vector<std::string> read_lines(const std::string& source) {
+	std::ifstream in(source);
+	VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open file " << source);
+
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(in, line)) {
+		lines.push_back(line);
+	}
+	return lines;
+}
+
+SourceMap debug_ns::load_source_map(const std::string& source) {
+	Parser parser(source);
+	std::stringstream bytecode;
+	parser.parse(bytecode);
+
+	return SourceMap{parser.command_lines(), parser.labels(), read_lines(source)};
+}
+
+SourceMap debug_ns::load_source_map(const DebugInfo& info, const std::string& source) {
+	SourceMap map{{}, info.labels, read_lines(source)};
+	for (const SourceLocation& location : info.locations) {
+		map.lines.push_back(location.line);
+	}
+	return map;
+}
+
+///////////////////
+// PATCH COMMAND //
+///////////////////
+
+// Stands in place of the original instruction. On a breakpoint it stops before
+// the instruction, so the engine will run the patch again after resume,
+// the debugger steps over it with the original instruction
+class PatchCommand : public Command {
+private:
+	Debugger& debugger_;
+	Command* original_;
+	bool breakpoint_;
+	int watched_; // register written by the instruction if it is watched, -1 otherwise
+public:
+	PatchCommand(Debugger& debugger, Command* original, bool breakpoint, int watched) :
+		Command(0), debugger_(debugger), original_(original), breakpoint_(breakpoint), watched_(watched) {}
+
+	virtual void execute(CPU& cpu) override {
+		if (breakpoint_) {
+			debugger_.stop = STOP_BREAKPOINT;
+			cpu.interrupt = true;
+			return;
+		}
+
+		int before = (watched_ >= 0) ? cpu.registers[watched_] : 0;
+		original_->execute(cpu);
+		if (watched_ >= 0 && cpu.registers[watched_] != before) {
+			debugger_.stop = STOP_WATCH;
+			debugger_.watch_register = watched_;
+			debugger_.old_value = before;
+			debugger_.new_value = cpu.registers[watched_];
+			cpu.interrupt = true;
+		}
+	}
+};
+
+//////////////
+// DEBUGGER //
+//////////////
+
+Debugger::Debugger(CPU& cpu) :
+	cpu_(cpu), patches_(), breakpoints_(), watched_(), temporary_(NO_PC),
+	stop(STOP_NONE), watch_register(0), old_value(0), new_value(0) {}
+
+Debugger::~Debugger() {
+	while (!patches_.empty()) {
+		uninstall(patches_.begin()->first);
+	}
+}
+
+int Debugger::original_id(int pc) const {
+	auto patch = patches_.find(pc);
+	return (patch != patches_.end()) ? patch->second.id : cpu_.program->code[pc].id;
+}
+
+bool Debugger::needs_patch(int pc) const {
+	if (breakpoints_.contains(pc) || temporary_ == pc) return true;
+	return original_id(pc) == POPR_ID && watched_.contains(cpu_.program->code[pc].argument);
+}
+
+// A superinstruction runs its own copies of the commands after its head,
+// so a patch inside the sequence would never run. The head gets its plain command
+void Debugger::unfuse(int pc) {
+	Program& program = *cpu_.program;
+	std::vector<std::vector<int>> catalog = superinstruction_catalog();
+
+	std::vector<int> heads;
+	for (const auto& [head, index] : program.superinstructions) {
+		if (pc >= head && pc < head + (int)catalog[index].size()) heads.push_back(head);
+	}
+
+	for (int head : heads) {
+		bool patched = patches_.contains(head);
+		if (patched) uninstall(head);
+
+		delete program.commands[head];
+		program.commands[head] = Command::get_command(program.code[head].id, program.code[head].argument);
+		program.superinstructions.erase(head);
+
+		if (patched) install(head);
+	}
+}
+
+void Debugger::install(int pc) {
+	unfuse(pc);
+
+	Program& program = *cpu_.program;
+	int id = program.code[pc].id;
+	int argument = program.code[pc].argument;
+	bool watched = (id == POPR_ID) && watched_.contains(argument);
+
+	Patch patch{program.commands[pc], id, nullptr};
+	patch.patch = new PatchCommand(*this, patch.original,
+		breakpoints_.contains(pc) || temporary_ == pc, watched ? argument : -1);
+
+	program.commands[pc] = patch.patch;
+	program.code[pc].id = PATCHED_COMMAND_ID;
+	patches_[pc] = patch;
+}
+
+void Debugger::uninstall(int pc) {
+	Program& program = *cpu_.program;
+	Patch& patch = patches_.at(pc);
+
+	program.commands[pc] = patch.original;
+	program.code[pc].id = patch.id;
+	delete patch.patch;
+	patches_.erase(pc);
+}
+
+// Patch is made again on every change, so it knows what to check
+void Debugger::update_patch(int pc) {
+	if (patches_.contains(pc)) uninstall(pc);
+	if (needs_patch(pc)) install(pc);
+}
+
+void Debugger::set_breakpoint(int pc) {
+	VERIFY_CONTRACT(pc >= 0 && pc < (int)cpu_.program->code.size(), "ERROR: no instruction " << pc);
+	breakpoints_.insert(pc);
+	update_patch(pc);
+}
+
+void Debugger::remove_breakpoint(int pc) {
+	breakpoints_.erase(pc);
+	if (pc >= 0 && pc < (int)cpu_.program->code.size()) update_patch(pc);
+}
+
+const std::set<int>& Debugger::breakpoints() const {
+	return breakpoints_;
+}
+
+void Debugger::watch(int register_id) {
+	VERIFY_CONTRACT(register_id >= 0 && register_id < REGS, "ERROR: no register " << register_id);
+	watched_.insert(register_id);
+	for (int pc = 0; pc < (int)cpu_.program->code.size(); ++pc) {
+		if (original_id(pc) == POPR_ID) update_patch(pc);
+	}
+}
+
+void Debugger::unwatch(int register_id) {
+	watched_.erase(register_id);
+	for (int pc = 0; pc < (int)cpu_.program->code.size(); ++pc) {
+		if (original_id(pc) == POPR_ID) update_patch(pc);
+	}
+}
+
+StopReason Debugger::run() {
+	int end = static_cast<int>(cpu_.program->end);
+	stop = STOP_NONE;
+
+	while (true) {
+		CPUStatus status = cpu_.run_for(UNLIMITED);
+
+		if (stop == STOP_BREAKPOINT) {
+			// the patch is counted by the engine, but the instruction is not executed yet
+			--cpu_.executed;
+			return stop;
+		}
+		if (stop != STOP_NONE) return stop;
+		if (status == CPU_HALTED || cpu_.pc_register == end) return STOP_HALTED;
+		if (status == CPU_BUDGET || status == CPU_DEADLINE) return STOP_LIMIT;
+		// CPU_YIELDED by YIELD or IN, continue
+	}
+}
+
+StopReason Debugger::step() {
+	if (cpu_.pc_register == static_cast<int>(cpu_.program->end)) return STOP_HALTED;
+
+	// run the original instruction instead of the patch
+	int pc = cpu_.pc_register;
+	bool patched = patches_.contains(pc);
+	if (patched) uninstall(pc);
+
+	std::vector<int> before(cpu_.registers, cpu_.registers + REGS);
+	CPUStatus status = cpu_.run_for(1);
+
+	if (needs_patch(pc)) install(pc);
+
+	stop = STOP_STEP;
+	for (int register_id : watched_) {
+		if (cpu_.registers[register_id] != before[register_id]) {
+			stop = STOP_WATCH;
+			watch_register = register_id;
+			old_value = before[register_id];
+			new_value = cpu_.registers[register_id];
+		}
+	}
+
+	if (status == CPU_HALTED) return STOP_HALTED;
+	if (status == CPU_BUDGET || status == CPU_DEADLINE) return STOP_LIMIT;
+	return stop;
+}
+
+StopReason Debugger::step_over() {
+	int pc = cpu_.pc_register;
+	if (pc == static_cast<int>(cpu_.program->end) || original_id(pc) != CALL_ID) {
+		return step();
+	}
+
+	unsigned depth = cpu_.call_stack.size();
+	StopReason reason = step();
+	if (reason != STOP_STEP) return reason;
+
+	// stop when the call returns to the next instruction at the same depth, not in recursion
+	temporary_ = pc + 1;
+	update_patch(temporary_);
+	while (true) {
+		reason = run();
+		if (reason != STOP_BREAKPOINT || cpu_.pc_register != temporary_ || cpu_.call_stack.size() <= depth) break;
+		if (breakpoints_.contains(temporary_)) break;
+
+		reason = step();
+		if (reason != STOP_STEP) break;
+	}
+
+	int returned = temporary_;
+	temporary_ = NO_PC;
+	update_patch(returned);
+
+	// the temporary breakpoint is not a stop for the user
+	return (reason == STOP_BREAKPOINT && !breakpoints_.contains(cpu_.pc_register)) ? STOP_STEP : reason;
+}
+
+StopReason Debugger::resume() {
+	// leave the current instruction first, it may have a breakpoint
+	StopReason reason = step();
+	if (reason != STOP_STEP) return reason;
+	return run();
+}
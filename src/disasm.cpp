@@ -0,0 +1,223 @@
+#include "analysis.hpp"
+#include "command.hpp"
+#include "compiler.hpp"
+#include "parser.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace analysis_ns;
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+
+// Number of opcode pairs printed by default
+const unsigned PRINTED_PAIRS = 10;
+
+// Longest bar of histograms
+const unsigned HISTOGRAM_WIDTH = 40;
+
+// Source is parsed in memory, the debug section comes with the byte code
+static std::unique_ptr<CPU> load_program(const std::string& filename) {
+	if (!has_extension(filename, ".lng") && !has_extension(filename, compiler_ns::SOURCE_EXTENSION)) return std::make_unique<CPU>(filename);
+
+	Parser parser(filename);
+	std::stringstream bytecode;
+	parser.parse(bytecode);
+	return std::make_unique<CPU>(bytecode);
+}
+
+// Memory commands are named with their addressing mode
+static std::string opcode_name(int id) {
+	std::string name = get_command_name(id);
+	if (id / 10 == 6 && (id - 60) % 3 == ADDRESS_ABSOLUTE) name += " [ADDR]";
+	if (id / 10 == 6 && (id - 60) % 3 == ADDRESS_REGISTER) name += " [REG]";
+	return name;
+}
+
+class Listing {
+private:
+	const Program& program_;
+	const Analysis& analysis_;
+	const DebugInfo* info_;
+	std::multimap<int, std::string> labels_; // instruction to its labels
+	std::map<int, PureRoutine> pure_;
+
+	std::string target_name(int pc) const {
+		auto label = labels_.find(pc);
+		if (label != labels_.end()) return label->second;
+
+		std::string name = "<";
+		name += std::to_string(pc);
+		name += '>';
+		return name;
+	}
+
+	std::string operand(const Instruction& instruction) const {
+		int id = instruction.id;
+		int argument = instruction.argument;
+		std::string address = "[";
+		switch (id / 10) {
+			case 2: return target_name(argument);
+			case 3: return std::to_string(argument);
+			case 4: return (argument >= 0 && argument < REGS) ? REGISTER_NAMES[argument] : "?";
+			case 6:
+				if ((id - 60) % 3 == ADDRESS_STACK) return "";
+				address += ((id - 60) % 3 == ADDRESS_ABSOLUTE) ? std::to_string(argument) : REGISTER_NAMES[argument];
+				address += ']';
+				return address;
+			default: return "";
+		}
+	}
+
+	static std::string depth_text(int depth) {
+		switch (depth) {
+			case NO_DEPTH:      return "-";
+			case UNKNOWN_DEPTH: return "?";
+			case MIXED_DEPTH:   return "!";
+			default:            return std::to_string(depth);
+		}
+	}
+
+	std::string block_list(const std::vector<int>& blocks) const {
+		std::string text;
+		for (int block : blocks) {
+			if (!text.empty()) text += ", ";
+			text += std::to_string(block);
+		}
+		return text.empty() ? "none" : text;
+	}
+
+	// Blocks calling or spawning the routine, in order
+	std::vector<int> callers(int entry) const {
+		std::vector<int> blocks;
+		for (int pc = 0; pc < (int)program_.code.size(); ++pc) {
+			const Instruction& instruction = program_.code[pc];
+			bool called = has_target(instruction.id) && !is_branch(instruction.id) && instruction.argument == entry;
+			if (called && (blocks.empty() || blocks.back() != analysis_.block_of[pc])) {
+				blocks.push_back(analysis_.block_of[pc]);
+			}
+		}
+		return blocks;
+	}
+
+	void print_block_header(int index, const std::vector<int>& predecessors) const {
+		const BasicBlock& block = analysis_.blocks[index];
+		printf("\n" SET_COLOR_YELLOW "; block %d: pc %d-%d, from %s, to %s", index, block.begin, block.end - 1,
+			block_list(predecessors).c_str(), block_list(block.successors).c_str());
+
+		if (block.begin == static_cast<int>(program_.begin)) printf(", program entry");
+		else if (analysis_.routine[block.begin] == block.begin) {
+			auto effect = analysis_.returns.find(block.begin);
+			printf(", routine entered from %s", block_list(callers(block.begin)).c_str());
+			if (effect == analysis_.returns.end()) printf(", no return");
+			else printf(", stack effect %s", depth_text(effect->second).c_str());
+			if (pure_.contains(block.begin)) printf(", pure");
+		}
+		printf(RESET_COLOR "\n");
+	}
+public:
+	Listing(const Program& program, const Analysis& analysis) :
+		program_(program), analysis_(analysis), info_(program.debug_info()), labels_(), pure_(find_pure_routines(program)) {
+		// byte code without debug section gets a name for every target
+		if (info_ != nullptr) {
+			for (const auto& [name, pc] : info_->labels) labels_.emplace(pc, name);
+			return;
+		}
+		for (const Instruction& instruction : program.code) {
+			if (has_target(instruction.id) && !labels_.contains(instruction.argument)) {
+				std::string name = "L";
+				name += std::to_string(instruction.argument);
+				labels_.emplace(instruction.argument, name);
+			}
+		}
+	}
+
+	void print_code() const {
+		std::vector<std::vector<int>> predecessors(analysis_.blocks.size());
+		for (size_t i = 0; i < analysis_.blocks.size(); ++i) {
+			for (int successor : analysis_.blocks[i].successors) predecessors[successor].push_back(i);
+		}
+
+		printf(SET_COLOR_YELLOW "; %zu instructions, %zu blocks. Depth is the stack size before the instruction,\n"
+			"; relative to the entry of its routine (- unreachable, ? depends on values, ! paths disagree)" RESET_COLOR "\n",
+			program_.code.size(), analysis_.blocks.size());
+		if (info_ != nullptr && !info_->source.empty()) printf(SET_COLOR_YELLOW "; source %s" RESET_COLOR "\n", info_->source.c_str());
+
+		for (int pc = 0; pc < (int)program_.code.size(); ++pc) {
+			int block = analysis_.block_of[pc];
+			if (analysis_.blocks[block].begin == pc) print_block_header(block, predecessors[block]);
+
+			auto [first, last] = labels_.equal_range(pc);
+			for (auto label = first; label != last; ++label) {
+				printf(SET_COLOR_CYAN "%s:" RESET_COLOR "\n", label->second.c_str());
+			}
+
+			const Instruction& instruction = program_.code[pc];
+			std::string text = get_command_name(instruction.id);
+			text += ' ';
+			text += operand(instruction);
+			printf("%6d %5s    %-24s", pc, depth_text(analysis_.depth[pc]).c_str(), text.c_str());
+			if (info_ != nullptr && pc < (int)info_->locations.size()) {
+				printf(SET_COLOR_YELLOW "; line %d" RESET_COLOR, info_->locations[pc].line);
+			}
+			printf("\n");
+		}
+	}
+
+	void print_histograms(unsigned pairs) const {
+		std::vector<std::pair<unsigned, std::string>> opcodes;
+		for (const auto& [id, count] : analysis_.opcodes) opcodes.emplace_back(count, opcode_name(id));
+		print_histogram("opcodes", opcodes, opcodes.size());
+
+		std::vector<std::pair<unsigned, std::string>> adjacent;
+		for (const auto& [ids, count] : analysis_.opcode_pairs) {
+			std::string pair = opcode_name(ids.first);
+			pair += ", ";
+			pair += opcode_name(ids.second);
+			adjacent.emplace_back(count, pair);
+		}
+		print_histogram("adjacent opcodes in blocks", adjacent, pairs);
+	}
+
+	static void print_histogram(const char* title, std::vector<std::pair<unsigned, std::string>>& rows, size_t printed) {
+		std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		unsigned total = 0;
+		for (const auto& row : rows) total += row.first;
+		printf("\n" SET_COLOR_YELLOW "; %s (%zu kinds, %u in total)" RESET_COLOR "\n", title, rows.size(), total);
+
+		for (size_t i = 0; i < rows.size() && i < printed; ++i) {
+			unsigned bar = rows[i].first * HISTOGRAM_WIDTH / rows[0].first;
+			printf("%-28s %6u %5.1f%%  %s\n", rows[i].second.c_str(), rows[i].first,
+				100.0 * rows[i].first / total, std::string(std::max(bar, 1u), '#').c_str());
+		}
+	}
+};
+
+// Usage: disasm FILE.bcode | FILE.lng | FILE.lnx [--pairs COUNT]
+// Prints the code split into basic blocks with label names, stack depths and source lines,
+// then static histograms of opcodes and of adjacent opcode pairs
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc == 2 || (argc == 4 && std::strcmp(argv[2], "--pairs") == 0),
+		"Unexpected arguments passed to make disasm");
+
+	unsigned pairs = (argc == 4) ? parse_number(argv[3], argv[2], 0, std::numeric_limits<unsigned>::max()) : PRINTED_PAIRS;
+
+	std::unique_ptr<CPU> cpu = load_program(argv[1]);
+	const Program& program = *cpu->program;
+	Analysis analysis = analyze(program);
+
+	Listing listing(program, analysis);
+	listing.print_code();
+	listing.print_histograms(pairs);
+	return 0;
+}
@@ -0,0 +1,28 @@
+#include "fuzzer.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+
+// Usage: fuzz [ITERATIONS] [SEED]
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc <= 3, "Unexpected arguments passed to make fuzz");
+
+	const unsigned max = std::numeric_limits<unsigned>::max();
+	unsigned iterations = (argc >= 2) ? parse_number(argv[1], "ITERATIONS", 0, max) : 1000;
+	unsigned seed = (argc >= 3) ? parse_number(argv[2], "SEED", 0, max) : std::random_device()();
+
+	std::cout << SET_COLOR_YELLOW << "Fuzzing " << SET_COLOR_CYAN << iterations << SET_COLOR_YELLOW
+	          << " programs from seed " << SET_COLOR_CYAN << seed << SET_COLOR_YELLOW << "...\n" << RESET_COLOR;
+
+	unsigned failures = fuzzer_ns::fuzz(iterations, seed);
+	if (failures > 0) {
+		std::cout << SET_COLOR_RED << failures << " programs differ between engines\n" << RESET_COLOR;
+		return 1;
+	}
+
+	std::cout << SET_COLOR_GREEN << "All engines agree\n" << RESET_COLOR;
+	return 0;
+}
@@ -0,0 +1,386 @@
+#include "fuzzer.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <random>
+#include <sstream>
+
+using namespace fuzzer_ns;
+
+// Data cells used by generated programs, loop counters are stored right after them
+const int DATA_CELLS = 32;
+const int MAX_LOOP_DEPTH = 2;
+const int MAX_FUNCTIONS = 3;
+const int MAX_STATEMENTS = 12;
+
+// Number of memory cells compared between engines
+const int COMPARED_CELLS = DATA_CELLS + (MAX_FUNCTIONS + 1) * MAX_LOOP_DEPTH;
+
+// Generated programs are small, so this budget is only hit by a broken engine
+const unsigned long long FUZZ_BUDGET = 1000000;
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+const char* const CONDITIONAL_JUMPS[] = {"JEQ", "JNE", "JA", "JAE", "JB", "JBE"};
+const char* const VECTOR_BINARY[] = {"VADD", "VSUB", "VMUL", "VCMPEQ", "VCMPGT"};
+
+/////////////////
+// ENGINE LIST //
+/////////////////
+
+const std::vector<EngineConfig>& fuzzer_ns::engine_configs() {
+	static const std::vector<EngineConfig> configs {
+		{"virtual",        ENGINE_VIRTUAL, UNLIMITED},
+		{"switch",         ENGINE_SWITCH,  UNLIMITED},
+		{"virtual sliced", ENGINE_VIRTUAL, 3},
+		{"switch sliced",  ENGINE_SWITCH,  5},
+		{"profile",        ENGINE_PROFILE, UNLIMITED},
+		{"trace",          ENGINE_TRACE,   UNLIMITED},
+		{"trace sliced",   ENGINE_TRACE,   7},
+	};
+	return configs;
+}
+
+///////////////
+// GENERATOR //
+///////////////
+
+// Labels can't contain digits, so numbers are written with letters
+static std::string letters(unsigned number) {
+	std::string result;
+	do {
+		result.push_back(static_cast<char>('a' + number % 26));
+		number /= 26;
+	} while (number > 0);
+	return result;
+}
+
+static std::string memory_operand(int address) {
+	std::string operand = "[";
+	operand += std::to_string(address);
+	operand += ']';
+	return operand;
+}
+
+static std::string function_label(int index) {
+	return "fn_" + letters(index);
+}
+
+class Generator {
+private:
+	std::mt19937 rng_;
+	unsigned labels_;
+	int functions_;
+	int function_; // index of generated function, -1 for main
+
+	int random(int min, int max) {
+		return std::uniform_int_distribution<int>(min, max)(rng_);
+	}
+
+	std::string new_label(const char* prefix) {
+		return std::string(prefix) + "_" + letters(labels_++);
+	}
+
+	std::string random_register() {
+		return REGISTER_NAMES[random(0, REGS - 1)];
+	}
+
+	std::string data_address() {
+		return memory_operand(random(0, DATA_CELLS - 1));
+	}
+
+	// Lines pushing exactly one value
+	void expression(std::vector<std::string>& lines, int levels) {
+		int kind = random(0, (levels > 0) ? 7 : 3);
+		switch (kind) {
+			case 0:
+				lines.push_back("PUSH " + std::to_string(random(-20, 20)));
+				break;
+			case 1:
+				lines.push_back("PUSHR " + random_register());
+				break;
+			case 2:
+				lines.push_back("LOAD " + data_address());
+				break;
+			case 3: {
+				int length = random(0, 8);
+				lines.push_back("PUSH " + std::to_string(random(0, DATA_CELLS - length)));
+				lines.push_back("PUSH " + std::to_string(length));
+				lines.push_back("VSUM");
+				break;
+			}
+			case 4:
+			case 5:
+			case 6: {
+				static const char* const operations[] = {"ADD", "SUB", "MUL"};
+				expression(lines, levels - 1);
+				expression(lines, levels - 1);
+				lines.push_back(operations[kind - 4]);
+				break;
+			}
+			case 7: {
+				// divisor is pushed first, it is never 0 or -1
+				int divisor = random(1, 9) * (random(0, 1) ? 1 : -1);
+				lines.push_back("PUSH " + std::to_string(divisor == -1 ? 2 : divisor));
+				expression(lines, levels - 1);
+				lines.push_back("DIV");
+				break;
+			}
+		}
+	}
+
+	Statement simple_statement() {
+		Statement statement;
+		expression(statement.head, 2);
+		switch (random(0, 3)) {
+			case 0: statement.head.push_back("OUT"); break;
+			case 1: statement.head.push_back("POPR " + random_register()); break;
+			case 2: statement.head.push_back("STORE " + data_address()); break;
+			case 3: statement.head.push_back("POP"); break;
+		}
+		return statement;
+	}
+
+	Statement vector_statement() {
+		Statement statement;
+		int length = random(0, 8);
+		auto address = [&] { return "PUSH " + std::to_string(random(0, DATA_CELLS - length)); };
+
+		if (random(0, 1)) {
+			for (int i = 0; i < length; ++i) {
+				statement.head.push_back("PUSH " + std::to_string(random(-50, 50)));
+			}
+			statement.head.push_back(address());
+			statement.head.push_back("PUSH " + std::to_string(length));
+			statement.head.push_back("VSTORE");
+		}
+		else {
+			statement.head.push_back(address());
+			statement.head.push_back(address());
+			statement.head.push_back(address());
+			statement.head.push_back("PUSH " + std::to_string(length));
+			statement.head.push_back(VECTOR_BINARY[random(0, 4)]);
+		}
+		return statement;
+	}
+
+	Statement condition_statement(int depth) {
+		Statement statement;
+		std::string skip = new_label("skip");
+		expression(statement.head, 1);
+		expression(statement.head, 1);
+		statement.head.push_back(std::string(CONDITIONAL_JUMPS[random(0, 5)]) + " " + skip);
+		statement.body = block(depth, random(1, 3));
+		statement.tail.push_back(skip + ":");
+		return statement;
+	}
+
+	// Counter of the loop is kept in memory, every function and depth has its own cell
+	Statement loop_statement(int depth) {
+		Statement statement;
+		std::string loop = new_label("loop");
+		std::string counter = memory_operand(DATA_CELLS + (function_ + 1) * MAX_LOOP_DEPTH + depth);
+
+		statement.head.push_back("PUSH " + std::to_string(random(1, 4)));
+		statement.head.push_back("STORE " + counter);
+		statement.head.push_back(loop + ":");
+		statement.body = block(depth + 1, random(1, 3));
+		statement.tail = {
+			"PUSH 1", "LOAD " + counter, "SUB", "STORE " + counter,
+			"PUSH 0", "LOAD " + counter, "JA " + loop
+		};
+		return statement;
+	}
+
+	Statement call_statement() {
+		Statement statement;
+		statement.head.push_back("CALL " + function_label(random(function_ + 1, functions_ - 1)));
+		return statement;
+	}
+
+	Statement statement(int depth) {
+		bool can_call = function_ + 1 < functions_;
+		while (true) {
+			switch (random(0, 9)) {
+				case 0: case 1: case 2: case 3:
+					return simple_statement();
+				case 4:
+					return vector_statement();
+				case 5: case 6:
+					return condition_statement(depth);
+				case 7:
+					if (depth < MAX_LOOP_DEPTH) return loop_statement(depth);
+					break;
+				case 8:
+					if (can_call) return call_statement();
+					break;
+				case 9:
+					// values pushed at the top level of main stay until END
+					if (function_ == -1 && depth == 0) {
+						Statement push;
+						expression(push.head, 0);
+						return push;
+					}
+					break;
+			}
+		}
+	}
+
+	std::vector<Statement> block(int depth, int size) {
+		std::vector<Statement> statements;
+		for (int i = 0; i < size; ++i) {
+			statements.push_back(statement(depth));
+		}
+		return statements;
+	}
+public:
+	Generator(unsigned seed) : rng_(seed), labels_(0), functions_(0), function_(-1) {}
+
+	GeneratedProgram generate() {
+		GeneratedProgram program;
+		functions_ = random(0, MAX_FUNCTIONS);
+
+		function_ = -1;
+		program.main = block(0, random(1, MAX_STATEMENTS));
+		for (function_ = 0; function_ < functions_; ++function_) {
+			program.functions.push_back(block(0, random(1, MAX_STATEMENTS / 2)));
+		}
+		return program;
+	}
+};
+
+GeneratedProgram fuzzer_ns::generate(unsigned seed) {
+	return Generator(seed).generate();
+}
+
+static void render(const std::vector<Statement>& statements, int depth, std::ostringstream& out) {
+	std::string indent(depth + 1, '\t');
+	for (const Statement& statement : statements) {
+		for (const std::string& line : statement.head) out << indent << line << '\n';
+		render(statement.body, depth + 1, out);
+		for (const std::string& line : statement.tail) out << indent << line << '\n';
+	}
+}
+
+std::string GeneratedProgram::source() const {
+	std::ostringstream out;
+	out << "BEGIN\n";
+	render(main, 0, out);
+	out << "END\n";
+
+	for (size_t i = 0; i < functions.size(); ++i) {
+		out << function_label(i) << ":\n";
+		render(functions[i], 0, out);
+		out << "\tRET\n";
+	}
+
+	// parser does not accept a newline at the end of file
+	std::string source = out.str();
+	source.pop_back();
+	return source;
+}
+
+///////////////
+// EXECUTION //
+///////////////
+
+Outcome fuzzer_ns::execute(const std::string& source, const EngineConfig& config) {
+	std::istringstream text(source);
+	std::stringstream bytecode;
+	Parser parser(text);
+	parser.parse(bytecode);
+
+	CPU cpu(bytecode);
+	std::ostringstream output;
+	cpu.output = &output;
+	cpu.engine = config.engine;
+	cpu.set_budget(FUZZ_BUDGET);
+
+	CPUStatus status = CPU_RUNNING;
+	while (status == CPU_RUNNING || status == CPU_YIELDED) {
+		status = cpu.run_for(config.slice);
+	}
+
+	Outcome outcome{status, output.str(), {}, {}, {}, cpu.executed};
+
+	VMStack stack(cpu.stack);
+	while (stack.size() > 0) {
+		outcome.stack.push_back(stack.top());
+		stack.pop();
+	}
+	outcome.registers.assign(cpu.registers, cpu.registers + REGS);
+	outcome.memory.assign(cpu.memory, cpu.memory + COMPARED_CELLS);
+	return outcome;
+}
+
+static std::string describe_difference(const Outcome& expected, const Outcome& actual) {
+	if (expected.status != actual.status)       return "status";
+	if (expected.output != actual.output)       return "output";
+	if (expected.stack != actual.stack)         return "stack";
+	if (expected.registers != actual.registers) return "registers";
+	if (expected.memory != actual.memory)       return "memory";
+	return "instruction count";
+}
+
+std::string fuzzer_ns::compare_engines(const GeneratedProgram& program) {
+	std::string source = program.source();
+	const std::vector<EngineConfig>& configs = engine_configs();
+
+	Outcome reference = execute(source, configs.front());
+	for (size_t i = 1; i < configs.size(); ++i) {
+		Outcome outcome = execute(source, configs[i]);
+		if (!(outcome == reference)) {
+			return std::string(configs[i].name) + " differs from " + configs.front().name +
+				" in " + describe_difference(reference, outcome);
+		}
+	}
+	return "";
+}
+
+//////////////////
+// MINIMIZATION //
+//////////////////
+
+// Try to remove one statement of the block or of its nested blocks keeping the failure.
+// Blocks are visited while walking, because erase() moves the statements and their bodies
+static bool remove_from_block(GeneratedProgram& program, std::vector<Statement>& block) {
+	for (size_t i = block.size(); i-- > 0; ) {
+		Statement removed = block[i];
+		block.erase(block.begin() + i);
+
+		if (!compare_engines(program).empty()) return true;
+		block.insert(block.begin() + i, std::move(removed));
+
+		if (remove_from_block(program, block[i].body)) return true;
+	}
+	return false;
+}
+
+// Try to remove one statement keeping the failure, return false if nothing can be removed
+static bool remove_one_statement(GeneratedProgram& program) {
+	if (remove_from_block(program, program.main)) return true;
+	for (std::vector<Statement>& function : program.functions) {
+		if (remove_from_block(program, function)) return true;
+	}
+	return false;
+}
+
+GeneratedProgram fuzzer_ns::minimize(GeneratedProgram program) {
+	while (remove_one_statement(program)) {}
+	return program;
+}
+
+unsigned fuzzer_ns::fuzz(unsigned iterations, unsigned seed) {
+	unsigned failures = 0;
+	for (unsigned i = 0; i < iterations; ++i) {
+		GeneratedProgram program = generate(seed + i);
+		std::string difference = compare_engines(program);
+		if (difference.empty()) continue;
+
+		++failures;
+		GeneratedProgram minimal = minimize(program);
+		printf(SET_COLOR_RED "Seed %u: %s" RESET_COLOR "\nMinimized program:\n%s\n",
+			seed + i, compare_engines(minimal).c_str(), minimal.source().c_str());
+	}
+	return failures;
+}
@@ -0,0 +1,112 @@
+#include "golden.hpp"
+#include "compiler.hpp"
+#include "parser.hpp"
+#include "cpu.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+using namespace golden_ns;
+using Clock = std::chrono::steady_clock;
+
+static double milliseconds_between(Clock::time_point begin, Clock::time_point end) {
+	return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+static std::string read_file(const std::string& filename) {
+	std::ifstream file(filename);
+	VERIFY_CONTRACT(file.good(), "ERROR: unable to open file " << filename);
+
+	std::stringstream content;
+	content << file.rdbuf();
+	return content.str();
+}
+
+std::vector<GoldenCase> golden_ns::find_cases(const std::string& programs) {
+	namespace fs = std::filesystem;
+
+	std::vector<GoldenCase> cases;
+	fs::path directory = fs::path(programs) / GOLDEN_DIRECTORY;
+	if (!fs::is_directory(directory)) return cases;
+
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory)) {
+		if (entry.path().extension() != ".out") continue;
+
+		std::string name = entry.path().stem().string();
+		std::string program = name.substr(0, name.find('.'));
+		fs::path input = directory / (name + ".in");
+		fs::path source = fs::path(programs) / (program + ".lng");
+		if (!fs::exists(source)) source.replace_extension(compiler_ns::SOURCE_EXTENSION);
+
+		cases.push_back(GoldenCase{
+			name,
+			source.string(),
+			fs::exists(input) ? input.string() : "",
+			entry.path().string()
+		});
+	}
+
+	std::sort(cases.begin(), cases.end(),
+		[](const GoldenCase& lhs, const GoldenCase& rhs) { return lhs.name < rhs.name; });
+	return cases;
+}
+
+// Print the first line where outputs differ
+static void print_difference(const std::string& expected, const std::string& actual) {
+	std::istringstream expected_lines(expected), actual_lines(actual);
+	std::string expected_line, actual_line;
+
+	for (unsigned line = 1; ; ++line) {
+		bool has_expected = static_cast<bool>(std::getline(expected_lines, expected_line));
+		bool has_actual = static_cast<bool>(std::getline(actual_lines, actual_line));
+		if (!has_expected && !has_actual) return;
+
+		if (!has_expected) expected_line = "<end of output>";
+		if (!has_actual) actual_line = "<end of output>";
+		if (expected_line != actual_line) {
+			printf("line %u: expected '%s', got '%s'\n", line, expected_line.c_str(), actual_line.c_str());
+			return;
+		}
+	}
+}
+
+bool golden_ns::run_case(const GoldenCase& test) {
+	Clock::time_point start = Clock::now();
+
+	std::stringstream bytecode;
+	Parser parser(test.program);
+	parser.parse(bytecode);
+	Clock::time_point parsed = Clock::now();
+
+	CPU cpu(bytecode);
+	Clock::time_point loaded = Clock::now();
+
+	std::istringstream input(test.input.empty() ? "" : read_file(test.input));
+	std::ostringstream output;
+	cpu.input = &input;
+	cpu.output = &output;
+
+	Scheduler scheduler;
+	scheduler.add(cpu);
+	scheduler.run();
+	Clock::time_point finished = Clock::now();
+
+	printf("%llu instructions, parse %.3f ms, load %.3f ms, run %.3f ms\n",
+		scheduler.executed(),
+		milliseconds_between(start, parsed),
+		milliseconds_between(parsed, loaded),
+		milliseconds_between(loaded, finished));
+
+	std::string expected = read_file(test.expected);
+	if (output.str() != expected) {
+		print_difference(expected, output.str());
+		return false;
+	}
+	return true;
+}
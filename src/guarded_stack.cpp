@@ -0,0 +1,121 @@
+#include "guarded_stack.hpp"
+#include "utils.hpp"
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace stack_ns;
+
+// LINUX SPECIFIC CODE
+
+//////////////
+// REGISTRY //
+//////////////
+
+// Rooms of guarded stacks, read by the signal handler without locks.
+// Entries are never freed, released ones are reused by new stacks
+struct GuardedRegion {
+	std::atomic<uintptr_t> room{0}; // 0 if the entry is free
+	GuardedRegion* next = nullptr;
+};
+
+static std::atomic<GuardedRegion*> regions{nullptr};
+static std::mutex regions_mutex;
+static struct sigaction previous_action;
+
+static size_t page_size() {
+	static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return size;
+}
+
+// Access to a guard page is an error of the running program, the process
+// ends as on VERIFY_CONTRACT. Other faults go to the previous handler
+static void guard_page_fault(int signal, siginfo_t* info, void* context) {
+	uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+	size_t page = page_size();
+
+	for (GuardedRegion* region = regions.load(std::memory_order_acquire); region != nullptr; region = region->next) {
+		uintptr_t room = region->room.load(std::memory_order_acquire);
+		if (room == 0) continue;
+
+		if (address >= room - page && address < room) {
+			TERMINATE("ERROR: cannot read top element of empty stack");
+		}
+		if (address >= room + GUARDED_STACK_BYTES && address < room + GUARDED_STACK_BYTES + page) {
+			TERMINATE("ERROR: stack overflow, the stack is limited to " << GUARDED_STACK_BYTES << " bytes");
+		}
+	}
+
+	if (previous_action.sa_flags & SA_SIGINFO) {
+		previous_action.sa_sigaction(signal, info, context);
+		return;
+	}
+	// the access is repeated after return and handled by the previous action
+	sigaction(SIGSEGV, &previous_action, nullptr);
+}
+
+static void install_handler() {
+	struct sigaction action {};
+	action.sa_sigaction = guard_page_fault;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	VERIFY_CONTRACT(sigaction(SIGSEGV, &action, &previous_action) == 0, "ERROR: unable to set SIGSEGV handler");
+}
+
+static void add_region(uintptr_t room) {
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	for (GuardedRegion* region = regions.load(); region != nullptr; region = region->next) {
+		if (region->room.load() != 0) continue;
+		region->room.store(room, std::memory_order_release);
+		return;
+	}
+
+	GuardedRegion* region = new GuardedRegion();
+	region->room.store(room);
+	region->next = regions.load();
+	regions.store(region, std::memory_order_release);
+}
+
+static void remove_region(uintptr_t room) {
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	for (GuardedRegion* region = regions.load(); region != nullptr; region = region->next) {
+		if (region->room.load() == room) {
+			region->room.store(0, std::memory_order_release);
+			return;
+		}
+	}
+}
+
+///////////////////
+// GUARDED ROOMS //
+///////////////////
+
+void* stack_ns::reserve_guarded_region() {
+	static std::once_flag installed;
+	std::call_once(installed, install_handler);
+
+	size_t page = page_size();
+	VERIFY_CONTRACT(GUARDED_STACK_BYTES % page == 0, "ERROR: guarded stack must take whole pages");
+
+	// the whole region is inaccessible, then the room between the guard pages is opened.
+	// MAP_NORESERVE: untouched pages of the room take neither memory nor swap
+	size_t total = GUARDED_STACK_BYTES + 2 * page;
+	void* region = mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	VERIFY_CONTRACT(region != MAP_FAILED, "ERROR: unable to reserve memory for stack");
+
+	char* room = static_cast<char*>(region) + page;
+	VERIFY_CONTRACT(mprotect(room, GUARDED_STACK_BYTES, PROT_READ | PROT_WRITE) == 0,
+		"ERROR: unable to open memory for stack");
+
+	add_region(reinterpret_cast<uintptr_t>(room));
+	return room;
+}
+
+void stack_ns::release_guarded_region(void* room) {
+	remove_region(reinterpret_cast<uintptr_t>(room));
+	munmap(static_cast<char*>(room) - page_size(), GUARDED_STACK_BYTES + 2 * page_size());
+}
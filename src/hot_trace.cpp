@@ -0,0 +1,243 @@
+#include "hot_trace.hpp"
+#include "analysis.hpp"
+#include "command.hpp"
+#include "tracer.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+
+using namespace hot_trace_ns;
+using namespace analysis_ns;
+
+/////////////////
+// TRACE CACHE //
+/////////////////
+
+TraceCache::TraceCache(const Program& program) :
+	hotness_(program.code.size(), 0), trace_of_(program.code.size(), -1), traces_(),
+	recording_(false), recorded_(), stats() {}
+
+void TraceCache::jumped_back(int target) {
+	if (trace_of_[target] >= 0 || ++hotness_[target] < HOT_LOOP_THRESHOLD) return;
+	recording_ = true;
+	recorded_ = Trace{target, {}, 0};
+}
+
+void TraceCache::abort() {
+	hotness_[recorded_.head] = -RETRY_BACKOFF;
+	recording_ = false;
+	++stats.aborted;
+}
+
+void TraceCache::interrupted() {
+	if (recording_) abort();
+}
+
+// Command id-s executed by the trace as they are, jumps become guards
+static bool traceable(int id) {
+	switch (id) {
+		case 11: case 12: case 13: case 14: case 15: case 16: // POP, ADD, SUB, MUL, DIV, OUT
+		case 30: case 40: case 41:                            // PUSH, POPR, PUSHR
+		case 60: case 61: case 62: case 63: case 64: case 65: // LOAD, STORE
+			return true;
+	}
+	return false;
+}
+
+void TraceCache::record(const Program& program, int pc, int length, int next) {
+	for (int i = 0; i < length; ++i) {
+		const Instruction& instruction = program.code[pc + i];
+		int id = instruction.id;
+		recorded_.instructions += 1;
+
+		if (id == JMP_ID) {
+			// JMP does nothing in the trace, the next operation follows the target
+			recorded_.ops.push_back(TraceOp{id, 0, pc + i, -1, recorded_.instructions});
+			continue;
+		}
+		if (is_conditional(id)) {
+			// the guard leaves the trace if the jump goes the other way
+			bool taken = (next == instruction.argument) && (next != pc + i + 1);
+			int exit = taken ? pc + i + 1 : instruction.argument;
+			recorded_.ops.push_back(TraceOp{taken ? inverse_condition(id) : id, 0, pc + i, exit, recorded_.instructions});
+			continue;
+		}
+		if (!traceable(id)) {
+			abort();
+			return;
+		}
+		recorded_.ops.push_back(TraceOp{id, instruction.argument, pc + i, -1, recorded_.instructions});
+	}
+
+	if (recorded_.instructions > MAX_TRACE_LENGTH) {
+		abort();
+		return;
+	}
+	if (next != recorded_.head) return;
+
+	trace_of_[recorded_.head] = (int)traces_.size();
+	traces_.push_back(std::move(recorded_));
+	recording_ = false;
+	++stats.recorded;
+}
+
+//////////////////
+// TRACE ENGINE //
+//////////////////
+
+static int checked_address(int address) {
+	VERIFY_CONTRACT((address >= 0) && (address < MEMORY_SIZE),
+		"ERROR: address " << address << " is out of data memory");
+	return address;
+}
+
+// Pop two operands: rhs is the top of the stack, lhs is the next one
+#define POP_OPERANDS(rhs, lhs) \
+	int rhs = stack.top(); \
+	stack.pop(); \
+	int lhs = stack.top(); \
+	stack.pop();
+
+// Leave the trace if the jump of the guard is taken
+#define GUARD(condition) { \
+	POP_OPERANDS(rhs, lhs) \
+	if (condition) { \
+		TRACE_INSTRUCTION(op.pc, program->code[op.pc].id) \
+		pc_register = op.exit; \
+		++traces->stats.side_exits; \
+		return done + op.executed; \
+	} \
+	break; \
+}
+
+unsigned long long CPU::run_trace(const hot_trace_ns::Trace& loop, unsigned long long n) {
+	++traces->stats.entered;
+
+	unsigned long long done = 0;
+	while (n - done >= loop.instructions) {
+		for (const TraceOp& op : loop.ops) {
+			// errors tell the instruction of the operation
+			pc_register = op.pc;
+
+			switch (op.id) {
+				case 11: // POP
+					stack.pop();
+					break;
+				case 12: { // ADD
+					POP_OPERANDS(rhs, lhs)
+					stack.push(rhs + lhs);
+					break;
+				}
+				case 13: { // SUB
+					POP_OPERANDS(rhs, lhs)
+					stack.push(rhs - lhs);
+					break;
+				}
+				case 14: { // MUL
+					POP_OPERANDS(rhs, lhs)
+					stack.push(rhs * lhs);
+					break;
+				}
+				case 15: { // DIV
+					POP_OPERANDS(rhs, lhs)
+					stack.push(rhs / lhs);
+					break;
+				}
+				case 16: // OUT
+					*output << stack.top() << std::endl;
+					stack.pop();
+					break;
+				case 21: // JMP
+					break;
+				case 22: GUARD(rhs == lhs) // JEQ
+				case 23: GUARD(rhs != lhs) // JNE
+				case 24: GUARD(rhs >  lhs) // JA
+				case 25: GUARD(rhs >= lhs) // JAE
+				case 26: GUARD(rhs <  lhs) // JB
+				case 27: GUARD(rhs <= lhs) // JBE
+				case 30: // PUSH
+					stack.push(op.operand);
+					break;
+				case 40: // POPR
+					registers[op.operand] = stack.top();
+					stack.pop();
+					break;
+				case 41: // PUSHR
+					stack.push(registers[op.operand]);
+					break;
+				case 60 + ADDRESS_ABSOLUTE: // LOAD [address]
+					stack.push(memory[op.operand]);
+					break;
+				case 60 + ADDRESS_REGISTER: // LOAD [register]
+					stack.push(memory[checked_address(registers[op.operand])]);
+					break;
+				case 60 + ADDRESS_STACK: { // LOAD
+					int& top = stack.top();
+					top = memory[checked_address(top)];
+					break;
+				}
+				case 63 + ADDRESS_ABSOLUTE: // STORE [address]
+					memory[op.operand] = stack.top();
+					stack.pop();
+					break;
+				case 63 + ADDRESS_REGISTER: // STORE [register]
+					memory[checked_address(registers[op.operand])] = stack.top();
+					stack.pop();
+					break;
+				case 63 + ADDRESS_STACK: { // STORE
+					int address = checked_address(stack.top());
+					stack.pop();
+					memory[address] = stack.top();
+					stack.pop();
+					break;
+				}
+			}
+			// the guard has its jump inverted, the record tells the instruction of the program
+			TRACE_INSTRUCTION(op.pc, program->code[op.pc].id)
+		}
+		done += loop.instructions;
+	}
+
+	pc_register = loop.head;
+	return done;
+}
+
+unsigned long long CPU::execute_trace(unsigned long long n) {
+	Command* const* commands = program->commands.data();
+	int size = (int)program->commands.size();
+	int stop = static_cast<int>(program->end);
+
+	if (!traces) traces = std::make_shared<TraceCache>(*program);
+	TraceCache& cache = *traces;
+
+	slice_left = n;
+	while (slice_left > 0 && pc_register != stop) {
+		VERIFY_CONTRACT((pc_register < size) && (pc_register >= 0),
+			"ERROR: jump or call to non-existing pointer");
+
+		// the whole iteration must fit into the slice
+		const Trace* loop = cache.recording() ? nullptr : cache.at(pc_register);
+		if (loop != nullptr && slice_left >= loop->instructions) {
+			slice_left -= run_trace(*loop, slice_left);
+			continue;
+		}
+
+		const int pc = pc_register;
+		const unsigned long long before = slice_left--;
+		commands[pc]->execute(*this);
+		TRACE_DISPATCH(pc, before - slice_left)
+
+		if (cache.recording()) {
+			cache.record(*program, pc, (int)(before - slice_left), pc_register);
+		}
+		else if (pc_register <= pc) {
+			cache.jumped_back(pc_register);
+		}
+
+		if (interrupt) {
+			cache.interrupted();
+			break;
+		}
+	}
+	return n - slice_left;
+}
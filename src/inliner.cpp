@@ -0,0 +1,184 @@
+#include "inliner.hpp"
+
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <vector>
+
+using namespace inliner_ns;
+using preprocessor_ns::ExpandedSource;
+using preprocessor_ns::LineOrigin;
+
+static const std::set<std::string> JUMPS = {"JMP", "JEQ", "JNE", "JA", "JAE", "JB", "JBE"};
+
+// Line of assembly split into label declarations and the command
+struct SourceLine {
+	std::vector<std::string> labels;
+	std::string command;  // empty if the line only declares labels
+	std::string operand;  // label, number, register or memory operand
+	LineOrigin origin;    // column is filled with the column of the command
+	std::string text;     // as in the source, empty for lines made by the inliner
+};
+
+static SourceLine split_line(const std::string& text, const LineOrigin& origin) {
+	static const std::regex label_pattern{"[ \t]*([A-Za-z_\\-][A-Za-z0-9_\\-]*):"};
+	static const std::regex command_pattern{"[ \t]*([A-Z]+)[ \t]*(.*?)[ \t]*"};
+
+	SourceLine line{{}, "", "", origin, text};
+	std::smatch match;
+	auto position = text.cbegin();
+	while (std::regex_search(position, text.cend(), match, label_pattern, std::regex_constants::match_continuous)) {
+		line.labels.push_back(match[1]);
+		position = match[0].second;
+	}
+	if (std::regex_match(position, text.cend(), match, command_pattern)) {
+		line.command = match[1];
+		line.operand = match[2];
+		if (line.origin.column == 0) line.origin.column = static_cast<int>(match[1].first - text.cbegin()) + 1;
+	}
+	return line;
+}
+
+class Inliner {
+private:
+	std::vector<SourceLine> lines_;
+	std::map<std::string, size_t> declared_;                // label to the line declaring it
+	std::map<std::string, std::vector<SourceLine>> bodies_; // with their own calls inlined
+	std::set<std::string> rejected_;
+	int budget_;
+	unsigned copies_;
+
+	// Lines from the label to the first RET, without it. Labels declared on the line
+	// of RET are kept on a line of their own, so jumps to RET fall through past the body
+	bool find_body(const std::string& name, std::vector<SourceLine>& body) const {
+		auto declared = declared_.find(name);
+		if (declared == declared_.end()) return false;
+
+		std::set<std::string> labels;
+		for (size_t i = declared->second; i < lines_.size(); ++i) {
+			const SourceLine& line = lines_[i];
+			labels.insert(line.labels.begin(), line.labels.end());
+			if (line.command != "RET") {
+				body.push_back(line);
+				continue;
+			}
+
+			if (!line.labels.empty()) body.push_back(SourceLine{line.labels, "", "", line.origin, ""});
+			for (const SourceLine& inner : body) {
+				if (JUMPS.contains(inner.command) && !labels.contains(inner.operand)) return false;
+			}
+			return true;
+		}
+		return false;
+	}
+
+	bool reaches(const std::string& from, const std::string& target, std::set<std::string>& visited) const {
+		std::vector<SourceLine> body;
+		if (!visited.insert(from).second || !find_body(from, body)) return false;
+
+		for (const SourceLine& line : body) {
+			if (line.command != "CALL") continue;
+			if (line.operand == target || reaches(line.operand, target, visited)) return true;
+		}
+		return false;
+	}
+
+	// Body to put in place of the call, nullptr if the call stays
+	const std::vector<SourceLine>* inlined_body(const std::string& name) {
+		if (bodies_.contains(name)) return &bodies_.at(name);
+		if (rejected_.contains(name)) return nullptr;
+
+		std::set<std::string> visited;
+		std::vector<SourceLine> body;
+		if (!find_body(name, body) || reaches(name, name, visited)) {
+			rejected_.insert(name);
+			return nullptr;
+		}
+
+		body = expand(body);
+		int size = 0;
+		for (const SourceLine& line : body) size += !line.command.empty();
+		if (size > budget_) {
+			rejected_.insert(name);
+			return nullptr;
+		}
+		return &(bodies_[name] = std::move(body));
+	}
+
+	// Copy of the body with unique labels, labels of the call are kept before it
+	void copy(const std::vector<SourceLine>& body, const SourceLine& call, std::vector<SourceLine>& result) {
+		std::string suffix = "__inline";
+		suffix += std::to_string(++copies_);
+
+		std::set<std::string> labels;
+		for (const SourceLine& line : body) labels.insert(line.labels.begin(), line.labels.end());
+
+		if (!call.labels.empty()) result.push_back(SourceLine{call.labels, "", "", call.origin, ""});
+		for (const SourceLine& line : body) {
+			SourceLine renamed{{}, line.command, line.operand, line.origin, ""};
+			for (const std::string& label : line.labels) renamed.labels.push_back(label + suffix);
+
+			// calls and spawns still go to the subroutines, only the copy of the body is renamed
+			if (JUMPS.contains(line.command) && labels.contains(line.operand)) renamed.operand += suffix;
+			result.push_back(renamed);
+		}
+	}
+
+	std::vector<SourceLine> expand(const std::vector<SourceLine>& lines) {
+		std::vector<SourceLine> result;
+		for (const SourceLine& line : lines) {
+			const std::vector<SourceLine>* body = (line.command == "CALL") ? inlined_body(line.operand) : nullptr;
+			if (body != nullptr) copy(*body, line, result);
+			else result.push_back(line);
+		}
+		return result;
+	}
+public:
+	Inliner(std::vector<SourceLine> lines, int budget) :
+		lines_(std::move(lines)), declared_(), bodies_(), rejected_(), budget_(budget), copies_(0) {
+		for (size_t i = 0; i < lines_.size(); ++i) {
+			for (const std::string& label : lines_[i].labels) declared_[label] = i;
+		}
+	}
+
+	std::vector<SourceLine> run() {
+		return expand(lines_);
+	}
+};
+
+ExpandedSource inliner_ns::inline_calls(ExpandedSource source, int budget) {
+	if (budget <= 0) return source;
+
+	std::vector<SourceLine> lines;
+	std::istringstream text(source.text);
+	std::string line;
+	for (size_t i = 0; i < source.origins.size() && std::getline(text, line); ++i) {
+		lines.push_back(split_line(line, source.origins[i]));
+	}
+
+	ExpandedSource result{"", {}, std::move(source.files)};
+	auto append = [&result](const std::string& text, const LineOrigin& origin) {
+		if (!result.origins.empty()) result.text += '\n';
+		result.text += text;
+		result.origins.push_back(origin);
+	};
+
+	for (const SourceLine& line : Inliner(std::move(lines), budget).run()) {
+		if (!line.text.empty()) {
+			append(line.text, line.origin);
+			continue;
+		}
+		for (const std::string& label : line.labels) append(label + ":", line.origin);
+		if (line.command.empty()) continue;
+
+		std::string instruction = "\t";
+		instruction += line.command;
+		if (!line.operand.empty()) {
+			instruction += ' ';
+			instruction += line.operand;
+		}
+		append(instruction, line.origin);
+	}
+	return result;
+}
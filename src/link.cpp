@@ -0,0 +1,61 @@
+#include "linker.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Split "a,b,c" into names
+static std::vector<std::string> split_names(const std::string& list) {
+	std::vector<std::string> names;
+	std::stringstream stream(list);
+	std::string name;
+	while (std::getline(stream, name, ',')) {
+		if (!name.empty()) names.push_back(name);
+	}
+	return names;
+}
+
+// Usage: link OUTPUT.bcode OBJECT.lobj... [--keep-dead] [--strip] [--hot NAME,NAME...]
+// Objects are made by code FILE.lng --object.
+// --keep-dead keeps routines never reached from BEGIN, --strip leaves out the debug section,
+// --hot places the routines right after the entry so the code they run together is contiguous
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc >= 3, "Unexpected arguments passed to make link");
+
+	std::string output = argv[1];
+	VERIFY_CONTRACT(has_extension(output, ".bcode"), "Expected .bcode output file");
+
+	linker_ns::LinkOptions options;
+	std::vector<linker_ns::ObjectFile> objects;
+	for (int i = 2; i < argc; ++i) {
+		std::string argument = argv[i];
+		if (argument == "--keep-dead") {
+			options.strip_dead = false;
+		}
+		else if (argument == "--strip") {
+			options.debug_section = false;
+		}
+		else if (argument == "--hot" && i + 1 < argc) {
+			options.hot = split_names(argv[++i]);
+		}
+		else {
+			objects.push_back(linker_ns::read_object(argument));
+		}
+	}
+	VERIFY_CONTRACT(!objects.empty(), "Expected object files to link");
+
+	// written to a string first, so a failed link leaves no output
+	std::stringstream bytecode;
+	linker_ns::LinkStats stats = linker_ns::link(objects, bytecode, options);
+
+	std::ofstream out(output);
+	VERIFY_CONTRACT(out.is_open(), "Unable to open file " << output);
+	out << bytecode.rdbuf();
+
+	std::cout << SET_COLOR_YELLOW << "Linked " << objects.size() << " objects into " << SET_COLOR_CYAN << output
+	          << SET_COLOR_YELLOW << ": " << stats.instructions << " instructions, stripped " << stats.stripped_routines
+	          << " routines (" << stats.stripped_instructions << " instructions)" << RESET_COLOR << '\n';
+	return 0;
+}
@@ -0,0 +1,345 @@
+#include "linker.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <set>
+
+using namespace linker_ns;
+
+//////////////////
+// OBJECT FILES //
+//////////////////
+
+void linker_ns::write_object(const ObjectFile& object, std::ostream& out) {
+	out << OBJECT_MARKER << '\n';
+	if (!object.source.empty()) {
+		out << "source " << object.source << '\n';
+	}
+
+	out << "code " << object.code.size() << '\n';
+	for (const Instruction& instruction : object.code) {
+		out << instruction.id << ' ' << instruction.argument << '\n';
+	}
+
+	out << "relocations " << object.relocations.size() << '\n';
+	for (const Relocation& relocation : object.relocations) {
+		out << relocation.instruction << ' ' << relocation.label << '\n';
+	}
+
+	out << "labels " << object.labels.size() << '\n';
+	for (const auto& [label, instruction] : object.labels) {
+		out << label << ' ' << instruction << '\n';
+	}
+
+	out << "lines " << object.locations.size() << '\n';
+	for (const SourceLocation& location : object.locations) {
+		out << location.line << ' ' << location.column << '\n';
+	}
+}
+
+void linker_ns::write_object(const ObjectFile& object, const std::string& filename) {
+	std::ofstream out(filename);
+	VERIFY_CONTRACT(out.is_open(), "Unable to open file " << filename);
+	write_object(object, out);
+}
+
+ObjectFile linker_ns::read_object(std::istream& in) {
+	ObjectFile object;
+	std::string word;
+	in >> word;
+	VERIFY_CONTRACT(word == OBJECT_MARKER, "ERROR: not an object file");
+
+	in >> word;
+	if (word == "source") {
+		in >> std::ws;
+		std::getline(in, object.source);
+		in >> word;
+	}
+
+	size_t count = 0;
+	auto section = [&](const char* name) {
+		if (word.empty()) in >> word;
+		VERIFY_CONTRACT(word == name && (in >> count), "ERROR: invalid object file, expected " << name << " section");
+		word.clear();
+	};
+
+	section("code");
+	object.code.resize(count);
+	for (Instruction& instruction : object.code) {
+		in >> instruction.id >> instruction.argument;
+	}
+
+	section("relocations");
+	object.relocations.resize(count);
+	for (Relocation& relocation : object.relocations) {
+		in >> relocation.instruction >> relocation.label;
+		VERIFY_CONTRACT(relocation.instruction >= 0 && relocation.instruction < (int)object.code.size(),
+			"ERROR: invalid object file, relocation of non-existing instruction " << relocation.instruction);
+	}
+
+	section("labels");
+	for (size_t i = 0; i < count; ++i) {
+		std::string label;
+		int instruction = 0;
+		in >> label >> instruction;
+		object.labels[label] = instruction;
+	}
+
+	section("lines");
+	object.locations.resize(count);
+	for (SourceLocation& location : object.locations) {
+		in >> location.line >> location.column;
+	}
+
+	VERIFY_CONTRACT(!in.fail() && object.locations.size() == object.code.size(), "ERROR: invalid object file");
+	return object;
+}
+
+ObjectFile linker_ns::read_object(const std::string& filename) {
+	std::ifstream in(filename);
+	VERIFY_CONTRACT(in.is_open(), "Unable to open file " << filename);
+	return read_object(in);
+}
+
+////////////
+// LINKER //
+////////////
+
+// Instruction of an object
+struct Position {
+	int object;
+	int instruction;
+};
+
+// Consecutive instructions of one object, kept or stripped together
+struct Routine {
+	int object;
+	int begin;
+	int end;
+	std::vector<int> references; // routines it jumps to, calls or spawns
+	int address;                 // of the first instruction in linked code, -1 if it is not placed
+};
+
+static bool falls_through(int id) {
+	return id != 18 && id != 19 && id != 21; // RET, END, JMP
+}
+
+class Linker {
+private:
+	const std::vector<ObjectFile>& objects_;
+	const LinkOptions& options_;
+
+	std::map<std::string, std::vector<Position>> exports_;
+	std::vector<std::vector<Position>> targets_;    // of every relocation
+	std::vector<Routine> routines_;
+	std::vector<std::vector<int>> routine_of_;      // of every instruction
+	std::vector<bool> kept_;
+	std::vector<int> order_;
+
+	std::string name(int object) const {
+		if (!objects_[object].source.empty()) return objects_[object].source;
+		std::string unnamed = "object ";
+		unnamed += std::to_string(object);
+		return unnamed;
+	}
+
+	Position resolve(int object, const std::string& label) const {
+		Position target{object, 0};
+		auto local = objects_[object].labels.find(label);
+		if (local != objects_[object].labels.end()) {
+			target.instruction = local->second;
+		}
+		else {
+			auto exported = exports_.find(label);
+			VERIFY_CONTRACT(exported != exports_.end(), "ERROR: " << name(object) << ": undefined label " << label);
+			VERIFY_CONTRACT(exported->second.size() == 1, "ERROR: " << name(object) << ": label " << label
+				<< " is exported by " << name(exported->second[0].object) << " and " << name(exported->second[1].object));
+			target = exported->second[0];
+		}
+
+		VERIFY_CONTRACT(target.instruction < (int)objects_[target.object].code.size(),
+			"ERROR: " << name(target.object) << ": label " << label << " is not followed by an instruction");
+		return target;
+	}
+
+	void resolve_labels() {
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			for (const auto& [label, instruction] : objects_[object].labels) {
+				if (label[0] != '_') exports_[label].push_back(Position{object, instruction});
+			}
+		}
+
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			targets_.emplace_back();
+			for (const Relocation& relocation : objects_[object].relocations) {
+				targets_.back().push_back(resolve(object, relocation.label));
+			}
+		}
+	}
+
+	// Routines end after RET, JMP and END, code that falls through stays in one routine
+	void split_routines() {
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			const std::vector<Instruction>& code = objects_[object].code;
+			routine_of_.emplace_back(code.size(), -1);
+
+			int begin = 0;
+			for (int i = 0; i < (int)code.size(); ++i) {
+				if (i + 1 < (int)code.size() && falls_through(code[i].id)) continue;
+
+				for (int j = begin; j <= i; ++j) routine_of_[object][j] = static_cast<int>(routines_.size());
+				routines_.push_back(Routine{object, begin, i + 1, {}, -1});
+				begin = i + 1;
+			}
+		}
+
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			const ObjectFile& file = objects_[object];
+			for (size_t i = 0; i < file.relocations.size(); ++i) {
+				const Position& target = targets_[object][i];
+				int from = routine_of_[object][file.relocations[i].instruction];
+				routines_[from].references.push_back(routine_of_[target.object][target.instruction]);
+			}
+		}
+	}
+
+	int find_entry() const {
+		int entry = -1;
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			const std::vector<Instruction>& code = objects_[object].code;
+			for (int i = 0; i < (int)code.size(); ++i) {
+				if (code[i].id != 10) continue;
+				VERIFY_CONTRACT(entry < 0 || routines_[entry].object == object,
+					"ERROR: BEGIN in " << name(routines_[entry].object) << " and " << name(object));
+				entry = routine_of_[object][i];
+			}
+		}
+		VERIFY_CONTRACT(entry >= 0, "ERROR: no object contains BEGIN");
+		return entry;
+	}
+
+	void mark_reachable(int routine) {
+		if (kept_[routine]) return;
+		kept_[routine] = true;
+		for (int reference : routines_[routine].references) mark_reachable(reference);
+	}
+
+	// Depth first, so a callee follows its first caller
+	void place(int routine) {
+		if (!kept_[routine] || routines_[routine].address >= 0) return;
+
+		int address = 0;
+		if (!order_.empty()) {
+			const Routine& previous = routines_[order_.back()];
+			address = previous.address + previous.end - previous.begin;
+		}
+		routines_[routine].address = address;
+		order_.push_back(routine);
+
+		for (int reference : routines_[routine].references) place(reference);
+	}
+
+	void lay_out(int entry) {
+		routines_[entry].address = 0;
+		order_.push_back(entry);
+		for (const std::string& hot : options_.hot) {
+			auto exported = exports_.find(hot);
+			VERIFY_CONTRACT(exported != exports_.end() && exported->second.size() == 1, "ERROR: unknown hot routine " << hot);
+			place(routine_of_[exported->second[0].object][exported->second[0].instruction]);
+		}
+		for (size_t i = 0; i < order_.size(); ++i) {
+			for (int reference : routines_[order_[i]].references) place(reference);
+		}
+		for (int routine = 0; routine < (int)routines_.size(); ++routine) place(routine);
+	}
+
+	int address(const Position& position) const {
+		const Routine& routine = routines_[routine_of_[position.object][position.instruction]];
+		return routine.address + position.instruction - routine.begin;
+	}
+
+	// Labels keep their names unless several objects declare them, then the file name is added
+	std::map<std::string, int> linked_labels() const {
+		std::map<std::string, int> declared;
+		for (const ObjectFile& file : objects_) {
+			for (const auto& [label, instruction] : file.labels) ++declared[label];
+		}
+
+		std::map<std::string, int> labels;
+		for (int object = 0; object < (int)objects_.size(); ++object) {
+			std::string file = objects_[object].source.empty() ? std::to_string(object)
+			                 : std::filesystem::path(objects_[object].source).stem().string();
+			for (const auto& [label, instruction] : objects_[object].labels) {
+				if (instruction >= (int)objects_[object].code.size()) continue;
+				if (!kept_[routine_of_[object][instruction]]) continue;
+
+				std::string linked = label;
+				if (declared[label] > 1) {
+					linked += '@';
+					linked += file;
+				}
+				labels[linked] = address(Position{object, instruction});
+			}
+		}
+		return labels;
+	}
+public:
+	Linker(const std::vector<ObjectFile>& objects, const LinkOptions& options) :
+		objects_(objects), options_(options), exports_(), targets_(), routines_(), routine_of_(), kept_(), order_() {}
+
+	LinkStats link(std::ostream& out) {
+		resolve_labels();
+		split_routines();
+
+		int entry = find_entry();
+		kept_.assign(routines_.size(), !options_.strip_dead);
+		kept_[entry] = false;
+		mark_reachable(entry);
+		lay_out(entry);
+
+		// relocation of every instruction with a label argument
+		std::vector<std::map<int, Position>> relocated(objects_.size());
+		for (size_t object = 0; object < objects_.size(); ++object) {
+			for (size_t i = 0; i < objects_[object].relocations.size(); ++i) {
+				relocated[object].emplace(objects_[object].relocations[i].instruction, targets_[object][i]);
+			}
+		}
+
+		LinkStats stats;
+		std::vector<int> lines, columns;
+		std::set<int> sources;
+		for (int routine : order_) {
+			const Routine& placed = routines_[routine];
+			const ObjectFile& file = objects_[placed.object];
+			sources.insert(placed.object);
+
+			for (int i = placed.begin; i < placed.end; ++i) {
+				auto relocation = relocated[placed.object].find(i);
+				int argument = (relocation != relocated[placed.object].end()) ? address(relocation->second) : file.code[i].argument;
+				out << file.code[i].id << ' ' << argument << '\n';
+				lines.push_back(file.locations[i].line);
+				columns.push_back(file.locations[i].column);
+			}
+			stats.instructions += placed.end - placed.begin;
+		}
+
+		for (int routine = 0; routine < (int)routines_.size(); ++routine) {
+			if (kept_[routine]) continue;
+			++stats.stripped_routines;
+			stats.stripped_instructions += routines_[routine].end - routines_[routine].begin;
+		}
+
+		// lines are ambiguous if the code comes from several files, so the source is named only for one
+		if (options_.debug_section) {
+			std::string source = (sources.size() == 1) ? objects_[*sources.begin()].source : "";
+			write_debug_section(out, source, lines, columns, linked_labels());
+		}
+		return stats;
+	}
+};
+
+LinkStats linker_ns::link(const std::vector<ObjectFile>& objects, std::ostream& out, const LinkOptions& options) {
+	return Linker(objects, options).link(out);
+}
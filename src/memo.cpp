@@ -0,0 +1,137 @@
+#include "memo.hpp"
+#include "command.hpp"
+#include "utils.hpp"
+
+using namespace memo_ns;
+
+////////////////
+// MEMO CACHE //
+////////////////
+
+size_t MemoKeyHash::operator() (const MemoKey& key) const {
+	uint64_t hash = 14695981039346656037ULL;
+	for (int value : key) {
+		hash ^= static_cast<uint32_t>(value);
+		hash *= 1099511628211ULL;
+	}
+	return static_cast<size_t>(hash);
+}
+
+MemoCache::MemoCache(const std::map<int, analysis_ns::PureRoutine>& routines, size_t capacity) :
+	capacity_(capacity), tables_(), stats_(), mutex_()
+{
+	VERIFY_CONTRACT(capacity_ > 0, "ERROR: memo cache needs room for at least one result");
+	for (const auto& [entry, routine] : routines) {
+		tables_[entry].routine = routine;
+	}
+}
+
+const analysis_ns::PureRoutine& MemoCache::routine(int entry) const {
+	return tables_.at(entry).routine;
+}
+
+bool MemoCache::lookup(int entry, const MemoKey& key, MemoResult& result) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	const Table& table = tables_.at(entry);
+	auto found = table.results.find(key);
+	if (found == table.results.end()) {
+		++stats_.misses;
+		return false;
+	}
+	++stats_.hits;
+	result = found->second;
+	return true;
+}
+
+void MemoCache::store(int entry, const MemoKey& key, MemoResult result) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	Table& table = tables_.at(entry);
+	if (table.results.size() >= capacity_ && !table.results.contains(key)) {
+		table.results.erase(table.results.begin());
+		++stats_.evictions;
+	}
+	table.results[key] = std::move(result);
+}
+
+MemoStats MemoCache::stats() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return stats_;
+}
+
+///////////////////////
+// MEMOIZED COMMANDS //
+///////////////////////
+
+// CALL of a pure routine: a hit replaces the call, a miss is remembered until RET
+class MemoCALLCommand : public Command {
+private:
+	MemoCache* cache_;
+	const analysis_ns::PureRoutine& routine_;
+public:
+	MemoCALLCommand(int arg, MemoCache* cache) : Command(arg), cache_(cache), routine_(cache->routine(arg)) {}
+	virtual void execute(CPU& cpu) override {
+		unsigned size = cpu.stack.size();
+		// too few arguments fail in the routine as without memoization
+		if (size >= (unsigned)routine_.arguments) {
+			const int* top = cpu.stack.data() + size;
+			MemoKey key(top - routine_.arguments, top);
+			for (int reg : routine_.inputs) key.push_back(cpu.registers[reg]);
+
+			MemoResult result;
+			if (cache_->lookup(argument, key, result)) {
+				for (int i = 0; i < routine_.arguments; ++i) cpu.stack.pop();
+				for (int i = 0; i < routine_.results; ++i) cpu.stack.push(result[i]);
+				for (size_t i = 0; i < routine_.outputs.size(); ++i) {
+					cpu.registers[routine_.outputs[i]] = result[routine_.results + i];
+				}
+				cpu.pc_register += 1;
+				return;
+			}
+			cpu.memo_calls.push_back(PendingCall{argument, cpu.call_stack.size(), std::move(key)});
+		}
+
+		cpu.call_stack.push(cpu.pc_register);
+		cpu.pc_register = argument;
+	}
+};
+
+// RET storing the results of the pending call it returns from
+class MemoRETCommand : public Command {
+private:
+	MemoCache* cache_;
+public:
+	explicit MemoRETCommand(MemoCache* cache) : Command(0), cache_(cache) {}
+	virtual void execute(CPU& cpu) override {
+		cpu.pc_register = cpu.call_stack.top();
+		cpu.call_stack.pop();
+		cpu.pc_register += 1;
+
+		if (cpu.memo_calls.empty() || cpu.memo_calls.back().depth != cpu.call_stack.size()) return;
+
+		PendingCall& call = cpu.memo_calls.back();
+		const analysis_ns::PureRoutine& routine = cache_->routine(call.routine);
+		const int* top = cpu.stack.data() + cpu.stack.size();
+		MemoResult result(top - routine.results, top);
+		for (int reg : routine.outputs) result.push_back(cpu.registers[reg]);
+
+		cache_->store(call.routine, call.key, std::move(result));
+		cpu.memo_calls.pop_back();
+	}
+};
+
+size_t memo_ns::enable_memoization(Program& program, size_t capacity) {
+	std::map<int, analysis_ns::PureRoutine> routines = analysis_ns::find_pure_routines(program);
+	if (routines.empty()) return 0;
+
+	program.memo = std::make_shared<MemoCache>(routines, capacity);
+	for (size_t pc = 0; pc < program.code.size(); ++pc) {
+		const Instruction& instruction = program.code[pc];
+		bool pure_call = instruction.id == 20 && routines.contains(instruction.argument);
+		if (!pure_call && instruction.id != 18) continue; // CALL, RET
+
+		delete program.commands[pc];
+		program.commands[pc] = pure_call ? static_cast<Command*>(new MemoCALLCommand(instruction.argument, program.memo.get()))
+		                                 : new MemoRETCommand(program.memo.get());
+	}
+	return routines.size();
+}
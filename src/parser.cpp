@@ -1,8 +1,11 @@
 #include "parser.hpp"
 #include "command.hpp"
+#include "compiler.hpp"
 #include "cpu.hpp"
 #include "utils.hpp"
 
+#include <cstring>
+
 const std::map<std::string, int> str_to_reg {
     {"AX", 0},
     {"BX", 1},
@@ -22,6 +25,10 @@ int get_register_id(const std::string& name) {
 // Commands with label argument     start with "2"
 // Commands with integer argument   start with "3"
 // Commands with register argumen   start with "4"
+// Vector commands (stack operands) start with "5"
+// Memory commands                  start with "6" (id + addressing mode)
+// Green thread commands (no arg)   start with "7"
+// Big integer commands (no arg)    start with "8"
 const std::map<std::string, int> command_name_to_id {
     {"BEGIN", 10},
     {"POP", 11},
@@ -42,11 +49,36 @@ const std::map<std::string, int> command_name_to_id {
     {"JAE", 25},
     {"JB",  26},
     {"JBE", 27},
+    {"SPAWN", 28},
 
     {"PUSH", 30},
+    {"SEND", 31},
+    {"RECV", 32},
 
     {"POPR", 40},
-    {"PUSHR", 41}
+    {"PUSHR", 41},
+
+    {"VLOAD",  50},
+    {"VSTORE", 51},
+    {"VADD",   52},
+    {"VSUB",   53},
+    {"VMUL",   54},
+    {"VCMPEQ", 55},
+    {"VCMPGT", 56},
+    {"VSUM",   57},
+
+    {"LOAD",  60},
+    {"STORE", 63},
+
+    {"YIELD", 70},
+    {"JOIN",  71},
+
+    {"BIG",  80},
+    {"BADD", 81},
+    {"BSUB", 82},
+    {"BMUL", 83},
+    {"BCMP", 84},
+    {"BOUT", 85}
 };
 
 int get_command_id(std::string& name) {
@@ -54,6 +86,20 @@ int get_command_id(std::string& name) {
     return command_name_to_id.at(name);
 }
 
+std::string get_command_name(int id) {
+    // memory commands are stored as base id + addressing mode
+    int base = (id / 10 == 6) ? id - (id - 60) % 3 : id;
+    for (const auto& [name, command_id] : command_name_to_id) {
+        if (command_id == base) return name;
+    }
+    return "???";
+}
+
+preprocessor_ns::ExpandedSource read_source(const std::string& filename) {
+    if (has_extension(filename, compiler_ns::SOURCE_EXTENSION)) return compiler_ns::compile(filename);
+    return preprocessor_ns::preprocess(filename);
+}
+
 ////////////
 ////////////
 // PARSER //
@@ -61,9 +107,15 @@ int get_command_id(std::string& name) {
 
 // Constructor
 Parser::Parser(const std::string& filename) :
-    file_ (std::ifstream(filename, std::ios::in)), pos_ (), end_(), command_line_number(0) {
-    VERIFY_CONTRACT(file_.good(), "Unable to open file " << filename);
+    Parser(read_source(filename), filename) {}
+
+Parser::Parser(std::istream& source) :
+    Parser(preprocessor_ns::preprocess(source), "") {}
 
+Parser::Parser(preprocessor_ns::ExpandedSource source, const std::string& source_name) :
+    expanded_(std::move(source.text)), input_(&expanded_), pos_ (), end_(), command_line_number(0), source_line_(0),
+    origins_(std::move(source.origins)), source_name_(source_name), debug_section_(true),
+    code_(), relocations_(), resolve_labels_(true) {
     // Initialize the first line:
     read_line_from_file();
 }
@@ -77,10 +129,11 @@ Parser::~Parser() {
 
 // Put line in private buffer
 void Parser::read_line_from_file() {
-    file_.getline(line_, MAX_LINE_SIZE);
+    input_->getline(line_, MAX_LINE_SIZE);
+    ++source_line_;
 
     VERIFY_CONTRACT(
-        file_.good() || file_.eof(),
+        input_->good() || input_->eof(),
         "Unable to read input line\n");
 
     pos_ = line_;
@@ -128,7 +181,7 @@ bool Parser::parse_space_sequence() {
 bool Parser::parse_newline_sequence() {
     parse_space_sequence();
     bool success = (pos_ == end_);
-    while (pos_ == end_ && !file_.eof()) {
+    while (pos_ == end_ && !input_->eof()) {
         read_line_from_file();
         parse_space_sequence();
     }
@@ -136,11 +189,11 @@ bool Parser::parse_newline_sequence() {
 }
 
 bool Parser::parse_end_of_file() {
-    return file_.eof();
+    return input_->eof();
 }
 
 bool Parser::parse_label_declaration() {
-    static const std::regex pattern{"[A-Za-z_\\-]+:"};
+    static const std::regex pattern{"[A-Za-z_\\-][A-Za-z0-9_\\-]*:"};
 
     // Skip leading whitespaces
     parse_space_sequence();
@@ -216,8 +269,44 @@ int Parser::parse_int_number() {
     return std::atoi(val_str.c_str());
 }
 
+// Memory operand is one of:
+//      [123]   absolute address
+//      [BX]    address stored in register
+//      (none)  address is on top of the stack
+// Returns the addressing mode and puts the argument of the command into 'argument'
+int Parser::parse_memory_operand(int& argument) {
+    static const std::regex open_pattern{"[ \t]+\\["};
+    static const std::regex close_pattern{"\\]"};
+    static const std::regex register_pattern{"[A-Z]+"};
+    static const std::regex address_pattern{"0|[1-9][0-9]*"};
+
+    argument = 0;
+    if (!parse_pattern(open_pattern)) {
+        return ADDRESS_STACK;
+    }
+
+    int mode;
+    std::string operand;
+    if (parse_pattern(register_pattern, operand)) {
+        argument = get_register_id(operand);
+        mode = ADDRESS_REGISTER;
+    }
+    else if (parse_pattern(address_pattern, operand)) {
+        argument = std::atoi(operand.c_str());
+        mode = ADDRESS_ABSOLUTE;
+    }
+    else {
+        throw std::runtime_error("Expected a register or an address in memory operand!\n");
+    }
+
+    if (!parse_pattern(close_pattern)) {
+        throw std::runtime_error("Expected ']' after memory operand!\n");
+    }
+    return mode;
+}
+
 std::string Parser::parse_label() {
-    static const std::regex pattern{"[A-Za-z_\\-]+"};
+    static const std::regex pattern{"[A-Za-z_\\-][A-Za-z0-9_\\-]*"};
 
     // Skip leading whitespaces:
     bool success = parse_space_sequence();
@@ -239,55 +328,139 @@ std::string Parser::parse_label() {
 void Parser::parse(const std::string& outfile) {
     std::ofstream out;
     out.open(outfile);
+    VERIFY_CONTRACT(out.is_open(), "Unable to open file " << outfile);
 
-    if (out.is_open()) {
-        while (!parse_end_of_file()) {
-            // skip all empty lines at every step
-            parse_newline_sequence();
+    parse(out);
+}
 
-            if (parse_label_declaration()) continue;
+void Parser::parse(std::ostream& out) {
+    while (!parse_end_of_file()) {
+        // skip all empty lines at every step
+        parse_newline_sequence();
+
+        if (parse_label_declaration()) continue;
+        else {
+            // leading spaces are already skipped by parse_label_declaration()
+            const preprocessor_ns::LineOrigin& origin = origins_[source_line_ - 1];
+            command_lines_.push_back(origin.line);
+            command_columns_.push_back(origin.column ? origin.column : static_cast<int>(pos_ - line_) + 1);
+            int cmd_id = parse_command();
+            int argument = 0;
+
+            // switch case may fall through T_T 
+            if (command_has_no_argument(cmd_id)) {
+                out << cmd_id << " " << 0 << std::endl;
+            }
+            else if (cmd_id / 10 == 2) {
+                // write command and 50 whitespaces as 
+                out << cmd_id << ' ';
+
+                // store the pair position-label
+                std::string label = parse_label();
+                used_labels[out.tellp()] = label;
+                relocations_.push_back(linker_ns::Relocation{command_line_number, label});
+                
+                // write 50 whitespaces as buffer
+                out << std::string(50, ' ') << std::endl;
+            }
+            else if (cmd_id / 10 == 3) {
+                argument = parse_int_number();
+                out << cmd_id << " " << argument << std::endl;
+            }
+            else if (cmd_id / 10 == 4) {
+                //std::cout << "POPR OR PUSHR!!!\n";
+                argument = parse_register();
+                out << cmd_id << " " << argument << std::endl;
+            }
+            else if (cmd_id / 10 == 6) {
+                cmd_id += parse_memory_operand(argument);
+                out << cmd_id << " " << argument << std::endl;
+            }
             else {
-                int cmd_id = parse_command();
-
-                // switch case may fall through T_T 
-                if (cmd_id / 10 == 1) {
-                    out << cmd_id << " " << 0 << std::endl;
-                }
-                else if (cmd_id / 10 == 2) {
-                    // write command and 50 whitespaces as 
-                    out << cmd_id << ' ';
-
-                    // store the pair position-label
-                    used_labels[out.tellp()] = parse_label();
-                    
-                    // write 50 whitespaces as buffer
-                    out << std::string(50, ' ') << std::endl;
-                }
-                else if (cmd_id / 10 == 3) {
-                    out << cmd_id << " " << parse_int_number() << std::endl;
-                }
-                else if (cmd_id / 10 == 4) {
-                    //std::cout << "POPR OR PUSHR!!!\n";
-                    out << cmd_id << " " << parse_register() << std::endl;
-                }
-                else {
-                    throw std::runtime_error("Unexpected error");
-                }
-
-                ++command_line_number;
+                throw std::runtime_error("Unexpected error");
             }
-        } // while
 
-        // Run throug pairs position-label 
-        for (const auto& [key, value] : used_labels) {
-            // Check if label is declared
-            VERIFY_CONTRACT(declared_labels.contains(value), "ERROR: reference to undefined label " << value);
+            code_.push_back(Instruction{cmd_id, argument});
+            ++command_line_number;
+        }
+    } // while
 
-            // Go to the position of byte code where it suppose to be used
-            out.seekp(key);
+    // labels of objects are resolved by the linker
+    if (!resolve_labels_) return;
 
-            // Write the pointer
-            out << declared_labels.at(value);
-        }
-    } // if
+    // Run throug pairs position-label 
+    for (const auto& [key, value] : used_labels) {
+        // Check if label is declared
+        VERIFY_CONTRACT(declared_labels.contains(value), "ERROR: reference to undefined label " << value);
+
+        // Go to the position of byte code where it suppose to be used
+        out.seekp(key);
+
+        // Write the pointer
+        out << declared_labels.at(value);
+    }
+
+    if (debug_section_) {
+        out.seekp(0, std::ios::end);
+        write_debug_section(out);
+    }
 } // parse
+
+// Debug section follows the code:
+//      #debug
+//      source <path of .lng file>          (only if parsed from file)
+//      lines <number of instructions>
+//      <line delta> <column>               for every instruction, line delta from the previous one
+//      labels <number of labels>
+//      <label> <instruction>               for every label
+void Parser::write_debug_section(std::ostream& out) const {
+    ::write_debug_section(out, source_name_, command_lines_, command_columns_, declared_labels);
+}
+
+void write_debug_section(std::ostream& out, const std::string& source, const std::vector<int>& lines,
+                         const std::vector<int>& columns, const std::map<std::string, int>& labels) {
+    out << DEBUG_SECTION_MARKER << '\n';
+    if (!source.empty()) {
+        out << "source " << source << '\n';
+    }
+
+    out << "lines " << lines.size() << '\n';
+    int previous = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        out << lines[i] - previous << ' ' << columns[i] << '\n';
+        previous = lines[i];
+    }
+
+    out << "labels " << labels.size() << '\n';
+    for (const auto& [label, instruction] : labels) {
+        out << label << ' ' << instruction << '\n';
+    }
+}
+
+linker_ns::ObjectFile Parser::parse_object() {
+    std::stringstream bytecode;
+    resolve_labels_ = false;
+    parse(bytecode);
+
+    linker_ns::ObjectFile object{source_name_, code_, relocations_, declared_labels, {}};
+    for (size_t i = 0; i < command_lines_.size(); ++i) {
+        object.locations.push_back(SourceLocation{command_lines_[i], command_columns_[i]});
+    }
+    return object;
+}
+
+void Parser::set_debug_section(bool enabled) {
+    debug_section_ = enabled;
+}
+
+const std::vector<int>& Parser::command_columns() const {
+    return command_columns_;
+}
+
+const std::vector<int>& Parser::command_lines() const {
+    return command_lines_;
+}
+
+const std::map<std::string, int>& Parser::labels() const {
+    return declared_labels;
+}
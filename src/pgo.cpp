@@ -0,0 +1,395 @@
+#include "pgo.hpp"
+#include "analysis.hpp"
+#include "command.hpp"
+#include "parser.hpp"
+#include "recorder.hpp"
+#include "tracer.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+using namespace pgo_ns;
+using namespace analysis_ns;
+
+/////////////
+// PROFILE //
+/////////////
+
+void ExecutionProfile::save(std::ostream& out) const {
+	out << PROFILE_MARKER << '\n';
+	out << "program " << program_hash << '\n';
+	out << "instructions " << counts.size() << '\n';
+	for (size_t pc = 0; pc < counts.size(); ++pc) {
+		if (counts[pc] > 0) out << pc << ' ' << counts[pc] << ' ' << jumps[pc] << '\n';
+	}
+}
+
+void ExecutionProfile::save(const std::string& filename) const {
+	std::ofstream out(filename);
+	VERIFY_CONTRACT(out.is_open(), "Unable to open file " << filename);
+	save(out);
+}
+
+ExecutionProfile pgo_ns::load(std::istream& in) {
+	ExecutionProfile profile;
+	std::string word;
+	in >> word;
+	VERIFY_CONTRACT(word == PROFILE_MARKER, "ERROR: not a profile");
+
+	size_t size = 0;
+	in >> word >> profile.program_hash;
+	VERIFY_CONTRACT(in && word == "program", "ERROR: invalid profile, expected program hash");
+	in >> word >> size;
+	VERIFY_CONTRACT(in && word == "instructions", "ERROR: invalid profile, expected number of instructions");
+	profile.counts.assign(size, 0);
+	profile.jumps.assign(size, 0);
+
+	size_t pc = 0;
+	uint64_t count = 0, jumps = 0;
+	while (in >> pc >> count >> jumps) {
+		VERIFY_CONTRACT(pc < size && jumps <= count, "ERROR: invalid profile of instruction " << pc);
+		profile.counts[pc] = count;
+		profile.jumps[pc] = jumps;
+	}
+	VERIFY_CONTRACT(in.eof(), "ERROR: invalid profile, expected <pc> <count> <jumps>");
+	return profile;
+}
+
+ExecutionProfile pgo_ns::load(const std::string& filename) {
+	std::ifstream in(filename);
+	VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open file " << filename);
+	return load(in);
+}
+
+ProfileCounters::ProfileCounters(const Program& program) :
+	program_hash_(replay_ns::program_hash(program)), size_(program.code.size()),
+	counts_(std::make_unique<std::atomic<uint64_t>[]>(size_)),
+	jumps_(std::make_unique<std::atomic<uint64_t>[]>(size_)) {}
+
+ExecutionProfile ProfileCounters::snapshot() const {
+	ExecutionProfile profile;
+	profile.program_hash = program_hash_;
+	for (size_t pc = 0; pc < size_; ++pc) {
+		profile.counts.push_back(counts_[pc].load(std::memory_order_relaxed));
+		profile.jumps.push_back(jumps_[pc].load(std::memory_order_relaxed));
+	}
+	return profile;
+}
+
+////////////////////
+// PROFILE ENGINE //
+////////////////////
+
+unsigned long long CPU::execute_profile(unsigned long long n) {
+	Command* const* commands = program->commands.data();
+	int size = (int)program->commands.size();
+	int stop = static_cast<int>(program->end);
+
+	if (!profile) profile = std::make_shared<ProfileCounters>(*program);
+	ProfileCounters& counters = *profile;
+
+	slice_left = n;
+	while (slice_left > 0 && pc_register != stop) {
+		VERIFY_CONTRACT((pc_register < size) && (pc_register >= 0),
+			"ERROR: jump or call to non-existing pointer");
+		const int pc = pc_register;
+		[[maybe_unused]] const unsigned long long before = slice_left--;
+		commands[pc]->execute(*this);
+		counters.count(pc, pc_register);
+		TRACE_DISPATCH(pc, before - slice_left)
+
+		if (interrupt) break;
+	}
+	return n - slice_left;
+}
+
+//////////////////
+// BLOCK LAYOUT //
+//////////////////
+
+// Control may go on to the next instruction after the last one of the block
+static bool falls_through(int id) {
+	return id != JMP_ID && id != RET_ID && id != END_ID;
+}
+
+struct Edge {
+	int from;
+	int to;
+	uint64_t weight;
+};
+
+class Layout {
+private:
+	const std::vector<Instruction>& code_;
+	const ExecutionProfile& profile_;
+	Analysis analysis_;
+	int blocks_;
+
+	// chains of blocks placed one after another, -1 at the ends
+	std::vector<int> next_;
+	std::vector<int> previous_;
+
+	int last_id(int block) const {
+		return code_[analysis_.blocks[block].end - 1].id;
+	}
+
+	// block of the jump target, -1 if it is out of code
+	int target_block(int block) const {
+		int target = code_[analysis_.blocks[block].end - 1].argument;
+		return (target >= 0 && target < (int)code_.size()) ? analysis_.block_of[target] : -1;
+	}
+
+	int fallthrough_block(int block) const {
+		return (falls_through(last_id(block)) && block + 1 < blocks_) ? block + 1 : -1;
+	}
+
+	// the last block falls off the end of code, it must stay the last one
+	bool open_end(int block) const {
+		return block == blocks_ - 1 && falls_through(last_id(block));
+	}
+
+	int head(int block) const {
+		while (previous_[block] != -1) block = previous_[block];
+		return block;
+	}
+
+	void chain(int from, int to) {
+		if (from == to || next_[from] != -1 || previous_[to] != -1) return;
+		if (open_end(from) || head(from) == to) return;
+		next_[from] = to;
+		previous_[to] = from;
+	}
+
+	uint64_t heat(int block) const {
+		return profile_.counts[analysis_.blocks[block].begin];
+	}
+public:
+	Layout(const Program& program, const ExecutionProfile& profile) :
+		code_(program.code), profile_(profile), analysis_(analyze(program)),
+		blocks_((int)analysis_.blocks.size()), next_(blocks_, -1), previous_(blocks_, -1) {}
+
+	int blocks() const {
+		return blocks_;
+	}
+
+	const BasicBlock& block(int index) const {
+		return analysis_.blocks[index];
+	}
+
+	// Greedy chaining of the heaviest edges first (Pettis-Hansen)
+	std::vector<int> order(int entry) {
+		// RET goes to the instruction after CALL, so the return block is always next
+		for (int block = 0; block + 1 < blocks_; ++block) {
+			if (last_id(block) == CALL_ID) chain(block, block + 1);
+		}
+
+		std::vector<Edge> edges;
+		for (int block = 0; block < blocks_; ++block) {
+			int last = analysis_.blocks[block].end - 1;
+			uint64_t count = profile_.counts[last];
+			uint64_t jumps = profile_.jumps[last];
+
+			int fallthrough = fallthrough_block(block);
+			if (fallthrough != -1) edges.push_back(Edge{block, fallthrough, count - jumps});
+
+			int target = is_branch(last_id(block)) ? target_block(block) : -1;
+			if (target != -1) edges.push_back(Edge{block, target, is_conditional(last_id(block)) ? jumps : count});
+		}
+
+		std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+		for (const Edge& edge : edges) {
+			if (edge.weight > 0) chain(edge.from, edge.to);
+		}
+		// code never executed keeps its original order
+		for (const Edge& edge : edges) {
+			if (edge.weight == 0 && edge.to == edge.from + 1) chain(edge.from, edge.to);
+		}
+
+		// chain of BEGIN first, then hot chains, then cold ones, the open end last
+		std::vector<int> heads;
+		std::vector<uint64_t> hottest(blocks_, 0);
+		for (int block = 0; block < blocks_; ++block) {
+			if (previous_[block] == -1) heads.push_back(block);
+			int first = head(block);
+			hottest[first] = std::max(hottest[first], heat(block));
+		}
+
+		int entry_chain = head(entry);
+		int open_chain = open_end(blocks_ - 1) ? head(blocks_ - 1) : -1;
+		auto rank = [&](int chain) {
+			if (chain == open_chain) return 2;
+			return (chain == entry_chain) ? 0 : 1;
+		};
+		std::stable_sort(heads.begin(), heads.end(), [&](int a, int b) {
+			if (rank(a) != rank(b)) return rank(a) < rank(b);
+			return hottest[a] > hottest[b];
+		});
+
+		std::vector<int> placed;
+		for (int chain : heads) {
+			for (int block = chain; block != -1; block = next_[block]) placed.push_back(block);
+		}
+		return placed;
+	}
+};
+
+///////////////////////
+// SUPERINSTRUCTIONS //
+///////////////////////
+
+static bool matches(const std::vector<Instruction>& code, size_t pc, const std::vector<int>& ids) {
+	if (pc + ids.size() > code.size()) return false;
+	for (size_t i = 0; i < ids.size(); ++i) {
+		if (code[pc + i].id != ids[i]) return false;
+	}
+	return true;
+}
+
+// Superinstruction by pc: the kinds saving the most dispatches, then their
+// occurrences from the most executed one, so that they do not overlap
+static std::map<int, int> choose_superinstructions(const std::vector<Instruction>& code, const std::vector<uint64_t>& counts) {
+	std::vector<std::vector<int>> catalog = superinstruction_catalog();
+
+	std::vector<uint64_t> savings(catalog.size(), 0);
+	for (size_t pc = 0; pc < code.size(); ++pc) {
+		for (size_t kind = 0; kind < catalog.size(); ++kind) {
+			if (counts[pc] > 0 && matches(code, pc, catalog[kind])) savings[kind] += counts[pc] * (catalog[kind].size() - 1);
+		}
+	}
+
+	std::vector<int> kinds;
+	for (size_t kind = 0; kind < catalog.size(); ++kind) {
+		if (savings[kind] > 0) kinds.push_back((int)kind);
+	}
+	std::stable_sort(kinds.begin(), kinds.end(), [&savings](int a, int b) { return savings[a] > savings[b]; });
+	if (kinds.size() > MAX_SUPERINSTRUCTION_KINDS) kinds.resize(MAX_SUPERINSTRUCTION_KINDS);
+
+	struct Occurrence {
+		int pc;
+		int kind;
+		uint64_t saving;
+	};
+	std::vector<Occurrence> occurrences;
+	for (size_t pc = 0; pc < code.size(); ++pc) {
+		for (int kind : kinds) {
+			if (counts[pc] > 0 && matches(code, pc, catalog[kind])) {
+				occurrences.push_back(Occurrence{(int)pc, kind, counts[pc] * (catalog[kind].size() - 1)});
+			}
+		}
+	}
+	std::stable_sort(occurrences.begin(), occurrences.end(),
+		[](const Occurrence& a, const Occurrence& b) { return a.saving > b.saving; });
+
+	std::map<int, int> chosen;
+	std::vector<bool> covered(code.size(), false);
+	for (const Occurrence& occurrence : occurrences) {
+		size_t length = catalog[occurrence.kind].size();
+		bool free = true;
+		for (size_t i = 0; i < length; ++i) free = free && !covered[occurrence.pc + i];
+		if (!free) continue;
+
+		for (size_t i = 0; i < length; ++i) covered[occurrence.pc + i] = true;
+		chosen[occurrence.pc] = occurrence.kind;
+	}
+	return chosen;
+}
+
+//////////////
+// OPTIMIZE //
+//////////////
+
+OptimizationStats pgo_ns::optimize(const Program& program, const ExecutionProfile& profile, std::ostream& out,
+                                   bool debug_section) {
+	const std::vector<Instruction>& code = program.code;
+	int size = (int)code.size();
+	VERIFY_CONTRACT(profile.program_hash == replay_ns::program_hash(program) && (int)profile.counts.size() == size,
+		"ERROR: the profile was recorded for other byte code");
+
+	Layout layout(program, profile);
+	std::vector<int> order = layout.order(static_cast<int>(program.begin));
+
+	OptimizationStats stats;
+	stats.blocks = layout.blocks();
+	for (size_t i = 0; i < order.size(); ++i) {
+		if (order[i] != ((i == 0) ? 0 : order[i - 1] + 1)) ++stats.moved_blocks;
+	}
+
+	// new code with targets still pointing to the original instructions
+	std::vector<Instruction> placed;
+	std::vector<int> origin;          // original instruction for the debug section
+	std::vector<uint64_t> counts;
+	std::vector<int> new_index(size + 1, 0);
+
+	auto emit = [&](Instruction instruction, int from, uint64_t count) {
+		placed.push_back(instruction);
+		origin.push_back(from);
+		counts.push_back(count);
+		stats.executed += count;
+	};
+
+	for (size_t i = 0; i < order.size(); ++i) {
+		const BasicBlock& block = layout.block(order[i]);
+		int next = (i + 1 < order.size()) ? layout.block(order[i + 1]).begin : -1;
+		int last = block.end - 1;
+		int id = code[last].id;
+
+		for (int pc = block.begin; pc < block.end; ++pc) {
+			new_index[pc] = (int)placed.size();
+			if (pc == last && id == JMP_ID && code[pc].argument == next) {
+				++stats.removed_jumps;
+				continue;
+			}
+			emit(code[pc], pc, profile.counts[pc]);
+		}
+
+		int fallthrough = (falls_through(id) && block.end < size) ? block.end : -1;
+		if (fallthrough == -1 || fallthrough == next) continue;
+
+		uint64_t fallen = profile.counts[last] - profile.jumps[last];
+		if (is_conditional(id) && code[last].argument == next) {
+			placed.back() = Instruction{inverse_condition(id), fallthrough};
+			++stats.inverted_jumps;
+		}
+		else {
+			emit(Instruction{JMP_ID, fallthrough}, last, fallen);
+			++stats.added_jumps;
+		}
+	}
+	new_index[size] = (int)placed.size();
+
+	// out of code targets stay out of code
+	for (Instruction& instruction : placed) {
+		if (!has_target(instruction.id)) continue;
+		int target = instruction.argument;
+		instruction.argument = (target >= 0 && target < size) ? new_index[target] : (int)placed.size();
+	}
+
+	std::map<int, int> fused = choose_superinstructions(placed, counts);
+	for (const auto& [pc, kind] : fused) ++stats.superinstructions[kind];
+
+	for (const Instruction& instruction : placed) {
+		out << instruction.id << ' ' << instruction.argument << '\n';
+	}
+	if (!fused.empty()) {
+		out << FUSED_SECTION_MARKER << '\n';
+		for (const auto& [pc, kind] : fused) out << pc << ' ' << kind << '\n';
+	}
+
+	const DebugInfo* info = program.debug_info();
+	if (debug_section && info != nullptr) {
+		std::vector<int> lines, columns;
+		for (int from : origin) {
+			bool known = from < (int)info->locations.size();
+			lines.push_back(known ? info->locations[from].line : 0);
+			columns.push_back(known ? info->locations[from].column : 0);
+		}
+
+		std::map<std::string, int> labels;
+		for (const auto& [label, pc] : info->labels) {
+			labels[label] = (pc >= 0 && pc <= size) ? new_index[pc] : pc;
+		}
+		write_debug_section(out, info->source, lines, columns, labels);
+	}
+	return stats;
+}
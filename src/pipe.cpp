@@ -0,0 +1,24 @@
+#include "cpu.hpp"
+#include "pipeline.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+
+// Usage: pipe first.bcode second.bcode ... last.bcode
+// Runs every program on its own thread and streams integers between neighbours
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc >= 2, "Unexpected arguments passed to make pipe");
+
+	std::vector<std::unique_ptr<CPU>> stages;
+	for (int i = 1; i < argc; ++i) {
+		stages.push_back(std::make_unique<CPU>(std::string(argv[i])));
+	}
+
+	std::cout << SET_COLOR_YELLOW << "Running pipeline of " << SET_COLOR_CYAN << stages.size() << SET_COLOR_YELLOW << " programs...\n" << RESET_COLOR;
+
+	run_pipeline(stages);
+	return 0;
+}
@@ -0,0 +1,28 @@
+#include "pipeline.hpp"
+#include "channel.hpp"
+
+#include <thread>
+
+void run_pipeline(std::vector<std::unique_ptr<CPU>>& stages) {
+	std::vector<std::shared_ptr<Channel>> links;
+	for (size_t i = 0; i + 1 < stages.size(); ++i) {
+		links.push_back(std::make_shared<SPSCChannel>());
+		stages[i]->attach_channel(OUTPUT_CHANNEL, links.back());
+		stages[i + 1]->attach_channel(INPUT_CHANNEL, links.back());
+	}
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < stages.size(); ++i) {
+		threads.emplace_back([&stages, &links, i] {
+			stages[i]->run();
+
+			// the next stage drains the channel and halts
+			if (i < links.size()) links[i]->close();
+			// the previous stage would wait forever on the full channel
+			if (i > 0) links[i - 1]->abandon();
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
@@ -0,0 +1,220 @@
+#include "preprocessor.hpp"
+#include "utils.hpp"
+
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <set>
+
+using namespace preprocessor_ns;
+
+namespace fs = std::filesystem;
+
+struct Macro {
+	std::vector<std::string> parameters;
+	std::vector<std::string> body;
+	std::set<std::string> labels; // declared in the body
+};
+
+// Words are names of constants, parameters and labels. '-' continues a word,
+// but does not start it: -NAME is a negated constant
+static bool is_word_start(char c) {
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool is_word_char(char c) {
+	return is_word_start(c) || c == '-';
+}
+
+// Replace whole words found in the table
+static std::string replace_words(const std::string& text, const std::map<std::string, std::string>& table) {
+	if (table.empty()) return text;
+
+	std::string result;
+	size_t i = 0;
+	while (i < text.size()) {
+		if (!is_word_start(text[i])) {
+			result += text[i++];
+			continue;
+		}
+		size_t end = i;
+		while (end < text.size() && is_word_char(text[end])) ++end;
+
+		std::string word = text.substr(i, end - i);
+		auto replacement = table.find(word);
+		result += (replacement != table.end()) ? replacement->second : word;
+		i = end;
+	}
+	return result;
+}
+
+// Words separated by spaces, tabs or commas
+static std::vector<std::string> split_words(const std::string& text) {
+	std::vector<std::string> words;
+	std::string word;
+	for (char c : text) {
+		if (c == ' ' || c == '\t' || c == ',') {
+			if (!word.empty()) words.push_back(word);
+			word.clear();
+		}
+		else {
+			word += c;
+		}
+	}
+	if (!word.empty()) words.push_back(word);
+	return words;
+}
+
+static std::string trim(const std::string& text) {
+	size_t begin = text.find_first_not_of(" \t\r");
+	if (begin == std::string::npos) return "";
+	size_t end = text.find_last_not_of(" \t\r");
+	return text.substr(begin, end - begin + 1);
+}
+
+class Preprocessor {
+private:
+	ExpandedSource result_;
+	std::map<std::string, std::string> constants_;
+	std::map<std::string, Macro> macros_;
+	std::set<fs::path> included_;
+	unsigned expansions_; // number of macro expansions, makes labels of bodies unique
+
+	// Lines of included files come from the line of #include in the main source
+	void process(std::istream& in, const std::string& name, const fs::path& directory, int depth, const LineOrigin* parent) {
+		static const std::regex name_pattern{"[A-Za-z_][A-Za-z0-9_]*"};
+
+		std::string line;
+		int number = 0;
+		while (std::getline(in, line)) {
+			++number;
+			size_t indent = line.find_first_not_of(" \t");
+			LineOrigin origin = parent ? *parent : LineOrigin{number, 0};
+
+			if (indent == std::string::npos || line[indent] != '#') {
+				emit(line, origin, depth);
+				continue;
+			}
+
+			std::vector<std::string> words = split_words(line.substr(indent));
+			const std::string& directive = words[0];
+			if (parent == nullptr) origin.column = static_cast<int>(indent) + 1;
+
+			if (directive == "#define") {
+				VERIFY_CONTRACT(words.size() >= 2 && std::regex_match(words[1], name_pattern),
+					"ERROR: " << name << ":" << number << ": expected a constant name after #define");
+
+				size_t value = line.find(words[1], line.find("#define") + 7) + words[1].size();
+				constants_[words[1]] = replace_words(trim(line.substr(value)), constants_);
+			}
+			else if (directive == "#macro") {
+				VERIFY_CONTRACT(words.size() >= 2 && std::regex_match(words[1], name_pattern),
+					"ERROR: " << name << ":" << number << ": expected a macro name after #macro");
+
+				Macro macro{std::vector<std::string>(words.begin() + 2, words.end()), {}, {}};
+				read_macro_body(in, name, number, macro);
+				macros_[words[1]] = macro;
+			}
+			else if (directive == "#include") {
+				VERIFY_CONTRACT(words.size() == 2, "ERROR: " << name << ":" << number << ": expected a file after #include");
+				VERIFY_CONTRACT(depth < MAX_EXPANSION_DEPTH, "ERROR: " << name << ":" << number << ": includes are nested too deep");
+
+				std::string file = words[1];
+				if (file.size() >= 2 && file.front() == '"' && file.back() == '"') file = file.substr(1, file.size() - 2);
+				include(directory / file, depth, origin);
+			}
+			else {
+				TERMINATE("ERROR: " << name << ":" << number << ": unknown directive " << directive);
+			}
+		}
+	}
+
+	void read_macro_body(std::istream& in, const std::string& name, int& number, Macro& macro) {
+		static const std::regex label_pattern{"[ \t]*([A-Za-z_\\-][A-Za-z0-9_\\-]*):.*"};
+
+		int first = number;
+		std::string line;
+		while (std::getline(in, line)) {
+			++number;
+			if (trim(line) == "#endmacro") return;
+
+			std::smatch label;
+			if (std::regex_match(line, label, label_pattern)) macro.labels.insert(label[1]);
+			macro.body.push_back(line);
+		}
+		TERMINATE("ERROR: " << name << ":" << first << ": #macro without #endmacro");
+	}
+
+	void include(const fs::path& path, int depth, const LineOrigin& origin) {
+		fs::path canonical = fs::weakly_canonical(path);
+		if (!included_.insert(canonical).second) return;
+
+		std::ifstream in(path);
+		VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open included file " << path.string());
+		result_.files.push_back(path.string());
+		process(in, path.string(), path.parent_path(), depth + 1, &origin);
+	}
+
+	void emit(const std::string& line, LineOrigin origin, int depth) {
+		std::string text = replace_words(line, constants_);
+		std::vector<std::string> words = split_words(text);
+		if (words.empty()) return;
+
+		auto macro = macros_.find(words[0]);
+		if (macro == macros_.end()) {
+			if (!result_.origins.empty()) result_.text += '\n';
+			result_.text += text;
+			result_.origins.push_back(origin);
+			return;
+		}
+
+		const Macro& body = macro->second;
+		VERIFY_CONTRACT(depth < MAX_EXPANSION_DEPTH, "ERROR: line " << origin.line << ": macros are nested too deep");
+		VERIFY_CONTRACT(words.size() - 1 == body.parameters.size(), "ERROR: line " << origin.line << ": macro "
+			<< words[0] << " expects " << body.parameters.size() << " arguments, got " << words.size() - 1);
+
+		std::map<std::string, std::string> replacements;
+		for (size_t i = 0; i < body.parameters.size(); ++i) {
+			replacements[body.parameters[i]] = words[i + 1];
+		}
+		++expansions_;
+		for (const std::string& label : body.labels) {
+			std::string unique = label;
+			unique += "__";
+			unique += std::to_string(expansions_);
+			replacements[label] = unique;
+		}
+
+		// expanded lines point to the macro name
+		if (origin.column == 0) origin.column = static_cast<int>(line.find_first_not_of(" \t")) + 1;
+		for (const std::string& body_line : body.body) {
+			emit(replace_words(body_line, replacements), origin, depth + 1);
+		}
+	}
+public:
+	Preprocessor() : result_(), constants_(), macros_(), included_(), expansions_(0) {}
+
+	ExpandedSource run(std::istream& in, const std::string& name, const fs::path& directory) {
+		process(in, name, directory, 0, nullptr);
+		return std::move(result_);
+	}
+
+	ExpandedSource run(const std::string& filename) {
+		std::ifstream in(filename);
+		VERIFY_CONTRACT(in.is_open(), "Unable to open file " << filename);
+
+		included_.insert(fs::weakly_canonical(filename));
+		result_.files.push_back(filename);
+		return run(in, filename, fs::path(filename).parent_path());
+	}
+};
+
+ExpandedSource preprocessor_ns::preprocess(const std::string& filename) {
+	return Preprocessor().run(filename);
+}
+
+ExpandedSource preprocessor_ns::preprocess(std::istream& source) {
+	return Preprocessor().run(source, "<stream>", fs::path());
+}
@@ -0,0 +1,247 @@
+#include "profiler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <linux/perf_event.h>
+#include <map>
+#include <memory>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace profiler_ns;
+
+///////////////////////
+// HARDWARE COUNTERS //
+///////////////////////
+
+// LINUX SPECIFIC CODE
+static int open_counter(uint32_t type, uint64_t config) {
+	perf_event_attr attributes {};
+	attributes.size = sizeof(attributes);
+	attributes.type = type;
+	attributes.config = config;
+	attributes.disabled = 1;
+	attributes.inherit = 1;        // threads of the scheduler are counted too
+	attributes.exclude_kernel = 1; // allowed with perf_event_paranoid = 2
+	attributes.exclude_hv = 1;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+
+HardwareCounters::HardwareCounters() {
+	fds_[COUNTER_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	fds_[COUNTER_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	fds_[COUNTER_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	fds_[COUNTER_L1I_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_L1I | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+HardwareCounters::~HardwareCounters() {
+	for (int fd : fds_) {
+		if (fd >= 0) close(fd);
+	}
+}
+
+void HardwareCounters::start() {
+	for (int fd : fds_) {
+		if (fd < 0) continue;
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void HardwareCounters::stop() {
+	for (int fd : fds_) {
+		if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	}
+}
+
+long long HardwareCounters::value(Counter counter) const {
+	long long count = 0;
+	if (fds_[counter] < 0 || read(fds_[counter], &count, sizeof(count)) != sizeof(count)) return UNAVAILABLE;
+	return count;
+}
+
+void HardwareCounters::print(std::ostream& out, unsigned long long executed) const {
+	out << SET_COLOR_YELLOW << "Hardware counters for " << executed << " instructions of the program:" << RESET_COLOR << '\n';
+	for (int counter = 0; counter < COUNTERS; ++counter) {
+		long long count = value(static_cast<Counter>(counter));
+		out << "    " << std::left << std::setw(16) << COUNTER_NAMES[counter] << std::right;
+		if (count == UNAVAILABLE) {
+			out << "not available\n";
+			continue;
+		}
+
+		out << std::setw(14) << count;
+		if (executed > 0) {
+			out << "  " << std::fixed << std::setprecision(2) << static_cast<double>(count) / executed << " per instruction";
+		}
+		out << '\n';
+	}
+
+	long long cycles = value(COUNTER_CYCLES);
+	long long instructions = value(COUNTER_INSTRUCTIONS);
+	if (cycles > 0 && instructions != UNAVAILABLE) {
+		out << "    " << std::left << std::setw(16) << "IPC" << std::right << std::setw(14)
+		    << std::fixed << std::setprecision(2) << static_cast<double>(instructions) / cycles << '\n';
+	}
+}
+
+///////////////////////
+// SAMPLING PROFILER //
+///////////////////////
+
+// pc of CALL instructions of the chain from the outermost, then pc.
+// depth is -1 if the thread ran no context
+struct RawSample {
+	int depth;
+	bool truncated;
+	int frames[MAX_SAMPLE_DEPTH + 1];
+};
+
+struct SampleBuffer {
+	std::unique_ptr<RawSample[]> samples;
+	std::atomic<unsigned long long> taken;
+};
+
+static SampleBuffer sample_buffer;
+static std::atomic<bool> sampling = false;
+
+// Runs on the interrupted thread, so the context cannot change meanwhile.
+// Only reads memory and stores into the preallocated buffer. A push or pop of
+// the call stack may be interrupted: its array is valid (see Stack::data()),
+// the innermost frame may be missing or stale, which is tolerated by a sample
+static void take_sample(int) {
+	if (!sampling.load(std::memory_order_relaxed)) return;
+
+	unsigned long long index = sample_buffer.taken.fetch_add(1, std::memory_order_relaxed);
+	if (index >= MAX_SAMPLES) return;
+
+	RawSample& sample = sample_buffer.samples[index];
+	const CPU* cpu = CPU::running();
+	if (cpu == nullptr) {
+		sample.depth = -1;
+		return;
+	}
+
+	const int* calls = cpu->call_stack.data();
+	unsigned size = cpu->call_stack.unchecked_size();
+	unsigned first = (size > MAX_SAMPLE_DEPTH) ? size - MAX_SAMPLE_DEPTH : 0;
+
+	int depth = 0;
+	sample.truncated = (first > 0);
+	for (unsigned i = first; i < size; ++i) sample.frames[depth++] = calls[i];
+	sample.frames[depth++] = cpu->pc_register;
+	sample.depth = depth;
+}
+
+SamplingProfiler::SamplingProfiler(unsigned period) : period_(period), running_(false) {
+	VERIFY_CONTRACT(period_ > 0, "ERROR: sample period must be positive");
+}
+
+SamplingProfiler::~SamplingProfiler() {
+	stop();
+}
+
+void SamplingProfiler::start() {
+	VERIFY_CONTRACT(!sampling.load(), "ERROR: another profiler is running");
+	if (!sample_buffer.samples) sample_buffer.samples = std::make_unique<RawSample[]>(MAX_SAMPLES);
+	sample_buffer.taken = 0;
+
+	struct sigaction action {};
+	action.sa_handler = take_sample;
+	action.sa_flags = SA_RESTART; // IN keeps reading input
+	sigemptyset(&action.sa_mask);
+	VERIFY_CONTRACT(sigaction(SIGPROF, &action, nullptr) == 0, "ERROR: unable to set SIGPROF handler");
+
+	itimerval timer {};
+	timer.it_interval.tv_sec = period_ / 1000000;
+	timer.it_interval.tv_usec = period_ % 1000000;
+	timer.it_value = timer.it_interval;
+
+	sampling = true;
+	running_ = true;
+	VERIFY_CONTRACT(setitimer(ITIMER_PROF, &timer, nullptr) == 0, "ERROR: unable to start profiling timer");
+}
+
+void SamplingProfiler::stop() {
+	if (!running_) return;
+	itimerval timer {};
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	sampling = false;
+	running_ = false;
+}
+
+unsigned long long SamplingProfiler::samples() const {
+	return sample_buffer.taken.load();
+}
+
+// Subroutines start at BEGIN and at targets of CALL and SPAWN
+static std::map<int, std::string> find_subroutines(const Program& program) {
+	std::map<int, std::string> names;
+	const DebugInfo* info = program.debug_info();
+	if (info != nullptr) {
+		// exported labels are preferred to local ones of the same instruction
+		for (const auto& [label, address] : info->labels) {
+			auto named = names.find(address);
+			if (named == names.end() || (named->second[0] == '_' && label[0] != '_')) names[address] = label;
+		}
+	}
+
+	std::map<int, std::string> subroutines;
+	auto add = [&](int entry, const std::string& unnamed) {
+		auto named = names.find(entry);
+		subroutines[entry] = (named != names.end()) ? named->second : unnamed;
+	};
+
+	add(static_cast<int>(program.begin), "BEGIN");
+	for (const Instruction& instruction : program.code) {
+		if (instruction.id != 20 && instruction.id != 28) continue; // CALL, SPAWN
+		std::string unnamed = "@";
+		unnamed += std::to_string(instruction.argument);
+		add(instruction.argument, unnamed);
+	}
+	return subroutines;
+}
+
+void SamplingProfiler::write_folded(const Program& program, std::ostream& out) const {
+	std::map<int, std::string> subroutines = find_subroutines(program);
+	auto subroutine = [&subroutines](int pc) -> std::string {
+		auto entry = subroutines.upper_bound(pc);
+		if (entry == subroutines.begin()) return "[unknown]";
+		return std::prev(entry)->second;
+	};
+
+	std::map<std::string, unsigned long long> stacks;
+	unsigned long long taken = std::min<unsigned long long>(sample_buffer.taken.load(), MAX_SAMPLES);
+	for (unsigned long long i = 0; i < taken; ++i) {
+		const RawSample& sample = sample_buffer.samples[i];
+		if (sample.depth < 0) {
+			++stacks["[vm]"];
+			continue;
+		}
+
+		std::string stack = sample.truncated ? "[truncated]" : "";
+		for (int frame = 0; frame < sample.depth; ++frame) {
+			if (!stack.empty()) stack += ';';
+			stack += subroutine(sample.frames[frame]);
+		}
+		++stacks[stack];
+	}
+
+	for (const auto& [stack, count] : stacks) {
+		out << stack << ' ' << count << '\n';
+	}
+}
+
+void SamplingProfiler::write_folded(const Program& program, const std::string& filename) const {
+	std::ofstream out(filename);
+	VERIFY_CONTRACT(out.is_open(), "Unable to open file " << filename);
+	write_folded(program, out);
+}
@@ -0,0 +1,279 @@
+#include "recorder.hpp"
+#include "bigint.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace replay_ns;
+
+// Recording file layout:
+//     magic, version, program hash (8 bytes), number of events
+//     for every event: instruction delta (varint), value (zigzag varint)
+const char RECORDING_MAGIC[8] = {'V', 'M', 'R', 'E', 'P', 'L', 'A', 'Y'};
+const uint32_t RECORDING_VERSION = 1;
+
+//////////////
+// ENCODING //
+//////////////
+
+static void write_raw(std::ostream& out, const void* data, size_t size) {
+	out.write(static_cast<const char*>(data), size);
+}
+
+static void read_raw(std::istream& in, void* data, size_t size) {
+	in.read(static_cast<char*>(data), size);
+	VERIFY_CONTRACT(in.good(), "ERROR: recording file is truncated");
+}
+
+// 7 bits per byte, the high bit is set on all bytes but the last
+static void write_varint(std::ostream& out, uint64_t value) {
+	while (value >= 0x80) {
+		out.put(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	out.put(static_cast<char>(value));
+}
+
+static uint64_t read_varint(std::istream& in) {
+	uint64_t value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		int byte = in.get();
+		VERIFY_CONTRACT(byte != EOF, "ERROR: recording file is truncated");
+		value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return value;
+	}
+	TERMINATE("ERROR: invalid number in recording file");
+}
+
+// Small negative values take one byte too: 0, -1, 1, -2, ... are written as 0, 1, 2, 3, ...
+static uint64_t zigzag(int32_t value) {
+	return (static_cast<uint64_t>(static_cast<uint32_t>(value)) << 1) ^ static_cast<uint64_t>(value < 0 ? -1 : 0);
+}
+
+static int32_t unzigzag(uint64_t value) {
+	return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+///////////////
+// RECORDING //
+///////////////
+
+void Recording::save(std::ostream& out) const {
+	write_raw(out, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+	write_raw(out, &RECORDING_VERSION, sizeof(RECORDING_VERSION));
+	write_raw(out, &program_hash, sizeof(program_hash));
+	write_varint(out, events.size());
+
+	uint64_t previous = 0;
+	for (const InputEvent& event : events) {
+		write_varint(out, event.instruction - previous);
+		write_varint(out, zigzag(event.value));
+		previous = event.instruction;
+	}
+	VERIFY_CONTRACT(out.good(), "ERROR: unable to write recording");
+}
+
+void Recording::save(const std::string& filename) const {
+	std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	VERIFY_CONTRACT(out.is_open(), "ERROR: unable to open file " << filename);
+	save(out);
+}
+
+Recording replay_ns::load(std::istream& in) {
+	char magic[sizeof(RECORDING_MAGIC)];
+	uint32_t version = 0;
+	read_raw(in, magic, sizeof(magic));
+	read_raw(in, &version, sizeof(version));
+	VERIFY_CONTRACT(std::memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0, "ERROR: not a recording file");
+	VERIFY_CONTRACT(version == RECORDING_VERSION, "ERROR: unsupported recording version " << version);
+
+	Recording recording{};
+	read_raw(in, &recording.program_hash, sizeof(recording.program_hash));
+
+	uint64_t count = read_varint(in);
+	uint64_t instruction = 0;
+	for (uint64_t i = 0; i < count; ++i) {
+		instruction += read_varint(in);
+		recording.events.push_back(InputEvent{instruction, unzigzag(read_varint(in))});
+	}
+	return recording;
+}
+
+Recording replay_ns::load(const std::string& filename) {
+	std::ifstream in(filename, std::ios::in | std::ios::binary);
+	VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open file " << filename);
+	return load(in);
+}
+
+// FNV-1a over ids and arguments
+uint64_t replay_ns::program_hash(const Program& program) {
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](int value) {
+		uint32_t bits = static_cast<uint32_t>(value);
+		for (int i = 0; i < 4; ++i) {
+			hash ^= (bits >> (8 * i)) & 0xFF;
+			hash *= 1099511628211ULL;
+		}
+	};
+	for (const Instruction& instruction : program.code) {
+		mix(instruction.id);
+		mix(instruction.argument);
+	}
+	return hash;
+}
+
+///////////////////
+// INPUT JOURNAL //
+///////////////////
+
+InputJournal::InputJournal(const Program& program) :
+	recording_{program_hash(program), {}}, replaying_(false), next_(0), pending_(false) {}
+
+InputJournal::InputJournal(const Program& program, Recording recording) :
+	recording_(std::move(recording)), replaying_(true), next_(0), pending_(false)
+{
+	VERIFY_CONTRACT(recording_.program_hash == program_hash(program),
+		"ERROR: the recording was made by another program");
+}
+
+int InputJournal::read(std::istream& input) {
+	VERIFY_CONTRACT(!pending_, "ERROR: IN executed twice in one slice");
+	pending_ = true;
+
+	if (replaying_) {
+		VERIFY_CONTRACT(next_ < recording_.events.size(),
+			"ERROR: replay diverged, the recording has only " << recording_.events.size() << " values");
+		return recording_.events[next_].value;
+	}
+
+	int value;
+	bool correct = static_cast<bool>(input >> value);
+	VERIFY_CONTRACT(correct, "ERROR: invalid input in IN command");
+	recording_.events.push_back(InputEvent{0, value});
+	return value;
+}
+
+void InputJournal::settle(uint64_t instruction) {
+	if (!pending_) return;
+	pending_ = false;
+
+	InputEvent& event = recording_.events[next_];
+	if (replaying_) {
+		VERIFY_CONTRACT(event.instruction == instruction,
+			"ERROR: replay diverged, IN at instruction " << instruction << " was recorded at " << event.instruction);
+	}
+	else {
+		event.instruction = instruction;
+	}
+	++next_;
+}
+
+bool InputJournal::replaying() const {
+	return replaying_;
+}
+
+const Recording& InputJournal::recording() const {
+	return recording_;
+}
+
+size_t InputJournal::position() const {
+	return next_;
+}
+
+void InputJournal::seek(size_t position) {
+	VERIFY_CONTRACT(replaying_ && position <= recording_.events.size(), "ERROR: invalid position in recording");
+	next_ = position;
+	pending_ = false;
+}
+
+static std::shared_ptr<InputJournal> exit_journal;
+static std::string exit_filename;
+
+static void save_exit_journal() {
+	if (exit_journal) exit_journal->recording().save(exit_filename);
+}
+
+void replay_ns::save_at_exit(std::shared_ptr<InputJournal> journal, const std::string& filename) {
+	bool registered = static_cast<bool>(exit_journal);
+	exit_journal = std::move(journal);
+	exit_filename = filename;
+	if (!registered) std::atexit(save_exit_journal);
+}
+
+/////////////////
+// CHECKPOINTS //
+/////////////////
+
+Checkpoint replay_ns::capture(CPU& cpu) {
+	return Checkpoint{
+		cpu.executed,
+		cpu.pc_register,
+		cpu.stack,
+		cpu.call_stack,
+		std::vector<int>(cpu.registers, cpu.registers + REGS),
+		std::vector<int>(cpu.memory, cpu.memory + MEMORY_SIZE),
+		cpu.journal ? cpu.journal->position() : 0,
+		std::make_shared<bigint_ns::BigArena>(bigint_ns::arena(cpu))
+	};
+}
+
+void replay_ns::restore(CPU& cpu, const Checkpoint& checkpoint) {
+	cpu.executed = checkpoint.executed;
+	cpu.pc_register = checkpoint.pc;
+	cpu.stack = checkpoint.stack;
+	cpu.call_stack = checkpoint.call_stack;
+	std::copy(checkpoint.registers.begin(), checkpoint.registers.end(), cpu.registers);
+	std::copy(checkpoint.memory.begin(), checkpoint.memory.end(), cpu.memory);
+	cpu.interrupt = false;
+	if (cpu.journal) cpu.journal->seek(checkpoint.input_position);
+	// a copy, the checkpoint may be restored again
+	cpu.bigints = std::make_shared<bigint_ns::BigArena>(*checkpoint.bigints);
+}
+
+//////////////
+// REPLAYER //
+//////////////
+
+Replayer::Replayer(CPU& cpu, Recording recording, unsigned long long period) :
+	cpu_(cpu), journal_(std::make_shared<InputJournal>(*cpu.program, std::move(recording))),
+	period_(std::max(period, 1ULL)), checkpoints_()
+{
+	cpu_.journal = journal_;
+	take_checkpoint();
+}
+
+void Replayer::take_checkpoint() {
+	checkpoints_.push_back(capture(cpu_));
+}
+
+CPUStatus Replayer::seek(unsigned long long instruction) {
+	// go back to the last checkpoint not after the instruction
+	if (instruction < cpu_.executed) {
+		auto after = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), instruction,
+			[](unsigned long long value, const Checkpoint& checkpoint) { return value < checkpoint.executed; });
+		restore(cpu_, *(after - 1));
+	}
+
+	CPUStatus status = CPU_RUNNING;
+	while (cpu_.executed < instruction) {
+		unsigned long long boundary = (cpu_.executed / period_ + 1) * period_;
+		status = cpu_.run_for(std::min(instruction, boundary) - cpu_.executed);
+
+		if (cpu_.executed % period_ == 0 && checkpoints_.back().executed < cpu_.executed) {
+			take_checkpoint();
+		}
+		if (status != CPU_RUNNING && status != CPU_YIELDED) return status;
+	}
+	return (cpu_.pc_register == static_cast<int>(cpu_.program->end)) ? CPU_HALTED : status;
+}
+
+CPUStatus Replayer::run() {
+	return seek(UNLIMITED);
+}
+
+size_t Replayer::checkpoints() const {
+	return checkpoints_.size();
+}
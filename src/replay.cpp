@@ -0,0 +1,82 @@
+#include "recorder.hpp"
+#include "cpu.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+
+// Number of stack values printed from the top
+const unsigned PRINTED_STACK = 8;
+
+static const char* status_name(CPUStatus status) {
+	switch (status) {
+		case CPU_RUNNING:  return "running";
+		case CPU_HALTED:   return "halted";
+		case CPU_BUDGET:   return "budget exhausted";
+		case CPU_DEADLINE: return "deadline exceeded";
+		case CPU_YIELDED:  return "yielded";
+	}
+	return "";
+}
+
+static void print_state(CPU& cpu, CPUStatus status) {
+	printf(SET_COLOR_YELLOW "instruction " SET_COLOR_CYAN "%llu" SET_COLOR_YELLOW ", pc " SET_COLOR_CYAN "%d"
+		SET_COLOR_YELLOW " (%s)\n" RESET_COLOR, cpu.executed, cpu.pc_register, status_name(status));
+
+	printf("  registers:");
+	for (int i = 0; i < REGS; ++i) {
+		printf(" %s=%d", REGISTER_NAMES[i], cpu.registers[i]);
+	}
+
+	VMStack stack(cpu.stack);
+	printf("\n  stack (%u values, top first):", stack.size());
+	for (unsigned i = 0; i < PRINTED_STACK && stack.size() > 0; ++i) {
+		printf(" %d", stack.top());
+		stack.pop();
+	}
+	printf("%s\n", (stack.size() > 0) ? " ..." : "");
+}
+
+// Usage: replay FILE.bcode RECORDING [--checkpoint INSTRUCTIONS] [--seek INSTRUCTION]...
+// Without --seek the program is replayed to the end with its output.
+// Every --seek moves the program to the instruction (back or forward) and prints its state
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc >= 3 && argc % 2 == 1, "Unexpected arguments passed to make replay");
+
+	unsigned long long period = replay_ns::DEFAULT_CHECKPOINT_PERIOD;
+	std::vector<unsigned long long> seeks;
+	for (int i = 3; i < argc; i += 2) {
+		if (std::strcmp(argv[i], "--checkpoint") == 0) {
+			period = parse_number(argv[i + 1], argv[i], 1);
+		}
+		else if (std::strcmp(argv[i], "--seek") == 0) {
+			seeks.push_back(parse_number(argv[i + 1], argv[i]));
+		}
+		else {
+			TERMINATE("Unknown option " << argv[i]);
+		}
+	}
+
+	CPU cpu(argv[1]);
+	replay_ns::Replayer replayer(cpu, replay_ns::load(argv[2]), period);
+
+	if (seeks.empty()) {
+		print_state(cpu, replayer.run());
+		return 0;
+	}
+
+	// output is already known from the recorded run, and is repeated on every seek back
+	std::ostream discard(nullptr);
+	cpu.output = &discard;
+
+	for (unsigned long long instruction : seeks) {
+		print_state(cpu, replayer.seek(instruction));
+	}
+	printf(SET_COLOR_YELLOW "%zu checkpoints taken\n" RESET_COLOR, replayer.checkpoints());
+	return 0;
+}
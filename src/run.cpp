@@ -1,18 +1,162 @@
 #include "parser.hpp"
 #include "cpu.hpp"
+#include "scheduler.hpp"
+#include "tracer.hpp"
+#include "recorder.hpp"
+#include "cache.hpp"
+#include "compiler.hpp"
+#include "profiler.hpp"
+#include "pgo.hpp"
+#include "hot_trace.hpp"
+#include "memo.hpp"
+#include "utils.hpp"
 #include <iostream>
 #include <string>
+#include <memory>
 
+// Usage: run file.bcode | file.lng | file.lnx [--budget INSTRUCTIONS] [--deadline MILLISECONDS]
+//                       [--slice INSTRUCTIONS] [--workers THREADS]
+//                       [--trace FILE] [--record FILE | --replay FILE]
+//                       [--counters] [--profile FILE] [--pgo FILE]
+//                       [--engine virtual | switch | trace] [--memo]
+// --counters prints hardware counters of the run, --profile samples the program
+// and writes folded stacks for flame graphs (e.g. flamegraph.pl FILE > profile.svg).
+// --pgo counts executions of every instruction and writes the profile for code --profile.
+// --engine trace runs iterations of hot loops from recorded traces.
+// --memo caches results of pure routines by their arguments, the switch engine does not memoize.
+// Source is compiled through the byte code cache, warm starts do not parse it
 int main(int argc, char** argv) {
-	VERIFY_CONTRACT(argc == 2, "Unexpected arguments passed to make code");
+	VERIFY_CONTRACT(argc >= 2, "Unexpected arguments passed to make run");
 
 	std::string filename(argv[1]);
-	std::regex extension = std::regex("[A-Za-z_\\/\\-]+\\.bcode");
-	VERIFY_CONTRACT(std::regex_match(filename, extension), "Expected .bcode file");
+	if (has_extension(filename, ".lng") || has_extension(filename, compiler_ns::SOURCE_EXTENSION)) {
+		bool hit = false;
+		filename = cache_ns::BytecodeCache().compile(filename, {}, &hit);
+		std::cout << SET_COLOR_YELLOW << (hit ? "Using cached byte code " : "Compiled to cache ")
+		          << SET_COLOR_CYAN << filename << RESET_COLOR << '\n';
+	}
+	VERIFY_CONTRACT(has_extension(filename, ".bcode"), "Expected .bcode, .lng or .lnx file");
 
 	CPU cpu = CPU(filename);
+	unsigned long long slice = DEFAULT_SLICE;
+	unsigned workers = 1;
+
+	bool counters = false;
+	bool memo = false;
+	std::string profile;
+	std::string pgo;
+
+	for (int i = 2; i < argc; ++i) {
+		// every option but --counters and --memo takes a value
+		std::string option = argv[i];
+		if (option == "--counters") {
+			counters = true;
+			continue;
+		}
+		if (option == "--memo") {
+			memo = true;
+			continue;
+		}
+		VERIFY_CONTRACT(i + 1 < argc, "Expected value of option " << option);
+		const char* value = argv[++i];
+
+		if (option == "--budget") {
+			cpu.set_budget(parse_number(value, option));
+		}
+		else if (option == "--deadline") {
+			cpu.set_deadline(std::chrono::milliseconds(parse_number(value, option)));
+		}
+		else if (option == "--slice") {
+			slice = parse_number(value, option, 1);
+		}
+		else if (option == "--workers") {
+			workers = parse_number(value, option, 1, std::numeric_limits<unsigned>::max());
+		}
+		else if (option == "--record") {
+			// the recording is saved even if the program fails with a runtime error
+			cpu.journal = std::make_shared<replay_ns::InputJournal>(*cpu.program);
+			replay_ns::save_at_exit(cpu.journal, value);
+		}
+		else if (option == "--replay") {
+			cpu.journal = std::make_shared<replay_ns::InputJournal>(*cpu.program, replay_ns::load(value));
+		}
+		else if (option == "--profile") {
+			profile = value;
+		}
+		else if (option == "--engine") {
+			std::string engine = value;
+			if (engine == "virtual")     cpu.engine = ENGINE_VIRTUAL;
+			else if (engine == "switch") cpu.engine = ENGINE_SWITCH;
+			else if (engine == "trace")  cpu.engine = ENGINE_TRACE;
+			else {
+				TERMINATE("Unknown engine " << engine);
+			}
+		}
+		else if (option == "--pgo") {
+			cpu.engine = ENGINE_PROFILE;
+			pgo = value;
+		}
+		else if (option == "--trace") {
+#ifdef VM_TRACE
+			// the trace is saved even if the program fails with a runtime error
+			cpu.trace = std::make_shared<trace_ns::TraceBuffer>();
+			trace_ns::save_at_exit(cpu.trace, value);
+#else
+			TERMINATE("Tracing is disabled in this build, rebuild with make VM_TRACE=1");
+#endif
+		}
+		else {
+			TERMINATE("Unknown option " << option);
+		}
+	}
+
+	if (memo) {
+		// the switch engine runs CALL and RET itself, memoizing commands are never called
+		VERIFY_CONTRACT(cpu.engine != ENGINE_SWITCH, "ERROR: --memo cannot be used with --engine switch");
+		size_t routines = memo_ns::enable_memoization(*cpu.program);
+		std::cout << SET_COLOR_YELLOW << "Memoizing " << routines << " pure routines" << RESET_COLOR << '\n';
+	}
 
 	std::cout << SET_COLOR_YELLOW << "Running program " << SET_COLOR_CYAN << filename << SET_COLOR_YELLOW << "...\n" << RESET_COLOR;
-	cpu.run();
+
+	// the main context is run by the scheduler, so the program can SPAWN green threads
+	Scheduler scheduler(slice, workers);
+	scheduler.add(cpu);
+
+	// counters are opened only on request, it takes a few system calls
+	std::unique_ptr<profiler_ns::HardwareCounters> hardware;
+	if (counters) {
+		hardware = std::make_unique<profiler_ns::HardwareCounters>();
+		hardware->start();
+	}
+	profiler_ns::SamplingProfiler sampler;
+	if (!profile.empty()) sampler.start();
+	scheduler.run();
+	sampler.stop();
+
+	if (hardware) {
+		hardware->stop();
+		hardware->print(std::cout, scheduler.executed());
+	}
+	if (!profile.empty()) {
+		sampler.write_folded(*cpu.program, profile);
+		std::cout << SET_COLOR_YELLOW << "Folded stacks of " << sampler.samples() << " samples written to "
+		          << SET_COLOR_CYAN << profile << RESET_COLOR << '\n';
+	}
+	if (cpu.program->memo) {
+		memo_ns::MemoStats stats = cpu.program->memo->stats();
+		std::cout << SET_COLOR_YELLOW << "Memoized calls: " << stats.hits << " hits, " << stats.misses << " misses, "
+		          << stats.evictions << " evictions" << RESET_COLOR << '\n';
+	}
+	if (cpu.traces) {
+		const hot_trace_ns::TraceStats& stats = cpu.traces->stats;
+		std::cout << SET_COLOR_YELLOW << "Hot loops of the main context: " << stats.recorded << " traces recorded, "
+		          << stats.aborted << " recordings aborted, " << stats.entered << " entries, "
+		          << stats.side_exits << " side exits" << RESET_COLOR << '\n';
+	}
+	if (!pgo.empty() && cpu.profile) {
+		cpu.profile->snapshot().save(pgo);
+		std::cout << SET_COLOR_YELLOW << "Execution profile written to " << SET_COLOR_CYAN << pgo << RESET_COLOR << '\n';
+	}
 	return 0;
-}
\ No newline at end of file
+}
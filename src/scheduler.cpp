@@ -0,0 +1,111 @@
+#include "utils.hpp"
+#include "scheduler.hpp"
+
+#include <thread>
+#include <vector>
+
+///////////////
+// SCHEDULER //
+///////////////
+
+Scheduler::Scheduler(unsigned long long slice, unsigned workers) :
+	running_(0), slice_(slice), workers_(workers)
+{
+	VERIFY_CONTRACT(slice_ > 0, "ERROR: scheduler slice must be positive");
+	VERIFY_CONTRACT(workers_ > 0, "ERROR: scheduler needs at least one worker");
+}
+
+int Scheduler::push_task(CPU* cpu, std::unique_ptr<CPU> owned) {
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	int id = static_cast<int>(tasks_.size());
+	tasks_.push_back(Task{cpu, std::move(owned), false});
+	ready_.push_back(id);
+
+	wakeup_.notify_one();
+	return id;
+}
+
+int Scheduler::add(CPU& cpu) {
+	cpu.scheduler = this;
+	return push_task(&cpu, nullptr);
+}
+
+int Scheduler::spawn(CPU& parent, int entry, int argument) {
+	VERIFY_CONTRACT((entry >= 0) && (entry < (int)parent.program->commands.size()),
+		"ERROR: SPAWN to non-existing pointer");
+
+	std::unique_ptr<CPU> child = std::make_unique<CPU>(parent, entry);
+	child->scheduler = this;
+	child->stack.push(argument);
+
+	CPU* cpu = child.get();
+	return push_task(cpu, std::move(child));
+}
+
+bool Scheduler::finished(int id) {
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	VERIFY_CONTRACT((id >= 0) && (id < (int)tasks_.size()), "ERROR: JOIN with invalid context id " << id);
+	return tasks_[id].finished;
+}
+
+// Take ready contexts one by one until nothing is ready and nothing is running
+void Scheduler::work() {
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	while (true) {
+		wakeup_.wait(lock, [this] { return !ready_.empty() || running_ == 0; });
+		if (ready_.empty()) break;
+
+		int id = ready_.front();
+		ready_.pop_front();
+		CPU* cpu = tasks_[id].cpu;
+		++running_;
+
+		lock.unlock();
+		CPUStatus status = cpu->run_for(slice_);
+		lock.lock();
+
+		--running_;
+		switch (status) {
+			case CPU_HALTED:
+				tasks_[id].finished = true;
+				break;
+			case CPU_RUNNING:
+			case CPU_YIELDED:
+				ready_.push_back(id);
+				break;
+			case CPU_BUDGET:
+				TERMINATE("ERROR: instruction budget of context " << id << " exhausted after " << cpu->executed << " instructions");
+			case CPU_DEADLINE:
+				TERMINATE("ERROR: deadline of context " << id << " exceeded after " << cpu->executed << " instructions");
+		}
+		wakeup_.notify_all();
+	}
+}
+
+void Scheduler::run() {
+	if (workers_ == 1) {
+		work();
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < workers_; ++i) {
+		threads.emplace_back(&Scheduler::work, this);
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+unsigned long long Scheduler::executed() {
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	unsigned long long total = 0;
+	for (const Task& task : tasks_) {
+		total += task.cpu->executed;
+	}
+	return total;
+}
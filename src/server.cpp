@@ -0,0 +1,290 @@
+#include "server.hpp"
+#include "cache.hpp"
+#include "compiler.hpp"
+#include "memo.hpp"
+#include "scheduler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <streambuf>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace server_ns;
+
+namespace fs = std::filesystem;
+
+///////////////////
+// SOCKET STREAM //
+///////////////////
+
+// Buffered reads and writes of a connected socket, it does not close the socket
+class SocketBuffer : public std::streambuf {
+private:
+	static const size_t BUFFER_SIZE = 4096;
+
+	int socket_;
+	char input_[BUFFER_SIZE];
+	char output_[BUFFER_SIZE];
+public:
+	explicit SocketBuffer(int socket) : socket_(socket), input_(), output_() {
+		setg(input_, input_, input_);
+		setp(output_, output_ + BUFFER_SIZE);
+	}
+
+	~SocketBuffer() override {
+		sync();
+	}
+protected:
+	int_type underflow() override {
+		ssize_t received = 0;
+		do {
+			received = recv(socket_, input_, BUFFER_SIZE, 0);
+		} while (received < 0 && errno == EINTR);
+
+		if (received <= 0) return traits_type::eof();
+		setg(input_, input_, input_ + received);
+		return traits_type::to_int_type(input_[0]);
+	}
+
+	int_type overflow(int_type c) override {
+		if (sync() != 0) return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	// the peer may be gone, MSG_NOSIGNAL turns SIGPIPE into an error of the stream
+	int sync() override {
+		const char* position = pbase();
+		while (position < pptr()) {
+			ssize_t sent = send(socket_, position, pptr() - position, MSG_NOSIGNAL);
+			if (sent < 0 && errno == EINTR) continue;
+			if (sent <= 0) return -1;
+			position += sent;
+		}
+		setp(output_, output_ + BUFFER_SIZE);
+		return 0;
+	}
+};
+
+static sockaddr_un socket_address(const std::string& path) {
+	sockaddr_un address {};
+	address.sun_family = AF_UNIX;
+	VERIFY_CONTRACT(path.size() < sizeof(address.sun_path), "ERROR: socket path is too long: " << path);
+	std::strcpy(address.sun_path, path.c_str());
+	return address;
+}
+
+// Signals the server waits for: stop, or a worker exited
+static sigset_t server_signals() {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGCHLD);
+	return signals;
+}
+
+////////////
+// SERVER //
+////////////
+
+Server::Server(const std::string& socket_path, unsigned workers) :
+	socket_path_(socket_path), workers_(workers), listener_(-1), memoize_(false), programs_(), pids_()
+{
+	VERIFY_CONTRACT(workers_ > 0, "ERROR: server needs at least one worker");
+	sockaddr_un address = socket_address(socket_path_);
+
+	// socket left by a server that was killed, a running server still accepts connections on it
+	std::error_code error;
+	if (fs::exists(socket_path_, error)) {
+		VERIFY_CONTRACT(fs::is_socket(socket_path_, error), "ERROR: " << socket_path_ << " exists and is not a socket");
+
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		VERIFY_CONTRACT(probe >= 0, "ERROR: unable to create socket: " << std::strerror(errno));
+		bool running = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+		close(probe);
+		VERIFY_CONTRACT(!running, "ERROR: another server is listening on " << socket_path_);
+
+		fs::remove(socket_path_, error);
+	}
+
+	listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	VERIFY_CONTRACT(listener_ >= 0, "ERROR: unable to create socket: " << std::strerror(errno));
+	VERIFY_CONTRACT(bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0,
+		"ERROR: unable to bind socket " << socket_path_ << ": " << std::strerror(errno));
+	VERIFY_CONTRACT(listen(listener_, SOMAXCONN) == 0, "ERROR: unable to listen on " << socket_path_ << ": " << std::strerror(errno));
+}
+
+Server::~Server() {
+	if (listener_ >= 0) close(listener_);
+}
+
+std::shared_ptr<Program> Server::load(const std::string& requested) {
+	// one entry for every file, however the path is spelled
+	std::error_code error;
+	std::string path = fs::weakly_canonical(requested, error).string();
+	VERIFY_CONTRACT(!error, "ERROR: unable to open file " << requested);
+
+	fs::file_time_type modified = fs::last_write_time(path, error);
+	VERIFY_CONTRACT(!error, "ERROR: unable to open file " << path);
+
+	auto loaded = programs_.find(path);
+	if (loaded != programs_.end() && loaded->second.modified == modified) return loaded->second.program;
+
+	std::string bytecode = path;
+	if (has_extension(path, ".lng") || has_extension(path, compiler_ns::SOURCE_EXTENSION)) {
+		bytecode = cache_ns::BytecodeCache().compile(path);
+	}
+	CPU loader(bytecode);
+	if (memoize_) memo_ns::enable_memoization(*loader.program);
+	programs_[path] = LoadedProgram{loader.program, modified};
+	return loader.program;
+}
+
+void Server::enable_memoization() {
+	memoize_ = true;
+}
+
+void Server::preload(const std::string& path) {
+	load(path);
+}
+
+pid_t Server::start_worker() {
+	// buffered output would be written by both processes
+	std::cout.flush();
+
+	pid_t pid = fork();
+	VERIFY_CONTRACT(pid >= 0, "ERROR: unable to start worker: " << std::strerror(errno));
+	if (pid == 0) {
+		sigset_t signals = server_signals();
+		pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+		work();
+	}
+	return pid;
+}
+
+void Server::work() {
+	for (;;) {
+		int client = accept(listener_, nullptr, nullptr);
+		if (client < 0) continue;
+
+		handle(client);
+		close(client);
+	}
+}
+
+void Server::handle(int client) {
+	// separate streams, so the end of input does not stop the output
+	SocketBuffer buffer(client);
+	std::istream input(&buffer);
+	std::ostream output(&buffer);
+
+	// error messages go to the client, then the worker exits
+	std::cout.flush();
+	int saved_stdout = dup(STDOUT_FILENO);
+	dup2(client, STDOUT_FILENO);
+
+	Request request;
+	std::string command;
+	input >> command >> request.budget >> request.deadline >> std::ws;
+	std::getline(input, request.program);
+	VERIFY_CONTRACT(command == "run" && !request.program.empty(), "ERROR: invalid request");
+
+	CPU cpu(load(request.program));
+	cpu.input = &input;
+	cpu.output = &output;
+	if (request.budget > 0) cpu.set_budget(request.budget);
+	if (request.deadline > 0) cpu.set_deadline(std::chrono::milliseconds(request.deadline));
+
+	// run by the scheduler, so the program can SPAWN green threads
+	Scheduler scheduler;
+	scheduler.add(cpu);
+	scheduler.run();
+	output << DONE_MARKER << ' ' << scheduler.executed() << std::endl;
+
+	std::cout.flush();
+	dup2(saved_stdout, STDOUT_FILENO);
+	close(saved_stdout);
+}
+
+void Server::serve() {
+	// signals are blocked and taken by sigwait, so none of them comes between the checks
+	sigset_t signals = server_signals();
+	sigset_t previous;
+	pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+	for (unsigned i = 0; i < workers_; ++i) {
+		pids_.push_back(start_worker());
+	}
+
+	int signal = 0;
+	while (sigwait(&signals, &signal) == 0 && signal == SIGCHLD) {
+		// a program failed and its worker exited
+		pid_t pid = 0;
+		while ((pid = waitpid(-1, nullptr, WNOHANG)) > 0) {
+			auto exited = std::find(pids_.begin(), pids_.end(), pid);
+			if (exited != pids_.end()) *exited = start_worker();
+		}
+	}
+
+	for (pid_t pid : pids_) kill(pid, SIGTERM);
+	for (pid_t pid : pids_) waitpid(pid, nullptr, 0);
+	pids_.clear();
+	unlink(socket_path_.c_str());
+	pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+////////////
+// CLIENT //
+////////////
+
+bool server_ns::submit(const std::string& socket_path, const Request& request, std::istream& input, std::ostream& output,
+                       unsigned long long* executed) {
+	sockaddr_un address = socket_address(socket_path);
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	VERIFY_CONTRACT(connection >= 0 && connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0,
+		"ERROR: unable to connect to " << socket_path << ": " << std::strerror(errno));
+
+	bool done = false;
+	{
+		SocketBuffer buffer(connection);
+		std::istream incoming(&buffer);
+		std::ostream outgoing(&buffer);
+
+		// the server resolves paths in its own directory
+		outgoing << "run " << request.budget << ' ' << request.deadline << ' ' << fs::weakly_canonical(request.program).string() << '\n';
+		outgoing.flush();
+
+		// the program may write more than the socket holds before it reads all input,
+		// so the input is sent while the output is read
+		std::thread sender([&input, &outgoing, connection] {
+			if (input.peek() != std::char_traits<char>::eof()) outgoing << input.rdbuf();
+			outgoing.flush();
+			shutdown(connection, SHUT_WR);
+		});
+
+		std::string line;
+		std::string marker = DONE_MARKER;
+		while (std::getline(incoming, line)) {
+			if (line.compare(0, marker.size(), marker) == 0) {
+				done = true;
+				if (executed != nullptr) *executed = std::stoull(line.substr(marker.size()));
+				continue;
+			}
+			output << line << std::endl;
+		}
+		sender.join();
+	}
+	close(connection);
+	return done;
+}
@@ -0,0 +1,176 @@
+#include "simd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace simd_ns;
+
+////////////
+// SCALAR //
+////////////
+
+// Arithmetic is done on unsigned values, so the overflow wraps around
+// exactly like the vector instructions do
+
+static void scalar_add(int* dst, const int* a, const int* b, unsigned n) {
+	for (unsigned i = 0; i < n; ++i)
+		dst[i] = static_cast<int>(static_cast<unsigned>(a[i]) + static_cast<unsigned>(b[i]));
+}
+
+static void scalar_sub(int* dst, const int* a, const int* b, unsigned n) {
+	for (unsigned i = 0; i < n; ++i)
+		dst[i] = static_cast<int>(static_cast<unsigned>(a[i]) - static_cast<unsigned>(b[i]));
+}
+
+static void scalar_mul(int* dst, const int* a, const int* b, unsigned n) {
+	for (unsigned i = 0; i < n; ++i)
+		dst[i] = static_cast<int>(static_cast<unsigned>(a[i]) * static_cast<unsigned>(b[i]));
+}
+
+static void scalar_cmpeq(int* dst, const int* a, const int* b, unsigned n) {
+	for (unsigned i = 0; i < n; ++i)
+		dst[i] = (a[i] == b[i]) ? -1 : 0;
+}
+
+static void scalar_cmpgt(int* dst, const int* a, const int* b, unsigned n) {
+	for (unsigned i = 0; i < n; ++i)
+		dst[i] = (a[i] > b[i]) ? -1 : 0;
+}
+
+static int scalar_sum(const int* a, unsigned n) {
+	unsigned sum = 0;
+	for (unsigned i = 0; i < n; ++i)
+		sum += static_cast<unsigned>(a[i]);
+	return static_cast<int>(sum);
+}
+
+static const Kernels SCALAR_KERNELS {
+	"scalar",
+	scalar_add,
+	scalar_sub,
+	scalar_mul,
+	scalar_cmpeq,
+	scalar_cmpgt,
+	scalar_sum
+};
+
+#ifdef SIMD_X86
+
+////////////
+// SSE4.1 //
+////////////
+
+// Every kernel processes full vectors first and leaves the tail to the scalar loop
+
+#define DEFINE_SSE_KERNEL(name, intrinsic) \
+__attribute__((target("sse4.1"))) \
+static void sse_##name(int* dst, const int* a, const int* b, unsigned n) { \
+	unsigned i = 0; \
+	for (; i + 4 <= n; i += 4) { \
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)); \
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)); \
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), intrinsic(va, vb)); \
+	} \
+	scalar_##name(dst + i, a + i, b + i, n - i); \
+}
+
+DEFINE_SSE_KERNEL(add,   _mm_add_epi32)
+DEFINE_SSE_KERNEL(sub,   _mm_sub_epi32)
+DEFINE_SSE_KERNEL(mul,   _mm_mullo_epi32)
+DEFINE_SSE_KERNEL(cmpeq, _mm_cmpeq_epi32)
+DEFINE_SSE_KERNEL(cmpgt, _mm_cmpgt_epi32)
+
+__attribute__((target("sse4.1")))
+static int sse_sum(const int* a, unsigned n) {
+	__m128i acc = _mm_setzero_si128();
+	unsigned i = 0;
+	for (; i + 4 <= n; i += 4) {
+		acc = _mm_add_epi32(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	unsigned sum = static_cast<unsigned>(_mm_cvtsi128_si32(acc));
+	return static_cast<int>(sum + static_cast<unsigned>(scalar_sum(a + i, n - i)));
+}
+
+static const Kernels SSE_KERNELS {
+	"sse4.1",
+	sse_add,
+	sse_sub,
+	sse_mul,
+	sse_cmpeq,
+	sse_cmpgt,
+	sse_sum
+};
+
+//////////
+// AVX2 //
+//////////
+
+#define DEFINE_AVX2_KERNEL(name, intrinsic) \
+__attribute__((target("avx2"))) \
+static void avx2_##name(int* dst, const int* a, const int* b, unsigned n) { \
+	unsigned i = 0; \
+	for (; i + 8 <= n; i += 8) { \
+		__m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)); \
+		__m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)); \
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), intrinsic(va, vb)); \
+	} \
+	sse_##name(dst + i, a + i, b + i, n - i); \
+}
+
+DEFINE_AVX2_KERNEL(add,   _mm256_add_epi32)
+DEFINE_AVX2_KERNEL(sub,   _mm256_sub_epi32)
+DEFINE_AVX2_KERNEL(mul,   _mm256_mullo_epi32)
+DEFINE_AVX2_KERNEL(cmpeq, _mm256_cmpeq_epi32)
+DEFINE_AVX2_KERNEL(cmpgt, _mm256_cmpgt_epi32)
+
+__attribute__((target("avx2")))
+static int avx2_sum(const int* a, unsigned n) {
+	__m256i acc = _mm256_setzero_si256();
+	unsigned i = 0;
+	for (; i + 8 <= n; i += 8) {
+		acc = _mm256_add_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+	}
+	__m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+	half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+	unsigned sum = static_cast<unsigned>(_mm_cvtsi128_si32(half));
+	return static_cast<int>(sum + static_cast<unsigned>(sse_sum(a + i, n - i)));
+}
+
+static const Kernels AVX2_KERNELS {
+	"avx2",
+	avx2_add,
+	avx2_sub,
+	avx2_mul,
+	avx2_cmpeq,
+	avx2_cmpgt,
+	avx2_sum
+};
+
+#endif // SIMD_X86
+
+///////////////
+// SELECTION //
+///////////////
+
+static const Kernels& select_kernels() {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))   return AVX2_KERNELS;
+	if (__builtin_cpu_supports("sse4.1")) return SSE_KERNELS;
+#endif
+	return SCALAR_KERNELS;
+}
+
+const Kernels& simd_ns::kernels() {
+	static const Kernels& selected = select_kernels();
+	return selected;
+}
+
+const Kernels& simd_ns::scalar_kernels() {
+	return SCALAR_KERNELS;
+}
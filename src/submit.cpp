@@ -0,0 +1,38 @@
+#include "server.hpp"
+#include "utils.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Usage: submit SOCKET PROGRAM [--budget INSTRUCTIONS] [--deadline MILLISECONDS]
+// Runs the program on the daemon listening on SOCKET. Input of the program is read
+// from stdin and sent as it is read, its output is printed as it comes
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc >= 3 && argc % 2 == 1, "Unexpected arguments passed to make submit");
+
+	server_ns::Request request;
+	request.program = argv[2];
+	for (int i = 3; i < argc; i += 2) {
+		std::string flag = argv[i];
+		if (flag == "--budget") {
+			request.budget = parse_number(argv[i + 1], flag);
+		}
+		else if (flag == "--deadline") {
+			request.deadline = parse_number(argv[i + 1], flag);
+		}
+		else {
+			TERMINATE("Unknown option " << flag);
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long executed = 0;
+	bool done = server_ns::submit(argv[1], request, std::cin, std::cout, &executed);
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+	VERIFY_CONTRACT(done, "Program " << request.program << " failed");
+	std::cout << SET_COLOR_YELLOW << "Executed " << executed << " instructions, request took "
+	          << elapsed.count() << " us" << RESET_COLOR << '\n';
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include "utils.hpp"
+#include "cpu.hpp"
+#include "command.hpp"
+#include "tracer.hpp"
+
+#include <iostream>
+
+///////////////////
+// SWITCH ENGINE //
+///////////////////
+
+// Frequent commands are executed right here without a virtual call,
+// the rest go to Command::execute. Every case must behave exactly like
+// the corresponding command in command.cpp
+
+// Pop two operands: rhs is the top of the stack, lhs is the next one
+#define POP_OPERANDS(rhs, lhs) \
+	int rhs = stack.top(); \
+	stack.pop(); \
+	int lhs = stack.top(); \
+	stack.pop();
+
+#define CONDITIONAL_JUMP(condition) { \
+	POP_OPERANDS(rhs, lhs) \
+	pc_register = (condition) ? instruction.argument : pc_register + 1; \
+	break; \
+}
+
+unsigned long long CPU::execute_switch(unsigned long long n) {
+	Command* const* commands = program->commands.data();
+	const Instruction* code = program->code.data();
+	int size = (int)program->code.size();
+	int stop = static_cast<int>(program->end);
+
+	unsigned long long done = 0;
+	while (done < n && pc_register != stop) {
+		VERIFY_CONTRACT((pc_register < size) && (pc_register >= 0),
+			"ERROR: jump or call to non-existing pointer");
+		const Instruction& instruction = code[pc_register];
+		[[maybe_unused]] const int pc = pc_register;
+		++done;
+
+		switch (instruction.id) {
+			case 10: // BEGIN
+				pc_register += 1;
+				break;
+			case 11: // POP
+				stack.pop();
+				pc_register += 1;
+				break;
+			case 12: { // ADD
+				POP_OPERANDS(rhs, lhs)
+				stack.push(rhs + lhs);
+				pc_register += 1;
+				break;
+			}
+			case 13: { // SUB
+				POP_OPERANDS(rhs, lhs)
+				stack.push(rhs - lhs);
+				pc_register += 1;
+				break;
+			}
+			case 14: { // MUL
+				POP_OPERANDS(rhs, lhs)
+				stack.push(rhs * lhs);
+				pc_register += 1;
+				break;
+			}
+			case 15: { // DIV
+				POP_OPERANDS(rhs, lhs)
+				stack.push(rhs / lhs);
+				pc_register += 1;
+				break;
+			}
+			case 16: // OUT
+				*output << stack.top() << std::endl;
+				stack.pop();
+				pc_register += 1;
+				break;
+			case 18: // RET
+				pc_register = call_stack.top();
+				call_stack.pop();
+				pc_register += 1;
+				break;
+
+			case 20: // CALL
+				call_stack.push(pc_register);
+				pc_register = instruction.argument;
+				break;
+			case 21: // JMP
+				pc_register = instruction.argument;
+				break;
+			case 22: CONDITIONAL_JUMP(rhs == lhs) // JEQ
+			case 23: CONDITIONAL_JUMP(rhs != lhs) // JNE
+			case 24: CONDITIONAL_JUMP(rhs >  lhs) // JA
+			case 25: CONDITIONAL_JUMP(rhs >= lhs) // JAE
+			case 26: CONDITIONAL_JUMP(rhs <  lhs) // JB
+			case 27: CONDITIONAL_JUMP(rhs <= lhs) // JBE
+
+			case 30: // PUSH
+				stack.push(instruction.argument);
+				pc_register += 1;
+				break;
+
+			case 40: // POPR
+				registers[instruction.argument] = stack.top();
+				stack.pop();
+				pc_register += 1;
+				break;
+			case 41: // PUSHR
+				stack.push(registers[instruction.argument]);
+				pc_register += 1;
+				break;
+
+			case 60 + ADDRESS_ABSOLUTE: // LOAD [address]
+				stack.push(memory[instruction.argument]);
+				pc_register += 1;
+				break;
+			case 63 + ADDRESS_ABSOLUTE: // STORE [address]
+				memory[instruction.argument] = stack.top();
+				stack.pop();
+				pc_register += 1;
+				break;
+
+			default:
+				commands[pc_register]->execute(*this);
+				if (interrupt) {
+					TRACE_INSTRUCTION(pc, instruction.id)
+					return done;
+				}
+				break;
+		}
+		TRACE_INSTRUCTION(pc, instruction.id)
+	}
+	return done;
+}
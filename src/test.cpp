@@ -2,44 +2,83 @@
 #include "stack.hpp"
 #include "tests.hpp"
 #include "test_system.hpp"
+#include "golden.hpp"
+#include "fuzzer.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <fstream>
+#include <thread>
+#include <string>
 
 using namespace stack_ns;
 using namespace TestSystem;
 
-//#define TEST
+const char* const PROGRAMS_DIRECTORY = "programs";
+
+// Usage: test [JOBS]
+// JOBS is the number of tests run at once, all cores by default
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc <= 2, "Unexpected arguments passed to make test");
 
-int main(void) {
 	std::ofstream out;
 	out.open(DEFAULT_OUT_FILE, std::ofstream::out | std::ofstream::trunc);
 	if (out.is_open()) {
 		out.close();
 	}
 
+	unsigned jobs = (argc == 2) ? parse_number(argv[1], "JOBS", 1, std::numeric_limits<unsigned>::max())
+	                            : std::max(std::thread::hardware_concurrency(), 1U);
+
+	TestScheduler tests;
+	tests.add("empty constructor", test_empty_constructor);
+	tests.add("copy constructor", test_copy_constructor);
+	tests.add("move constructor", test_move_constructor);
+	tests.add("copy assignment", test_copy_assignment);
+	tests.add("move assignment", test_move_assignment);
+	tests.add("copy push", test_copy_push);
+	tests.add("move push", test_move_push);
+	tests.add("emplace", test_emplace);
+	tests.add("pop", test_pop);
+	tests.add("top", test_top);
+	tests.add("simd kernels", test_simd_kernels);
+	tests.add("vector commands", test_vector_commands);
+	tests.add("mpmc channel", test_mpmc_channel, std::chrono::milliseconds(2000));
+	tests.add("spsc channel", test_spsc_channel, std::chrono::milliseconds(2000));
+	tests.add("trace buffer", test_trace_buffer);
+	tests.add("run for slices", test_run_for);
+	tests.add("scheduler", test_scheduler, std::chrono::milliseconds(2000));
+	tests.add("pipeline", test_pipeline, std::chrono::milliseconds(2000));
+	tests.add("memory commands", test_memory_commands);
+	tests.add("record and replay", test_record_replay);
+	tests.add("debugger", test_debugger);
+	tests.add("source map", test_source_map);
+	tests.add("static analysis", test_analysis);
+	tests.add("bytecode cache", test_bytecode_cache);
+	tests.add("preprocessor", test_preprocessor);
+	tests.add("compiler", test_compiler);
+	tests.add("inliner", test_inliner);
+	tests.add("linker", test_linker);
+	tests.add("server", test_server, std::chrono::milliseconds(2000));
+	tests.add("profiler", test_profiler, std::chrono::milliseconds(2000));
+	tests.add("profile-guided optimization", test_pgo, std::chrono::milliseconds(5000));
+	tests.add("hot loop traces", test_hot_traces);
+	tests.add("memoization", test_memoization);
+	tests.add("big integers", test_big_integers);
+	tests.add("guarded stack", test_guarded_stack);
+	tests.add("differential fuzz", [] { return fuzzer_ns::fuzz(200, 0) == 0; },
+		std::chrono::milliseconds(10000));
+
+	// run every program against its golden output
+	for (const golden_ns::GoldenCase& golden : golden_ns::find_cases(PROGRAMS_DIRECTORY)) {
+		tests.add("golden " + golden.name, [golden] { return golden_ns::run_case(golden); },
+			std::chrono::milliseconds(2000));
+	}
+
+	unsigned not_passed = tests.run(jobs);
+	tests.print_summary();
 
-	Stack<int> s = Stack<int>();
-	s.push(1);
-	s.push(2);
-	std::cout << s.top() << '\n';
-	s.pop();
-	std::cout << s.top() << '\n';
-	s.pop();
-	
-	#ifdef TEST	
-	run_test("empty constructor", test_empty_constructor);
-	run_test("copy constructor", test_copy_constructor);
-	run_test("move constructor", test_move_constructor);
-	run_test("copy assignment", test_copy_assignment);
-	run_test("move assignment", test_move_assignment);
-	run_test("copy push", test_copy_push);
-	run_test("move push", test_move_push);
-	run_test("emplace", test_emplace);
-	run_test("pop", test_pop);
-	run_test("top", test_top);
-	#endif // TEST
-
-	return 0;
-}
\ No newline at end of file
+	return (not_passed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,112 +2,255 @@
 #include "test_system.hpp"
 
 #include <cstdio>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <algorithm>
 
 // LINUX SPECIFIC HEADERS
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
 
-// Test time limit
-constexpr size_t TIMEOUT_MILLISSECONDS = 100U;
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// Child exits with CHILD_EXIT_BASE + TestResult, so that other exit codes
+// (e.g. exit(1) from VERIFY_CONTRACT) are not mistaken for a result
+constexpr int CHILD_EXIT_BASE = 100;
 
 using namespace TestSystem;
+using Clock = std::chrono::steady_clock;
 
-TestResult TestSystem::run_test(const char* name, TestScenario test) {
-	printf(SET_COLOR_CYAN "Running test %20s: " RESET_COLOR, name);
-    fflush(stdout); // print everything unprinted
-
-	// LINUX SPECIFIC CODE
-	// Create a new parallel process to run the test in it 
-	// and handle the timeout
-	pid_t process_id = fork(); 
-		// ==0 if child process
-		// >0 if main process
-		// <0 if something wrong
-
-	// Handle the excception while calling fork()
-	if (process_id < 0) {
-		fprintf(stderr, "Unable to call fork()\n");
-		exit(EXIT_FAILURE);
-	}
-
-	// Child process
-	if (process_id == 0) {
-		try {
-			bool result = test(); // run the test
-			exit(result ? OK : FAIL);
-		}
-		catch (const std::exception& exc) {
-			printf(SET_COLOR_PURPLE "[EXC] (exception: %s)\n" RESET_COLOR, exc.what());
-			exit(EXCEPTION);
-		}
-	}
-
-	// Parent process
-	int status = 0; // the code that the child process ended with
-	pid_t ret = 0; // the code that wait function returned, trying to get status
-
-	// Run the loop for the fixed amount of times, one millisecond each
-	for (size_t ms = 0; ms < TIMEOUT_MILLISSECONDS; ms++) {
-		// wait for the child process to return
-		ret = waitpid(process_id, &status, WNOHANG);
-
-		// Handle the exception in waitpid() function
-		if (ret == -1) {
-			fprintf(stderr, "Unable to call wait()\n");
-            exit(EXIT_FAILURE);
-		}
+static const char* result_name(TestResult result) {
+    switch (result) {
+        case OK:        return "[OK]";
+        case FAIL:      return "[FAIL]";
+        case EXCEPTION: return "[EXC]";
+        case ERROR:     return "[ERROR]";
+        case TIMEOUT:   return "[TIMEOUT]";
+    }
+    return "";
+}
+
+static const char* result_color(TestResult result) {
+    switch (result) {
+        case OK:   return SET_COLOR_GREEN;
+        case FAIL: return SET_COLOR_RED;
+        default:   return SET_COLOR_PURPLE;
+    }
+}
+
+static double to_milliseconds(std::chrono::microseconds duration) {
+    return static_cast<double>(duration.count()) / 1000.0;
+}
+
+////////////////////
+// TEST SCHEDULER //
+////////////////////
+
+// Test that is being run by a child process
+struct RunningTest {
+    size_t index;
+    pid_t process_id;
+    int pidfd;
+    int output_fd; // in-memory file with stdout of the child
+    Clock::time_point start;
+    Clock::time_point deadline;
+};
+
+TestScheduler::TestScheduler() : elapsed_(0) {}
+
+void TestScheduler::add(const std::string& name, TestScenario test, std::chrono::milliseconds timeout) {
+    tests_.push_back(Test{name, std::move(test), timeout});
+}
+
+const std::vector<TestReport>& TestScheduler::reports() const {
+    return reports_;
+}
+
+// LINUX SPECIFIC CODE
+// Create a new process running the test and a pidfd to wait for it
+static RunningTest start_test(size_t index, const TestScenario& test, std::chrono::milliseconds timeout) {
+    fflush(stdout); // print everything unprinted, so the child won't print it again
+
+    int output_fd = memfd_create("test-output", 0);
+    if (output_fd < 0) {
+        fprintf(stderr, "Unable to call memfd_create(): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t process_id = fork();
+        // ==0 if child process
+        // >0 if main process
+        // <0 if something wrong
+
+    // Handle the excception while calling fork()
+    if (process_id < 0) {
+        fprintf(stderr, "Unable to call fork()\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Child process
+    if (process_id == 0) {
+        dup2(output_fd, STDOUT_FILENO);
+        try {
+            bool result = test(); // run the test
+            exit(CHILD_EXIT_BASE + (result ? OK : FAIL));
+        }
+        catch (const std::exception& exc) {
+            printf(SET_COLOR_PURPLE "(exception: %s)\n" RESET_COLOR, exc.what());
+            exit(CHILD_EXIT_BASE + EXCEPTION);
+        }
+    }
+
+    // Parent process
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, process_id, 0));
+    if (pidfd < 0) {
+        fprintf(stderr, "Unable to call pidfd_open(): %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    Clock::time_point now = Clock::now();
+    return RunningTest{index, process_id, pidfd, output_fd, now, now + timeout};
+}
+
+static std::string read_output(int fd) {
+    std::string output;
+    char buffer[4096];
+
+    lseek(fd, 0, SEEK_SET);
+    ssize_t size = 0;
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, size);
+    }
+    close(fd);
+    return output;
+}
 
-		// Break the loop if something meaningful returned
-		if (ret != 0) break;
+// Collect the exit status of the finished child
+static TestResult finish_test(const RunningTest& test, bool timed_out) {
+    if (timed_out) {
+        kill(test.process_id, SIGKILL);
+    }
 
-		// sleep for 1ms
-		usleep(1000U);
-	}
+    int status = 0; // the code that the child process ended with
+    pid_t ret = waitpid(test.process_id, &status, 0);
+    close(test.pidfd);
 
-	// Handle timeout exit
-    if (ret == 0)
-    {
-        printf(SET_COLOR_PURPLE "[TIMEOUT]\n" RESET_COLOR);
-        return TIMEOUT;
+    // Handle the exception in waitpid() function
+    if (ret == -1) {
+        fprintf(stderr, "Unable to call wait()\n");
+        exit(EXIT_FAILURE);
     }
 
+    if (timed_out) return TIMEOUT;
+
     // Handle correct exit
-    if (WIFEXITED(status))
-    {
-        switch (WEXITSTATUS(status))
-        {
-            case OK:
-   			{
-                printf(SET_COLOR_GREEN "[OK]\n" RESET_COLOR);
-                return OK;
-            }
-            case FAIL:
-            {
-                printf(SET_COLOR_RED "[FAIL]\n" RESET_COLOR);
-                return FAIL;
-            }
-            case EXCEPTION:
-            {
-                printf(SET_COLOR_PURPLE "[EXC]\n" RESET_COLOR);
-                return EXCEPTION;
-            }
-            default:
-            {
-                fprintf(stderr, "Unexpected switch case\n");
-                exit(EXIT_FAILURE);
-            }
+    if (WIFEXITED(status)) {
+        switch (WEXITSTATUS(status) - CHILD_EXIT_BASE) {
+            case OK:        return OK;
+            case FAIL:      return FAIL;
+            case EXCEPTION: return EXCEPTION;
+            default:        return ERROR; // the test terminated the process itself
         };
     }
 
-    // Handle error exit:
-    else if (WIFSIGNALED(status))
-    {
-        printf(SET_COLOR_PURPLE "[ERROR] (killed by signal %d)\n" RESET_COLOR, WTERMSIG(status));
-        return ERROR;
+    // Handle error exit
+    return ERROR;
+}
+
+unsigned TestScheduler::run(unsigned jobs) {
+    jobs = std::max(jobs, 1U);
+    reports_.assign(tests_.size(), TestReport{});
+    Clock::time_point begin = Clock::now();
+
+    std::vector<RunningTest> running;
+    size_t next = 0;
+    unsigned not_passed = 0;
+
+    while (next < tests_.size() || !running.empty()) {
+        // Fill free slots
+        while (running.size() < jobs && next < tests_.size()) {
+            running.push_back(start_test(next, tests_[next].scenario, tests_[next].timeout));
+            ++next;
+        }
+
+        // Sleep until some child exits or the nearest deadline comes
+        Clock::time_point nearest = running.front().deadline;
+        std::vector<pollfd> fds;
+        for (const RunningTest& test : running) {
+            fds.push_back(pollfd{test.pidfd, POLLIN, 0});
+            nearest = std::min(nearest, test.deadline);
+        }
+
+        auto wait = std::chrono::ceil<std::chrono::milliseconds>(nearest - Clock::now());
+        int ready = poll(fds.data(), fds.size(), std::max<long long>(wait.count(), 0));
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "Unable to call poll()\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Collect finished and timed out tests
+        Clock::time_point now = Clock::now();
+        std::vector<RunningTest> still_running;
+        for (size_t i = 0; i < running.size(); ++i) {
+            const RunningTest& test = running[i];
+            bool exited = (ready > 0) && (fds[i].revents & (POLLIN | POLLHUP));
+            bool timed_out = !exited && (now >= test.deadline);
+
+            if (!exited && !timed_out) {
+                still_running.push_back(test);
+                continue;
+            }
+
+            TestResult result = finish_test(test, timed_out);
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - test.start);
+            reports_[test.index] = TestReport{tests_[test.index].name, result, duration, read_output(test.output_fd)};
+            if (result != OK) ++not_passed;
+
+            printf(SET_COLOR_CYAN "Running test %20s: " RESET_COLOR "%s%s" RESET_COLOR " (%.1f ms)\n",
+                tests_[test.index].name.c_str(), result_color(result), result_name(result), to_milliseconds(duration));
+        }
+        running = std::move(still_running);
+    }
+
+    elapsed_ = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin);
+    return not_passed;
+}
+
+void TestScheduler::print_summary() const {
+    unsigned passed = 0;
+    std::chrono::microseconds total(0);
+
+    printf(SET_COLOR_YELLOW "\n%-25s %-10s %12s\n" RESET_COLOR, "TEST", "RESULT", "TIME (ms)");
+    for (const TestReport& report : reports_) {
+        printf("%-25s %s%-10s" RESET_COLOR " %12.1f\n",
+            report.name.c_str(), result_color(report.result), result_name(report.result), to_milliseconds(report.duration));
+        if (report.result == OK) ++passed;
+        total += report.duration;
+
+        // indent what the test printed
+        size_t begin = 0;
+        while (begin < report.output.size()) {
+            size_t end = report.output.find('\n', begin);
+            if (end == std::string::npos) end = report.output.size();
+            printf("    %s\n", report.output.substr(begin, end - begin).c_str());
+            begin = end + 1;
+        }
     }
 
-    // This point must be unreachable:
-    fprintf(stderr, "Unexpected waitpid() opeartion\n");
-    exit(EXIT_FAILURE);
-}
\ No newline at end of file
+    printf(SET_COLOR_YELLOW "Passed %u/%zu tests in %.1f ms (%.1f ms of test time)\n" RESET_COLOR,
+        passed, reports_.size(), to_milliseconds(elapsed_), to_milliseconds(total));
+}
+
+TestResult TestSystem::run_test(const char* name, TestScenario test) {
+    TestScheduler scheduler;
+    scheduler.add(name, std::move(test));
+    scheduler.run(1);
+    return scheduler.reports().front().result;
+}
@@ -2,9 +2,43 @@
 #include "stack.hpp"
 #include "tests.hpp"
 #include "utils.hpp"
+#include "simd.hpp"
+#include "channel.hpp"
+#include "scheduler.hpp"
+#include "tracer.hpp"
+#include "recorder.hpp"
+#include "parser.hpp"
+#include "cpu.hpp"
+#include "debugger.hpp"
+#include "command.hpp"
+#include "analysis.hpp"
+#include "cache.hpp"
+#include "preprocessor.hpp"
+#include "compiler.hpp"
+#include "inliner.hpp"
+#include "linker.hpp"
+#include "server.hpp"
+#include "profiler.hpp"
+#include "pgo.hpp"
+#include "fuzzer.hpp"
+#include "hot_trace.hpp"
+#include "memo.hpp"
+#include "bigint.hpp"
+#include "guarded_stack.hpp"
+#include "pipeline.hpp"
 
+#include <algorithm>
+#include <random>
 #include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
 #include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace stack_ns;
 using namespace TestSystem;
@@ -226,3 +260,1659 @@ bool test_top() {
 	}
 	return true;
 }
+
+bool test_simd_kernels() {
+	const simd_ns::Kernels& fast = simd_ns::kernels();
+	const simd_ns::Kernels& slow = simd_ns::scalar_kernels();
+
+	// odd length to cover the scalar tail of vector kernels
+	const unsigned length = 37;
+	vector<int> a(length), b(length), fast_dst(length), slow_dst(length);
+	for (unsigned i = 0; i < length; i++) {
+		a[i] = static_cast<int>(i * 2654435761U);
+		b[i] = (i % 3 == 0) ? a[i] : static_cast<int>(i * 40503U);
+	}
+
+	simd_ns::BinaryKernel fast_kernels[] = {fast.add, fast.sub, fast.mul, fast.cmpeq, fast.cmpgt};
+	simd_ns::BinaryKernel slow_kernels[] = {slow.add, slow.sub, slow.mul, slow.cmpeq, slow.cmpgt};
+	for (unsigned k = 0; k < 5; k++) {
+		fast_kernels[k](fast_dst.data(), a.data(), b.data(), length);
+		slow_kernels[k](slow_dst.data(), a.data(), b.data(), length);
+		if (fast_dst != slow_dst) return false;
+	}
+
+	return fast.sum(a.data(), length) == slow.sum(a.data(), length);
+}
+
+bool test_mpmc_channel() {
+	const int threads = 4;
+	const int values = 10000;
+
+	MPMCChannel channel(64);
+	atomic<long long> received_sum(0);
+	atomic<int> received_count(0);
+
+	vector<thread> senders, receivers;
+	for (int t = 0; t < threads; t++) {
+		senders.emplace_back([&channel] {
+			for (int i = 1; i <= values; i++) {
+				while (!channel.try_send(i)) this_thread::yield();
+			}
+		});
+		receivers.emplace_back([&] {
+			int value;
+			while (received_count.load() < threads * values) {
+				if (channel.try_receive(value)) {
+					received_sum += value;
+					received_count++;
+				}
+				else {
+					this_thread::yield();
+				}
+			}
+		});
+	}
+	for (thread& sender : senders) sender.join();
+	for (thread& receiver : receivers) receiver.join();
+
+	return received_sum.load() == threads * (long long)values * (values + 1) / 2;
+}
+
+bool test_spsc_channel() {
+	const int values = 100000;
+
+	SPSCChannel channel(64);
+	int value;
+	if (channel.try_receive(value)) return false;
+	for (int i = 0; i < 64; i++) {
+		if (!channel.try_send(i)) return false;
+	}
+	if (channel.try_send(64)) return false;
+	for (int i = 0; i < 64; i++) {
+		if (!channel.try_receive(value) || value != i) return false;
+	}
+
+	// values of the sender come in order
+	thread sender([&channel] {
+		for (int i = 1; i <= values; i++) {
+			while (!channel.try_send(i)) this_thread::yield();
+		}
+		channel.close();
+	});
+	int expected = 1;
+	bool ordered = true;
+	for (bool closed = false; !closed; ) {
+		// values sent right before closing are taken after it
+		closed = channel.closed();
+		while (channel.try_receive(value)) ordered = ordered && (value == expected++);
+		this_thread::yield();
+	}
+	sender.join();
+
+	// endpoints belong to the first context using them
+	int first = 0, second = 0;
+	bool bound = channel.bind_sender(&first) && channel.bind_sender(&first) && !channel.bind_sender(&second) &&
+	             channel.bind_receiver(&second) && !channel.bind_receiver(&first);
+	return ordered && expected == values + 1 && bound;
+}
+
+// Byte code of the source made in memory, lines is set to the source line of every instruction
+static string build_bytecode(preprocessor_ns::ExpandedSource source, vector<int>* lines = nullptr) {
+	stringstream bytecode;
+	Parser parser(std::move(source), "");
+	parser.parse(bytecode);
+	if (lines != nullptr) *lines = parser.command_lines();
+	return bytecode.str();
+}
+
+static string build_bytecode(const string& source, vector<int>* lines = nullptr) {
+	istringstream text(source);
+	return build_bytecode(preprocessor_ns::preprocess(text), lines);
+}
+
+// Run the program to the end in slices of the size, at most budget instructions
+static fuzzer_ns::Outcome run_outcome(CPU& cpu, unsigned long long slice = UNLIMITED, unsigned long long budget = 1000000) {
+	ostringstream output;
+	cpu.output = &output;
+	cpu.set_budget(budget);
+
+	CPUStatus status = CPU_RUNNING;
+	while (status == CPU_RUNNING || status == CPU_YIELDED) {
+		status = cpu.run_for(slice);
+	}
+
+	fuzzer_ns::Outcome outcome{status, output.str(), {}, {}, {}, cpu.executed};
+	VMStack stack(cpu.stack);
+	while (stack.size() > 0) {
+		outcome.stack.push_back(stack.top());
+		stack.pop();
+	}
+	outcome.registers.assign(cpu.registers, cpu.registers + REGS);
+	outcome.memory.assign(cpu.memory, cpu.memory + MEMORY_SIZE);
+	return outcome;
+}
+
+// Run the function in a child process and return its exit status, output is dropped
+static int exit_status_of(const function<void()>& body) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (freopen("/dev/null", "w", stdout) == nullptr) _exit(2);
+		body();
+		_exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool test_vector_commands() {
+	// 11 values are not a multiple of any vector width, so the scalar tails run too.
+	// a = 1..11 at [0], b at [16], results at [32], [48], ..., a copy of a at [128]
+	string source =
+		"BEGIN\n"
+		"\tPUSH 1\n\tPUSH 2\n\tPUSH 3\n\tPUSH 4\n\tPUSH 5\n\tPUSH 6\n\tPUSH 7\n\tPUSH 8\n\tPUSH 9\n\tPUSH 10\n\tPUSH 11\n"
+		"\tPUSH 0\n\tPUSH 11\n\tVSTORE\n"
+		"\tPUSH 3\n\tPUSH 2\n\tPUSH 1\n\tPUSH 4\n\tPUSH 5\n\tPUSH 0\n\tPUSH 9\n\tPUSH 8\n\tPUSH 7\n\tPUSH 20\n\tPUSH -1\n"
+		"\tPUSH 16\n\tPUSH 11\n\tVSTORE\n";
+	const char* binary[] = {"VADD", "VSUB", "VMUL", "VCMPEQ", "VCMPGT"};
+	for (int k = 0; k < 5; ++k) {
+		source += "\tPUSH " + to_string(32 + 16 * k) + "\n\tPUSH 0\n\tPUSH 16\n\tPUSH 11\n\t" + binary[k] + "\n";
+	}
+	source +=
+		// sums of a + b and of a, an empty vector sums to 0
+		"\tPUSH 32\n\tPUSH 11\n\tVSUM\n\tOUT\n"
+		"\tPUSH 0\n\tPUSH 11\n\tVSUM\n\tOUT\n"
+		"\tPUSH 5\n\tPUSH 0\n\tVSUM\n\tOUT\n"
+		// copy of a, then a + b written one cell after it: the destination overlaps a source
+		"\tPUSH 0\n\tPUSH 11\n\tVLOAD\n\tPUSH 128\n\tPUSH 11\n\tVSTORE\n"
+		"\tPUSH 129\n\tPUSH 128\n\tPUSH 16\n\tPUSH 11\n\tVADD\n"
+		// the last cells of memory
+		"\tPUSH " + to_string(MEMORY_SIZE - 11) + "\n\tPUSH 11\n\tVSUM\n\tOUT\n"
+		"END";
+
+	istringstream code(build_bytecode(source));
+	CPU cpu(code);
+	fuzzer_ns::Outcome outcome = run_outcome(cpu);
+	if (outcome.status != CPU_HALTED || outcome.output != "124\n66\n0\n0\n" || !outcome.stack.empty()) return false;
+
+	const vector<vector<int>> expected = {
+		{4, 4, 4, 8, 10, 6, 16, 16, 16, 30, 10},       // VADD
+		{-2, 0, 2, 0, 0, 6, -2, 0, 2, -10, 12},        // VSUB
+		{3, 4, 3, 16, 25, 0, 63, 64, 63, 200, -11},    // VMUL
+		{0, -1, 0, -1, -1, 0, 0, -1, 0, 0, 0},         // VCMPEQ
+		{0, 0, -1, 0, 0, -1, 0, 0, -1, 0, -1},         // VCMPGT
+	};
+	auto cells = [&outcome](int address, int length) {
+		return vector<int>(outcome.memory.begin() + address, outcome.memory.begin() + address + length);
+	};
+	for (int k = 0; k < 5; ++k) {
+		// the cell after the result is untouched
+		vector<int> result = expected[k];
+		result.push_back(0);
+		if (cells(32 + 16 * k, 12) != result) return false;
+	}
+	vector<int> copied = {1};
+	copied.insert(copied.end(), expected[0].begin(), expected[0].end());
+	if (cells(128, 12) != copied) return false;
+
+	// operands out of data memory terminate the program
+	const string out_of_memory[] = {
+		"PUSH -1\n\tPUSH 2\n\tVLOAD",
+		"PUSH 1\n\tPUSH 1\n\tPUSH " + to_string(MEMORY_SIZE - 1) + "\n\tPUSH 2\n\tVSTORE",
+		"PUSH 0\n\tPUSH 16\n\tPUSH " + to_string(MEMORY_SIZE - 10) + "\n\tPUSH 11\n\tVADD",
+		"PUSH " + to_string(MEMORY_SIZE - 10) + "\n\tPUSH 0\n\tPUSH 16\n\tPUSH 11\n\tVMUL",
+		"PUSH 0\n\tPUSH 16\n\tPUSH 32\n\tPUSH -1\n\tVCMPGT",
+		"PUSH " + to_string(MEMORY_SIZE) + "\n\tPUSH 1\n\tVSUM",
+	};
+	for (const string& body : out_of_memory) {
+		string bytecode = build_bytecode("BEGIN\n\t" + body + "\nEND");
+		int status = exit_status_of([&bytecode] {
+			istringstream code(bytecode);
+			CPU cpu(code);
+			cpu.run();
+		});
+		if (status != 1) return false;
+	}
+	return true;
+}
+
+#ifdef VM_TRACE
+// Trace of the whole run of the byte code with the engine
+static vector<trace_ns::TraceRecord> trace_records(const string& bytecode, Engine engine) {
+	istringstream code(bytecode);
+	CPU cpu(code);
+	cpu.engine = engine;
+	cpu.trace = make_shared<trace_ns::TraceBuffer>();
+	run_outcome(cpu);
+	return cpu.trace->snapshot();
+}
+
+// The same instructions with the same state after them
+static bool same_records(const vector<trace_ns::TraceRecord>& a, const vector<trace_ns::TraceRecord>& b) {
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].pc != b[i].pc || a[i].opcode != b[i].opcode || a[i].top != b[i].top
+			|| a[i].register_id != b[i].register_id || a[i].register_value != b[i].register_value) return false;
+	}
+	return true;
+}
+#endif
+
+bool test_trace_buffer() {
+	trace_ns::TraceBuffer buffer(4);
+	VMStack stack;
+	int registers[REGS] = {};
+
+	for (int pc = 0; pc < 6; pc++) {
+		stack.push(pc * 10);
+		registers[1] = pc / 2; // changes on every second instruction
+		buffer.record(pc, 30, stack, registers);
+	}
+
+	stringstream file;
+	buffer.save(file);
+	trace_ns::TraceFile trace = trace_ns::load(file);
+
+	// only the last 4 records are kept
+	if (trace.written != 6 || trace.records.size() != 4) return false;
+	for (int i = 0; i < 4; i++) {
+		const trace_ns::TraceRecord& record = trace.records[i];
+		int pc = i + 2;
+		bool changed = (pc % 2 == 0);
+		if (record.pc != pc || record.opcode != 30 || record.top != pc * 10) return false;
+		if (!(record.flags & trace_ns::RECORD_HAS_TOP)) return false;
+		if (changed && (record.register_id != 1 || record.register_value != pc / 2)) return false;
+		if (!changed && record.register_id != trace_ns::NO_REGISTER) return false;
+	}
+
+	// a memoized CALL may set several registers, the record keeps the last one and flags the others
+	trace_ns::TraceBuffer several(4);
+	int results[REGS] = {7, 0, 9};
+	several.record(0, 20, stack, results);
+	several.record(1, 30, stack, results);
+	vector<trace_ns::TraceRecord> calls = several.snapshot();
+	if (calls[0].register_id != 2 || calls[0].register_value != 9 || !(calls[0].flags & trace_ns::RECORD_MORE_REGISTERS)) return false;
+	if (calls[1].register_id != trace_ns::NO_REGISTER || (calls[1].flags & trace_ns::RECORD_MORE_REGISTERS)) return false;
+
+#ifdef VM_TRACE
+	// every instruction of a superinstruction has its record, as in the switch engine
+	vector<vector<int>> catalog = superinstruction_catalog();
+	int popr_popr = (int)(find(catalog.begin(), catalog.end(), vector<int>{40, 40}) - catalog.begin());
+	string bytecode = build_bytecode("BEGIN\n\tPUSH 1\n\tPUSH 2\n\tPOPR AX\n\tPOPR BX\nEND");
+	bytecode.insert(bytecode.find(DEBUG_SECTION_MARKER), FUSED_SECTION_MARKER "\n3 " + to_string(popr_popr) + "\n");
+	vector<trace_ns::TraceRecord> fused = trace_records(bytecode, ENGINE_VIRTUAL);
+	if (fused.size() < 4 || !same_records(fused, trace_records(bytecode, ENGINE_SWITCH))) return false;
+#endif
+	return true;
+}
+
+bool test_record_replay() {
+	// sum of values read until 0
+	const string bytecode = build_bytecode(
+		"BEGIN\n"
+		"loop:\n"
+		"\tIN\n"
+		"\tPOPR BX\n"
+		"\tPUSHR AX\n"
+		"\tPUSHR BX\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tPUSH 0\n"
+		"\tPUSHR BX\n"
+		"\tJNE loop\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"END");
+
+	// record
+	istringstream recorded_code(bytecode), input("5 -7 100000 3 0");
+	ostringstream recorded_output;
+	CPU recorded(recorded_code);
+	recorded.input = &input;
+	recorded.output = &recorded_output;
+	recorded.journal = make_shared<replay_ns::InputJournal>(*recorded.program);
+	recorded.run();
+
+	stringstream file;
+	recorded.journal->recording().save(file);
+
+	// replay without input, with a checkpoint every 4 instructions
+	istringstream replayed_code(bytecode), no_input("");
+	ostringstream replayed_output;
+	CPU replayed(replayed_code);
+	replayed.input = &no_input;
+	replayed.output = &replayed_output;
+	replay_ns::Replayer replayer(replayed, replay_ns::load(file), 4);
+
+	replayer.seek(20);
+	if (replayed.executed != 20) return false;
+	int ax = replayed.registers[0];
+	int pc = replayed.pc_register;
+
+	if (replayer.run() != CPU_HALTED) return false;
+	if (replayed_output.str() != recorded_output.str() || replayed.executed != recorded.executed) return false;
+
+	// travel back in time
+	replayer.seek(20);
+	if (replayed.executed != 20 || replayed.registers[0] != ax || replayed.pc_register != pc) return false;
+
+	// checkpoints keep big integers of their handles, seeking back crosses collections of the arena
+	const string factorial = build_bytecode(
+		"BEGIN\n"
+		"\tIN\n"
+		"\tPOPR BX\n"
+		"\tPUSH 1\n"
+		"\tBIG\n"
+		"\tPOPR AX\n"
+		"\tPUSH 1\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tPUSHR BX\n"
+		"\tPUSHR CX\n"
+		"\tJA done\n"
+		"\tPUSHR AX\n"
+		"\tPUSHR CX\n"
+		"\tBIG\n"
+		"\tBMUL\n"
+		"\tPOPR AX\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tJMP loop\n"
+		"done:\n"
+		"\tPUSHR AX\n"
+		"\tBOUT\n"
+		"END");
+	istringstream big_code(factorial), big_input("3000");
+	ostringstream big_output;
+	CPU big(big_code);
+	big.input = &big_input;
+	big.output = &big_output;
+	big.journal = make_shared<replay_ns::InputJournal>(*big.program);
+	big.run();
+	stringstream big_file;
+	big.journal->recording().save(big_file);
+
+	istringstream big_replayed_code(factorial);
+	ostringstream big_replayed_output;
+	CPU big_replayed(big_replayed_code);
+	big_replayed.output = &big_replayed_output;
+	replay_ns::Replayer big_replayer(big_replayed, replay_ns::load(big_file), 1000);
+	big_replayer.seek(35000);
+	string value = bigint_ns::arena(big_replayed).to_string(big_replayed.registers[0]);
+	unsigned long long collections = bigint_ns::arena(big_replayed).stats().collections;
+	big_replayer.seek(2000);
+	big_replayer.seek(35000);
+	if (collections == 0 || bigint_ns::arena(big_replayed).to_string(big_replayed.registers[0]) != value) return false;
+	return big_replayer.run() == CPU_HALTED && big_replayed_output.str() == big_output.str();
+}
+
+bool test_debugger() {
+	// sum of 3, 2, 1 computed by recursion
+	const string bytecode = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 3\n"
+		"\tCALL sum\n"
+		"\tOUT\n"
+		"END\n"
+		"sum:\n"
+		"\tPOPR AX\n"
+		"\tPUSHR AX\n"
+		"\tPUSH 0\n"
+		"\tPUSHR AX\n"
+		"\tJBE done\n"
+		"\tPUSH 1\n"
+		"\tPUSHR AX\n"
+		"\tSUB\n"
+		"\tCALL sum\n"
+		"\tADD\n"
+		"done:\n"
+		"\tRET");
+
+	istringstream plain_code(bytecode);
+	ostringstream plain_output;
+	CPU plain(plain_code);
+	plain.output = &plain_output;
+	plain.run();
+
+	istringstream debugged_code(bytecode);
+	ostringstream debugged_output;
+	CPU debugged(debugged_code);
+	debugged.output = &debugged_output;
+	debugged.engine = ENGINE_SWITCH;
+
+	debug_ns::Debugger debugger(debugged);
+	const int add = 14; // ADD after the recursive CALL
+	debugger.set_breakpoint(add);
+
+	// the deepest call returns first
+	if (debugger.resume() != debug_ns::STOP_BREAKPOINT || debugged.pc_register != add) return false;
+	if (debugged.call_stack.size() != 3) return false;
+
+	// AX is written only on entry to sum, and there are no more calls
+	debugger.remove_breakpoint(add);
+	debugger.watch(0);
+	if (debugger.resume() != debug_ns::STOP_HALTED) return false;
+
+	// step over the top level CALL in a fresh run
+	istringstream stepped_code(bytecode);
+	ostringstream stepped_output;
+	CPU stepped(stepped_code);
+	stepped.output = &stepped_output;
+	debug_ns::Debugger stepper(stepped);
+	stepper.set_breakpoint(add);
+	stepper.step();
+	stepper.step();
+	if (stepper.step_over() != debug_ns::STOP_BREAKPOINT) return false; // user breakpoint inside the call
+	if (stepper.step_over() != debug_ns::STOP_STEP || stepped.pc_register != add + 1) return false;
+
+	if (debugged_output.str() != plain_output.str() || debugged.executed != plain.executed
+		|| debugged.program->code[add].id != 12) return false;
+
+	// stops inside superinstructions: PUSH 5, POPR AX and PUSH 7, POPR BX are fused
+	vector<vector<int>> catalog = superinstruction_catalog();
+	int push_popr = (int)(find(catalog.begin(), catalog.end(), vector<int>{30, 40}) - catalog.begin());
+	string fused_bytecode = build_bytecode("BEGIN\n\tPUSH 5\n\tPOPR AX\n\tPUSH 7\n\tPOPR BX\n\tPUSHR AX\n\tPUSHR BX\n\tADD\n\tOUT\nEND");
+	fused_bytecode.insert(fused_bytecode.find(DEBUG_SECTION_MARKER),
+		FUSED_SECTION_MARKER "\n1 " + to_string(push_popr) + "\n3 " + to_string(push_popr) + "\n");
+
+	istringstream fused_code(fused_bytecode);
+	ostringstream fused_output;
+	CPU fused(fused_code);
+	fused.output = &fused_output;
+	if (fused.program->superinstructions.size() != 2) return false;
+
+	debug_ns::Debugger fused_debugger(fused);
+	fused_debugger.watch(0);
+	fused_debugger.set_breakpoint(4);
+	if (fused_debugger.resume() != debug_ns::STOP_WATCH || fused.registers[0] != 5 || fused.pc_register != 3) return false;
+	if (fused_debugger.resume() != debug_ns::STOP_BREAKPOINT || fused.pc_register != 4) return false;
+	if (fused_debugger.resume() != debug_ns::STOP_HALTED) return false;
+	return fused_output.str() == "12\n" && fused.program->superinstructions.empty();
+}
+
+bool test_source_map() {
+	const string source =
+		"BEGIN\n"
+		"\n"
+		"loop:\n"
+		"    PUSH 1\n"
+		"\tJMP loop\n"
+		"END";
+
+	istringstream code(build_bytecode(source));
+	CPU cpu(code);
+	const DebugInfo* info = cpu.program->debug_info();
+	if (info == nullptr || info->locations.size() != 4 || info->labels.at("loop") != 1) return false;
+
+	// source is a stream, so there is no file name
+	if (cpu.program->describe(1) != "line 4:5" || cpu.program->describe(2) != "line 5:2") return false;
+
+	// byte code without the debug section still runs
+	istringstream text(source);
+	stringstream stripped;
+	Parser parser(text);
+	parser.set_debug_section(false);
+	parser.parse(stripped);
+	CPU plain(stripped);
+	return plain.program->debug_info() == nullptr && plain.program->describe(3) == "instruction 3"
+		&& plain.program->code.size() == 4;
+}
+
+bool test_analysis() {
+	// sum of 3, 2, 1 computed by recursion
+	istringstream code(build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 3\n"
+		"\tCALL sum\n"
+		"\tOUT\n"
+		"END\n"
+		"sum:\n"
+		"\tPOPR AX\n"
+		"\tPUSHR AX\n"
+		"\tPUSH 0\n"
+		"\tPUSHR AX\n"
+		"\tJBE done\n"
+		"\tPUSH 1\n"
+		"\tPUSHR AX\n"
+		"\tSUB\n"
+		"\tCALL sum\n"
+		"\tADD\n"
+		"done:\n"
+		"\tRET"));
+	CPU cpu(code);
+	analysis_ns::Analysis analysis = analysis_ns::analyze(*cpu.program);
+
+	// BEGIN..CALL, OUT END, sum..JBE, PUSH..CALL, ADD, RET
+	if (analysis.blocks.size() != 6 || analysis.block_of[15] != 5) return false;
+	if (analysis.blocks[2].successors != vector<int>{5, 3}) return false;
+
+	// sum replaces its argument with the result, the recursive call is resolved by the other path
+	if (analysis.returns.at(5) != 0 || analysis.depth[3] != 1 || analysis.depth[13] != 1) return false;
+	if (analysis.routine[14] != 5 || analysis.depth[14] != 1 || analysis.depth[15] != 0) return false;
+
+	return analysis.opcodes.at(41) == 3 && analysis.opcode_pairs.at({41, 30}) == 1
+		&& analysis_ns::stack_effect(51) == analysis_ns::UNKNOWN_EFFECT;
+}
+
+bool test_bytecode_cache() {
+	filesystem::path directory = filesystem::temp_directory_path() / ("lng_cache_test_" + to_string(getpid()));
+	filesystem::remove_all(directory);
+	filesystem::create_directories(directory);
+	string source = (directory / "sum.lng").string();
+
+	auto write_source = [&source](const char* text) {
+		ofstream out(source);
+		out << text;
+	};
+	write_source("BEGIN\n\tPUSH 1\n\tPUSH 2\n\tADD\n\tOUT\nEND");
+
+	cache_ns::BytecodeCache cache((directory / "cache").string());
+	bool hit = true;
+	string cold = cache.compile(source, {}, &hit);
+	if (hit) return false;
+	string warm = cache.compile(source, {}, &hit);
+	if (!hit || warm != cold) return false;
+
+	// entry is the same byte code the parser writes
+	stringstream parsed;
+	Parser parser(source);
+	parser.parse(parsed);
+	ifstream entry(cold);
+	stringstream cached;
+	cached << entry.rdbuf();
+	bool same = cached.str() == parsed.str();
+
+	// other flags and changed source get their own entries
+	cache_ns::CompileOptions stripped;
+	stripped.debug_section = false;
+	string other = cache.compile(source, stripped, &hit);
+	write_source("BEGIN\n\tPUSH 3\n\tOUT\nEND");
+	string changed = cache.compile(source, {}, &hit);
+
+	filesystem::remove_all(directory);
+	return same && !hit && other != cold && changed != cold;
+}
+
+bool test_preprocessor() {
+	istringstream source(
+		"#define LIMIT 10\n"
+		"#define TWICE LIMIT LIMIT\n"
+		"#macro skip_if_zero REG\n"
+		"\tPUSH 0\n"
+		"\tPUSHR REG\n"
+		"\tJEQ skip\n"
+		"\tskip:\n"
+		"#endmacro\n"
+		"BEGIN\n"
+		"\n"
+		"\tPUSH -LIMIT\n"
+		"  skip_if_zero AX\n"
+		"\tskip_if_zero BX\n"
+		"label2: PUSH TWICE\n"
+		"END");
+	preprocessor_ns::ExpandedSource expanded = preprocessor_ns::preprocess(source);
+
+	const string expected =
+		"BEGIN\n"
+		"\tPUSH -10\n"
+		"\tPUSH 0\n\tPUSHR AX\n\tJEQ skip__1\n\tskip__1:\n"
+		"\tPUSH 0\n\tPUSHR BX\n\tJEQ skip__2\n\tskip__2:\n"
+		"label2: PUSH 10 10\n"
+		"END";
+	if (expanded.text != expected || expanded.origins.size() != 12) return false;
+
+	// expanded lines point to the macro name, other lines keep their columns
+	const preprocessor_ns::LineOrigin& expansion = expanded.origins[2];
+	if (expansion.line != 12 || expansion.column != 3 || expanded.origins[1].line != 11 || expanded.origins[1].column != 0) {
+		return false;
+	}
+
+	// the same labels in two expansions do not clash, the program parses
+	vector<int> command_lines;
+	istringstream valid(build_bytecode(
+		"#define STEP 3\n"
+		"#macro add_step REG\n"
+		"\tPUSH -STEP\n"
+		"\tPUSH 0\n"
+		"\tSUB\n"
+		"\tPUSHR REG\n"
+		"\tADD\n"
+		"\tPOPR REG\n"
+		"\tJMP next\n"
+		"next:\n"
+		"#endmacro\n"
+		"BEGIN\n"
+		"\tadd_step AX\n"
+		"\tadd_step AX\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"END", &command_lines));
+	CPU cpu(valid);
+	return run_outcome(cpu).output == "6\n" && command_lines[1] == 13 && command_lines[8] == 14;
+}
+
+bool test_compiler() {
+	istringstream source(
+		"func fact(n) {\n"
+		"    if (n <= 1) { return 1; }\n"
+		"    return n * fact(n - 1);\n"
+		"}\n"
+		"func main() {\n"
+		"    var x = 2 * 3 + 4;\n"
+		"    var unused = x * 7;\n"
+		"    out(-x + (x + 0) * 1);\n"
+		"    out(x > 5 && !(x == 3));\n"
+		"    out(fact(x - 5));\n"
+		"}");
+	preprocessor_ns::ExpandedSource assembly = compiler_ns::compile(source);
+
+	// constants are folded, the dead variable is not computed and nothing is live across the calls
+	size_t lines = count(assembly.text.begin(), assembly.text.end(), '\n') + 1;
+	if (assembly.text.find("PUSH 10") == string::npos || assembly.text.find("PUSH 7") != string::npos
+		|| assembly.text.find("POPR FX") != string::npos || assembly.origins.size() != lines) {
+		return false;
+	}
+
+	// n * fact(n - 1) reads n before the call
+	size_t multiply = assembly.text.find("\tPUSHR AX\n\tPUSH 1\n\tPUSHR AX\n\tSUB\n\tCALL fact\n\tMUL");
+	if (multiply == string::npos) return false;
+
+	vector<int> command_lines;
+	istringstream bytecode(build_bytecode(std::move(assembly), &command_lines));
+	CPU cpu(bytecode);
+
+	// the variable comes from line 6
+	return run_outcome(cpu).output == "0\n1\n120\n" && command_lines[1] == 6 && command_lines[3] == 8;
+}
+
+bool test_inliner() {
+	const string source =
+		"BEGIN\n"
+		"\tPUSH 5\n"
+		"\tCALL clamp\n"
+		"\tOUT\n"
+		"\tPUSH 50\n"
+		"again: CALL clamp\n"
+		"\tOUT\n"
+		"\tPUSH 3\n"
+		"\tCALL fact\n"
+		"\tOUT\n"
+		"END\n"
+		"clamp:\n"
+		"\tPOPR AX\n"
+		"\tPUSH 10\n"
+		"\tPUSHR AX\n"
+		"\tJB small\n"
+		"\tPUSH 10\n"
+		"\tPOPR AX\n"
+		"small:\n"
+		"\tPUSHR AX\n"
+		"\tRET\n"
+		"fact:\n"
+		"\tPOPR BX\n"
+		"\tPUSHR BX\n"
+		"\tPUSH 1\n"
+		"\tPUSHR BX\n"
+		"\tJBE one\n"
+		"\tPUSH 1\n"
+		"\tPUSHR BX\n"
+		"\tSUB\n"
+		"\tCALL fact\n"
+		"\tMUL\n"
+		"\tRET\n"
+		"one:\n"
+		"\tRET";
+
+	auto run_inlined = [&source](int budget, preprocessor_ns::ExpandedSource& inlined) {
+		istringstream text(source);
+		inlined = inliner_ns::inline_calls(preprocessor_ns::preprocess(text), budget);
+		istringstream bytecode(build_bytecode(inlined));
+		CPU cpu(bytecode);
+		return run_outcome(cpu).output;
+	};
+
+	// both calls of clamp get their own labels, recursive fact keeps its calls
+	preprocessor_ns::ExpandedSource inlined;
+	if (run_inlined(inliner_ns::DEFAULT_INLINE_BUDGET, inlined) != "5\n10\n6\n") return false;
+	if (inlined.text.find("CALL clamp") != string::npos || inlined.text.find("JB small__inline2") == string::npos) return false;
+	if (inlined.text.find("again:") == string::npos || inlined.text.find("CALL fact") == string::npos) return false;
+
+	// inlined instructions keep the source lines of the body
+	size_t first_line = count(inlined.text.begin(), inlined.text.begin() + inlined.text.find("\tPOPR AX"), '\n');
+	if (inlined.origins[first_line].line != 13 || inlined.origins[first_line].column != 2) return false;
+
+	// clamp has 7 instructions besides RET
+	if (run_inlined(6, inlined) != "5\n10\n6\n" || inlined.text.find("CALL clamp") == string::npos) return false;
+	istringstream text(source);
+	return run_inlined(0, inlined) == "5\n10\n6\n" && inlined.text == preprocessor_ns::preprocess(text).text;
+}
+
+bool test_linker() {
+	auto compile_object = [](const char* source) {
+		istringstream text(source);
+		Parser parser(text);
+		linker_ns::ObjectFile object = parser.parse_object();
+
+		// objects survive a round trip through their file format
+		stringstream file;
+		linker_ns::write_object(object, file);
+		return linker_ns::read_object(file);
+	};
+
+	// both files have a local _loop, triple is never called
+	vector<linker_ns::ObjectFile> objects = {
+		compile_object(
+			"BEGIN\n"
+			"\tPUSH 3\n"
+			"\tPOPR CX\n"
+			"_loop:\n"
+			"\tPUSHR CX\n"
+			"\tCALL double\n"
+			"\tOUT\n"
+			"\tPUSH 1\n"
+			"\tPUSHR CX\n"
+			"\tSUB\n"
+			"\tPOPR CX\n"
+			"\tPUSH 0\n"
+			"\tPUSHR CX\n"
+			"\tJNE _loop\n"
+			"END"),
+		compile_object(
+			"triple:\n"
+			"\tPUSH 3\n"
+			"\tMUL\n"
+			"\tRET\n"
+			"double:\n"
+			"\tPUSH 0\n"
+			"\tPOPR AX\n"
+			"\tPOPR BX\n"
+			"_loop:\n"
+			"\tPUSHR BX\n"
+			"\tPUSHR AX\n"
+			"\tADD\n"
+			"\tPOPR AX\n"
+			"\tPUSHR AX\n"
+			"\tPUSHR BX\n"
+			"\tADD\n"
+			"\tPOPR AX\n"
+			"\tPUSHR AX\n"
+			"\tRET")
+	};
+	if (objects[0].relocations.size() != 2 || objects[0].labels.at("_loop") != 3) return false;
+
+	auto run_linked = [&objects](const linker_ns::LinkOptions& options, linker_ns::LinkStats& stats) {
+		stringstream bytecode;
+		stats = linker_ns::link(objects, bytecode, options);
+		CPU cpu(bytecode);
+		ostringstream output;
+		cpu.output = &output;
+		cpu.run();
+		return output.str();
+	};
+
+	linker_ns::LinkStats stats;
+	if (run_linked({}, stats) != "6\n4\n2\n" || stats.stripped_routines != 1 || stats.stripped_instructions != 3) return false;
+
+	// the entry still goes first, the hot routine follows it
+	linker_ns::LinkOptions options;
+	options.strip_dead = false;
+	options.hot = {"triple"};
+	stringstream bytecode;
+	linker_ns::link(objects, bytecode, options);
+	CPU cpu(bytecode);
+	const DebugInfo* info = cpu.program->debug_info();
+	return run_linked(options, stats) == "6\n4\n2\n" && stats.stripped_routines == 0 && info != nullptr
+		&& info->labels.at("triple") == 14 && info->labels.at("double") == 17
+		&& info->labels.contains("_loop@0") && info->labels.contains("_loop@1") && info->source.empty();
+}
+
+bool test_server() {
+	filesystem::path directory = filesystem::temp_directory_path() / ("lng_server_test_" + to_string(getpid()));
+	filesystem::remove_all(directory);
+	filesystem::create_directories(directory);
+	string program = (directory / "double.bcode").string();
+	string socket_path = (directory / "server.sock").string();
+
+	auto write_program = [&program](const char* text) {
+		ofstream(program) << build_bytecode(text);
+	};
+	write_program("BEGIN\n\tIN\n\tPUSH 2\n\tMUL\n\tOUT\nEND");
+
+	// one worker, so the second request only passes if the worker was restarted
+	server_ns::Server server(socket_path, 1);
+	server.preload(program);
+	pid_t pid = fork();
+	if (pid == 0) {
+		server.serve();
+		_exit(0);
+	}
+
+	auto submit = [&](const char* input, bool& done) {
+		istringstream in(input);
+		ostringstream out;
+		unsigned long long executed = 0;
+		done = server_ns::submit(socket_path, server_ns::Request{program}, in, out, &executed) && executed > 0;
+		return out.str();
+	};
+
+	// a second server must not take the socket of the running one
+	int second_server = exit_status_of([&socket_path] {
+		server_ns::Server other(socket_path, 1);
+	});
+
+	bool done = false;
+	bool passed = second_server == 1 && submit("21", done) == "42\n" && done;
+	submit("", done);
+	passed = passed && !done;
+	passed = passed && submit("5", done) == "10\n" && done;
+
+	// changed file is decoded again
+	filesystem::file_time_type modified = filesystem::last_write_time(program);
+	write_program("BEGIN\n\tIN\n\tPUSH 3\n\tMUL\n\tOUT\nEND");
+	filesystem::last_write_time(program, modified + chrono::seconds(1));
+	passed = passed && submit("5", done) == "15\n" && done;
+
+	// output larger than the socket buffers comes back before all input is sent
+	string echo = (directory / "echo.bcode").string();
+	ofstream(echo) << build_bytecode(
+		"BEGIN\n"
+		"\tIN\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tIN\n"
+		"\tOUT\n"
+		"\tPUSH 1\n"
+		"\tPUSHR CX\n"
+		"\tSUB\n"
+		"\tPOPR CX\n"
+		"\tPUSH 0\n"
+		"\tPUSHR CX\n"
+		"\tJNE loop\n"
+		"END");
+	const int values = 100000;
+	string input = to_string(values) + "\n";
+	string expected;
+	for (int i = 0; i < values; ++i) {
+		input += to_string(i) + "\n";
+		expected += to_string(i) + "\n";
+	}
+	istringstream echo_input(input);
+	ostringstream echo_output;
+	passed = passed && server_ns::submit(socket_path, server_ns::Request{echo}, echo_input, echo_output) &&
+	         echo_output.str() == expected;
+
+	// the same file under another spelling of the path
+	string spelled = (directory / "." / "double.bcode").string();
+	istringstream spelled_input("4");
+	ostringstream spelled_output;
+	passed = passed && server_ns::submit(socket_path, server_ns::Request{spelled}, spelled_input, spelled_output) &&
+	         spelled_output.str() == "12\n";
+
+	kill(pid, SIGTERM);
+	waitpid(pid, nullptr, 0);
+	passed = passed && !filesystem::exists(socket_path);
+	filesystem::remove_all(directory);
+	return passed;
+}
+
+bool test_profiler() {
+	istringstream bytecode(build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 500000\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tCALL work\n"
+		"\tPUSH 1\n"
+		"\tPUSHR CX\n"
+		"\tSUB\n"
+		"\tPOPR CX\n"
+		"\tPUSH 0\n"
+		"\tPUSHR CX\n"
+		"\tJNE loop\n"
+		"END\n"
+		"work:\n"
+		"\tPUSH 1\n"
+		"\tPUSH 2\n"
+		"\tADD\n"
+		"\tPOP\n"
+		"\tRET"));
+	CPU cpu(bytecode);
+
+	profiler_ns::HardwareCounters counters;
+	profiler_ns::SamplingProfiler sampler(200);
+	counters.start();
+	sampler.start();
+	cpu.run();
+	sampler.stop();
+	counters.stop();
+
+	// counters may be unavailable on the machine, but never made up
+	long long instructions = counters.value(profiler_ns::COUNTER_INSTRUCTIONS);
+	if (instructions != profiler_ns::UNAVAILABLE && instructions < (long long)cpu.executed) return false;
+
+	stringstream folded;
+	sampler.write_folded(*cpu.program, folded);
+	bool in_work = false;
+	string stack;
+	unsigned long long count = 0, total = 0;
+	while (folded >> stack >> count) {
+		if (stack.rfind("BEGIN", 0) != 0 && stack != "[vm]") return false;
+		in_work = in_work || stack == "BEGIN;work";
+		total += count;
+	}
+	return sampler.samples() > 0 && total == sampler.samples() && in_work;
+}
+
+// Profile the program, optimize it for the profile and run the result with the engine.
+// Everything must stay the same, but the number of executed instructions, which the profile predicts.
+// A budget and slices stop the engine after the same instruction as the switch engine,
+// also inside superinstructions
+static bool check_pgo(const string& source, Engine engine, pgo_ns::OptimizationStats* stats = nullptr,
+                      unsigned long long* saved = nullptr) {
+	istringstream bytecode(build_bytecode(source));
+	CPU profiled(bytecode);
+	profiled.engine = ENGINE_PROFILE;
+	fuzzer_ns::Outcome expected = run_outcome(profiled);
+	// a program stopped by the budget has no complete profile
+	if (expected.status != CPU_HALTED) return true;
+
+	stringstream profile;
+	profiled.profile->snapshot().save(profile);
+	stringstream optimized;
+	pgo_ns::OptimizationStats result = pgo_ns::optimize(*profiled.program, pgo_ns::load(profile), optimized);
+	if (stats != nullptr) *stats = result;
+	if (saved != nullptr) *saved = expected.executed - result.executed;
+	const string optimized_code = optimized.str();
+
+	istringstream code(optimized_code);
+	CPU cpu(code);
+	cpu.engine = engine;
+	fuzzer_ns::Outcome actual = run_outcome(cpu);
+	expected.executed = result.executed;
+	if (actual != expected) return false;
+
+	unsigned long long budget = result.executed / 3 + 1;
+	istringstream limited_code(optimized_code), reference_code(optimized_code);
+	CPU limited(limited_code), reference(reference_code);
+	limited.engine = engine;
+	reference.engine = ENGINE_SWITCH;
+	return run_outcome(limited, 1, budget) == run_outcome(reference, UNLIMITED, budget);
+}
+
+bool test_pgo() {
+	// the condition jumps into the body, JB is inverted to fall through into it
+	string loop =
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tPUSH 100\n"
+		"\tPUSHR CX\n"
+		"\tJB body\n"
+		"\tJMP exit\n"
+		"body:\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tJMP loop\n"
+		"exit:\n"
+		"\tPUSHR CX\n"
+		"\tOUT\n"
+		"END";
+
+	pgo_ns::OptimizationStats stats;
+	unsigned long long saved = 0;
+	if (!check_pgo(loop, ENGINE_VIRTUAL, &stats, &saved)) return false;
+	if (stats.inverted_jumps != 1 || stats.removed_jumps != 1 || stats.superinstructions.empty()) return false;
+	// the only instruction saved is JMP exit, run once: the fused loop counts all of its instructions
+	if (saved != 1) return false;
+	if (!check_pgo(loop, ENGINE_SWITCH)) return false;
+
+	for (unsigned seed = 0; seed < 100; ++seed) {
+		string source = fuzzer_ns::generate(seed).source();
+		if (!check_pgo(source, ENGINE_VIRTUAL) || !check_pgo(source, ENGINE_SWITCH)) {
+			cout << "PGO changed the result of generated program " << seed << '\n';
+			return false;
+		}
+	}
+	return true;
+}
+
+bool test_hot_traces() {
+	// the condition alternates, so the trace is left through its guard every other iteration.
+	// The inner CALL makes the outer loop untraceable
+	string source =
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tPUSH 2\n"
+		"\tPUSHR CX\n"
+		"\tDIV\n"
+		"\tPUSH 2\n"
+		"\tMUL\n"
+		"\tPUSHR CX\n"
+		"\tJEQ even\n"
+		"\tPUSHR AX\n"
+		"\tPUSHR CX\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tJMP next\n"
+		"even:\n"
+		"\tPUSHR CX\n"
+		"\tSTORE [3]\n"
+		"next:\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 1000\n"
+		"\tPUSHR CX\n"
+		"\tJB loop\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"outer:\n"
+		"\tCALL work\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 200\n"
+		"\tPUSHR CX\n"
+		"\tJB outer\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"END\n"
+		"work:\n"
+		"\tPUSHR BX\n"
+		"\tPUSH 3\n"
+		"\tADD\n"
+		"\tPOPR BX\n"
+		"\tRET";
+
+	const string bytecode = build_bytecode(source);
+	auto run = [&bytecode](Engine engine, unsigned long long slice, shared_ptr<hot_trace_ns::TraceCache>* traces = nullptr) {
+		istringstream code(bytecode);
+		CPU cpu(code);
+		cpu.engine = engine;
+		fuzzer_ns::Outcome outcome = run_outcome(cpu, slice);
+		if (traces != nullptr) *traces = cpu.traces;
+		return outcome;
+	};
+
+	fuzzer_ns::Outcome expected = run(ENGINE_VIRTUAL, UNLIMITED);
+	shared_ptr<hot_trace_ns::TraceCache> traces;
+	if (!(run(ENGINE_TRACE, UNLIMITED, &traces) == expected)) return false;
+	if (traces->stats.recorded != 1 || traces->stats.aborted == 0) return false;
+	if (traces->stats.side_exits < 400 || traces->stats.side_exits > 500) return false;
+
+	// iterations of the trace never cross the end of a slice
+	for (unsigned long long slice : {1ULL, 7ULL, 20ULL}) {
+		if (!(run(ENGINE_TRACE, slice) == expected)) return false;
+	}
+
+#ifdef VM_TRACE
+	// a record after every operation of the trace, with the command of the program
+	// for a guard and with the JMPs the trace skips
+	if (!same_records(trace_records(bytecode, ENGINE_TRACE), trace_records(bytecode, ENGINE_SWITCH))) return false;
+#endif
+	return true;
+}
+
+bool test_memoization() {
+	string source =
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tPUSH 10\n"
+		"\tCALL fact\n"
+		"\tOUT\n"
+		"\tPUSH 1\n"
+		"\tPUSHR CX\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 50\n"
+		"\tPUSHR CX\n"
+		"\tJB loop\n"
+		"\tPUSH 3\n"
+		"\tPOPR BX\n"
+		"\tPUSH 5\n"
+		"\tCALL scale\n"
+		"\tOUT\n"
+		"\tCALL show\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"END\n"
+		// AX is written on every path, its value after RET is a result
+		"fact:\n"
+		"\tPOPR AX\n"
+		"\tPUSHR AX\n"
+		"\tPUSHR AX\n"
+		"\tPUSH 1\n"
+		"\tJAE one\n"
+		"\tPOPR AX\n"
+		"\tPUSHR AX\n"
+		"\tPUSH 1\n"
+		"\tPUSHR AX\n"
+		"\tSUB\n"
+		"\tCALL fact\n"
+		"\tMUL\n"
+		"\tRET\n"
+		"one:\n"
+		"\tPOP\n"
+		"\tPUSH 1\n"
+		"\tRET\n"
+		// the result depends on BX
+		"scale:\n"
+		"\tPUSHR BX\n"
+		"\tMUL\n"
+		"\tRET\n"
+		"show:\n"
+		"\tPUSHR CX\n"
+		"\tOUT\n"
+		"\tRET";
+
+	auto load = [&source]() {
+		istringstream bytecode(build_bytecode(source));
+		return make_unique<CPU>(bytecode);
+	};
+
+	unique_ptr<CPU> plain = load();
+	map<int, analysis_ns::PureRoutine> pure = analysis_ns::find_pure_routines(*plain->program);
+	int fact = plain->program->code[4].argument;
+	int scale = plain->program->code[16].argument;
+	if (pure.size() != 2 || !pure.contains(fact) || !pure.contains(scale)) return false;
+	if (pure[fact].arguments != 1 || pure[fact].results != 1 || !pure[fact].inputs.empty()) return false;
+	if (pure[fact].outputs != vector<int>{0}) return false;
+	if (pure[scale].inputs != vector<int>{1} || !pure[scale].outputs.empty()) return false;
+
+	ostringstream expected;
+	plain->output = &expected;
+	plain->run();
+
+	unique_ptr<CPU> memoized = load();
+	if (memo_ns::enable_memoization(*memoized->program) != 2) return false;
+	ostringstream output;
+	memoized->output = &output;
+	memoized->run();
+
+	memo_ns::MemoStats stats = memoized->program->memo->stats();
+	return output.str() == expected.str() && equal(plain->registers, plain->registers + REGS, memoized->registers) &&
+	       stats.hits == 49 && stats.misses == 11 && memoized->executed < plain->executed / 10;
+}
+
+// Product of non-negative decimal numbers digit by digit
+static string multiply_decimal(const string& lhs, const string& rhs) {
+	vector<int> digits(lhs.size() + rhs.size(), 0);
+	for (size_t i = lhs.size(); i-- > 0;) {
+		for (size_t j = rhs.size(); j-- > 0;) {
+			digits[i + j + 1] += (lhs[i] - '0') * (rhs[j] - '0');
+		}
+	}
+	for (size_t k = digits.size(); k-- > 1;) {
+		digits[k - 1] += digits[k] / 10;
+		digits[k] %= 10;
+	}
+
+	string product;
+	for (int digit : digits) {
+		if (product.empty() && digit == 0) continue;
+		product += static_cast<char>('0' + digit);
+	}
+	return product.empty() ? "0" : product;
+}
+
+bool test_big_integers() {
+	istringstream bytecode(build_bytecode("BEGIN\nEND"));
+	CPU cpu(bytecode);
+	bigint_ns::BigArena& arena = bigint_ns::arena(cpu);
+
+	// 10^300 has 32 limbs, its powers are multiplied by Karatsuba
+	int ten = arena.make(10);
+	int x = arena.make(1);
+	for (int i = 0; i < 300; ++i) x = arena.multiply(x, ten);
+	int x2 = arena.multiply(x, x);
+	int x4 = arena.multiply(x2, x2);
+	int x5 = arena.multiply(x4, x); // unbalanced
+	if (arena.to_string(x4) != "1" + string(1200, '0')) return false;
+	if (arena.to_string(x5) != "1" + string(1500, '0')) return false;
+
+	// (a + b)(a - b) = a^2 - b^2 with signs and borrows across limbs
+	int a = arena.subtract(x5, arena.make(7));
+	int b = arena.add(x2, arena.make(-123456789));
+	int product = arena.multiply(arena.add(a, b), arena.subtract(a, b));
+	int squares = arena.subtract(arena.multiply(a, a), arena.multiply(b, b));
+	if (arena.compare(product, squares) != 0) return false;
+	if (arena.to_string(arena.subtract(b, a)) != "-" + arena.to_string(arena.subtract(a, b))) return false;
+	if (arena.to_string(arena.make(-2147483648LL)) != "-2147483648" || arena.to_string(arena.make(0)) != "0") return false;
+	if (arena.compare(arena.make(-5), arena.make(3)) != -1 || arena.compare(a, b) != 1) return false;
+
+	// only handles kept by the context survive, values keep their limbs
+	string kept_x5 = arena.to_string(x5);
+	string kept_b = arena.to_string(b);
+	cpu.registers[0] = x5;
+	cpu.memory[100] = b;
+	size_t before = arena.stats().limbs;
+	arena.collect(cpu);
+	bigint_ns::ArenaStats stats = arena.stats();
+	if (stats.values != 2 || stats.limbs >= before || stats.collections != 1 ||
+	    arena.to_string(x5) != kept_x5 || arena.to_string(b) != kept_b) {
+		return false;
+	}
+
+	// Karatsuba gives the products of schoolbook multiplication of decimal digits
+	mt19937 random(49);
+	int limb_base = arena.make(1LL << 32);
+	auto random_number = [&](size_t limbs) {
+		int number = arena.make(0);
+		for (size_t i = 0; i < limbs; ++i) {
+			number = arena.add(arena.multiply(number, limb_base), arena.make(random()));
+		}
+		return number;
+	};
+	const size_t threshold = bigint_ns::KARATSUBA_THRESHOLD;
+	for (auto [na, nb] : {pair{threshold, threshold}, pair{threshold + 7, 3 * threshold}, pair{4 * threshold + 1, 4 * threshold}}) {
+		int lhs = random_number(na);
+		int rhs = arena.subtract(arena.make(0), random_number(nb));
+		string digits = arena.to_string(rhs).substr(1);
+		if (arena.to_string(arena.multiply(lhs, rhs)) != "-" + multiply_decimal(arena.to_string(lhs), digits)) return false;
+	}
+
+	// handles kept by other contexts are rejected, not taken for values of this one
+	int foreign = exit_status_of([] {
+		istringstream code(build_bytecode(
+			"BEGIN\n"
+			"\tPUSH 5\n"
+			"\tBIG\n"
+			"\tPOPR AX\n"
+			"\tPUSH 0\n"
+			"\tSPAWN child\n"
+			"\tJOIN\n"
+			"END\n"
+			"child:\n"
+			"\tPUSH 7\n"
+			"\tBIG\n"
+			"\tPUSHR AX\n"
+			"\tBOUT\n"
+			"END"));
+		CPU cpu(code);
+		Scheduler scheduler;
+		scheduler.add(cpu);
+		scheduler.run();
+	});
+	// a value in the channel is not kept alive by the arena
+	int sent = exit_status_of([] {
+		istringstream code(build_bytecode("BEGIN\n\tPUSH 5\n\tBIG\n\tSEND 0\nEND"));
+		CPU cpu(code);
+		cpu.attach_channel(0, make_shared<MPMCChannel>());
+		cpu.run();
+	});
+	return foreign == 1 && sent == 1;
+}
+
+bool test_guarded_stack() {
+	GuardedStack<int> stack;
+	for (int i = 0; i < 100000; ++i) stack.push(i);
+	for (int i = 0; i < 50000; ++i) stack.pop();
+
+	GuardedStack<int> copy(stack);
+	copy.top() += 1;
+	bool passed = stack.size() == 50000 && stack.top() == 49999 && copy.size() == 50000 && copy.top() == 50000 &&
+	              copy.data()[123] == 123 && copy.capacity() == stack_ns::GUARDED_STACK_BYTES / sizeof(int);
+
+	GuardedStack<int> moved(std::move(copy));
+	copy = GuardedStack<int>();
+	copy.push(7);
+	passed = passed && moved.top() == 50000 && copy.size() == 1 && copy.top() == 7;
+
+	// copies into and from moved-from stacks
+	GuardedStack<int> taken(std::move(moved));
+	moved = stack;
+	passed = passed && moved.size() == 50000 && moved.top() == 49999 && taken.top() == 50000;
+	GuardedStack<int> retaken(std::move(taken));
+	copy = taken;
+	passed = passed && copy.size() == 0 && retaken.size() == 50000;
+
+	// guard pages end the process with an error, not with a crash
+	int underflow = exit_status_of([] {
+		GuardedStack<int> empty;
+		cout << empty.top();
+	});
+	// pops past the guard page must not reach memory of other stacks
+	int deep_underflow = exit_status_of([] {
+		GuardedStack<int> empty;
+		GuardedStack<int> neighbour;
+		for (int i = 0; i < 3000; ++i) empty.pop();
+		empty.push(42);
+		cout << empty.top();
+	});
+	int overflow = exit_status_of([] {
+		GuardedStack<int> full;
+		for (unsigned i = 0; i <= full.capacity(); ++i) full.push(1);
+	});
+	int program = exit_status_of([] {
+		istringstream bytecode(build_bytecode("BEGIN\n\tPOP\n\tOUT\nEND"));
+		CPU cpu(bytecode);
+		cpu.run();
+	});
+	return passed && underflow == 1 && deep_underflow == 1 && overflow == 1 && program == 1;
+}
+
+bool test_run_for() {
+	// sum of 1..100, printed every 10 iterations
+	const string bytecode = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSHR AX\n"
+		"\tPUSHR CX\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 10\n"
+		"\tDIV\n"
+		"\tPUSH 10\n"
+		"\tMUL\n"
+		"\tPUSHR CX\n"
+		"\tJNE skip\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"skip:\n"
+		"\tPUSH 100\n"
+		"\tPUSHR CX\n"
+		"\tJB loop\n"
+		"END");
+
+	istringstream whole_code(bytecode);
+	ostringstream whole_output;
+	CPU whole(whole_code);
+	whole.output = &whole_output;
+	whole.run();
+
+	// the same program resumed after every slice gives the same result
+	for (unsigned long long slice : {1ULL, 7ULL, 64ULL}) {
+		istringstream sliced_code(bytecode);
+		ostringstream sliced_output;
+		CPU sliced(sliced_code);
+		sliced.output = &sliced_output;
+
+		unsigned long long slices = 0;
+		CPUStatus status = CPU_RUNNING;
+		while (status == CPU_RUNNING) {
+			unsigned long long before = sliced.executed;
+			status = sliced.run_for(slice);
+			if (sliced.executed - before > slice) return false;
+			++slices;
+		}
+		if (status != CPU_HALTED || sliced_output.str() != whole_output.str()) return false;
+		if (sliced.executed != whole.executed || sliced.registers[0] != 5050) return false;
+		if (slices < whole.executed / slice) return false;
+	}
+
+	// the budget stops the program at the exact instruction, the state is kept
+	istringstream limited_code(bytecode);
+	ostringstream limited_output;
+	CPU limited(limited_code);
+	limited.output = &limited_output;
+	limited.set_budget(100);
+	if (limited.run_for(UNLIMITED) != CPU_BUDGET || limited.executed != 100) return false;
+	if (limited.run_for(UNLIMITED) != CPU_BUDGET || limited.executed != 100) return false;
+	limited.set_budget(UNLIMITED);
+	if (limited.run_for(UNLIMITED) != CPU_HALTED || limited_output.str() != whole_output.str()) return false;
+
+	// a passed deadline stops the program before the first instruction
+	istringstream late_code(bytecode);
+	CPU late(late_code);
+	late.set_deadline(std::chrono::milliseconds(0));
+	this_thread::sleep_for(std::chrono::milliseconds(1));
+	return late.run_for(UNLIMITED) == CPU_DEADLINE && late.executed == 0;
+}
+
+bool test_memory_commands() {
+	// every addressing mode of LOAD and STORE, the last cell included
+	const string bytecode = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 11\n"
+		"\tSTORE [5]\n"
+		"\tPUSH 6\n"
+		"\tPOPR BX\n"
+		"\tPUSH 22\n"
+		"\tSTORE [BX]\n"
+		"\tPUSH 33\n"
+		"\tPUSH 7\n"
+		"\tSTORE\n"
+		"\tLOAD [5]\n"
+		"\tLOAD [BX]\n"
+		"\tPUSH 7\n"
+		"\tLOAD\n"
+		"\tADD\n"
+		"\tADD\n"
+		"\tOUT\n"
+		"\tPUSH 44\n"
+		"\tPUSH 65535\n"
+		"\tSTORE\n"
+		"\tLOAD [65535]\n"
+		"\tOUT\n"
+		"END");
+
+	for (Engine engine : {ENGINE_VIRTUAL, ENGINE_SWITCH, ENGINE_TRACE}) {
+		istringstream code(bytecode);
+		ostringstream output;
+		CPU cpu(code);
+		cpu.engine = engine;
+		cpu.output = &output;
+		cpu.run();
+		if (output.str() != "66\n44\n" || cpu.stack.size() != 0) return false;
+		if (cpu.memory[5] != 11 || cpu.memory[6] != 22 || cpu.memory[7] != 33 || cpu.memory[MEMORY_SIZE - 1] != 44) return false;
+	}
+
+	// addresses out of data memory and bad register ids end the program with an error
+	auto fails = [](const string& code) {
+		return exit_status_of([&code] {
+			istringstream text(code);
+			CPU cpu(text);
+			cpu.run();
+		}) == 1;
+	};
+	return fails(build_bytecode("BEGIN\n\tPUSH 65536\n\tPOPR BX\n\tLOAD [BX]\nEND")) &&
+	       fails(build_bytecode("BEGIN\n\tPUSH -1\n\tPOPR BX\n\tPUSH 1\n\tSTORE [BX]\nEND")) &&
+	       fails(build_bytecode("BEGIN\n\tPUSH 1\n\tPUSH -1\n\tSTORE\nEND")) &&
+	       fails(build_bytecode("BEGIN\n\tPUSH 65536\n\tLOAD\nEND")) &&
+	       fails(build_bytecode("BEGIN\n\tLOAD [65536]\nEND")) &&
+	       fails("10 0\n41 6\n19 0\n") &&
+	       fails("10 0\n30 1\n40 6\n19 0\n");
+}
+
+bool test_scheduler() {
+	// 8 contexts sum 1..10(k + 1) into memory[k] with YIELD in every iteration,
+	// the main context joins them by the ids kept in memory[100 + k] and sums the results
+	const string bytecode = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"spawn:\n"
+		"\tPUSH 100\n"
+		"\tPUSHR CX\n"
+		"\tADD\n"
+		"\tPOPR BX\n"
+		"\tPUSHR CX\n"
+		"\tSPAWN sum\n"
+		"\tSTORE [BX]\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 8\n"
+		"\tPUSHR CX\n"
+		"\tJB spawn\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"join:\n"
+		"\tPUSH 100\n"
+		"\tPUSHR CX\n"
+		"\tADD\n"
+		"\tLOAD\n"
+		"\tJOIN\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 8\n"
+		"\tPUSHR CX\n"
+		"\tJB join\n"
+		"\tPUSH 0\n"
+		"\tPUSH 8\n"
+		"\tVSUM\n"
+		"\tOUT\n"
+		"END\n"
+		"sum:\n"
+		"\tPOPR CX\n"
+		"\tPUSH 10\n"
+		"\tPUSHR CX\n"
+		"\tMUL\n"
+		"\tPUSH 10\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tPUSH 0\n"
+		"\tPOPR BX\n"
+		"loop:\n"
+		"\tPUSH 0\n"
+		"\tPUSHR AX\n"
+		"\tJBE done\n"
+		"\tPUSHR BX\n"
+		"\tPUSHR AX\n"
+		"\tADD\n"
+		"\tPOPR BX\n"
+		"\tPUSH 1\n"
+		"\tPUSHR AX\n"
+		"\tSUB\n"
+		"\tPOPR AX\n"
+		"\tYIELD\n"
+		"\tJMP loop\n"
+		"done:\n"
+		"\tPUSHR BX\n"
+		"\tSTORE [CX]\n"
+		"END");
+
+	int total = 0;
+	vector<int> sums;
+	for (int k = 0; k < 8; ++k) {
+		int n = 10 * (k + 1);
+		sums.push_back(n * (n + 1) / 2);
+		total += sums.back();
+	}
+
+	for (unsigned workers : {1u, 2u, 4u}) {
+		for (unsigned long long slice : {1ULL, 5ULL, DEFAULT_SLICE}) {
+			istringstream code(bytecode);
+			ostringstream output;
+			CPU cpu(code);
+			cpu.output = &output;
+
+			Scheduler scheduler(slice, workers);
+			scheduler.add(cpu);
+			scheduler.run();
+
+			if (output.str() != to_string(total) + "\n") return false;
+			if (!equal(sums.begin(), sums.end(), cpu.memory)) return false;
+			for (int id = 0; id <= 8; ++id) {
+				if (!scheduler.finished(id)) return false;
+			}
+			if (scheduler.executed() <= cpu.executed) return false;
+		}
+	}
+	return true;
+}
+
+bool test_pipeline() {
+	// the source sends 1, 2, 3, ... forever
+	const string source = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR AX\n"
+		"loop:\n"
+		"\tPUSHR AX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tPUSHR AX\n"
+		"\tSEND 1\n"
+		"\tJMP loop\n"
+		"END");
+	// doubles every value until the input is closed
+	const string doubler = build_bytecode(
+		"BEGIN\n"
+		"loop:\n"
+		"\tRECV 0\n"
+		"\tPUSH 2\n"
+		"\tMUL\n"
+		"\tSEND 1\n"
+		"\tJMP loop\n"
+		"END");
+	// prints the sum of the first 100 values and stops reading
+	const string sink = build_bytecode(
+		"BEGIN\n"
+		"\tPUSH 0\n"
+		"\tPOPR AX\n"
+		"\tPUSH 0\n"
+		"\tPOPR CX\n"
+		"loop:\n"
+		"\tRECV 0\n"
+		"\tPUSHR AX\n"
+		"\tADD\n"
+		"\tPOPR AX\n"
+		"\tPUSHR CX\n"
+		"\tPUSH 1\n"
+		"\tADD\n"
+		"\tPOPR CX\n"
+		"\tPUSH 100\n"
+		"\tPUSHR CX\n"
+		"\tJB loop\n"
+		"\tPUSHR AX\n"
+		"\tOUT\n"
+		"END");
+
+	// the endless source halts once nobody reads its values
+	vector<unique_ptr<CPU>> stages;
+	ostringstream output;
+	for (const string* bytecode : {&source, &doubler, &sink}) {
+		istringstream code(*bytecode);
+		stages.push_back(make_unique<CPU>(code));
+	}
+	stages.back()->output = &output;
+	run_pipeline(stages);
+	if (output.str() != "10100\n") return false;
+
+	// a context and its spawned child cannot both send into an SPSC channel
+	int shared_sender = exit_status_of([] {
+		istringstream code(build_bytecode(
+			"BEGIN\n"
+			"\tPUSH 0\n"
+			"\tSPAWN child\n"
+			"\tPOP\n"
+			"\tPUSH 1\n"
+			"\tSEND 0\n"
+			"\tYIELD\n"
+			"END\n"
+			"child:\n"
+			"\tPOP\n"
+			"\tPUSH 2\n"
+			"\tSEND 0\n"
+			"END"));
+		CPU cpu(code);
+		cpu.attach_channel(0, make_shared<SPSCChannel>());
+		Scheduler scheduler(DEFAULT_SLICE, 1);
+		scheduler.add(cpu);
+		scheduler.run();
+	});
+	return shared_sender == 1;
+}
@@ -0,0 +1,89 @@
+#include "tracer.hpp"
+#include "parser.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+const char* const REGISTER_NAMES[] = {"AX", "BX", "CX", "DX", "EX", "FX"};
+
+static std::vector<std::string> read_lines(const std::string& filename) {
+	std::ifstream in(filename);
+	VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open file " << filename);
+
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(in, line)) {
+		size_t indent = line.find_first_not_of(" \t");
+		lines.push_back((indent == std::string::npos) ? "" : line.substr(indent));
+	}
+	return lines;
+}
+
+// Usage: trace FILE.trace PROGRAM.lng [--last RECORDS]
+// Prints the recorded instructions next to the source lines they come from
+int main(int argc, char** argv) {
+	VERIFY_CONTRACT(argc == 3 || (argc == 5 && std::strcmp(argv[3], "--last") == 0),
+		"Unexpected arguments passed to make trace");
+
+	// all records by default
+	long long last = (argc == 5) ? parse_number(argv[4], argv[3]) : std::numeric_limits<long long>::max();
+
+	trace_ns::TraceFile trace = trace_ns::load(argv[1]);
+	size_t first = ((size_t)last < trace.records.size()) ? trace.records.size() - last : 0;
+
+	// parse the source again to map instructions to source lines
+	std::string source(argv[2]);
+	Parser parser(source);
+	std::stringstream bytecode;
+	parser.parse(bytecode);
+	const std::vector<int>& command_lines = parser.command_lines();
+	std::vector<std::string> lines = read_lines(source);
+
+	std::vector<int> opcodes;
+	int id = 0, argument = 0;
+	while (bytecode >> id >> argument) {
+		opcodes.push_back(id);
+	}
+
+	uint64_t number = trace.written - trace.records.size(); // number of the first record in file
+	printf(SET_COLOR_YELLOW "%zu of %llu executed instructions are in the trace\n" RESET_COLOR,
+		trace.records.size() - first, static_cast<unsigned long long>(trace.written));
+	printf(SET_COLOR_YELLOW "%10s %6s %6s  %-7s %12s %10s  %s\n" RESET_COLOR,
+		"#", "PC", "LINE", "COMMAND", "TOP", "REGISTER", "SOURCE");
+
+	unsigned mismatched = 0;
+	for (size_t i = first; i < trace.records.size(); ++i) {
+		const trace_ns::TraceRecord& record = trace.records[i];
+
+		bool known = record.pc >= 0 && record.pc < (int)opcodes.size() && opcodes[record.pc] == record.opcode;
+		if (!known) ++mismatched;
+		int line = known ? command_lines[record.pc] : 0;
+
+		std::string top = (record.flags & trace_ns::RECORD_HAS_TOP) ? std::to_string(record.top) : "-";
+		std::string changed = "";
+		if (record.register_id < REGS) {
+			changed += REGISTER_NAMES[record.register_id];
+			changed += '=';
+			changed += std::to_string(record.register_value);
+			if (record.flags & trace_ns::RECORD_MORE_REGISTERS) changed += '+';
+		}
+
+		printf("%10llu %6d %6d  %s%-7s" RESET_COLOR " %12s %10s  %s\n",
+			static_cast<unsigned long long>(number + i), record.pc, line,
+			known ? SET_COLOR_CYAN : SET_COLOR_RED, get_command_name(record.opcode).c_str(),
+			top.c_str(), changed.c_str(), known ? lines[line - 1].c_str() : "<not in this program>");
+	}
+
+	if (mismatched > 0) {
+		printf(SET_COLOR_RED "%u records do not match %s, the trace may come from another program\n" RESET_COLOR,
+			mismatched, source.c_str());
+		return 1;
+	}
+	return 0;
+}
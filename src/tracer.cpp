@@ -0,0 +1,130 @@
+#include "tracer.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace trace_ns;
+
+// Trace file layout:
+//     TraceHeader
+//     TraceRecord x count, the oldest first
+const char TRACE_MAGIC[8] = {'V', 'M', 'T', 'R', 'A', 'C', 'E', '\0'};
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t written;
+	uint64_t count;
+};
+
+//////////////////
+// TRACE BUFFER //
+//////////////////
+
+static uint64_t round_up_to_power_of_two(uint64_t value) {
+	uint64_t result = 1;
+	while (result < value) result <<= 1;
+	return result;
+}
+
+TraceBuffer::TraceBuffer(unsigned capacity) :
+	records_(), mask_(round_up_to_power_of_two(std::max(capacity, 1U)) - 1), written_(0), registers_()
+{
+	records_ = std::make_unique<TraceRecord[]>(mask_ + 1);
+}
+
+uint64_t TraceBuffer::capacity() const {
+	return mask_ + 1;
+}
+
+uint64_t TraceBuffer::written() const {
+	return written_.load(std::memory_order_acquire);
+}
+
+std::vector<TraceRecord> TraceBuffer::snapshot() const {
+	uint64_t end = written_.load(std::memory_order_acquire);
+	uint64_t begin = (end > capacity()) ? end - capacity() : 0;
+
+	std::vector<TraceRecord> records;
+	records.reserve(end - begin);
+	for (uint64_t i = begin; i < end; ++i) {
+		records.push_back(records_[i & mask_]);
+	}
+
+	// record i is overwritten by record i + capacity. If the context has moved on while copying,
+	// records up to the one being written now may be overwritten, so they are dropped
+	uint64_t now = written_.load(std::memory_order_acquire);
+	if (now != end && now + 1 > capacity() + begin) {
+		uint64_t lost = std::min<uint64_t>(now - capacity() + 1 - begin, records.size());
+		records.erase(records.begin(), records.begin() + lost);
+	}
+	return records;
+}
+
+void TraceBuffer::save(std::ostream& out) const {
+	std::vector<TraceRecord> records = snapshot();
+
+	TraceHeader header{};
+	std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(TraceRecord);
+	header.written = written();
+	header.count = records.size();
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(TraceRecord));
+	VERIFY_CONTRACT(out.good(), "ERROR: unable to write trace");
+}
+
+void TraceBuffer::save(const std::string& filename) const {
+	std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	VERIFY_CONTRACT(out.is_open(), "ERROR: unable to open file " << filename);
+	save(out);
+}
+
+/////////////
+// LOADING //
+/////////////
+
+TraceFile trace_ns::load(std::istream& in) {
+	TraceHeader header{};
+	in.read(reinterpret_cast<char*>(&header), sizeof(header));
+	VERIFY_CONTRACT(in.good() && std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0,
+		"ERROR: not a trace file");
+	VERIFY_CONTRACT(header.version == TRACE_VERSION && header.record_size == sizeof(TraceRecord),
+		"ERROR: unsupported trace version " << header.version);
+
+	TraceFile trace{header.written, std::vector<TraceRecord>(header.count)};
+	in.read(reinterpret_cast<char*>(trace.records.data()), header.count * sizeof(TraceRecord));
+	VERIFY_CONTRACT(in.good() || (in.eof() && header.count == 0), "ERROR: trace file is truncated");
+	return trace;
+}
+
+TraceFile trace_ns::load(const std::string& filename) {
+	std::ifstream in(filename, std::ios::in | std::ios::binary);
+	VERIFY_CONTRACT(in.is_open(), "ERROR: unable to open file " << filename);
+	return load(in);
+}
+
+////////////////////
+// SAVING AT EXIT //
+////////////////////
+
+static std::shared_ptr<TraceBuffer> exit_buffer;
+static std::string exit_filename;
+
+static void save_exit_buffer() {
+	if (exit_buffer) exit_buffer->save(exit_filename);
+}
+
+void trace_ns::save_at_exit(std::shared_ptr<TraceBuffer> buffer, const std::string& filename) {
+	bool registered = static_cast<bool>(exit_buffer);
+	exit_buffer = std::move(buffer);
+	exit_filename = filename;
+	if (!registered) std::atexit(save_exit_buffer);
+}